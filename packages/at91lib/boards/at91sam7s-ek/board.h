@@ -59,7 +59,7 @@
 /// initializer values, otherwise they are not safe.
 ///
 /// Finally, some information about the flash controller is given by definitions
-/// prefixed with #BOARD_FLASH_#.
+/// prefixed with #BOARD_FLASH_#, and RAMFUNC places a function in SRAM.
 //------------------------------------------------------------------------------
 
 #ifndef BOARD_H
@@ -277,6 +277,18 @@
 #define BOARD_FLASH_EFC
 /// Address of the IAP function in ROM.
 #define BOARD_FLASH_IAP_ADDRESS         0x300E08
+/// Places a function in the .ramfunc section, which the startup code copies
+/// in SRAM when running from the flash: the function runs without wait states,
+/// and while the flash is programmed.
+#if defined(flash)
+    #if defined(__ICCARM__)
+        #define RAMFUNC     __ramfunc
+    #else
+        #define RAMFUNC     __attribute__ ((section (".ramfunc")))
+    #endif
+#else
+    #define RAMFUNC
+#endif
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
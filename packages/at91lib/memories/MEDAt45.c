@@ -0,0 +1,319 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//      Includes
+//------------------------------------------------------------------------------
+
+#include "MEDAt45.h"
+#include <utility/trace.h>
+#include <utility/assert.h>
+#include <utility/math.h>
+
+//------------------------------------------------------------------------------
+//      Internal Functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//! \brief  Ends an asynchronous transfer of a DataFlash media
+//! \param  argument Pointer to the Media instance
+//! \param  status   Flash translation layer status
+//! \param  pages    Number of logical pages transferred
+//------------------------------------------------------------------------------
+static void MEDAt45_Callback(void *argument,
+                             unsigned char status,
+                             unsigned int pages)
+{
+    Media *media = (Media *) argument;
+    At45Ftl *pFtl = (At45Ftl *) media->interface;
+    unsigned int transferred = pages << pFtl->dataShift;
+
+    if (status) {
+
+        TRACE_ERROR("MEDAt45_Callback: FTL error %u\n\r", status);
+    }
+
+    // Put the media in Ready state
+    media->state = MED_STATE_READY;
+
+    // Invoke the callback if it exists
+    if (media->transfer.callback != 0) {
+
+        media->transfer.callback(media->transfer.argument,
+                                 status ? MED_STATUS_ERROR : MED_STATUS_SUCCESS,
+                                 transferred,
+                                 media->transfer.length - transferred);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Reads or writes data on a DataFlash media. Whole logical pages
+//!         are transferred in the background, the others are split on the
+//!         logical pages of the flash translation layer and transferred
+//!         before returning
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data
+//! \param  data     Pointer to the data buffer
+//! \param  length   Length of the data buffer
+//! \param  isRead   1 to read the data, 0 to write it
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDAt45_Transfer(Media         *media,
+                                      unsigned int  address,
+                                      void          *data,
+                                      unsigned int  length,
+                                      unsigned char isRead,
+                                      MediaCallback callback,
+                                      void          *argument)
+{
+    At45Ftl *pFtl = (At45Ftl *) media->interface;
+    unsigned char *pData = (unsigned char *) data;
+    unsigned int page;
+    unsigned int offset;
+    unsigned int chunk;
+    unsigned int transferred = 0;
+    unsigned char error = 0;
+
+    // Check that the media is ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_INFO("Media busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that the data is not too big
+    if ((length + address) > (media->baseAddress + media->size)) {
+
+        TRACE_WARNING("MEDAt45_Transfer: Data too big: %u, 0x%08X\n\r",
+                      length, address);
+        return MED_STATUS_ERROR;
+    }
+
+    // Enter Busy state
+    media->state = MED_STATE_BUSY;
+
+    address -= media->baseAddress;
+    page = address >> pFtl->dataShift;
+    offset = address & (pFtl->dataSize - 1);
+
+    // Whole pages are transferred in the background, MEDAt45_Callback ends
+    // the transfer
+    if ((offset == 0) && ((length & (pFtl->dataSize - 1)) == 0)) {
+
+        media->transfer.data = data;
+        media->transfer.address = address;
+        media->transfer.length = length;
+        media->transfer.callback = callback;
+        media->transfer.argument = argument;
+        if (isRead) {
+
+            error = AT45FTL_ReadPages(pFtl, page, pData,
+                                      length >> pFtl->dataShift,
+                                      MEDAt45_Callback, media);
+        }
+        else {
+
+            error = AT45FTL_WritePages(pFtl, page, pData,
+                                       length >> pFtl->dataShift,
+                                       MEDAt45_Callback, media);
+        }
+        if (error) {
+
+            TRACE_ERROR("MEDAt45_Transfer: FTL error %u\n\r", error);
+            media->state = MED_STATE_READY;
+            return MED_STATUS_ERROR;
+        }
+
+        return MED_STATUS_SUCCESS;
+    }
+
+    while (length > 0) {
+
+        chunk = min(length, pFtl->dataSize - offset);
+        if (isRead) {
+
+            error = AT45FTL_Read(pFtl, page, offset, pData, chunk);
+        }
+        else {
+
+            error = AT45FTL_Write(pFtl, page, offset, pData, chunk);
+        }
+        if (error) {
+
+            TRACE_ERROR("MEDAt45_Transfer: FTL error %u on page %u\n\r",
+                        error, page);
+            break;
+        }
+
+        pData += chunk;
+        transferred += chunk;
+        length -= chunk;
+        page++;
+        offset = 0;
+    }
+
+    // Leave the Busy state
+    media->state = MED_STATE_READY;
+
+    // Invoke callback
+    if (callback != 0) {
+
+        callback(argument,
+                 error ? MED_STATUS_ERROR : MED_STATUS_SUCCESS,
+                 transferred,
+                 length);
+    }
+
+    return error ? MED_STATUS_ERROR : MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Reads a specified amount of data from a DataFlash media
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  data     Pointer to the buffer in which to store the retrieved
+//!                   data
+//! \param  length   Length of the buffer
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDAt45_Read(Media         *media,
+                                  unsigned int  address,
+                                  void          *data,
+                                  unsigned int  length,
+                                  MediaCallback callback,
+                                  void          *argument)
+{
+    return MEDAt45_Transfer(media, address, data, length, 1,
+                            callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes data on a DataFlash media
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  data     Pointer to the data to write
+//! \param  length   Size of the data buffer
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//! \see    Media
+//! \see    MediaCallback
+//------------------------------------------------------------------------------
+static unsigned char MEDAt45_Write(Media         *media,
+                                   unsigned int  address,
+                                   void          *data,
+                                   unsigned int  length,
+                                   MediaCallback callback,
+                                   void          *argument)
+{
+    return MEDAt45_Transfer(media, address, data, length, 0,
+                            callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a DataFlash media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDAt45_Ioctl(Media *media,
+                                   unsigned char ctrl,
+                                   void *buff)
+{
+    At45Ftl *pFtl = (At45Ftl *) media->interface;
+
+    switch (ctrl) {
+
+        // Each write programs whole logical pages
+        case MED_IOCTL_GET_SECTOR_SIZE:
+        case MED_IOCTL_GET_ERASE_UNIT:
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) buff) = pFtl->dataSize;
+            break;
+
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            *((unsigned char *) buff) = 0;
+            break;
+
+        // Pages are programmed and verified when they are written. The FTL
+        // cannot unmap a logical page, whose stale copies would come back at
+        // the next mount: MED_IOCTL_TRIM is not supported
+        case MED_IOCTL_SYNC:
+            break;
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//      Exported Functions
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//! \brief  Initializes a Media instance over a mounted AT45 flash translation
+//!         layer
+//! \param  media Pointer to the Media instance to initialize
+//! \param  pFtl  Pointer to the mounted At45Ftl instance
+//! \see    Media
+//------------------------------------------------------------------------------
+void MEDAt45_Initialize(Media *media, At45Ftl *pFtl)
+{
+    TRACE_INFO("MEDAt45 init\n\r");
+
+    // Initialize media fields
+    media->write = MEDAt45_Write;
+    media->read = MEDAt45_Read;
+    media->writev = 0;
+    media->readv = 0;
+    media->handler = 0;
+    media->flush = 0;
+    media->ioctl = MEDAt45_Ioctl;
+    media->baseAddress = 0;
+    media->size = pFtl->numLogical * pFtl->dataSize;
+    media->interface = pFtl;
+    media->state = MED_STATE_READY;
+
+    media->transfer.data = 0;
+    media->transfer.address = 0;
+    media->transfer.length = 0;
+    media->transfer.callback = 0;
+    media->transfer.argument = 0;
+
+    MED_InitializeQueue(media);
+}
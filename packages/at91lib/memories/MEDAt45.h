@@ -0,0 +1,67 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+/// !Purpose
+///
+/// Specialization of the Media class for interfacing with an AT45 DataFlash
+/// through its flash translation layer (see at45ftl).
+///
+/// !Usage
+///
+/// -# Mount the flash translation layer of the DataFlash with AT45FTL_Mount.
+/// -# Call MEDAt45_Initialize to bind a Media instance to it.
+/// -# Media addresses and lengths are in bytes. The accesses covering whole
+///    logical pages (MED_IOCTL_GET_SECTOR_SIZE) are performed in the
+///    background with AT45FTL_ReadPages and AT45FTL_WritePages, and the
+///    callback is invoked from the SPI interrupt; the media stays busy
+///    meanwhile. The other accesses are performed synchronously and the
+///    callback is invoked before MED_Read or MED_Write returns. Writing a part
+///    of a logical page rewrites the whole page, so the writes should cover
+///    whole pages.
+//------------------------------------------------------------------------------
+
+#ifndef MEDAT45_H
+#define MEDAT45_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "Media.h"
+#include <memories/spi-flash/at45ftl.h>
+
+//------------------------------------------------------------------------------
+//      Exported functions
+//------------------------------------------------------------------------------
+
+extern void MEDAt45_Initialize(Media *media, At45Ftl *pFtl);
+
+#endif //#ifndef MEDAT45_H
@@ -190,6 +190,44 @@ static unsigned char MEDDdram_Write(Media         *media,
     return MED_STATUS_SUCCESS;
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a DDRAM media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDDdram_Ioctl(Media *media,
+                                    unsigned char ctrl,
+                                    void *buff)
+{
+    switch (ctrl) {
+
+        // Dword-aligned accesses, no erase, no preferred transfer length
+        case MED_IOCTL_GET_SECTOR_SIZE:
+        case MED_IOCTL_GET_ERASE_UNIT:
+            *((unsigned int *) buff) = 4;
+            break;
+
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) buff) = 0;
+            break;
+
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            *((unsigned char *) buff) = 0;
+            break;
+
+        // Nothing can be discarded, MED_IOCTL_TRIM is not supported
+        case MED_IOCTL_SYNC:
+            break;
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
 //------------------------------------------------------------------------------
 //      Exported Functions
 //------------------------------------------------------------------------------
@@ -226,8 +264,11 @@ void MEDDdram_Initialize(Media *media,
     //--------------------------------------------------------------------------
     media->write = MEDDdram_Write;
     media->read = MEDDdram_Read;
+    media->writev = 0;
+    media->readv = 0;
     media->handler = 0;
     media->flush = 0;
+    media->ioctl = MEDDdram_Ioctl;
     media->baseAddress = baseAddress;
     media->size = size;
     media->state = MED_STATE_READY;
@@ -237,6 +278,8 @@ void MEDDdram_Initialize(Media *media,
     media->transfer.length = 0;
     media->transfer.callback = 0;
     media->transfer.argument = 0;
+
+    MED_InitializeQueue(media);
 }
 #endif //#if defined(AT91C_BASE_DDR2C)
 
@@ -37,6 +37,7 @@
 #include <efc/efc.h>
 #include <eefc/eefc.h>
 #include <memories/flash/flashd.h>
+#include <string.h>
 
 #if defined(AT91C_BASE_EFC)
 
@@ -49,10 +50,59 @@
     #define AT91C_MC_FRDY   (AT91C_MC_EOP | AT91C_MC_EOL)
 #endif
 
+#if MEDFLASH_ASYNC
+/// Asynchronous command of the pages written by FLA_Write.
+static FlashdCommand writeCommand;
+
+/// First address programmed in the background: when the code runs from the
+/// flash, only the second bank (EFC1) can be busy while it executes.
+#if defined(flash)
+    #define FLA_ASYNC_START (AT91C_IFLASH \
+                             + (AT91C_IFLASH_NB_OF_PAGES / 2) \
+                               * AT91C_IFLASH_PAGE_SIZE)
+#else
+    #define FLA_ASYNC_START AT91C_IFLASH
+#endif
+#endif
+
 //------------------------------------------------------------------------------
 //      Internal Functions
 //------------------------------------------------------------------------------
 
+#if MEDFLASH_ASYNC
+//------------------------------------------------------------------------------
+//! \brief  Ends an asynchronous write of a flash media
+//! \param  argument Pointer to the Media instance
+//! \param  status   FLASHD command status
+//------------------------------------------------------------------------------
+static void FLA_WriteCallback(void *argument, unsigned char status)
+{
+    Media *media = (Media *) argument;
+
+    // Put the media in Ready state
+    media->state = MED_STATE_READY;
+
+    // Invoke the callback if it exists
+    if (media->transfer.callback != 0) {
+
+        media->transfer.callback(media->transfer.argument,
+                                 status ? MED_STATUS_ERROR : MED_STATUS_SUCCESS,
+                                 0,
+                                 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Interrupt handler of a flash media, ends its asynchronous writes
+//! \param  media Pointer to a Media instance
+//------------------------------------------------------------------------------
+static void FLA_Handler(Media *media)
+{
+    FLASHD_Handler();
+}
+#endif
+
+
 //------------------------------------------------------------------------------
 //! \brief  Reads a specified amount of data from a flash memory
 //! \param  media    Pointer to a Media instance
@@ -115,7 +165,9 @@ static unsigned char FLA_Read(Media      *media,
 }
 
 //------------------------------------------------------------------------------
-//! \brief  Writes data on a flash media
+//! \brief  Writes data on a flash media. With MEDFLASH_ASYNC, whole aligned
+//!         pages are programmed in the background and the callback is invoked
+//!         from the interrupt handler of the media when they are written.
 //! \param  media    Pointer to a Media instance
 //! \param  address  Address at which to write
 //! \param  data     Pointer to the data to write
@@ -174,6 +226,26 @@ static unsigned char FLA_Write(Media      *media,
     media->transfer.callback = callback;
     media->transfer.argument = argument;
 
+#if MEDFLASH_ASYNC
+    // Whole pages are programmed in the background, FLA_WriteCallback ends
+    // the transfer
+    if ((address >= FLA_ASYNC_START)
+        && (address%AT91C_IFLASH_PAGE_SIZE == 0)
+        && (length%AT91C_IFLASH_PAGE_SIZE == 0)
+        && ((unsigned int) data%4 == 0)) {
+
+        writeCommand.command = FLASHD_CMD_WRITE;
+        writeCommand.address = address;
+        writeCommand.pBuffer = data;
+        writeCommand.numPages = length / AT91C_IFLASH_PAGE_SIZE;
+        writeCommand.callback = FLA_WriteCallback;
+        writeCommand.pArgument = media;
+        FLASHD_Submit(&writeCommand);
+
+        return MED_STATUS_SUCCESS;
+    }
+#endif
+
     // Start the write operation
     error = FLASHD_Write( address, data, length);
     ASSERT(!error, "-F- Error when trying to write page (0x%02X)\n\r", error);
@@ -191,6 +263,248 @@ static unsigned char FLA_Write(Media      *media,
     return MED_STATUS_SUCCESS;
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Reads a specified amount of data from a flash memory and scatters it
+//!         in several buffers
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  vector   List of the fragments receiving the data
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char FLA_Readv(Media           *media,
+                               unsigned int    address,
+                               const MEDVector *vector,
+                               unsigned int    count,
+                               MediaCallback   callback,
+                               void            *argument)
+{
+    unsigned int length = 0;
+    unsigned int i;
+
+    // Check that the media is ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_INFO("Media busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that the data to read is not too big
+    for (i = 0; i < count; i++) {
+
+        length += vector[i].length;
+    }
+    if ((length + address) > (media->baseAddress + media->size)) {
+
+        TRACE_WARNING("FLA_Readv: Data too big\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    // Enter Busy state
+    media->state = MED_STATE_BUSY;
+
+    // Read data
+    for (i = 0; i < count; i++) {
+
+        memcpy(vector[i].data, (void *) address, vector[i].length);
+        address += vector[i].length;
+    }
+
+    // Leave the Busy state
+    media->state = MED_STATE_READY;
+
+    // Invoke callback
+    if (callback != 0) {
+
+        callback(argument, MED_STATUS_SUCCESS, 0, 0);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes data gathered from several buffers on a flash media. Each
+//!         flash page is programmed once: a fragment covering the part of the
+//!         page to write is programmed directly, smaller fragments are
+//!         gathered page by page.
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  vector   List of the fragments to write
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char FLA_Writev(Media           *media,
+                                unsigned int    address,
+                                const MEDVector *vector,
+                                unsigned int    count,
+                                MediaCallback   callback,
+                                void            *argument)
+{
+    static unsigned char pPageBuffer[AT91C_IFLASH_PAGE_SIZE];
+    unsigned int length = 0;
+    unsigned int offset = 0;
+    unsigned int chunk;
+    unsigned int size;
+    unsigned int i;
+    unsigned char *pData;
+    unsigned char error;
+
+    // Check that the media if ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_WARNING("FLA_Writev: Media is busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that address is dword-aligned
+    if (address%4 != 0) {
+
+        TRACE_WARNING("FLA_Writev: Address must be dword-aligned\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    // Check that length is a multiple of 4
+    for (i = 0; i < count; i++) {
+
+        length += vector[i].length;
+    }
+    if (length%4 != 0) {
+
+        TRACE_WARNING("FLA_Writev: Data length must be a multiple of 4 bytes\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    // Check that the data to write is not too big
+    if ((length + address) > (media->baseAddress + media->size)) {
+
+        TRACE_WARNING("FLA_Writev: Data too big\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    // Put the media in Busy state
+    media->state = MED_STATE_BUSY;
+
+    i = 0;
+    while (length > 0) {
+
+        // Part of the current page to write
+        chunk = AT91C_IFLASH_PAGE_SIZE - (address % AT91C_IFLASH_PAGE_SIZE);
+        if (chunk > length) {
+
+            chunk = length;
+        }
+
+        // Skip empty fragments
+        while (offset == vector[i].length) {
+
+            i++;
+            offset = 0;
+        }
+
+        if ((vector[i].length - offset) >= chunk) {
+
+            // The current fragment covers the chunk
+            pData = (unsigned char *) vector[i].data + offset;
+            offset += chunk;
+        }
+        else {
+
+            // Gather the fragments covering the chunk
+            size = 0;
+            while (size < chunk) {
+
+                while (offset == vector[i].length) {
+
+                    i++;
+                    offset = 0;
+                }
+                pData = (unsigned char *) vector[i].data + offset;
+                if ((vector[i].length - offset) > (chunk - size)) {
+
+                    memcpy(pPageBuffer + size, pData, chunk - size);
+                    offset += chunk - size;
+                    size = chunk;
+                }
+                else {
+
+                    memcpy(pPageBuffer + size, pData, vector[i].length - offset);
+                    size += vector[i].length - offset;
+                    offset = vector[i].length;
+                }
+            }
+            pData = pPageBuffer;
+        }
+
+        error = FLASHD_Write(address, pData, chunk);
+        ASSERT(!error, "-F- Error when trying to write page (0x%02X)\n\r", error);
+
+        address += chunk;
+        length -= chunk;
+    }
+
+    // Put the media in Ready state
+    media->state = MED_STATE_READY;
+
+    // Invoke the callback if it exists
+    if (callback != 0) {
+
+        callback(argument, MED_STATUS_SUCCESS, 0, 0);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a flash media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char FLA_Ioctl(Media *media,
+                               unsigned char ctrl,
+                               void *buff)
+{
+    unsigned int numRegions;
+
+    switch (ctrl) {
+
+        // Writes are dword-aligned, the EFC erases and programs whole pages
+        case MED_IOCTL_GET_SECTOR_SIZE:
+            *((unsigned int *) buff) = 4;
+            break;
+
+        case MED_IOCTL_GET_ERASE_UNIT:
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) buff) = AT91C_IFLASH_PAGE_SIZE;
+            break;
+
+        // Pages are erased when they are written, discards are not supported
+        case MED_IOCTL_SYNC:
+            break;
+
+        // Write-protected when all the lock regions are locked
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            numRegions = media->size / AT91C_IFLASH_LOCK_REGION_SIZE;
+            *((unsigned char *) buff) =
+                (FLASHD_IsLocked(media->baseAddress,
+                                 media->baseAddress + media->size - 1)
+                 >= numRegions);
+            break;
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
 //------------------------------------------------------------------------------
 //      Exported Functions
 //------------------------------------------------------------------------------
@@ -206,8 +520,15 @@ void FLA_Initialize(Media *media, AT91S_EFC *efc)
     // Initialize media fields
     media->write = FLA_Write;
     media->read = FLA_Read;
+    media->writev = FLA_Writev;
+    media->readv = FLA_Readv;
     media->flush = 0;
+    media->ioctl = FLA_Ioctl;
+#if MEDFLASH_ASYNC
+    media->handler = FLA_Handler;
+#else
     media->handler = 0;
+#endif
     media->baseAddress = (unsigned int) AT91C_IFLASH;
     media->size = AT91C_IFLASH_SIZE;
     media->interface = efc;
@@ -219,6 +540,8 @@ void FLA_Initialize(Media *media, AT91S_EFC *efc)
     media->transfer.callback = 0;
     media->transfer.argument = 0;
 
+    MED_InitializeQueue(media);
+
     // Initialize low-level interface
     // Configure Flash Mode register
     efc->EFC_FMR |= (BOARD_MCK / 666666) << 16;
@@ -70,6 +70,24 @@
     #define AT91C_MC_FRDY               AT91C_EFC_FRDY
 #endif
 
+/// When 1, FLA_Write programs the runs of whole pages with the asynchronous
+/// FLASHD commands and returns at once; FLASHD_Handler must then be called
+/// from the system interrupt. The flash can not be read while a page is
+/// programmed, so it can only be used when the code does not run from it, or
+/// on the devices with two EFCs (SAM7S512) where the code runs from the first
+/// bank: only the pages of the second bank are then programmed in the
+/// background, the others are written synchronously.
+#if !defined(MEDFLASH_ASYNC)
+    #if defined(BOARD_FLASH_EFC) && !defined(flash)
+        #define MEDFLASH_ASYNC  1
+    #else
+        #define MEDFLASH_ASYNC  0
+    #endif
+#endif
+#if MEDFLASH_ASYNC && defined(flash) && !defined(AT91C_BASE_EFC1)
+    #error "MEDFLASH_ASYNC can not be used when the code runs from the flash"
+#endif
+
 #if defined(AT91C_BASE_EFC)
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,669 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "MEDSdcard.h"
+#include <sdmmc/sdspi.h>
+#include <utility/trace.h>
+#include <utility/assert.h>
+
+//------------------------------------------------------------------------------
+//      Local definitions
+//------------------------------------------------------------------------------
+
+/// Largest number of blocks given to a single SD_ReadBlock/SD_WriteBlock call.
+#define MEDSDCARD_MAX_BLOCKS    0xFFFF
+
+/// Largest card size which can be addressed by the Media interface.
+#define MEDSDCARD_MAX_SIZE      (0xFFFFFFFF & ~(SD_BLOCK_SIZE - 1))
+
+//------------------------------------------------------------------------------
+//      Internal Functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//! \brief  Checks that an access to a SD card media can be started.
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the access
+//! \param  length   Length of the access
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Check(Media         *media,
+                                     unsigned int  address,
+                                     unsigned int  length)
+{
+    // Check that the media is ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_INFO("Media busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that the access is block-aligned
+    if (((address % SD_BLOCK_SIZE) != 0) || ((length % SD_BLOCK_SIZE) != 0)) {
+
+        TRACE_WARNING("MEDSdcard: Unaligned access: %u, 0x%08X\n\r",
+                      length, address);
+        return MED_STATUS_ERROR;
+    }
+
+    // Check that the data is not too big
+    if ((address < media->baseAddress)
+        || ((address - media->baseAddress) > media->size)
+        || (length > (media->size - (address - media->baseAddress)))) {
+
+        TRACE_WARNING("MEDSdcard: Data too big: %u, 0x%08X\n\r",
+                      length, address);
+        return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Transfers a contiguous list of blocks from/to a SD card. The
+//!         transfer continues the multiple blocks transfer left open by the
+//!         previous one when it starts on the next block.
+//! \param  pSd     Pointer to the SdCard instance
+//! \param  write   1 to write the card, 0 to read it
+//! \param  block   Index of the first block
+//! \param  data    Pointer to the data buffer
+//! \param  length  Size of the data buffer, in bytes
+//! \return Number of bytes not transferred
+//------------------------------------------------------------------------------
+static unsigned int MEDSdcard_Transfer(SdCard        *pSd,
+                                       unsigned char write,
+                                       unsigned int  block,
+                                       unsigned char *data,
+                                       unsigned int  length)
+{
+    unsigned int nbBlocks = length / SD_BLOCK_SIZE;
+    unsigned int count;
+    unsigned char error;
+
+    while (nbBlocks > 0) {
+
+        count = (nbBlocks > MEDSDCARD_MAX_BLOCKS) ?
+                MEDSDCARD_MAX_BLOCKS : nbBlocks;
+        if (write) {
+
+            error = SD_WriteBlock(pSd, block, count, data);
+        }
+        else {
+
+            error = SD_ReadBlock(pSd, block, count, data);
+        }
+        if (error) {
+
+            TRACE_WARNING("MEDSdcard: Error %u on block %u\n\r", error, block);
+            break;
+        }
+
+        block += count;
+        data += count * SD_BLOCK_SIZE;
+        nbBlocks -= count;
+    }
+
+    return nbBlocks * SD_BLOCK_SIZE;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Ends a transfer on a SD card media, and invokes its callback.
+//! \param  media     Pointer to a Media instance
+//! \param  remaining Number of bytes not transferred
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Complete(Media *media, unsigned int remaining)
+{
+    MediaCallback callback = media->transfer.callback;
+    void *argument = media->transfer.argument;
+    unsigned int length = media->transfer.length;
+    unsigned char status = (remaining == 0) ? MED_STATUS_SUCCESS
+                                            : MED_STATUS_ERROR;
+
+    // Leave the Busy state before the callback, which may start a transfer
+    media->transfer.callback = 0;
+    media->state = MED_STATE_READY;
+
+    if (callback != 0) {
+
+        callback(argument, status, length - remaining, remaining);
+    }
+
+    return status;
+}
+
+static void MEDSdcard_ReadCallback(void *pArg, unsigned char status);
+static void MEDSdcard_WriteCallback(void *pArg, unsigned char status);
+
+//------------------------------------------------------------------------------
+//! \brief  Submits the next part of the read or write in progress on a SD card
+//!         media, up to MEDSDCARD_MAX_BLOCKS blocks.
+//! \param  media   Pointer to a Media instance
+//! \param  isRead  1 for a read, 0 for a write
+//! \param  offset  Number of bytes of the transfer already done
+//! \return 0 if the part has been started, otherwise a SD_ERROR code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Submit(Media         *media,
+                                      unsigned char isRead,
+                                      unsigned int  offset)
+{
+    unsigned int nbBlocks = (media->transfer.length - offset) / SD_BLOCK_SIZE;
+
+    if (nbBlocks > MEDSDCARD_MAX_BLOCKS) {
+
+        nbBlocks = MEDSDCARD_MAX_BLOCKS;
+    }
+
+    return SD_Submit((SdCard *) media->interface,
+                     isRead,
+                     (media->transfer.address + offset - media->baseAddress)
+                         / SD_BLOCK_SIZE,
+                     nbBlocks,
+                     (unsigned char *) media->transfer.data + offset,
+                     isRead ? MEDSdcard_ReadCallback : MEDSdcard_WriteCallback,
+                     media);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked from SDSPI_Handler when a part of a read or write ends.
+//!         Submits the next part, or ends the transfer.
+//! \param  media   Pointer to a Media instance
+//! \param  isRead  1 for a read, 0 for a write
+//! \param  status  0 if the part succeeded
+//------------------------------------------------------------------------------
+static void MEDSdcard_Callback(Media         *media,
+                               unsigned char isRead,
+                               unsigned char status)
+{
+    SdCard *pSd = (SdCard *) media->interface;
+    unsigned int done;
+
+    if (status) {
+
+        MEDSdcard_Complete(media, media->transfer.length);
+        return;
+    }
+
+    // The card stream ends on the last block transferred
+    done = (pSd->preBlock + 1) * SD_BLOCK_SIZE
+           + media->baseAddress - media->transfer.address;
+    if ((done < media->transfer.length)
+        && (MEDSdcard_Submit(media, isRead, done) == 0)) {
+
+        return;
+    }
+
+    MEDSdcard_Complete(media, media->transfer.length - done);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked from SDSPI_Handler when a part of a read ends.
+//! \param  pArg    Pointer to the Media instance
+//! \param  status  0 if the part succeeded
+//------------------------------------------------------------------------------
+static void MEDSdcard_ReadCallback(void *pArg, unsigned char status)
+{
+    MEDSdcard_Callback((Media *) pArg, 1, status);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked from SDSPI_Handler when a part of a write ends.
+//! \param  pArg    Pointer to the Media instance
+//! \param  status  0 if the part succeeded
+//------------------------------------------------------------------------------
+static void MEDSdcard_WriteCallback(void *pArg, unsigned char status)
+{
+    MEDSdcard_Callback((Media *) pArg, 0, status);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts a read or a write on a SD card. The transfer continues from
+//!         SDSPI_Handler, which invokes the callback when it ends.
+//! \param  media    Pointer to a Media instance
+//! \param  isRead   1 for a read, 0 for a write
+//! \param  address  Address of the data on the card
+//! \param  data     Pointer to the data buffer
+//! \param  length   Size of the data buffer
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Start(Media         *media,
+                                     unsigned char isRead,
+                                     unsigned int  address,
+                                     void          *data,
+                                     unsigned int  length,
+                                     MediaCallback callback,
+                                     void          *argument)
+{
+    unsigned char status;
+
+    status = MEDSdcard_Check(media, address, length);
+    if (status != MED_STATUS_SUCCESS) {
+
+        return status;
+    }
+
+    // Enter Busy state
+    media->state = MED_STATE_BUSY;
+    media->transfer.data = data;
+    media->transfer.address = address;
+    media->transfer.length = length;
+    media->transfer.callback = callback;
+    media->transfer.argument = argument;
+
+    if (length == 0) {
+
+        return MEDSdcard_Complete(media, 0);
+    }
+
+    if (MEDSdcard_Submit(media, isRead, 0)) {
+
+        TRACE_WARNING("MEDSdcard: Cannot start transfer\n\r");
+        media->transfer.callback = 0;
+        media->state = MED_STATE_READY;
+        return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Reads a specified amount of data from a SD card
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  data     Pointer to the buffer in which to store the retrieved
+//!                   data
+//! \param  length   Length of the buffer
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Read(Media         *media,
+                                    unsigned int  address,
+                                    void          *data,
+                                    unsigned int  length,
+                                    MediaCallback callback,
+                                    void          *argument)
+{
+    return MEDSdcard_Start(media, 1, address, data, length,
+                           callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes data on a SD card
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  data     Pointer to the data to write
+//! \param  length   Size of the data buffer
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Write(Media         *media,
+                                     unsigned int  address,
+                                     void          *data,
+                                     unsigned int  length,
+                                     MediaCallback callback,
+                                     void          *argument)
+{
+    return MEDSdcard_Start(media, 0, address, data, length,
+                           callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Transfers data between a SD card and several buffers. Each
+//!         fragment must hold a whole number of blocks; the fragments are
+//!         transferred within a single multiple blocks transfer, which is
+//!         waited for.
+//! \param  media    Pointer to a Media instance
+//! \param  write    1 to write the card, 0 to read it
+//! \param  address  Address of the data on the card
+//! \param  vector   List of the fragments
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Transferv(Media           *media,
+                                         unsigned char   write,
+                                         unsigned int    address,
+                                         const MEDVector *vector,
+                                         unsigned int    count,
+                                         MediaCallback   callback,
+                                         void            *argument)
+{
+    SdCard *pSd = (SdCard *) media->interface;
+    unsigned int length = 0;
+    unsigned int remaining = 0;
+    unsigned int block;
+    unsigned int i;
+    unsigned char status;
+
+    for (i = 0; i < count; i++) {
+
+        if ((vector[i].length % SD_BLOCK_SIZE) != 0) {
+
+            TRACE_WARNING("MEDSdcard: Unaligned fragment: %u\n\r",
+                          vector[i].length);
+            return MED_STATUS_ERROR;
+        }
+        length += vector[i].length;
+    }
+
+    status = MEDSdcard_Check(media, address, length);
+    if (status != MED_STATUS_SUCCESS) {
+
+        return status;
+    }
+
+    // Enter Busy state
+    media->state = MED_STATE_BUSY;
+    media->transfer.data = 0;
+    media->transfer.address = address;
+    media->transfer.length = length;
+    media->transfer.callback = callback;
+    media->transfer.argument = argument;
+
+    // Transfer each fragment, the following ones continue the same stream
+    block = (address - media->baseAddress) / SD_BLOCK_SIZE;
+    for (i = 0; (i < count) && (remaining == 0); i++) {
+
+        if (vector[i].length > 0) {
+
+            remaining = MEDSdcard_Transfer(pSd,
+                                           write,
+                                           block,
+                                           (unsigned char *) vector[i].data,
+                                           vector[i].length);
+            block += vector[i].length / SD_BLOCK_SIZE;
+        }
+    }
+
+    // Account for the fragments which have not been started
+    for (; i < count; i++) {
+
+        remaining += vector[i].length;
+    }
+
+    return MEDSdcard_Complete(media, remaining);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Reads data from a SD card and scatters it in several buffers
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  vector   List of the fragments receiving the data
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Readv(Media           *media,
+                                     unsigned int    address,
+                                     const MEDVector *vector,
+                                     unsigned int    count,
+                                     MediaCallback   callback,
+                                     void            *argument)
+{
+    return MEDSdcard_Transferv(media, 0, address, vector, count,
+                               callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes data gathered from several buffers on a SD card
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  vector   List of the fragments to write
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Writev(Media           *media,
+                                      unsigned int    address,
+                                      const MEDVector *vector,
+                                      unsigned int    count,
+                                      MediaCallback   callback,
+                                      void            *argument)
+{
+    return MEDSdcard_Transferv(media, 1, address, vector, count,
+                               callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Ends the multiple blocks transfer left open on a SD card, so that
+//!         the written data is committed by the card.
+//! \param  media Pointer to a Media instance
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Flush(Media *media)
+{
+    if (media->state != MED_STATE_READY) {
+
+        return MED_STATUS_BUSY;
+    }
+
+    if (SD_StopTransfer((SdCard *) media->interface)) {
+
+        TRACE_WARNING("MEDSdcard_Flush: Cannot stop transfer\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Returns the number of blocks erased at once by a SD card.
+//! \param  pSd Pointer to a SdCard instance
+//------------------------------------------------------------------------------
+static unsigned int MEDSdcard_GetEraseBlocks(SdCard *pSd)
+{
+    if ((pSd->cardType == CARD_MMC) || SD_CSD_ERASE_BLK_EN(pSd)) {
+
+        return 1;
+    }
+
+    return SD_CSD_SECTOR_SIZE(pSd) + 1;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Erases the whole erase units of a SD card contained in a range
+//!         which is no longer used. The partial units at the ends of the range
+//!         are kept, since erasing them would lose the data around it.
+//! \param  media Pointer to a Media instance
+//! \param  range Range to discard
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Trim(Media *media, MEDRange *range)
+{
+    SdCard *pSd = (SdCard *) media->interface;
+    unsigned int eraseBlocks = MEDSdcard_GetEraseBlocks(pSd);
+    unsigned int start;
+    unsigned int end;
+
+    if (media->state != MED_STATE_READY) {
+
+        return MED_STATUS_BUSY;
+    }
+
+    // MMC cards are not erased, discards are not supported
+    if (pSd->cardType == CARD_MMC) {
+
+        return MED_STATUS_ERROR;
+    }
+
+    // Nothing to discard outside of the media
+    if ((range->address < media->baseAddress)
+        || ((range->address - media->baseAddress) >= media->size)) {
+
+        return MED_STATUS_SUCCESS;
+    }
+
+    // Round the range inwards to whole erase units
+    start = range->address - media->baseAddress;
+    end = start + range->length;
+    if (range->length > (media->size - start)) {
+
+        end = media->size;
+    }
+    start = (start + SD_BLOCK_SIZE - 1) / SD_BLOCK_SIZE;
+    end = end / SD_BLOCK_SIZE;
+    start = ((start + eraseBlocks - 1) / eraseBlocks) * eraseBlocks;
+    end = (end / eraseBlocks) * eraseBlocks;
+    if (end <= start) {
+
+        return MED_STATUS_SUCCESS;
+    }
+
+    if (SD_Erase(pSd, start, end - start)) {
+
+        TRACE_WARNING("MEDSdcard_Trim: Cannot erase blocks %u-%u\n\r",
+                      start, end - 1);
+        return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a SD card media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdcard_Ioctl(Media *media,
+                                     unsigned char ctrl,
+                                     void *buff)
+{
+    SdCard *pSd = (SdCard *) media->interface;
+
+    switch (ctrl) {
+
+        case MED_IOCTL_GET_SECTOR_SIZE:
+            *((unsigned int *) buff) = SD_BLOCK_SIZE;
+            break;
+
+        // Erase sector of the card; writing whole sectors is the fastest
+        case MED_IOCTL_GET_ERASE_UNIT:
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) buff) = MEDSdcard_GetEraseBlocks(pSd)
+                                       * SD_BLOCK_SIZE;
+            break;
+
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            *((unsigned char *) buff) = (SD_CSD_PERM_WRITE_PROTECT(pSd)
+                                         || SD_CSD_TMP_WRITE_PROTECT(pSd));
+            break;
+
+        case MED_IOCTL_TRIM:
+            return MEDSdcard_Trim(media, (MEDRange *) buff);
+
+        case MED_IOCTL_SYNC:
+            return MEDSdcard_Flush(media);
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Interrupt handler of a SD card media; forwards the SPI interrupts
+//!         to the SD SPI driver.
+//! \param  media Pointer to a Media instance
+//------------------------------------------------------------------------------
+static void MEDSdcard_Handler(Media *media)
+{
+    SdCard *pSd = (SdCard *) media->interface;
+
+    SDSPI_Handler((SdSpi *) pSd->pSdDriver);
+}
+
+//------------------------------------------------------------------------------
+//      Exported Functions
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//! \brief  Initializes a Media instance for a SD card. The card must have been
+//!         initialized with SD_Init.
+//! \param  media Pointer to the Media instance to initialize
+//! \param  pSd   Pointer to the initialized SdCard instance
+//! \see    Media
+//------------------------------------------------------------------------------
+void MEDSdcard_Initialize(Media *media, SdCard *pSd)
+{
+    SANITY_CHECK(media);
+    SANITY_CHECK(pSd);
+
+    TRACE_INFO("MEDSdcard init\n\r");
+
+    // Initialize media fields
+    media->write = MEDSdcard_Write;
+    media->read = MEDSdcard_Read;
+    media->writev = MEDSdcard_Writev;
+    media->readv = MEDSdcard_Readv;
+    media->flush = MEDSdcard_Flush;
+    media->ioctl = MEDSdcard_Ioctl;
+    media->handler = MEDSdcard_Handler;
+    media->baseAddress = 0;
+    media->interface = pSd;
+    media->state = MED_STATE_READY;
+
+    // Byte addresses limit the usable part of the larger cards
+    if (SD_TOTAL_BLOCK(pSd) > (MEDSDCARD_MAX_SIZE / SD_BLOCK_SIZE)) {
+
+        TRACE_WARNING("MEDSdcard: Only %u MB of the card are used\n\r",
+                      MEDSDCARD_MAX_SIZE / (1024 * 1024));
+        media->size = MEDSDCARD_MAX_SIZE;
+    }
+    else {
+
+        media->size = SD_TOTAL_BLOCK(pSd) * SD_BLOCK_SIZE;
+    }
+
+    media->transfer.data = 0;
+    media->transfer.address = 0;
+    media->transfer.length = 0;
+    media->transfer.callback = 0;
+    media->transfer.argument = 0;
+
+    MED_InitializeQueue(media);
+}
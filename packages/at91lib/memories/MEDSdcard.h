@@ -0,0 +1,73 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+/// !Purpose
+///
+/// Specialization of the Media class for interfacing with a SD card accessed
+/// through the SPI bus (see sdmmc_spi).
+///
+/// !Usage
+///
+/// -# Initialize the SPI driver and the card with SDSPI_Configure and SD_Init.
+/// -# Call MEDSdcard_Initialize to bind a Media instance to the card.
+/// -# Call MED_HandleAll (or MED_Handler) from the SPI interrupt handler;
+///    it forwards the interrupts to SDSPI_Handler. The SPI interrupt handler
+///    may also call SDSPI_Handler directly, as SD_Init needs it before the
+///    media exists.
+/// -# MED_Read and MED_Write return as soon as the transfer is started; it
+///    proceeds from the SPI interrupt, which invokes the callback when it
+///    ends. MED_Readv and MED_Writev wait for the end of the transfer.
+/// -# Media addresses and lengths are in bytes and must be multiples of
+///    SD_BLOCK_SIZE. Consecutive accesses in the same direction continue the
+///    open multiple blocks transfer (CMD18/CMD25) instead of starting a new
+///    one; MED_Flush ends it.
+/// -# MED_Ioctl with MED_IOCTL_TRIM erases the whole erase units of the card
+///    contained in the discarded range (SD_Erase), and waits for the end of
+///    the erase.
+//------------------------------------------------------------------------------
+
+#ifndef MEDSDCARD_H
+#define MEDSDCARD_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "Media.h"
+#include <sdmmc/sdmmc_spi.h>
+
+//------------------------------------------------------------------------------
+//      Exported functions
+//------------------------------------------------------------------------------
+
+extern void MEDSdcard_Initialize(Media *media, SdCard *pSd);
+
+#endif //#ifndef MEDSDCARD_H
@@ -35,6 +35,7 @@
 #include <board.h>
 #include <board_memories.h>
 #include <utility/trace.h>
+#include <string.h>
 
 #if defined(AT91C_EBI_SDRAM)
 
@@ -190,6 +191,167 @@ static unsigned char MEDSdram_Write(Media         *media,
     return MED_STATUS_SUCCESS;
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Reads a specified amount of data from a SDRAM memory and scatters it
+//!         in several buffers
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  vector   List of the fragments receiving the data
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdram_Readv(Media           *media,
+                                    unsigned int    address,
+                                    const MEDVector *vector,
+                                    unsigned int    count,
+                                    MediaCallback   callback,
+                                    void            *argument)
+{
+    unsigned int length = 0;
+    unsigned int i;
+
+    // Check that the media is ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_INFO("Media busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that the data to read is not too big
+    for (i = 0; i < count; i++) {
+
+        length += vector[i].length;
+    }
+    if ((length + address) > (media->baseAddress + media->size)) {
+
+        TRACE_WARNING("MEDSdram_Readv: Data too big: %u, 0x%08X\n\r", length, address);
+        return MED_STATUS_ERROR;
+    }
+
+    // Enter Busy state
+    media->state = MED_STATE_BUSY;
+
+    // Read data
+    for (i = 0; i < count; i++) {
+
+        memcpy(vector[i].data, (void *) address, vector[i].length);
+        address += vector[i].length;
+    }
+
+    // Leave the Busy state
+    media->state = MED_STATE_READY;
+
+    // Invoke callback
+    if (callback != 0) {
+
+        callback(argument, MED_STATUS_SUCCESS, 0, 0);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes data gathered from several buffers on a SDRAM media
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  vector   List of the fragments to write
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdram_Writev(Media           *media,
+                                     unsigned int    address,
+                                     const MEDVector *vector,
+                                     unsigned int    count,
+                                     MediaCallback   callback,
+                                     void            *argument)
+{
+    unsigned int length = 0;
+    unsigned int i;
+
+    // Check that the media if ready
+    if (media->state != MED_STATE_READY) {
+
+        TRACE_WARNING("MEDSdram_Writev: Media is busy\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Check that the data to write is not too big
+    for (i = 0; i < count; i++) {
+
+        length += vector[i].length;
+    }
+    if ((length + address) > (media->baseAddress + media->size)) {
+
+        TRACE_WARNING("MEDSdram_Writev: Data too big\n\r");
+        return MED_STATUS_ERROR;
+    }
+
+    // Put the media in Busy state
+    media->state = MED_STATE_BUSY;
+
+    // Copy the data to write
+    for (i = 0; i < count; i++) {
+
+        memcpy((void *) address, vector[i].data, vector[i].length);
+        address += vector[i].length;
+    }
+
+    // Leave the Busy state
+    media->state = MED_STATE_READY;
+
+    // Invoke the callback if it exists
+    if (callback != 0) {
+
+        callback(argument, MED_STATUS_SUCCESS, 0, 0);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a SDRAM media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static unsigned char MEDSdram_Ioctl(Media *media,
+                                    unsigned char ctrl,
+                                    void *buff)
+{
+    switch (ctrl) {
+
+        // Dword-aligned accesses, no erase, no preferred transfer length
+        case MED_IOCTL_GET_SECTOR_SIZE:
+        case MED_IOCTL_GET_ERASE_UNIT:
+            *((unsigned int *) buff) = 4;
+            break;
+
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) buff) = 0;
+            break;
+
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            *((unsigned char *) buff) = 0;
+            break;
+
+        // Nothing can be discarded, MED_IOCTL_TRIM is not supported
+        case MED_IOCTL_SYNC:
+            break;
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
 //------------------------------------------------------------------------------
 //      Exported Functions
 //------------------------------------------------------------------------------
@@ -226,8 +388,11 @@ void MEDSdram_Initialize(Media *media,
     //--------------------------------------------------------------------------
     media->write = MEDSdram_Write;
     media->read = MEDSdram_Read;
+    media->writev = MEDSdram_Writev;
+    media->readv = MEDSdram_Readv;
     media->handler = 0;
     media->flush = 0;
+    media->ioctl = MEDSdram_Ioctl;
     media->baseAddress = baseAddress;
     media->size = size;
     media->state = MED_STATE_READY;
@@ -237,6 +402,8 @@ void MEDSdram_Initialize(Media *media,
     media->transfer.length = 0;
     media->transfer.callback = 0;
     media->transfer.argument = 0;
+
+    MED_InitializeQueue(media);
 }
 #endif //#if defined(AT91C_EBI_SDRAM)
 
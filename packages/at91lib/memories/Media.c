@@ -32,6 +32,119 @@
 //------------------------------------------------------------------------------
 
 #include "Media.h"
+#include <utility/trace.h>
+
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+static void MED_StartQueue(Media *media);
+
+//------------------------------------------------------------------------------
+//! \brief  Removes the oldest request from the queue of a media and invokes
+//!         its callback.
+//! \param  media       Pointer to the Media instance
+//! \param  status      Request status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void MED_EndRequest(Media         *media,
+                           unsigned char status,
+                           unsigned int  transferred,
+                           unsigned int  remaining)
+{
+    MEDRequest *request = &(media->queue[media->queueOut
+                                         & (MED_QUEUE_SIZE - 1)]);
+    MediaCallback callback = request->transfer.callback;
+    void *argument = request->transfer.argument;
+
+    // Free the slot before the callback, which may submit a new request
+    media->queueOut++;
+
+    if (callback) {
+
+        callback(argument, status, transferred, remaining);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked when a queued request ends. Starts the next one.
+//! \param  media       Pointer to the Media instance
+//! \param  status      Transfer status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void MED_RequestCallback(Media         *media,
+                                unsigned char status,
+                                unsigned int  transferred,
+                                unsigned int  remaining)
+{
+    MED_EndRequest(media, status, transferred, remaining);
+    MED_StartQueue(media);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts the oldest queued request of a media. Cancelled requests and
+//!         requests which cannot be started are ended with the corresponding
+//!         status. Must only be called by the owner of the queue
+//!         (queueActive set).
+//! \param  media Pointer to the Media instance
+//------------------------------------------------------------------------------
+static void MED_StartQueue(Media *media)
+{
+    MEDRequest *request;
+    unsigned char status;
+
+    media->queueRetry = 0;
+    while (media->queueOut != media->queueIn) {
+
+        request = &(media->queue[media->queueOut & (MED_QUEUE_SIZE - 1)]);
+        if (request->cancelled) {
+
+            status = MED_STATUS_CANCELLED;
+        }
+        else {
+
+            if (request->write) {
+
+                status = MED_Write(media,
+                                   request->transfer.address,
+                                   request->transfer.data,
+                                   request->transfer.length,
+                                   (MediaCallback) MED_RequestCallback,
+                                   media);
+            }
+            else {
+
+                status = MED_Read(media,
+                                  request->transfer.address,
+                                  request->transfer.data,
+                                  request->transfer.length,
+                                  (MediaCallback) MED_RequestCallback,
+                                  media);
+            }
+
+            // The completion callback proceeds with the next request
+            if (status == MED_STATUS_SUCCESS) {
+
+                return;
+            }
+
+            // The media is used directly, try again from MED_HandleAll
+            if (status == MED_STATUS_BUSY) {
+
+                media->queueRetry = 1;
+                return;
+            }
+
+            TRACE_WARNING("MED_StartQueue: Cannot start request\n\r");
+        }
+
+        MED_EndRequest(media, status, 0, request->transfer.length);
+    }
+
+    media->queueActive = 0;
+}
 
 //------------------------------------------------------------------------------
 //         Exported functions
@@ -41,7 +154,97 @@
 unsigned int numMedias = 0;
 
 //------------------------------------------------------------------------------
-//! \brief  Handle interrupts on specified media
+//! \brief  Queues a read or write request on a media. The request is started
+//!         at once if the queue is empty, otherwise when the previous requests
+//!         end. Its callback is invoked when it ends, possibly from interrupt
+//!         context; it may submit other requests.
+//!         Must be called from the main program only.
+//! \param  media    Pointer to a Media instance
+//! \param  write    1 to write the media, 0 to read it
+//! \param  address  Address at which to access the media
+//! \param  data     Pointer to the data buffer
+//! \param  length   Size of the data buffer
+//! \param  callback Optional callback to invoke when the request ends
+//! \param  argument Optional argument for the callback, also used to identify
+//!                   the request in MED_Cancel
+//! \return MED_STATUS_SUCCESS, or MED_STATUS_BUSY if the queue is full
+//------------------------------------------------------------------------------
+unsigned char MED_Submit(Media         *media,
+                         unsigned char write,
+                         unsigned int  address,
+                         void          *data,
+                         unsigned int  length,
+                         MediaCallback callback,
+                         void          *argument)
+{
+    MEDRequest *request;
+
+    // Check that the queue is not full
+    if (MED_GetQueueDepth(media) >= MED_QUEUE_SIZE) {
+
+        TRACE_WARNING("MED_Submit: Queue is full\n\r");
+        return MED_STATUS_BUSY;
+    }
+
+    // Fill the next free slot
+    request = &(media->queue[media->queueIn & (MED_QUEUE_SIZE - 1)]);
+    request->transfer.address = address;
+    request->transfer.data = data;
+    request->transfer.length = length;
+    request->transfer.callback = callback;
+    request->transfer.argument = argument;
+    request->write = write;
+    request->cancelled = 0;
+    media->queueIn++;
+
+    // Start processing the queue if idle
+    if (!media->queueActive) {
+
+        media->queueActive = 1;
+        MED_StartQueue(media);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Cancels the queued requests of a media which have the given
+//!         callback argument and have not started yet. Their callback is
+//!         invoked with MED_STATUS_CANCELLED when they reach the head of the
+//!         queue. Must be called from the main program only.
+//! \param  media    Pointer to a Media instance
+//! \param  argument Callback argument of the requests to cancel
+//! \return Number of requests cancelled
+//------------------------------------------------------------------------------
+unsigned char MED_Cancel(Media *media, void *argument)
+{
+    unsigned char index = media->queueOut;
+    unsigned char count = 0;
+    MEDRequest *request;
+
+    // The oldest request cannot be cancelled once started
+    if (media->queueActive && !media->queueRetry) {
+
+        index++;
+    }
+
+    while (index != media->queueIn) {
+
+        request = &(media->queue[index & (MED_QUEUE_SIZE - 1)]);
+        if (request->transfer.argument == argument) {
+
+            request->cancelled = 1;
+            count++;
+        }
+        index++;
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Handle interrupts on specified media, and restarts the queued
+//!         requests delayed by a direct access to the media.
 //! \param  pMedia    List of media
 //! \param  bNumMedia Number of media in list
 //! \see    S_media
@@ -53,5 +256,13 @@ void MED_HandleAll(Media *medias, unsigned char numMedias)
     for (i = 0; i < numMedias; i++) {
 
         MED_Handler(&(medias[i]));
+
+        // Restart a queued request which found the media busy
+        if (medias[i].queueActive
+            && medias[i].queueRetry
+            && (medias[i].state == MED_STATE_READY)) {
+
+            MED_StartQueue(&(medias[i]));
+        }
     }
 }
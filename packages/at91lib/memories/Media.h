@@ -36,7 +36,22 @@
 ///
 /// !Usage
 ///
-/// TODO
+/// -# Initialize a Media instance with the initialization function of its
+///    driver (e.g. FLA_Initialize, MEDSdram_Initialize).
+/// -# Access the media directly with MED_Read and MED_Write; they return
+///    MED_STATUS_BUSY while another transfer is in progress.
+/// -# Or queue the transfers with MED_Submit, so that several users can share
+///    the media without polling: up to MED_QUEUE_SIZE requests are processed
+///    in order, and the callback of each one is invoked when it ends.
+///    MED_Cancel withdraws the requests which have not started yet.
+/// -# MED_Readv and MED_Writev transfer a contiguous media area from/to a list
+///    of RAM fragments (MEDVector) without staging them in a single buffer.
+///    Medias without native support are accessed fragment by fragment.
+/// -# MED_Ioctl queries the geometry of the media (sector size, erase unit,
+///    optimal transfer length) and its write protection, discards unused
+///    ranges and synchronizes the pending writes (see MED_IOCTL_xxx).
+/// -# Call MED_HandleAll from the interrupt handler of the medias; it drives
+///    the transfers in progress and the queued requests.
 //------------------------------------------------------------------------------
 
 #ifndef MEDIA_H
@@ -50,11 +65,33 @@
 #define MED_STATUS_SUCCESS      0x00
 #define MED_STATUS_ERROR        0x01
 #define MED_STATUS_BUSY         0x02
+#define MED_STATUS_CANCELLED    0x03
 
 //! \brief Media statuses
 #define MED_STATE_READY         0x00
 #define MED_STATE_BUSY          0x01
 
+//! \brief  Media control codes (see MED_Ioctl)
+//! Smallest unit which can be written, in bytes (unsigned int *).
+#define MED_IOCTL_GET_SECTOR_SIZE       0x01
+//! Size of the unit erased before programming, in bytes (unsigned int *).
+#define MED_IOCTL_GET_ERASE_UNIT        0x02
+//! Transfer length giving the best throughput, in bytes, 0 if the media has
+//! no preference (unsigned int *).
+#define MED_IOCTL_GET_OPTIMAL_TRANSFER  0x03
+//! The data of a range is no longer used (MEDRange *). Media which cannot
+//! discard data return MED_STATUS_ERROR, even for an empty range.
+#define MED_IOCTL_TRIM                  0x04
+//! 1 if the media cannot be written, 0 otherwise (unsigned char *).
+#define MED_IOCTL_GET_WRITE_PROTECT     0x05
+//! Completes the pending writes (no argument).
+#define MED_IOCTL_SYNC                  0x06
+
+//! \brief  Maximum number of queued requests per media (power of two)
+#ifndef MED_QUEUE_SIZE
+#define MED_QUEUE_SIZE          4
+#endif
+
 //------------------------------------------------------------------------------
 //      Types
 //------------------------------------------------------------------------------
@@ -79,6 +116,30 @@ typedef unsigned char (*Media_read)(Media *media,
                                     MediaCallback callback,
                                     void *argument);
 
+//! \brief  Fragment of a scatter-gather transfer
+//! \see    MED_Readv
+//! \see    MED_Writev
+typedef struct {
+
+    void            *data;     //!< Pointer to the fragment
+    unsigned int    length;    //!< Size of the fragment in bytes
+
+} MEDVector;
+
+typedef unsigned char (*Media_writev)(Media *media,
+                                      unsigned int address,
+                                      const MEDVector *vector,
+                                      unsigned int count,
+                                      MediaCallback callback,
+                                      void *argument);
+
+typedef unsigned char (*Media_readv)(Media *media,
+                                     unsigned int address,
+                                     const MEDVector *vector,
+                                     unsigned int count,
+                                     MediaCallback callback,
+                                     void *argument);
+
 typedef unsigned char (*Media_ioctl)(Media *media,
                                      unsigned char ctrl,
                                      void *buff);
@@ -99,19 +160,46 @@ typedef struct {
 
 } MEDTransfer;
 
+//! \brief  Media address range
+//! \see    MED_IOCTL_TRIM
+typedef struct {
+
+    unsigned int    address;   //!< Start address of the range
+    unsigned int    length;    //!< Size of the range in bytes
+
+} MEDRange;
+
+//! \brief  Queued media request
+//! \see    MED_Submit
+typedef struct {
+
+    MEDTransfer     transfer;  //!< Transfer parameters
+    unsigned char   write;     //!< 1 for a write request, 0 for a read
+    volatile unsigned char cancelled; //!< Set when the request is cancelled
+
+} MEDRequest;
+
 //! \brief  Media object
 //! \see    MEDTransfer
 struct _Media {
 
   Media_write    write;       //!< Write method
   Media_read     read;        //!< Read method
+  Media_writev   writev;      //!< Scatter-gather write method (optional)
+  Media_readv    readv;       //!< Scatter-gather read method (optional)
   Media_flush    flush;       //!< Flush method
+  Media_ioctl    ioctl;       //!< Control method (optional)
   Media_handler  handler;     //!< Interrupt handler
   unsigned int   baseAddress; //!< Base address of media
   unsigned int   size;        //!< Size of media
   MEDTransfer    transfer;    //!< Current transfer operation
   void           *interface;  //!< Pointer to the physical interface used
   unsigned char  state;       //!< Status of media
+  MEDRequest     queue[MED_QUEUE_SIZE]; //!< Queued requests
+  volatile unsigned char queueIn;     //!< Index of the next free queue slot
+  volatile unsigned char queueOut;    //!< Index of the oldest queued request
+  volatile unsigned char queueActive; //!< Oldest request is in progress
+  volatile unsigned char queueRetry;  //!< Oldest request must be restarted
 };
 
 /// Available medias.
@@ -168,6 +256,116 @@ static inline unsigned char MED_Read(Media          *media,
     return media->read(media, address, data, length, callback, argument);
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Writes data gathered from several buffers on a media. Without native
+//!         support, the fragments are written one after the other, waiting
+//!         for each write to end; the callback is then invoked for the last
+//!         fragment only.
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address at which to write
+//! \param  vector   List of the fragments to write
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the write operation terminates
+//! \param  argument Optional argument for the callback function
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static inline unsigned char MED_Writev(Media           *media,
+                                       unsigned int    address,
+                                       const MEDVector *vector,
+                                       unsigned int    count,
+                                       MediaCallback   callback,
+                                       void            *argument)
+{
+    unsigned char status = MED_STATUS_SUCCESS;
+    unsigned int i;
+
+    if (media->writev) {
+
+        return media->writev(media, address, vector, count, callback, argument);
+    }
+
+    for (i = 0; (i < count) && (status == MED_STATUS_SUCCESS); i++) {
+
+        while ((i > 0) && (media->state != MED_STATE_READY));
+        status = media->write(media,
+                              address,
+                              vector[i].data,
+                              vector[i].length,
+                              (i == (count - 1)) ? callback : 0,
+                              argument);
+        address += vector[i].length;
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Reads data from a media and scatters it in several buffers. Without
+//!         native support, the fragments are read one after the other, waiting
+//!         for each read to end; the callback is then invoked for the last
+//!         fragment only.
+//! \param  media    Pointer to a Media instance
+//! \param  address  Address of the data to read
+//! \param  vector   List of the fragments receiving the data
+//! \param  count    Number of fragments
+//! \param  callback Optional pointer to a callback function to invoke when
+//!                   the operation is finished
+//! \param  argument Optional pointer to an argument for the callback
+//! \return Operation result code
+//------------------------------------------------------------------------------
+static inline unsigned char MED_Readv(Media           *media,
+                                      unsigned int    address,
+                                      const MEDVector *vector,
+                                      unsigned int    count,
+                                      MediaCallback   callback,
+                                      void            *argument)
+{
+    unsigned char status = MED_STATUS_SUCCESS;
+    unsigned int i;
+
+    if (media->readv) {
+
+        return media->readv(media, address, vector, count, callback, argument);
+    }
+
+    for (i = 0; (i < count) && (status == MED_STATUS_SUCCESS); i++) {
+
+        while ((i > 0) && (media->state != MED_STATE_READY));
+        status = media->read(media,
+                             address,
+                             vector[i].data,
+                             vector[i].length,
+                             (i == (count - 1)) ? callback : 0,
+                             argument);
+        address += vector[i].length;
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs a control operation on a media
+//! \param  media Pointer to a Media instance
+//! \param  ctrl  Control code (MED_IOCTL_xxx)
+//! \param  buff  Argument of the control code
+//! \return Operation result code, MED_STATUS_ERROR if the control is not
+//!         supported by the media
+//------------------------------------------------------------------------------
+static inline unsigned char MED_Ioctl(Media *media,
+                                      unsigned char ctrl,
+                                      void *buff)
+{
+    if (media->ioctl) {
+
+        return media->ioctl(media, ctrl, buff);
+    }
+    else {
+
+        return MED_STATUS_ERROR;
+    }
+}
+
 //------------------------------------------------------------------------------
 //! \brief
 //! \param  media Pointer to the Media instance to use
@@ -184,6 +382,29 @@ static inline unsigned char MED_Flush(Media *media)
     }
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Empties the request queue of a media. Invoked by the media
+//!         initialization functions.
+//! \param  media Pointer to the Media instance to use
+//------------------------------------------------------------------------------
+static inline void MED_InitializeQueue(Media *media)
+{
+    media->queueIn = 0;
+    media->queueOut = 0;
+    media->queueActive = 0;
+    media->queueRetry = 0;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Returns the number of queued requests of a media, including the
+//!         one in progress.
+//! \param  media Pointer to the Media instance to use
+//------------------------------------------------------------------------------
+static inline unsigned char MED_GetQueueDepth(Media *media)
+{
+    return (unsigned char) (media->queueIn - media->queueOut);
+}
+
 //------------------------------------------------------------------------------
 //! \brief  Invokes the interrupt handler of the specified media
 //! \param  media Pointer to the Media instance to use
@@ -200,6 +421,16 @@ static inline void MED_Handler(Media *media)
 //      Exported functions
 //------------------------------------------------------------------------------
 
+extern unsigned char MED_Submit(Media         *media,
+                                unsigned char write,
+                                unsigned int  address,
+                                void          *data,
+                                unsigned int  length,
+                                MediaCallback callback,
+                                void          *argument);
+
+extern unsigned char MED_Cancel(Media *media, void *argument);
+
 extern void MED_HandleAll(Media *medias, unsigned char numMedias);
 
 #endif // _MEDIA_H
@@ -49,11 +49,18 @@
 ///      in which page and in which lock region for difference Flash device,
 ///      so that can help develop your uppon appcations with maximum efficiency.
 /// -# Writes data in embedded %flash using FLASHD_Write().
+/// -# Writes a run of whole pages from a word-aligned buffer using
+///    FLASHD_WritePages(), without going through the page buffer.
 /// -# Erase data in embedded %flash using FLASHD_Write().
 /// -# Lock region in embedded %flash using FLASHD_Lock().
 /// -# Unlock region in embedded %flash using FLASHD_Unlock().
 /// -# Set GPNVM in embedded %flash using FLASHD_SetGPNVM().
 /// -# Clear GPNVM in embedded %flash using FLASHD_ClearGPNVM().
+/// -# On the EFC, queue page writes, locks and unlocks with FLASHD_Submit();
+///    they are carried out in the background, driven by FLASHD_Handler()
+///    which must be called from the system interrupt, and the callback of
+///    each command is invoked when it ends. The flash can not be read while a
+///    command runs, so the code running meanwhile must not be in the flash.
 ///
 /// !See also
 ///    - efc: EFC peripheral interface.
@@ -62,6 +69,65 @@
 #ifndef FLASHD_H
 #define FLASHD_H
 
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+#if defined(BOARD_FLASH_EFC)
+
+/// Asynchronous command writing whole pages.
+#define FLASHD_CMD_WRITE        0
+/// Asynchronous command locking the regions of an address range.
+#define FLASHD_CMD_LOCK         1
+/// Asynchronous command unlocking the regions of an address range.
+#define FLASHD_CMD_UNLOCK       2
+
+/// Status of an asynchronous command which has not ended yet.
+#define FLASHD_STATUS_PENDING   0xFF
+
+//------------------------------------------------------------------------------
+//         Types
+//------------------------------------------------------------------------------
+
+/// Asynchronous command callback, invoked with the command argument and 0 if
+/// the command is successful, or the error code otherwise.
+typedef void (*FlashdCallback)(void *pArgument, unsigned char status);
+
+//------------------------------------------------------------------------------
+/// Asynchronous flash command given to FLASHD_Submit. It is owned by the
+/// driver until its callback is invoked.
+//------------------------------------------------------------------------------
+typedef struct _FlashdCommand {
+
+    /// Command code (FLASHD_CMD_xxx).
+    unsigned char command;
+    /// Address of the first page to write, or start of the lock range.
+    unsigned int address;
+    /// End of the lock range.
+    unsigned int end;
+    /// Word-aligned data of the pages to write.
+    const void *pBuffer;
+    /// Number of pages to write.
+    unsigned int numPages;
+    /// Optional callback invoked when the command ends.
+    FlashdCallback callback;
+    /// Optional argument to the callback function.
+    void *pArgument;
+    /// Command status, FLASHD_STATUS_PENDING until the command ends.
+    volatile unsigned char status;
+    /// Next command of the queue.
+    struct _FlashdCommand *pNext;
+
+} FlashdCommand;
+
+#endif //#if defined(BOARD_FLASH_EFC)
+
 //------------------------------------------------------------------------------
 //         Functions
 //------------------------------------------------------------------------------
@@ -75,6 +141,11 @@ extern unsigned char FLASHD_Write(
     const void *pBuffer,
     unsigned int size);
 
+extern unsigned char FLASHD_WritePages(
+    unsigned int address,
+    const void *pBuffer,
+    unsigned int numPages);
+
 extern unsigned char FLASHD_Lock(
     unsigned int start,
     unsigned int end,
@@ -104,6 +175,12 @@ extern unsigned char FLASHD_IsSecurityBitSet(void);
 
 extern unsigned char FLASHD_SetSecurityBit(void);
 
+extern void FLASHD_Submit(FlashdCommand *pCommand);
+
+extern void FLASHD_Handler(void);
+
+extern unsigned char FLASHD_IsBusy(void);
+
 #elif defined(BOARD_FLASH_EEFC)
 
 #define FLASHD_IsSecurityBitSet() FLASHD_IsGPNVMSet(0)
@@ -111,9 +111,74 @@ unsigned char FLASHD_Erase(void)
 
 static unsigned char pPageBuffer[AT91C_IFLASH_PAGE_SIZE];
 
+//------------------------------------------------------------------------------
+/// Checks if a page must be erased before being programmed with new data,
+/// i.e. if a bit changes from 0 to 1; programming alone only clears bits.
+/// Returns 1 if the page must be erased; otherwise returns 0.
+/// \param pageAddress  Address of the page in the flash.
+/// \param pSource  Word-aligned new page data.
+//------------------------------------------------------------------------------
+static unsigned char NeedsErase(
+    unsigned int pageAddress,
+    const unsigned int *pSource)
+{
+    const unsigned int *pCurrent = (const unsigned int *) pageAddress;
+    unsigned int sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+
+    while (sizeTmp >= 4) {
+
+        if ((*pSource++ & ~(*pCurrent++)) != 0) {
+
+            return 1;
+        }
+        sizeTmp -= 4;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Copies a whole page in the page latch of the flash, word by word, and
+/// programs it. The page is erased first (EWP) only when the new data sets
+/// bits cleared in the flash; otherwise it is only programmed (WP), which is
+/// about twice faster and does not wear the page.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param page  Page number.
+/// \param pSource  Word-aligned page data.
+//------------------------------------------------------------------------------
+static unsigned char WritePage(unsigned short page, const unsigned int *pSource)
+{
+    unsigned int pageAddress;
+    unsigned int sizeTmp;
+    unsigned int *pAlignedDestination;
+    unsigned char command;
+
+    EFC_ComputeAddress(page, 0, &pageAddress);
+
+    // Only set bits require an erase, check before filling the latch
+    command = NeedsErase(pageAddress, pSource) ? AT91C_EFC_FCMD_EWP
+                                               : AT91C_EFC_FCMD_WP;
+
+    // Write page
+    // Writing 8-bit and 16-bit data is not allowed
+    // and may lead to unpredictable data corruption
+    pAlignedDestination = (unsigned int*)pageAddress;
+    sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+    while (sizeTmp >= 4) {
+
+        *pAlignedDestination++ = *pSource++;
+        sizeTmp -= 4;
+    }
+
+    // Send writing command
+    return EFC_PerformCommand(command, page);
+}
+
 //------------------------------------------------------------------------------
 /// Writes a data buffer in the internal flash. This function works in polling
 /// mode, and thus only returns when the data has been effectively written.
+/// Whole pages of a word-aligned buffer are copied straight in the page latch;
+/// the other pages are merged with the flash contents in a page buffer first.
 /// Returns 0 if successful; otherwise returns an error code.
 /// \param address  Write address.
 /// \param pBuffer  Data buffer.
@@ -131,10 +196,6 @@ unsigned char FLASHD_Write(
     unsigned short padding;
     unsigned char error;
 
-    unsigned int sizeTmp;
-    unsigned int *pAlignedDestination;
-    unsigned int *pAlignedSource;
-
     SANITY_CHECK(address >= AT91C_IFLASH);
     SANITY_CHECK(pBuffer);
     SANITY_CHECK((address + size) <= (AT91C_IFLASH + AT91C_IFLASH_SIZE));
@@ -145,34 +206,31 @@ unsigned char FLASHD_Write(
     // Write all pages
     while (size > 0) {
 
-        // Copy data in temporary buffer to avoid alignment problems
         writeSize = min(AT91C_IFLASH_PAGE_SIZE - offset, size);
-        EFC_ComputeAddress(page, 0, &pageAddress);
-        padding = AT91C_IFLASH_PAGE_SIZE - offset - writeSize;
 
-        // Pre-buffer data
-        memcpy(pPageBuffer, (void *) pageAddress, offset);
+        // Whole page from an aligned buffer, no need for the page buffer
+        if ((writeSize == AT91C_IFLASH_PAGE_SIZE)
+            && (((unsigned int) pBuffer & 3) == 0)) {
 
-        // Buffer data
-        memcpy(pPageBuffer + offset, pBuffer, writeSize);
+            error = WritePage(page, (const unsigned int *) pBuffer);
+        }
+        else {
 
-        // Post-buffer data
-        memcpy(pPageBuffer + offset + writeSize, (void *) (pageAddress + offset + writeSize), padding);
+            // Copy data in temporary buffer to avoid alignment problems
+            EFC_ComputeAddress(page, 0, &pageAddress);
+            padding = AT91C_IFLASH_PAGE_SIZE - offset - writeSize;
 
-        // Write page
-        // Writing 8-bit and 16-bit data is not allowed
-        // and may lead to unpredictable data corruption
-        pAlignedDestination = (unsigned int*)pageAddress;
-        pAlignedSource = (unsigned int*)pPageBuffer;
-        sizeTmp = AT91C_IFLASH_PAGE_SIZE;
-        while (sizeTmp >= 4) {
+            // Pre-buffer data
+            memcpy(pPageBuffer, (void *) pageAddress, offset);
 
-            *pAlignedDestination++ = *pAlignedSource++;
-            sizeTmp -= 4;
-        }
+            // Buffer data
+            memcpy(pPageBuffer + offset, pBuffer, writeSize);
+
+            // Post-buffer data
+            memcpy(pPageBuffer + offset + writeSize, (void *) (pageAddress + offset + writeSize), padding);
 
-        // Send writing command
-        error = EFC_PerformCommand(AT91C_EFC_FCMD_EWP, page);
+            error = WritePage(page, (const unsigned int *) pPageBuffer);
+        }
         if (error) {
 
             return error;
@@ -189,6 +247,50 @@ unsigned char FLASHD_Write(
     return 0;
 }
 
+//------------------------------------------------------------------------------
+/// Writes a run of whole pages in the internal flash, straight from the given
+/// buffer. Each page is copied in the page latch and programmed in turn; the
+/// function returns when the last one is programmed, or on the first error.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param address  Address of the first page, aligned on a page.
+/// \param pBuffer  Word-aligned data of the pages.
+/// \param numPages  Number of pages to write.
+//------------------------------------------------------------------------------
+unsigned char FLASHD_WritePages(
+    unsigned int address,
+    const void *pBuffer,
+    unsigned int numPages)
+{
+    unsigned short page;
+    unsigned short offset;
+    const unsigned int *pSource = (const unsigned int *) pBuffer;
+    unsigned char error;
+
+    SANITY_CHECK(address >= AT91C_IFLASH);
+    SANITY_CHECK(pBuffer);
+    SANITY_CHECK(((unsigned int) pBuffer & 3) == 0);
+    SANITY_CHECK((address + numPages * AT91C_IFLASH_PAGE_SIZE)
+                 <= (AT91C_IFLASH + AT91C_IFLASH_SIZE));
+
+    EFC_TranslateAddress(address, &page, &offset);
+    SANITY_CHECK(offset == 0);
+
+    while (numPages > 0) {
+
+        error = WritePage(page, pSource);
+        if (error) {
+
+            return error;
+        }
+
+        pSource += AT91C_IFLASH_PAGE_SIZE / 4;
+        numPages--;
+        page++;
+    }
+
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 /// Locks all the regions in the given address range. The actual lock range is
 /// reported through two output parameters.
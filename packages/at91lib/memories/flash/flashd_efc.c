@@ -133,9 +133,132 @@ unsigned char FLASHD_Erase(void)
 
 static unsigned char pPageBuffer[AT91C_IFLASH_PAGE_SIZE];
 
+//------------------------------------------------------------------------------
+/// Checks if a page must be erased before being programmed with new data,
+/// i.e. if a bit changes from 0 to 1; programming alone only clears bits.
+/// Returns 1 if the page must be erased; otherwise returns 0.
+/// \param pageAddress  Address of the page in the flash.
+/// \param pSource  Word-aligned new page data.
+//------------------------------------------------------------------------------
+static unsigned char NeedsErase(
+    unsigned int pageAddress,
+    const unsigned int *pSource)
+{
+    const unsigned int *pCurrent = (const unsigned int *) pageAddress;
+    unsigned int sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+
+    while (sizeTmp >= 4) {
+
+        if ((*pSource++ & ~(*pCurrent++)) != 0) {
+
+            return 1;
+        }
+        sizeTmp -= 4;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Copies a whole page in the page latch of the flash, word by word, and
+/// programs it. The page is erased first only when the new data sets bits
+/// cleared in the flash; otherwise it is programmed without erase (NEBP),
+/// which is about twice faster and does not wear the page.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pEfc  Pointer to the EFC of the page.
+/// \param page  Page number in the EFC.
+/// \param pSource  Word-aligned page data.
+//------------------------------------------------------------------------------
+static unsigned char WritePage(
+    AT91S_EFC *pEfc,
+    unsigned short page,
+    const unsigned int *pSource)
+{
+    unsigned int pageAddress;
+    unsigned int sizeTmp;
+    unsigned int *pAlignedDestination;
+    const unsigned int *pAlignedSource;
+    unsigned char error;
+
+    EFC_ComputeAddress(pEfc, page, 0, &pageAddress);
+
+    // Only set bits require an erase, check before filling the latch
+    if (!NeedsErase(pageAddress, pSource)) {
+
+        EFC_SetEraseBeforeProgramming(pEfc, 0);
+    }
+
+    // Write page
+    // Writing 8-bit and 16-bit data is not allowed
+    // and may lead to unpredictable data corruption
+#ifdef EFC_EVEN_ODD_PROG
+    // Write even words first, with auto erase if needed
+    pAlignedDestination = (unsigned int*)pageAddress;
+    pAlignedSource = pSource;
+    sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+    while (sizeTmp >= 4) {
+
+        *pAlignedDestination = *pAlignedSource;
+        pAlignedDestination += 2;
+        pAlignedSource += 2;
+        sizeTmp -= 8;
+    }
+    // Send writing command
+    error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
+    if (error) {
+
+        EFC_SetEraseBeforeProgramming(pEfc, 1);
+        return error;
+    }
+
+    // Then write odd words without auto erase
+    EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC0, 0);
+#ifdef AT91C_BASE_EFC1
+    EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC1, 0);
+#endif
+    pAlignedDestination = (unsigned int*)pageAddress + 1;
+    pAlignedSource = pSource + 1;
+    sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+    while (sizeTmp >= 4) {
+
+        *pAlignedDestination = *pAlignedSource;
+        pAlignedDestination += 2;
+        pAlignedSource += 2;
+        sizeTmp -= 8;
+    }
+
+    // Send writing command, then restore the auto erase even if it failed
+    error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
+
+    EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC0, 1);
+#ifdef AT91C_BASE_EFC1
+    EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC1, 1);
+#endif
+
+#else
+    pAlignedDestination = (unsigned int*)pageAddress;
+    pAlignedSource = pSource;
+    sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+    while (sizeTmp >= 4) {
+
+        *pAlignedDestination++ = *pAlignedSource++;
+        sizeTmp -= 4;
+    }
+
+    // Send writing command
+    error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
+
+    EFC_SetEraseBeforeProgramming(pEfc, 1);
+#endif
+
+    return error;
+}
+
 //------------------------------------------------------------------------------
 /// Writes a data buffer in the internal flash. This function works in polling
 /// mode, and thus only returns when the data has been effectively written.
+/// Whole pages of a word-aligned buffer are copied straight in the page latch;
+/// the other pages are merged with the flash contents in a page buffer first.
 /// Returns 0 if successful; otherwise returns an error code.
 /// \param address  Write address.
 /// \param pBuffer  Data buffer.
@@ -154,10 +277,6 @@ unsigned char FLASHD_Write(
     unsigned short padding;
     unsigned char error;
 
-    unsigned int sizeTmp;
-    unsigned int *pAlignedDestination;
-    unsigned int *pAlignedSource;
-
     SANITY_CHECK(address >= AT91C_IFLASH);
     SANITY_CHECK(pBuffer);
     SANITY_CHECK((address + size) <= (AT91C_IFLASH + AT91C_IFLASH_SIZE));
@@ -168,93 +287,96 @@ unsigned char FLASHD_Write(
     // Write all pages
     while (size > 0) {
 
-        // Copy data in temporary buffer to avoid alignment problems
         writeSize = min(AT91C_IFLASH_PAGE_SIZE - offset, size);
-        EFC_ComputeAddress(pEfc, page, 0, &pageAddress);
-        padding = AT91C_IFLASH_PAGE_SIZE - offset - writeSize;
 
-        // Pre-buffer data (mask with 0xFF)
-        memcpy(pPageBuffer, (void *) pageAddress, offset);
+        // Whole page from an aligned buffer, no need for the page buffer
+        if ((writeSize == AT91C_IFLASH_PAGE_SIZE)
+            && (((unsigned int) pBuffer & 3) == 0)) {
+
+            error = WritePage(pEfc, page, (const unsigned int *) pBuffer);
+        }
+        else {
 
-        // Buffer data
-        memcpy(pPageBuffer + offset, pBuffer, writeSize);
+            // Copy data in temporary buffer to avoid alignment problems
+            EFC_ComputeAddress(pEfc, page, 0, &pageAddress);
+            padding = AT91C_IFLASH_PAGE_SIZE - offset - writeSize;
 
-        // Post-buffer data
-        memcpy(pPageBuffer + offset + writeSize, (void *) (pageAddress + offset + writeSize), padding);
+            // Pre-buffer data (mask with 0xFF)
+            memcpy(pPageBuffer, (void *) pageAddress, offset);
 
-        // Write page
-        // Writing 8-bit and 16-bit data is not allowed
-        // and may lead to unpredictable data corruption
-#ifdef EFC_EVEN_ODD_PROG
-        // Write even words first with auto erase
-        pAlignedDestination = (unsigned int*)pageAddress;
-        pAlignedSource = (unsigned int*)pPageBuffer;
-        sizeTmp = AT91C_IFLASH_PAGE_SIZE;
-        while (sizeTmp >= 4) {
-
-            *pAlignedDestination = *pAlignedSource;
-            pAlignedDestination += 2;
-            pAlignedSource += 2;
-            sizeTmp -= 8;
+            // Buffer data
+            memcpy(pPageBuffer + offset, pBuffer, writeSize);
+
+            // Post-buffer data
+            memcpy(pPageBuffer + offset + writeSize, (void *) (pageAddress + offset + writeSize), padding);
+
+            error = WritePage(pEfc, page, (const unsigned int *) pPageBuffer);
         }
-        // Send writing command
-        error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
         if (error) {
 
             return error;
         }
 
-        // Then write odd words without auto erase
-        EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC0, 0);
-#ifdef AT91C_BASE_EFC1
-        EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC1, 0);
-#endif
-        pAlignedDestination = (unsigned int*)pageAddress + 1;
-        pAlignedSource = (unsigned int*)pPageBuffer + 1;
-        sizeTmp = AT91C_IFLASH_PAGE_SIZE;
-        while (sizeTmp >= 4) {
-
-            *pAlignedDestination = *pAlignedSource;
-            pAlignedDestination += 2;
-            pAlignedSource += 2;
-            sizeTmp -= 8;
-        }
+        // Progression
+        address += AT91C_IFLASH_PAGE_SIZE;
+        pBuffer = (void *) ((unsigned int) pBuffer + writeSize);
+        size -= writeSize;
+        page++;
+        offset = 0;
 
-        // Send writing command
-        error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
-        if (error) {
+#if defined(AT91C_BASE_EFC1)
+        // Handle EFC crossover
+        if ((pEfc == AT91C_BASE_EFC0) && (page >= (AT91C_IFLASH_NB_OF_PAGES / 2))) {
 
-            return error;
+            pEfc = AT91C_BASE_EFC1;
+            page = 0;
         }
-
-        EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC0, 1);
-#ifdef AT91C_BASE_EFC1
-        EFC_SetEraseBeforeProgramming(AT91C_BASE_EFC1, 1);
 #endif
+    }
 
-#else
-        pAlignedDestination = (unsigned int*)pageAddress;
-        pAlignedSource = (unsigned int*)pPageBuffer;
-        sizeTmp = AT91C_IFLASH_PAGE_SIZE;
-        while (sizeTmp >= 4) {
+    return 0;
+}
 
-            *pAlignedDestination++ = *pAlignedSource++;
-            sizeTmp -= 4;
-        }
+//------------------------------------------------------------------------------
+/// Writes a run of whole pages in the internal flash, straight from the given
+/// buffer. Each page is copied in the page latch and programmed in turn; the
+/// function returns when the last one is programmed, or on the first error.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param address  Address of the first page, aligned on a page.
+/// \param pBuffer  Word-aligned data of the pages.
+/// \param numPages  Number of pages to write.
+//------------------------------------------------------------------------------
+unsigned char FLASHD_WritePages(
+    unsigned int address,
+    const void *pBuffer,
+    unsigned int numPages)
+{
+    AT91S_EFC *pEfc;
+    unsigned short page;
+    unsigned short offset;
+    const unsigned int *pSource = (const unsigned int *) pBuffer;
+    unsigned char error;
 
-        // Send writing command
-        error = EFC_PerformCommand(pEfc, AT91C_MC_FCMD_START_PROG, page);
+    SANITY_CHECK(address >= AT91C_IFLASH);
+    SANITY_CHECK(pBuffer);
+    SANITY_CHECK(((unsigned int) pBuffer & 3) == 0);
+    SANITY_CHECK((address + numPages * AT91C_IFLASH_PAGE_SIZE)
+                 <= (AT91C_IFLASH + AT91C_IFLASH_SIZE));
+
+    EFC_TranslateAddress(address, &pEfc, &page, &offset);
+    SANITY_CHECK(offset == 0);
+
+    while (numPages > 0) {
+
+        error = WritePage(pEfc, page, pSource);
         if (error) {
 
             return error;
         }
-#endif
-        // Progression
-        address += AT91C_IFLASH_PAGE_SIZE;
-        pBuffer = (void *) ((unsigned int) pBuffer + writeSize);
-        size -= writeSize;
+
+        pSource += AT91C_IFLASH_PAGE_SIZE / 4;
+        numPages--;
         page++;
-        offset = 0;
 
 #if defined(AT91C_BASE_EFC1)
         // Handle EFC crossover
@@ -592,5 +714,264 @@ unsigned char FLASHD_SetSecurityBit(void)
 }
 
 #endif //#if (!defined EFC_NO_SECURITY_BIT)
+
+//------------------------------------------------------------------------------
+//         Asynchronous commands
+//------------------------------------------------------------------------------
+
+/// Queue of the asynchronous commands, the first one is in progress.
+static FlashdCommand * volatile pFirstCommand = 0;
+/// Last command of the queue.
+static FlashdCommand *pLastCommand = 0;
+/// Set while the EFC carries out a step of the first command.
+static volatile unsigned char stepBusy = 0;
+/// EFC of the current step.
+static AT91S_EFC *pStepEfc;
+/// Address of the page or lock region of the current step.
+static unsigned int stepAddress;
+/// Number of pages or lock regions left, the current one included.
+static unsigned int stepCount;
+/// Data of the page written by the current step.
+static const unsigned int *pStepSource;
+#ifdef EFC_EVEN_ODD_PROG
+/// 0 while the even words of the page are programmed, 1 for the odd words.
+static unsigned char stepPhase;
+#endif
+
+//------------------------------------------------------------------------------
+/// Starts the current step of the first command: copies the page in the page
+/// latch if needed, starts the EFC command and enables the FRDY interrupt.
+//------------------------------------------------------------------------------
+static void StartStep(void)
+{
+    unsigned short page;
+    unsigned int sizeTmp;
+    unsigned int *pAlignedDestination;
+    const unsigned int *pAlignedSource;
+    unsigned char command;
+
+    EFC_TranslateAddress(stepAddress, &pStepEfc, &page, 0);
+
+    switch (pFirstCommand->command) {
+
+        case FLASHD_CMD_WRITE:
+            // Writing 8-bit and 16-bit data is not allowed
+            // and may lead to unpredictable data corruption
+#ifdef EFC_EVEN_ODD_PROG
+            // Even words first, with auto erase if needed, then odd words
+            if ((stepPhase != 0) || !NeedsErase(stepAddress, pStepSource)) {
+
+                EFC_SetEraseBeforeProgramming(pStepEfc, 0);
+            }
+            pAlignedDestination = (unsigned int *) stepAddress + stepPhase;
+            pAlignedSource = pStepSource + stepPhase;
+            sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+            while (sizeTmp >= 4) {
+
+                *pAlignedDestination = *pAlignedSource;
+                pAlignedDestination += 2;
+                pAlignedSource += 2;
+                sizeTmp -= 8;
+            }
+#else
+            if (!NeedsErase(stepAddress, pStepSource)) {
+
+                EFC_SetEraseBeforeProgramming(pStepEfc, 0);
+            }
+            pAlignedDestination = (unsigned int *) stepAddress;
+            pAlignedSource = pStepSource;
+            sizeTmp = AT91C_IFLASH_PAGE_SIZE;
+            while (sizeTmp >= 4) {
+
+                *pAlignedDestination++ = *pAlignedSource++;
+                sizeTmp -= 4;
+            }
+#endif
+            command = AT91C_MC_FCMD_START_PROG;
+            break;
+
+        case FLASHD_CMD_LOCK:
+            command = AT91C_MC_FCMD_LOCK;
+            break;
+
+        default:
+            command = AT91C_MC_FCMD_UNLOCK;
+    }
+
+    stepBusy = 1;
+    EFC_StartCommand(pStepEfc, command, page);
+    pStepEfc->EFC_FMR |= AT91C_MC_FRDY;
+}
+
+//------------------------------------------------------------------------------
+/// Starts the first command of the queue which has something to do. The
+/// commands with nothing to do end at once.
+//------------------------------------------------------------------------------
+static void StartNextCommand(void)
+{
+    FlashdCommand *pCommand;
+    unsigned int actualStart, actualEnd;
+
+    while ((pCommand = pFirstCommand) != 0) {
+
+        if (pCommand->command == FLASHD_CMD_WRITE) {
+
+            stepAddress = pCommand->address;
+            stepCount = pCommand->numPages;
+            pStepSource = (const unsigned int *) pCommand->pBuffer;
+#ifdef EFC_EVEN_ODD_PROG
+            stepPhase = 0;
+#endif
+        }
+        else {
+
+            ComputeLockRange(pCommand->address, pCommand->end, &actualStart, &actualEnd);
+            stepAddress = actualStart;
+            stepCount = (actualEnd - actualStart) / AT91C_IFLASH_LOCK_REGION_SIZE;
+        }
+
+        if (stepCount > 0) {
+
+            StartStep();
+            return;
+        }
+
+        // Nothing to do
+        pFirstCommand = pCommand->pNext;
+        pCommand->status = 0;
+        if (pCommand->callback) {
+
+            pCommand->callback(pCommand->pArgument, 0);
+        }
+    }
+    pLastCommand = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Queues an asynchronous command and starts it if the driver is idle. The
+/// command status is FLASHD_STATUS_PENDING until it ends; its callback is then
+/// invoked by FLASHD_Handler. FLASHD_Write and the other synchronous functions
+/// must not be used while commands are queued.
+/// \param pCommand  Command to queue.
+//------------------------------------------------------------------------------
+void FLASHD_Submit(FlashdCommand *pCommand)
+{
+    unsigned int aicImr;
+
+    SANITY_CHECK(pCommand);
+    SANITY_CHECK(pCommand->address >= AT91C_IFLASH);
+    SANITY_CHECK((pCommand->command != FLASHD_CMD_WRITE)
+                 || ((((unsigned int) pCommand->pBuffer & 3) == 0)
+                     && ((pCommand->address % AT91C_IFLASH_PAGE_SIZE) == 0)
+                     && ((pCommand->address + pCommand->numPages * AT91C_IFLASH_PAGE_SIZE)
+                         <= (AT91C_IFLASH + AT91C_IFLASH_SIZE))));
+
+    pCommand->status = FLASHD_STATUS_PENDING;
+    pCommand->pNext = 0;
+
+    // Mask the system interrupt while the queue is updated
+    aicImr = AT91C_BASE_AIC->AIC_IMR & (1 << AT91C_ID_SYS);
+    AT91C_BASE_AIC->AIC_IDCR = aicImr;
+
+    if (pFirstCommand == 0) {
+
+        pFirstCommand = pCommand;
+    }
+    else {
+
+        pLastCommand->pNext = pCommand;
+    }
+    pLastCommand = pCommand;
+
+    if (!stepBusy) {
+
+        StartNextCommand();
+    }
+
+    AT91C_BASE_AIC->AIC_IECR = aicImr;
+}
+
+//------------------------------------------------------------------------------
+/// Handles the end of a step of the asynchronous commands: starts the next
+/// step, or ends the command and invokes its callback. Must be called from the
+/// system interrupt handler; it returns at once if the EFC is not ready.
+//------------------------------------------------------------------------------
+void FLASHD_Handler(void)
+{
+    FlashdCommand *pCommand = pFirstCommand;
+    unsigned int status;
+    unsigned char error;
+
+    if (!stepBusy) {
+
+        return;
+    }
+    status = pStepEfc->EFC_FSR;
+    if ((status & AT91C_MC_FRDY) == 0) {
+
+        return;
+    }
+
+    // The flash is ready from here
+    stepBusy = 0;
+    EFC_DisableIt(pStepEfc, AT91C_MC_FRDY);
+    error = status & (AT91C_MC_LOCKE | AT91C_MC_PROGE);
+
+    if (pCommand->command == FLASHD_CMD_WRITE) {
+
+#ifdef EFC_EVEN_ODD_PROG
+        if (!error && (stepPhase == 0)) {
+
+            stepPhase = 1;
+            StartStep();
+            return;
+        }
+        stepPhase = 0;
+#endif
+        EFC_SetEraseBeforeProgramming(pStepEfc, 1);
+        stepAddress += AT91C_IFLASH_PAGE_SIZE;
+        pStepSource += AT91C_IFLASH_PAGE_SIZE / 4;
+    }
+    else {
+
+        stepAddress += AT91C_IFLASH_LOCK_REGION_SIZE;
+    }
+    stepCount--;
+
+    if (!error && (stepCount > 0)) {
+
+        StartStep();
+        return;
+    }
+
+    // End of the command, the callback may queue new ones
+    if (error) {
+
+        TRACE_WARNING("FLASHD_Handler: Command failed (0x%02X)\n\r", error);
+    }
+    pFirstCommand = pCommand->pNext;
+    if (pFirstCommand == 0) {
+
+        pLastCommand = 0;
+    }
+    pCommand->status = error;
+    if (pCommand->callback) {
+
+        pCommand->callback(pCommand->pArgument, error);
+    }
+    if (!stepBusy) {
+
+        StartNextCommand();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if asynchronous commands are queued; otherwise returns 0.
+//------------------------------------------------------------------------------
+unsigned char FLASHD_IsBusy(void)
+{
+    return (pFirstCommand != 0);
+}
+
 #endif //#ifdef BOARD_FLASH_EFC
 
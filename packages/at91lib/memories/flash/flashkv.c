@@ -0,0 +1,578 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "flashkv.h"
+#include "flashd.h"
+#include <utility/crc16.h>
+#include <utility/math.h>
+#include <utility/assert.h>
+#include <utility/trace.h>
+
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Marks the pages of the store.
+#define FLASHKV_MAGIC       0x564B4C46
+
+/// Size of a record holding a value of the given length, in bytes.
+#define RECORD_SIZE(length) \
+    (FLASHKV_RECORD_HEADER_SIZE + (((length) + 3) & ~3))
+
+//------------------------------------------------------------------------------
+/// Header at the start of each page of the store.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// FLASHKV_MAGIC.
+    unsigned int magic;
+    /// Incremented each time a page becomes the head page.
+    unsigned int sequence;
+    /// Complement of the sequence number.
+    unsigned int sequenceCheck;
+
+} PageHeader;
+
+//------------------------------------------------------------------------------
+/// Header of a record, followed by the value padded to a word.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Key of the record, 0xFFFF after the last record of a page.
+    unsigned short key;
+    /// Length of the value in bytes, 0 for a deleted key.
+    unsigned short length;
+    /// Complement of the length.
+    unsigned short lengthCheck;
+    /// CRC16 of the key, the length and the value.
+    unsigned short crc;
+
+} RecordHeader;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Record being written, or erased page.
+static unsigned int pBuffer[AT91C_IFLASH_PAGE_SIZE / 4];
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the address of a page of the store.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param page  Page index in the store.
+//------------------------------------------------------------------------------
+static unsigned int PageAddress(const FlashKv *pKv, unsigned short page)
+{
+    return pKv->start + page * AT91C_IFLASH_PAGE_SIZE;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if the given flash area is erased; otherwise returns 0.
+/// \param address  Word-aligned address of the area.
+/// \param size  Size of the area in bytes, a multiple of 4.
+//------------------------------------------------------------------------------
+static unsigned char IsBlank(unsigned int address, unsigned int size)
+{
+    const unsigned int *pWord = (const unsigned int *) address;
+
+    while (size > 0) {
+
+        if (*pWord++ != 0xFFFFFFFF) {
+
+            return 0;
+        }
+        size -= 4;
+    }
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if the page at the given address holds a valid header; otherwise
+/// returns 0.
+/// \param address  Page address.
+//------------------------------------------------------------------------------
+static unsigned char IsUsed(unsigned int address)
+{
+    const PageHeader *pHeader = (const PageHeader *) address;
+
+    return ((pHeader->magic == FLASHKV_MAGIC)
+            && (pHeader->sequence == ~pHeader->sequenceCheck));
+}
+
+//------------------------------------------------------------------------------
+/// Erases a page of the flash.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param address  Page address.
+//------------------------------------------------------------------------------
+static unsigned char ErasePage(unsigned int address)
+{
+    memset(pBuffer, 0xFF, AT91C_IFLASH_PAGE_SIZE);
+    if (FLASHD_Write(address, pBuffer, AT91C_IFLASH_PAGE_SIZE)) {
+
+        TRACE_WARNING("FLASHKV: Cannot erase page 0x%06X\n\r", address);
+        return FLASHKV_ERROR_FLASH;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Checks the record at the given address. Returns the size of the record, or
+/// 0 if there is no more record to read in the page: either the end of the
+/// records is reached, or the record header is corrupted.
+/// \param address  Record address.
+/// \param end  Address of the end of the page.
+/// \param pValid  Set to 1 if the CRC of the record is right, 0 otherwise.
+//------------------------------------------------------------------------------
+static unsigned int CheckRecord(
+    unsigned int address,
+    unsigned int end,
+    unsigned char *pValid)
+{
+    const RecordHeader *pHeader = (const RecordHeader *) address;
+    unsigned int size;
+    unsigned short crc;
+
+    *pValid = 0;
+    if ((address + FLASHKV_RECORD_HEADER_SIZE) > end) {
+
+        return 0;
+    }
+    if ((pHeader->lengthCheck != (unsigned short) ~pHeader->length)
+        || (pHeader->length > FLASHKV_MAX_LENGTH)) {
+
+        return 0;
+    }
+    size = RECORD_SIZE(pHeader->length);
+    if ((address + size) > end) {
+
+        return 0;
+    }
+
+    crc = CRC16_Ccitt(0, (const unsigned char *) pHeader, 4);
+    crc = CRC16_Ccitt(crc,
+                      (const unsigned char *) (address + FLASHKV_RECORD_HEADER_SIZE),
+                      pHeader->length);
+    *pValid = (crc == pHeader->crc);
+
+    return size;
+}
+
+//------------------------------------------------------------------------------
+/// Adds the valid records of a page to the index. Returns the address after
+/// the last record, or the end of the page if the records are followed by
+/// corrupted data.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param page  Page index in the store.
+//------------------------------------------------------------------------------
+static unsigned int ScanPage(FlashKv *pKv, unsigned short page)
+{
+    unsigned int address = PageAddress(pKv, page) + FLASHKV_PAGE_HEADER_SIZE;
+    unsigned int end = PageAddress(pKv, page) + AT91C_IFLASH_PAGE_SIZE;
+    const RecordHeader *pHeader;
+    unsigned int size;
+    unsigned char valid;
+
+    while ((size = CheckRecord(address, end, &valid)) != 0) {
+
+        pHeader = (const RecordHeader *) address;
+        if (valid && (pHeader->key < pKv->numKeys)) {
+
+            pKv->pIndex[pHeader->key] = (pHeader->length != 0) ? address : 0;
+        }
+        else if (!valid) {
+
+            TRACE_DEBUG("FLASHKV: Bad record at 0x%06X\n\r", address);
+        }
+        address += size;
+    }
+
+    // Only an erased area can follow the records
+    if ((address < end)
+        && !IsBlank(address, min(FLASHKV_RECORD_HEADER_SIZE, end - address))) {
+
+        return end;
+    }
+
+    return address;
+}
+
+//------------------------------------------------------------------------------
+/// Makes the given page the head page: erases it if needed and writes its
+/// header with the next sequence number.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param page  Page index in the store.
+//------------------------------------------------------------------------------
+static unsigned char StartPage(FlashKv *pKv, unsigned short page)
+{
+    unsigned int address = PageAddress(pKv, page);
+    PageHeader header;
+
+    if (!IsBlank(address, AT91C_IFLASH_PAGE_SIZE)) {
+
+        if (ErasePage(address)) {
+
+            return FLASHKV_ERROR_FLASH;
+        }
+    }
+
+    header.magic = FLASHKV_MAGIC;
+    header.sequence = pKv->sequence + 1;
+    header.sequenceCheck = ~header.sequence;
+    if (FLASHD_Write(address, &header, sizeof(header))) {
+
+        return FLASHKV_ERROR_FLASH;
+    }
+
+    pKv->sequence++;
+    pKv->head = page;
+    pKv->next = address + FLASHKV_PAGE_HEADER_SIZE;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Garbage collection: copies the last record of each key held by the given
+/// page at the end of the head page, then erases the page.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param page  Page index in the store.
+//------------------------------------------------------------------------------
+static unsigned char Collect(FlashKv *pKv, unsigned short page)
+{
+    unsigned int address = PageAddress(pKv, page) + FLASHKV_PAGE_HEADER_SIZE;
+    unsigned int end = PageAddress(pKv, page) + AT91C_IFLASH_PAGE_SIZE;
+    unsigned int headEnd = PageAddress(pKv, pKv->head) + AT91C_IFLASH_PAGE_SIZE;
+    const RecordHeader *pHeader;
+    unsigned int size;
+    unsigned char valid;
+
+    TRACE_DEBUG("FLASHKV: Collect page %u\n\r", page);
+
+    while ((size = CheckRecord(address, end, &valid)) != 0) {
+
+        pHeader = (const RecordHeader *) address;
+        if (valid
+            && (pHeader->key < pKv->numKeys)
+            && (pKv->pIndex[pHeader->key] == address)) {
+
+            if ((pKv->next + size) > headEnd) {
+
+                TRACE_WARNING("FLASHKV: Store full\n\r");
+                return FLASHKV_ERROR_FULL;
+            }
+            if (FLASHD_Write(pKv->next, (const void *) address, size)) {
+
+                return FLASHKV_ERROR_FLASH;
+            }
+            pKv->pIndex[pHeader->key] = pKv->next;
+            pKv->next += size;
+        }
+        address += size;
+    }
+
+    return ErasePage(PageAddress(pKv, page));
+}
+
+//------------------------------------------------------------------------------
+/// Moves the head to the next page, which is erased, and collects the oldest
+/// page if no other page is erased, until a record of the given size fits in
+/// the head page.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param size  Size of the record to write.
+//------------------------------------------------------------------------------
+static unsigned char Advance(FlashKv *pKv, unsigned int size)
+{
+    unsigned short tries;
+    unsigned short page;
+    unsigned char error;
+
+    for (tries = 0; tries < pKv->numPages; tries++) {
+
+        error = StartPage(pKv, (pKv->head + 1) % pKv->numPages);
+        if (error) {
+
+            return error;
+        }
+
+        // Keep a spare page
+        page = (pKv->head + 1) % pKv->numPages;
+        if (IsUsed(PageAddress(pKv, page))) {
+
+            error = Collect(pKv, page);
+            if (error) {
+
+                return error;
+            }
+        }
+
+        if ((pKv->next + size) <= (PageAddress(pKv, pKv->head) + AT91C_IFLASH_PAGE_SIZE)) {
+
+            return 0;
+        }
+    }
+
+    TRACE_WARNING("FLASHKV: Store full\n\r");
+    return FLASHKV_ERROR_FULL;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes a key-value store on the given flash pages. The pages are
+/// formatted if they do not hold a store yet; otherwise the index is rebuilt
+/// from the records, and an interrupted garbage collection is undone.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param start  Address of the first page, aligned on a page.
+/// \param numPages  Number of pages, at least 2.
+/// \param pIndex  Index of the keys, numKeys entries.
+/// \param numKeys  Number of keys.
+//------------------------------------------------------------------------------
+unsigned char FLASHKV_Initialize(
+    FlashKv *pKv,
+    unsigned int start,
+    unsigned short numPages,
+    unsigned int *pIndex,
+    unsigned short numKeys)
+{
+    unsigned int address;
+    unsigned int sequence;
+    unsigned short page;
+    unsigned short i;
+    unsigned char found = 0;
+    unsigned char spare = 0;
+    unsigned int next;
+
+    SANITY_CHECK(pKv);
+    SANITY_CHECK(pIndex);
+    SANITY_CHECK(numPages >= 2);
+    SANITY_CHECK(numKeys < 0xFFFF);
+    SANITY_CHECK((start % AT91C_IFLASH_PAGE_SIZE) == 0);
+    SANITY_CHECK(start >= AT91C_IFLASH);
+    SANITY_CHECK((start + numPages * AT91C_IFLASH_PAGE_SIZE)
+                 <= (AT91C_IFLASH + AT91C_IFLASH_SIZE));
+
+    pKv->start = start;
+    pKv->numPages = numPages;
+    pKv->pIndex = pIndex;
+    pKv->numKeys = numKeys;
+    pKv->head = 0;
+    pKv->sequence = 0;
+    memset(pIndex, 0, numKeys * sizeof(unsigned int));
+
+    // Find the head page, erase the corrupted pages
+    for (page = 0; page < numPages; page++) {
+
+        address = PageAddress(pKv, page);
+        if (IsUsed(address)) {
+
+            sequence = ((const PageHeader *) address)->sequence;
+            if (!found || (sequence > pKv->sequence)) {
+
+                pKv->head = page;
+                pKv->sequence = sequence;
+            }
+            found = 1;
+        }
+        else {
+
+            if (!IsBlank(address, AT91C_IFLASH_PAGE_SIZE)) {
+
+                TRACE_INFO("FLASHKV: Erase corrupted page %u\n\r", page);
+                if (ErasePage(address)) {
+
+                    return FLASHKV_ERROR_FLASH;
+                }
+            }
+            spare = 1;
+        }
+    }
+
+    // Format
+    if (!found) {
+
+        TRACE_INFO("FLASHKV: Format\n\r");
+        return StartPage(pKv, 0);
+    }
+
+    // A reset occured before the oldest page was collected. The head page
+    // only holds copies of records of the oldest page: drop it and start again
+    if (!spare) {
+
+        TRACE_INFO("FLASHKV: Drop interrupted garbage collection\n\r");
+        if (ErasePage(PageAddress(pKv, pKv->head))) {
+
+            return FLASHKV_ERROR_FLASH;
+        }
+        return FLASHKV_Initialize(pKv, start, numPages, pIndex, numKeys);
+    }
+
+    // Index the records, from the oldest page to the head page
+    next = 0;
+    for (i = 1; i <= numPages; i++) {
+
+        page = (pKv->head + i) % numPages;
+        if (IsUsed(PageAddress(pKv, page))) {
+
+            next = ScanPage(pKv, page);
+        }
+    }
+    pKv->next = next;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the value of a key.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param key  Key to read.
+/// \param pData  Buffer receiving the value.
+/// \param pLength  Size of the buffer; set to the length of the value. At
+///                 most the size of the buffer is copied.
+//------------------------------------------------------------------------------
+unsigned char FLASHKV_Read(
+    FlashKv *pKv,
+    unsigned short key,
+    void *pData,
+    unsigned short *pLength)
+{
+    const RecordHeader *pHeader;
+
+    SANITY_CHECK(pKv);
+    SANITY_CHECK(pLength);
+    SANITY_CHECK(key < pKv->numKeys);
+
+    if (pKv->pIndex[key] == 0) {
+
+        return FLASHKV_ERROR_NOT_FOUND;
+    }
+
+    pHeader = (const RecordHeader *) pKv->pIndex[key];
+    memcpy(pData,
+           (const void *) (pKv->pIndex[key] + FLASHKV_RECORD_HEADER_SIZE),
+           min(*pLength, pHeader->length));
+    *pLength = pHeader->length;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Writes the value of a key, by appending a record to the store.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param key  Key to write.
+/// \param pData  Value.
+/// \param length  Length of the value in bytes, at most FLASHKV_MAX_LENGTH; 0
+///                deletes the key.
+//------------------------------------------------------------------------------
+unsigned char FLASHKV_Write(
+    FlashKv *pKv,
+    unsigned short key,
+    const void *pData,
+    unsigned short length)
+{
+    RecordHeader *pHeader = (RecordHeader *) pBuffer;
+    unsigned int size = RECORD_SIZE(length);
+    unsigned char error;
+
+    SANITY_CHECK(pKv);
+    SANITY_CHECK(key < pKv->numKeys);
+    SANITY_CHECK(length <= FLASHKV_MAX_LENGTH);
+    SANITY_CHECK((length == 0) || pData);
+
+    // Go on in the next page if the record does not fit in the head page or
+    // if its place is not erased
+    if (((pKv->next + size) > (PageAddress(pKv, pKv->head) + AT91C_IFLASH_PAGE_SIZE))
+        || !IsBlank(pKv->next, size)) {
+
+        error = Advance(pKv, size);
+        if (error) {
+
+            return error;
+        }
+    }
+
+    // Build the record
+    memset(pBuffer, 0xFF, size);
+    pHeader->key = key;
+    pHeader->length = length;
+    pHeader->lengthCheck = ~length;
+    memcpy((unsigned char *) pBuffer + FLASHKV_RECORD_HEADER_SIZE, pData, length);
+    pHeader->crc = CRC16_Ccitt(0, (const unsigned char *) pHeader, 4);
+    pHeader->crc = CRC16_Ccitt(pHeader->crc,
+                               (const unsigned char *) pBuffer + FLASHKV_RECORD_HEADER_SIZE,
+                               length);
+
+    // Program it after the last record, which only clears erased bits
+    if (FLASHD_Write(pKv->next, pBuffer, size)) {
+
+        return FLASHKV_ERROR_FLASH;
+    }
+    pKv->pIndex[key] = (length != 0) ? pKv->next : 0;
+    pKv->next += size;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Deletes the value of a key.
+/// Returns 0 if successful; otherwise returns an error code.
+/// \param pKv  Pointer to a FlashKv instance.
+/// \param key  Key to delete.
+//------------------------------------------------------------------------------
+unsigned char FLASHKV_Delete(FlashKv *pKv, unsigned short key)
+{
+    SANITY_CHECK(pKv);
+    SANITY_CHECK(key < pKv->numKeys);
+
+    if (pKv->pIndex[key] == 0) {
+
+        return 0;
+    }
+
+    return FLASHKV_Write(pKv, key, 0, 0);
+}
+
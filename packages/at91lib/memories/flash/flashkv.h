@@ -0,0 +1,146 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !Purpose
+///
+/// Wear-leveled key-value store in the internal flash, built on the FLASHD
+/// driver, to hold calibration data, counters and other small values which
+/// are updated often.
+///
+/// The store is a log over a ring of flash pages. Each update appends a
+/// record (key, length, CRC16 and value) after the last one of the head page;
+/// since appending only clears erased bits, the page is programmed without
+/// being erased. When the head page is full the log goes on in the next page,
+/// which is always erased: one page of the ring is kept as a spare. Once the
+/// spare is used, the still valid records of the oldest page are copied in
+/// the new head page and the oldest page is erased, becoming the new spare.
+/// All the pages are thus erased in turn.
+///
+/// A RAM index gives the address of the last record of each key, keys are
+/// numbers from 0 to the size of the index minus one.
+///
+/// A reset at any time leaves the store in a consistent state: records with a
+/// wrong CRC are ignored, pages with a corrupted header are erased, and the
+/// copies of a garbage collection interrupted before the oldest page is erased
+/// are dropped by FLASHKV_Initialize.
+///
+/// !Usage
+///
+/// -# Reserve a range of flash pages (at least two) and an index of
+///    unsigned int, one per key.
+/// -# Call FLASHKV_Initialize after FLASHD_Initialize; it formats the pages
+///    the first time and rebuilds the index otherwise.
+/// -# Read a value with FLASHKV_Read, update it with FLASHKV_Write and remove
+///    it with FLASHKV_Delete.
+//------------------------------------------------------------------------------
+
+#ifndef FLASHKV_H
+#define FLASHKV_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// The key has no value.
+#define FLASHKV_ERROR_NOT_FOUND     1
+/// The valid records do not fit in the pages of the store.
+#define FLASHKV_ERROR_FULL          2
+/// The flash could not be programmed.
+#define FLASHKV_ERROR_FLASH         3
+
+/// Size of the header of each page, in bytes.
+#define FLASHKV_PAGE_HEADER_SIZE    12
+/// Size of the header of each record, in bytes.
+#define FLASHKV_RECORD_HEADER_SIZE  8
+/// Maximum length of a value, in bytes.
+#define FLASHKV_MAX_LENGTH \
+    (AT91C_IFLASH_PAGE_SIZE - FLASHKV_PAGE_HEADER_SIZE - FLASHKV_RECORD_HEADER_SIZE)
+
+//------------------------------------------------------------------------------
+//         Types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Key-value store instance.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Address of the first page of the store.
+    unsigned int start;
+    /// Number of pages of the store.
+    unsigned short numPages;
+    /// Number of keys.
+    unsigned short numKeys;
+    /// Address of the last record of each key, 0 if the key has no value.
+    unsigned int *pIndex;
+    /// Page in which the records are appended.
+    unsigned short head;
+    /// Sequence number of the head page.
+    unsigned int sequence;
+    /// Address of the next record in the head page.
+    unsigned int next;
+
+} FlashKv;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern unsigned char FLASHKV_Initialize(
+    FlashKv *pKv,
+    unsigned int start,
+    unsigned short numPages,
+    unsigned int *pIndex,
+    unsigned short numKeys);
+
+extern unsigned char FLASHKV_Read(
+    FlashKv *pKv,
+    unsigned short key,
+    void *pData,
+    unsigned short *pLength);
+
+extern unsigned char FLASHKV_Write(
+    FlashKv *pKv,
+    unsigned short key,
+    const void *pData,
+    unsigned short length);
+
+extern unsigned char FLASHKV_Delete(FlashKv *pKv, unsigned short key);
+
+#endif //#ifndef FLASHKV_H
+
@@ -0,0 +1,380 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sdcache.h"
+#include <utility/assert.h>
+#include <utility/trace.h>
+
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Local constants
+//------------------------------------------------------------------------------
+
+/// No multiple blocks write open (SdCache nextWrite).
+#define SDCACHE_NO_WRITE    0xffffffff
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pointer to the sector data of a line.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param pLine  Pointer to the line.
+//------------------------------------------------------------------------------
+static unsigned char * LineData(SdCache *pCache, SdCacheLine *pLine)
+{
+    return pCache->pBuffer + (pLine - pCache->pLines) * SD_BLOCK_SIZE;
+}
+
+//------------------------------------------------------------------------------
+/// Looks for the line holding a sector.
+/// Returns a pointer to the line, or 0 if the sector is not cached.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param block  Sector address.
+//------------------------------------------------------------------------------
+static SdCacheLine * Find(SdCache *pCache, unsigned int block)
+{
+    SdCacheLine *pLine = pCache->pLines
+                         + (block % pCache->numSets) * pCache->ways;
+    unsigned int i;
+
+    for (i = 0; i < pCache->ways; i++) {
+
+        if (pLine[i].valid && (pLine[i].block == block)) {
+
+            return &pLine[i];
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Writes back a dirty line, followed by the dirty lines holding the next
+/// sectors. When the previous write back ended just before the line, the
+/// multiple blocks write still open is continued.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param pLine  Pointer to the first line to write back.
+//------------------------------------------------------------------------------
+static unsigned char WriteRun(SdCache *pCache, SdCacheLine *pLine)
+{
+    unsigned int block;
+    unsigned char error;
+
+    while (pLine && pLine->dirty) {
+
+        block = pLine->block;
+        if (block != pCache->nextWrite) {
+
+            pCache->bursts++;
+        }
+
+        error = SD_WriteBlock(pCache->pSd, block, 1, LineData(pCache, pLine));
+        if (error) {
+
+            TRACE_WARNING("SDCACHE: Write back of %u failed\n\r", block);
+            pCache->nextWrite = SDCACHE_NO_WRITE;
+            return error;
+        }
+        pLine->dirty = 0;
+        pCache->writes++;
+        pCache->nextWrite = block + 1;
+
+        pLine = Find(pCache, block + 1);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Allocates a line for a sector, replacing a free line or the least recently
+/// used one of its set. A dirty line is written back first.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param block  Sector address.
+/// \param ppLine  Receives a pointer to the allocated line.
+//------------------------------------------------------------------------------
+static unsigned char Allocate(SdCache *pCache,
+                              unsigned int block,
+                              SdCacheLine **ppLine)
+{
+    SdCacheLine *pLine = pCache->pLines
+                         + (block % pCache->numSets) * pCache->ways;
+    SdCacheLine *pVictim = pLine;
+    unsigned int i;
+    unsigned char error;
+
+    for (i = 0; i < pCache->ways; i++) {
+
+        if (!pLine[i].valid) {
+
+            pVictim = &pLine[i];
+            break;
+        }
+        if ((pCache->clock - pLine[i].lastUse)
+            > (pCache->clock - pVictim->lastUse)) {
+
+            pVictim = &pLine[i];
+        }
+    }
+
+    if (pVictim->dirty) {
+
+        error = WriteRun(pCache, pVictim);
+        if (error) {
+
+            return error;
+        }
+    }
+
+    pVictim->block = block;
+    pVictim->valid = 1;
+    pVictim->dirty = 0;
+    *ppLine = pVictim;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes a sector cache for a card initialized by SD_Init. The lines
+/// are grouped in sets of "ways" lines; numLines shall be a multiple of ways.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param pSd  Pointer to the SD card driver instance.
+/// \param pLines  Array of numLines line descriptors.
+/// \param pBuffer  Buffer of numLines * SD_BLOCK_SIZE bytes.
+/// \param numLines  Number of lines.
+/// \param ways  Number of lines per set (numLines for a fully associative
+///              cache, 1 for a direct mapped one).
+//------------------------------------------------------------------------------
+void SDCACHE_Initialize(SdCache *pCache,
+                        SdCard *pSd,
+                        SdCacheLine *pLines,
+                        unsigned char *pBuffer,
+                        unsigned int numLines,
+                        unsigned int ways)
+{
+    SANITY_CHECK(pCache);
+    SANITY_CHECK(pSd);
+    SANITY_CHECK(pLines);
+    SANITY_CHECK(pBuffer);
+    SANITY_CHECK(numLines);
+
+    if ((ways == 0) || (ways > numLines)) {
+
+        ways = numLines;
+    }
+
+    pCache->pSd = pSd;
+    pCache->pLines = pLines;
+    pCache->pBuffer = pBuffer;
+    pCache->ways = ways;
+    pCache->numSets = numLines / ways;
+    pCache->clock = 0;
+    pCache->nextWrite = SDCACHE_NO_WRITE;
+    pCache->hits = 0;
+    pCache->misses = 0;
+    pCache->writes = 0;
+    pCache->bursts = 0;
+    memset(pLines, 0, numLines * sizeof(SdCacheLine));
+
+    TRACE_DEBUG("SDCACHE: %u sets of %u lines\n\r", pCache->numSets, ways);
+}
+
+//------------------------------------------------------------------------------
+/// Reads sectors through the cache. The sectors missing in the cache are read
+/// from the card and cached.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param address  Address of the first sector.
+/// \param nbBlocks  Number of sectors to read.
+/// \param pData  Buffer of nbBlocks * SD_BLOCK_SIZE bytes.
+//------------------------------------------------------------------------------
+unsigned char SDCACHE_Read(SdCache *pCache,
+                           unsigned int address,
+                           unsigned short nbBlocks,
+                           unsigned char *pData)
+{
+    SdCacheLine *pLine;
+    unsigned char error;
+
+    SANITY_CHECK(pCache);
+    SANITY_CHECK(pData);
+
+    while (nbBlocks > 0) {
+
+        pLine = Find(pCache, address);
+        if (pLine) {
+
+            pCache->hits++;
+        }
+        else {
+
+            error = Allocate(pCache, address, &pLine);
+            if (error) {
+
+                return error;
+            }
+
+            // Consecutive misses continue the same multiple blocks read
+            pCache->nextWrite = SDCACHE_NO_WRITE;
+            error = SD_ReadBlock(pCache->pSd, address, 1,
+                                 LineData(pCache, pLine));
+            if (error) {
+
+                pLine->valid = 0;
+                return error;
+            }
+            pCache->misses++;
+        }
+
+        pLine->lastUse = pCache->clock++;
+        memcpy(pData, LineData(pCache, pLine), SD_BLOCK_SIZE);
+        pData += SD_BLOCK_SIZE;
+        address++;
+        nbBlocks--;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Writes sectors in the cache. They are written back to the card when their
+/// line is replaced, or by SDCACHE_Flush.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pCache  Pointer to a SdCache instance.
+/// \param address  Address of the first sector.
+/// \param nbBlocks  Number of sectors to write.
+/// \param pData  Buffer of nbBlocks * SD_BLOCK_SIZE bytes.
+//------------------------------------------------------------------------------
+unsigned char SDCACHE_Write(SdCache *pCache,
+                            unsigned int address,
+                            unsigned short nbBlocks,
+                            const unsigned char *pData)
+{
+    SdCacheLine *pLine;
+    unsigned char error;
+
+    SANITY_CHECK(pCache);
+    SANITY_CHECK(pData);
+
+    while (nbBlocks > 0) {
+
+        // Whole sectors are written, they need not be read first
+        pLine = Find(pCache, address);
+        if (!pLine) {
+
+            error = Allocate(pCache, address, &pLine);
+            if (error) {
+
+                return error;
+            }
+        }
+
+        pLine->lastUse = pCache->clock++;
+        pLine->dirty = 1;
+        memcpy(LineData(pCache, pLine), pData, SD_BLOCK_SIZE);
+        pData += SD_BLOCK_SIZE;
+        address++;
+        nbBlocks--;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Writes back all the dirty sectors, in ascending order so that consecutive
+/// sectors are written by a single multiple blocks write, then ends the
+/// transfer so that the card programs them.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pCache  Pointer to a SdCache instance.
+//------------------------------------------------------------------------------
+unsigned char SDCACHE_Flush(SdCache *pCache)
+{
+    SdCacheLine *pFirst;
+    unsigned int numLines = pCache->numSets * pCache->ways;
+    unsigned int i;
+    unsigned char error;
+
+    SANITY_CHECK(pCache);
+
+    do {
+
+        pFirst = 0;
+        for (i = 0; i < numLines; i++) {
+
+            if (pCache->pLines[i].dirty
+                && (!pFirst || (pCache->pLines[i].block < pFirst->block))) {
+
+                pFirst = &(pCache->pLines[i]);
+            }
+        }
+
+        if (pFirst) {
+
+            error = WriteRun(pCache, pFirst);
+            if (error) {
+
+                return error;
+            }
+        }
+    }
+    while (pFirst);
+
+    pCache->nextWrite = SDCACHE_NO_WRITE;
+    return SD_StopTransfer(pCache->pSd);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the percentage of the sectors read which were found in the cache.
+/// \param pCache  Pointer to a SdCache instance.
+//------------------------------------------------------------------------------
+unsigned int SDCACHE_HitRatio(SdCache *pCache)
+{
+    unsigned int hits = pCache->hits;
+    unsigned int total = hits + pCache->misses;
+
+    // Keep hits * 100 within 32 bits
+    while (total > 0x01000000) {
+
+        hits >>= 1;
+        total >>= 1;
+    }
+
+    return total ? ((hits * 100) / total) : 0;
+}
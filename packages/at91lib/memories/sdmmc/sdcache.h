@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \page "sdcache"
+///
+/// !Purpose
+///
+/// Write-back sector cache for the SD cards, above SD_ReadBlock and
+/// SD_WriteBlock.
+///
+/// The cache holds one sector per line. The lines are grouped in sets of
+/// "ways" lines, a sector can only be held by the lines of set
+/// (sector % number of sets), and the least recently used line of the set is
+/// replaced. Written sectors stay in the cache until their line is replaced
+/// or the cache is flushed; the dirty sectors are then written back in
+/// ascending order, so that consecutive sectors are written by the same
+/// multiple blocks write (CMD25) instead of one write each.
+///
+/// !Usage
+///
+/// -# Allocate a SdCache, an array of SdCacheLine and a buffer of
+///    SD_BLOCK_SIZE bytes per line; SDCACHE_LINES gives the number of lines
+///    fitting in a RAM budget.
+/// -# Call SDCACHE_Initialize once SD_Init succeeded.
+/// -# Use SDCACHE_Read and SDCACHE_Write instead of SD_ReadBlock and
+///    SD_WriteBlock; all the accesses to the card shall go through the cache.
+/// -# Call SDCACHE_Flush to write back the dirty sectors, e.g. before the
+///    card is removed or powered off.
+/// -# SDCACHE_HitRatio, and the bursts and writes fields of SdCache, report
+///    the efficiency of the cache.
+//------------------------------------------------------------------------------
+
+#ifndef SDCACHE_H
+#define SDCACHE_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sdmmc_spi.h"
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// Number of cache lines fitting in a RAM budget of the given number of bytes
+/// (line descriptors and sector buffers).
+#define SDCACHE_LINES(bytes)    ((bytes) / (SD_BLOCK_SIZE + sizeof(SdCacheLine)))
+
+//------------------------------------------------------------------------------
+//         Types
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Cache line descriptor.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Sector held by the line.
+    unsigned int block;
+    /// Value of the cache clock at the last access to the line.
+    unsigned int lastUse;
+    /// Set when the line holds a sector.
+    unsigned char valid;
+    /// Set when the sector must be written back.
+    unsigned char dirty;
+
+} SdCacheLine;
+
+//------------------------------------------------------------------------------
+/// Sector cache of a SD card.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Pointer to the cached card.
+    SdCard *pSd;
+    /// Line descriptors.
+    SdCacheLine *pLines;
+    /// Line data, SD_BLOCK_SIZE bytes per line.
+    unsigned char *pBuffer;
+    /// Number of sets.
+    unsigned int numSets;
+    /// Number of lines per set.
+    unsigned int ways;
+    /// Incremented on each access, used for LRU replacement.
+    unsigned int clock;
+    /// Sector following the last one written back, when the multiple blocks
+    /// write is still open.
+    unsigned int nextWrite;
+    /// Number of sectors read from the cache.
+    unsigned int hits;
+    /// Number of sectors read from the card.
+    unsigned int misses;
+    /// Number of sectors written back to the card.
+    unsigned int writes;
+    /// Number of multiple blocks writes started to write them back.
+    unsigned int bursts;
+
+} SdCache;
+
+//------------------------------------------------------------------------------
+//         Global functions
+//------------------------------------------------------------------------------
+
+extern void SDCACHE_Initialize(SdCache *pCache,
+                               SdCard *pSd,
+                               SdCacheLine *pLines,
+                               unsigned char *pBuffer,
+                               unsigned int numLines,
+                               unsigned int ways);
+
+extern unsigned char SDCACHE_Read(SdCache *pCache,
+                                  unsigned int address,
+                                  unsigned short nbBlocks,
+                                  unsigned char *pData);
+
+extern unsigned char SDCACHE_Write(SdCache *pCache,
+                                   unsigned int address,
+                                   unsigned short nbBlocks,
+                                   const unsigned char *pData);
+
+extern unsigned char SDCACHE_Flush(SdCache *pCache);
+
+extern unsigned int SDCACHE_HitRatio(SdCache *pCache);
+
+#endif //#ifndef SDCACHE_H
+
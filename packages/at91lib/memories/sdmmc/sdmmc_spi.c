@@ -48,18 +48,25 @@
 #define SD_STATE_DATA     1
 #define SD_STATE_RCV      2
 
-// Card type
-#define UNKNOWN_CARD      0
-#define CARD_SD           1
-#define CARD_SDHC         2
-#define CARD_MMC          3
-
 // Delay between sending MMC commands
 #define MMC_DELAY     0x4FF
 
 #define SD_ADDRESS(pSd, address) (((pSd)->cardType == CARD_SDHC) ? \
                                  (address):((address) << SD_BLOCK_SIZE_BIT))
 
+// CMD6 arguments: check or set the function of group 1 (access mode), the
+// other groups are left unchanged
+#define SD_SWITCH_CHECK         0x00FFFFF0
+#define SD_SWITCH_SET           0x80FFFFF0
+#define SD_SWITCH_HIGH_SPEED    1
+// Size of the CMD6 status data block
+#define SD_SWITCH_STATUS_SIZE   64
+
+// Clock of the cards in high speed mode
+#define SD_CLOCK_HIGH_SPEED     50000000
+// Clock used when TRAN_SPEED is invalid, the lowest default of SD and MMC
+#define SD_CLOCK_DEFAULT        20000000
+
 //-----------------------------------------------------------------------------
 /// MMC/SD in SPI mode reports R1 status always, and R2 for SEND_STATUS
 /// R1 is the low order byte; R2 is the next highest byte, when present.
@@ -196,11 +203,11 @@
 //* Class 5 commands: Erase commands
 //*----------------------------------------
 // Cmd32
-//#define AT91C_TAG_SECTOR_START_CMD    (32U)
+#define AT91C_TAG_SECTOR_START_CMD      (32U)
 // Cmd33
-//#define AT91C_TAG_SECTOR_END_CMD      (33U)
+#define AT91C_TAG_SECTOR_END_CMD        (33U)
 // Cmd38
-//#define AT91C_ERASE_CMD               (38U)
+#define AT91C_ERASE_CMD                 (38U)
 
 //*----------------------------------------
 //* Class 7 commands: Lock commands
@@ -222,7 +229,7 @@
 // ACMD22
 //#define AT91C_SDCARD_SEND_NUM_WR_BLOCKS_CMD     (22U)
 // ACMD23
-//#define AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD (23U)
+#define AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD   (23U)
 // ACMD41
 #define AT91C_SDCARD_APP_OP_COND_CMD              (41U)
 // ACMD42
@@ -230,6 +237,12 @@
 // ACMD51
 #define AT91C_SDCARD_SEND_SCR_CMD                 (51U)
 
+//*----------------------------------------
+//* Class 10 commands: Switch function
+//*----------------------------------------
+// Cmd6
+#define AT91C_SWITCH_FUNC_CMD           (6U)
+
 //------------------------------------------------------------------------------
 //         Local functions
 //------------------------------------------------------------------------------
@@ -247,8 +260,12 @@ static unsigned char SendCommand(SdCard *pSd)
     unsigned char error;
     unsigned int i;
 
-    // Send command
-    SDSPI_NCS((SdSpi *)pSdDriver);
+    // Send command. A continued transfer has no command: the card may already
+    // be sending the start token of the next block
+    if (pCommand->conTrans == SPI_NEW_TRANSFER) {
+
+        SDSPI_NCS((SdSpi *)pSdDriver);
+    }
 
     error = SDSPI_SendCommand((SdSpi *)pSdDriver, (SdSpiCmd *)pCommand);
     if (error) {
@@ -438,6 +455,113 @@ static unsigned char SD_SPI_R7(unsigned char *pResp, unsigned char *isSdhc)
     }
 }
 
+//------------------------------------------------------------------------------
+/// Sets the address of the first block to be erased.
+/// Returns the command transfer result (see SendCommand).
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param address  SD card address of the first block.
+//------------------------------------------------------------------------------
+static unsigned char Cmd32(SdCard *pSd, unsigned int address)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response;
+
+    TRACE_DEBUG("Cmd32()\n\r");
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_TAG_SECTOR_START_CMD;
+    pCommand->arg = address;
+    pCommand->resType = 1;
+    pCommand->pResp = &response;
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    error = SendCommand(pSd);
+    if (error) {
+        return error;
+    }
+    error = SD_SPI_R1((unsigned char *)&response);
+    return error;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the address of the last block of the continuous range to be erased.
+/// Returns the command transfer result (see SendCommand).
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param address  SD card address of the last block.
+//------------------------------------------------------------------------------
+static unsigned char Cmd33(SdCard *pSd, unsigned int address)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response;
+
+    TRACE_DEBUG("Cmd33()\n\r");
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_TAG_SECTOR_END_CMD;
+    pCommand->arg = address;
+    pCommand->resType = 1;
+    pCommand->pResp = &response;
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    error = SendCommand(pSd);
+    if (error) {
+        return error;
+    }
+    error = SD_SPI_R1((unsigned char *)&response);
+    return error;
+}
+
+//------------------------------------------------------------------------------
+/// Erases the blocks selected by Cmd32 and Cmd33, and waits for the end of
+/// the erase (R1b response).
+/// Returns the command transfer result (see SendCommand), or SD_ERROR_BUSY if
+/// the card is still busy after SD_ERASE_RETRY polls.
+/// \param pSd  Pointer to a SD card driver instance.
+//------------------------------------------------------------------------------
+static unsigned char Cmd38(SdCard *pSd)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response;
+    unsigned int retry = SD_ERASE_RETRY;
+
+    TRACE_DEBUG("Cmd38()\n\r");
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_ERASE_CMD;
+    pCommand->resType = 1;
+    pCommand->pResp = &response;
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    error = SendCommand(pSd);
+    if (error) {
+        return error;
+    }
+    error = SD_SPI_R1((unsigned char *)&response);
+    if (error) {
+        return error;
+    }
+
+    // The card holds DO low until the erase ends
+    while (SDSPI_WaitDataBusy((SdSpi *)pSd->pSdDriver) == 1) {
+
+        if (--retry == 0) {
+
+            TRACE_ERROR("Cmd38: Erase timeout\n\r");
+            return SD_ERROR_BUSY;
+        }
+    }
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 /// Initialization delay: The maximum of 1 msec, 74 clock cycles and supply ramp
 /// up time.
@@ -529,6 +653,43 @@ static unsigned char Cmd1(SdCard *pSd)
     return error;
 }
 
+//------------------------------------------------------------------------------
+/// Checks or switches a function of the card and reads the 512 bits switch
+/// status.
+/// Returns the command transfer result (see SendCommand).
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param arg  Mode and functions to check or switch.
+/// \param pStatus  Buffer of SD_SWITCH_STATUS_SIZE bytes for the status.
+//------------------------------------------------------------------------------
+static unsigned char Cmd6(SdCard *pSd, unsigned int arg, unsigned char *pStatus)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response = 0;
+
+    TRACE_DEBUG("Cmd6()\n\r");
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_SWITCH_FUNC_CMD;
+    pCommand->arg = arg;
+    pCommand->resType = 1;
+    pCommand->blockSize = SD_SWITCH_STATUS_SIZE;
+    pCommand->pData = pStatus;
+    pCommand->isRead = 1;
+    pCommand->pResp = &response;
+
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    error = SendCommand(pSd);
+    if (error) {
+        return error;
+    }
+    error = SD_SPI_R1((unsigned char *)&response);
+    return error;
+}
+
 //------------------------------------------------------------------------------
 /// Sends SD Memory Card interface
 /// condition, which includes host supply
@@ -878,6 +1039,44 @@ static unsigned char Cmd59(SdCard *pSd, unsigned char option)
     return error;
 }
 
+//------------------------------------------------------------------------------
+/// Sets the number of blocks to be pre-erased before the next multiple blocks
+/// write. The blocks are erased while the first ones are received, the write
+/// does not wait for the card to erase them one by one.
+/// Returns the command transfer result (see SendCommand).
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param nbBlocks  Number of blocks written by the next CMD25.
+//------------------------------------------------------------------------------
+static unsigned char Acmd23(SdCard *pSd, unsigned short nbBlocks)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char error;
+    unsigned int response;
+
+    error = Cmd55(pSd);
+    if (error) {
+        return error;
+    }
+
+    TRACE_DEBUG("Acmd23()\n\r");
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->cmd = AT91C_SDCARD_SET_WR_BLK_ERASE_COUNT_CMD;
+    pCommand->arg = nbBlocks;
+    pCommand->resType = 1;
+    pCommand->pResp = &response;
+    // Set SD command state
+    pSd->state = SD_STATE_STBY;
+
+    // Send command
+    error = SendCommand(pSd);
+    if (error) {
+        return error;
+    }
+    error = SD_SPI_R1((unsigned char *)&response);
+    return error;
+}
+
 //------------------------------------------------------------------------------
 /// Asks to all cards to send their operations conditions.
 /// Returns the command transfer result (see SendCommand).
@@ -933,6 +1132,111 @@ static unsigned char Acmd41(SdCard *pSd, unsigned char hcs, unsigned char *pCCS)
     return 0;
 }
 
+//------------------------------------------------------------------------------
+/// Decodes the maximum data transfer rate of the card (CSD TRAN_SPEED).
+/// Returns the maximum SPCK of the card in Hz.
+/// \param pSd  Pointer to a SD card driver instance.
+//------------------------------------------------------------------------------
+static unsigned int TranSpeed(SdCard *pSd)
+{
+    // Rate units from 100 kbit/s, divided by 10 as the time values are
+    // multiplied by 10
+    static const unsigned int units[4] = {10000, 100000, 1000000, 10000000};
+    static const unsigned char values[16] = {
+        0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+    };
+    unsigned int tranSpeed = SD_CSD_TRAN_SPEED(pSd);
+
+    if (((tranSpeed & 0x7) > 3) || (values[(tranSpeed >> 3) & 0xf] == 0)) {
+
+        TRACE_WARNING("Invalid TRAN_SPEED 0x%X\n\r", tranSpeed);
+        return SD_CLOCK_DEFAULT;
+    }
+
+    return units[tranSpeed & 0x7] * values[(tranSpeed >> 3) & 0xf];
+}
+
+//------------------------------------------------------------------------------
+/// Switches a SD card to high speed, when it supports the switch function
+/// (command class 10) and the high speed access mode.
+/// Returns 1 if the card is in high speed mode; otherwise returns 0.
+/// \param pSd  Pointer to a SD card driver instance.
+//------------------------------------------------------------------------------
+static unsigned char SwitchHighSpeed(SdCard *pSd)
+{
+    unsigned char status[SD_SWITCH_STATUS_SIZE];
+
+    if ((pSd->cardType == CARD_MMC) || ((SD_CSD_CCC(pSd) & (1 << 10)) == 0)) {
+
+        return 0;
+    }
+
+    // Support bits of group 1 are status bits 415:400
+    if (Cmd6(pSd, SD_SWITCH_CHECK | SD_SWITCH_HIGH_SPEED, status)
+        || ((status[13] & (1 << SD_SWITCH_HIGH_SPEED)) == 0)) {
+
+        TRACE_INFO("High speed not supported\n\r");
+        return 0;
+    }
+
+    // Function selected in group 1 is status bits 379:376
+    if (Cmd6(pSd, SD_SWITCH_SET | SD_SWITCH_HIGH_SPEED, status)
+        || ((status[16] & 0xf) != SD_SWITCH_HIGH_SPEED)) {
+
+        TRACE_WARNING("Switch to high speed failed\n\r");
+        return 0;
+    }
+
+    // The card switches within 8 clock cycles
+    SDSPI_Wait((SdSpi *)pSd->pSdDriver, 1);
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Sets SPCK to the fastest clock MCK allows which does not exceed the given
+/// one.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param clock  Maximum SPCK in Hz.
+//------------------------------------------------------------------------------
+static void SetClock(SdCard *pSd, unsigned int clock)
+{
+    pSd->spiClock = SDSPI_SetSpeed((SdSpi *)pSd->pSdDriver, clock);
+    pSd->clockErrors = 0;
+    TRACE_INFO("SD clock %u Hz\n\r", pSd->spiClock);
+}
+
+//------------------------------------------------------------------------------
+/// Counts the transfers failing in a row on a corrupted data block, and halves
+/// SPCK when SD_CLOCK_ERRORS of them have failed: CRC and data token errors may
+/// come from a clock too fast for the board. Other errors (no response,
+/// timeout, card status) do not depend on the clock and are not counted.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param error  Result of the transfer, 0 if it succeeded.
+//------------------------------------------------------------------------------
+static void UpdateClock(SdCard *pSd, unsigned char error)
+{
+    if (error == 0) {
+
+        pSd->clockErrors = 0;
+        return;
+    }
+    if (!((SdSpi *)pSd->pSdDriver)->dataError) {
+
+        return;
+    }
+
+    if (pSd->clockErrors < SD_CLOCK_ERRORS) {
+
+        pSd->clockErrors++;
+    }
+    if ((pSd->clockErrors == SD_CLOCK_ERRORS)
+        && ((pSd->spiClock / 2) >= SD_CLOCK_MIN)) {
+
+        TRACE_WARNING("SD: %u errors, lowering the clock\n\r",
+                      pSd->clockErrors);
+        SetClock(pSd, pSd->spiClock / 2);
+    }
+}
 
 //------------------------------------------------------------------------------
 /// Continue to transfer datablocks from card to host until interrupted by a
@@ -1011,24 +1315,10 @@ static unsigned char MoveToTransferState(SdCard *pSd,
 {
     unsigned int status;
     unsigned char error;
-    SdDriver *pSdDriver = pSd->pSdDriver;
 
-    if((pSd->state == SD_STATE_DATA)
-    || (pSd->state == SD_STATE_RCV)) {
-
-        // SD SPI mode uses stop transmission token to stop multiple block write.
-        if ((pSd->state == SD_STATE_RCV) ) { //&& (pSd->mode == SD_SPI_MODE)) {
-            SDSPI_StopTranToken((SdSpi *)pSdDriver);
-            pSd->state = SD_STATE_STBY;
-            while (SDSPI_WaitDataBusy((SdSpi *)pSdDriver) == 1);
-            while (SDSPI_WaitDataBusy((SdSpi *)pSdDriver) == 1);
-        }
-        else {
-            error = Cmd12(pSd);
-            if (error) {
-                return error;
-            }
-        }
+    error = SD_StopTransfer(pSd);
+    if (error) {
+        return error;
     }
     pSd->preBlock = address + (nbBlocks-1);
 
@@ -1066,6 +1356,15 @@ static unsigned char MoveToTransferState(SdCard *pSd,
         }
         while ((status & STATUS_READY_FOR_DATA) == 0);
 
+        // Pre-erase the blocks to write, MMC cards have no ACMD23
+        if (pSd->cardType != CARD_MMC) {
+            error = Acmd23(pSd, nbBlocks);
+            if (error) {
+                TRACE_DEBUG("error acmd 23\n\r");
+                return error;
+            }
+        }
+
         // Move to Sending data state
         error = Cmd25(pSd, nbBlocks, pData, SD_ADDRESS(pSd,address));
         if (error) {
@@ -1077,10 +1376,202 @@ static unsigned char MoveToTransferState(SdCard *pSd,
     return error;
 }
 
+//------------------------------------------------------------------------------
+/// Invoked by the SPI driver when a SD_Submit transfer ends. Forwards the
+/// result to the callback given to SD_Submit.
+/// \param status  0 if the transfer succeeded.
+/// \param pCommand  Pointer to the SdCmd instance of the card.
+//------------------------------------------------------------------------------
+static void SubmitCallback(unsigned char status, void *pCommand)
+{
+    SdCard *pSd = (SdCard *) ((SdCmd *) pCommand)->pArg;
+
+    // The open transfer cannot be continued, it is ended by the next access
+    if (status) {
+        TRACE_WARNING("SD_Submit: Transfer failed\n\r");
+        pSd->preBlock = 0xffffffff;
+    }
+    UpdateClock(pSd, status);
+
+    if (pSd->callback) {
+        pSd->callback(pSd->pArg, status);
+    }
+}
+
 //------------------------------------------------------------------------------
 //         Global functions
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+/// Starts reading or writing blocks of data without waiting for the end of the
+/// transfer. Like SD_ReadBlock and SD_WriteBlock, the transfer continues the
+/// multiple blocks transfer left open by the previous one when possible;
+/// otherwise it ends it and starts a new one (CMD18, or ACMD23 and CMD25 so
+/// that the card pre-erases the blocks written). The transfer is then driven
+/// by SDSPI_Handler, which invokes the callback when it ends; the callback may
+/// submit the next transfer. The data buffer must remain valid until then.
+/// Returns 0 if the transfer has been started; otherwise returns an SD_ERROR
+/// code.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param isRead  1 to read data, 0 to write it.
+/// \param address  Address of the first block.
+/// \param nbBlocks  Number of blocks to transfer.
+/// \param pData  Data buffer of nbBlocks * SD_BLOCK_SIZE bytes.
+/// \param callback  Optional callback invoked when the transfer ends.
+/// \param pArg  Optional argument of the callback.
+//------------------------------------------------------------------------------
+unsigned char SD_Submit(SdCard *pSd,
+                        unsigned char isRead,
+                        unsigned int address,
+                        unsigned short nbBlocks,
+                        unsigned char *pData,
+                        SdTransferCallback callback,
+                        void *pArg)
+{
+    SdCmd *pCommand = &(pSd->command);
+    unsigned char state = isRead ? SD_STATE_DATA : SD_STATE_RCV;
+    unsigned char prevState = pSd->state;
+    unsigned int prevBlock = pSd->preBlock;
+    unsigned char error;
+
+    SANITY_CHECK(pSd);
+    SANITY_CHECK(pData);
+    SANITY_CHECK(nbBlocks);
+
+    memset(pCommand, 0, sizeof(SdCmd));
+    // Fill command information
+    pCommand->blockSize = SD_BLOCK_SIZE;
+    pCommand->nbBlock = nbBlocks;
+    pCommand->pData = pData;
+    pCommand->isRead = isRead;
+    pCommand->callback = SubmitCallback;
+    pCommand->pArg = pSd;
+
+    if((pSd->state == state) && ((pSd->preBlock + 1) == address)) {
+
+        pCommand->conTrans = SPI_CONTINUE_TRANSFER;
+    }
+    else {
+
+        pCommand->cmd = isRead ? AT91C_READ_MULTIPLE_BLOCK_CMD
+                               : AT91C_WRITE_MULTIPLE_BLOCK_CMD;
+        pCommand->arg = SD_ADDRESS(pSd, address);
+        pCommand->conTrans = SPI_NEW_TRANSFER;
+        pCommand->resType = 1;
+
+        // Pre-erase the blocks to write, MMC cards have no ACMD23
+        if (!isRead && (pSd->cardType != CARD_MMC)) {
+            pCommand->preErase = nbBlocks;
+        }
+
+        // SD SPI mode uses stop transmission token to stop multiple block write.
+        if (pSd->state == SD_STATE_RCV) {
+            pCommand->stop = SDSPI_STOP_TOKEN;
+        }
+        else if (pSd->state == SD_STATE_DATA) {
+            pCommand->stop = SDSPI_STOP_CMD;
+        }
+    }
+
+    // Update the card state first, the transfer may end at any time
+    pSd->callback = callback;
+    pSd->pArg = pArg;
+    pSd->state = state;
+    pSd->preBlock = address + (nbBlocks-1);
+
+    error = SDSPI_Submit((SdSpi *)pSd->pSdDriver, (SdSpiCmd *)pCommand);
+    if (error) {
+        TRACE_ERROR("SD_Submit: Failed to start transfer (%d)\n\r", error);
+        pSd->state = prevState;
+        pSd->preBlock = prevBlock;
+        return SD_ERROR_DRIVER;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the multiple blocks read or write left open by the previous
+/// SD_ReadBlock or SD_WriteBlock call, and puts the card back in "stand-by
+/// state". Does nothing if no transfer is open.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pSd  Pointer to a SD card driver instance.
+//------------------------------------------------------------------------------
+unsigned char SD_StopTransfer(SdCard *pSd)
+{
+    SdDriver *pSdDriver = pSd->pSdDriver;
+
+    SANITY_CHECK(pSd);
+
+    // SD SPI mode uses stop transmission token to stop multiple block write.
+    if (pSd->state == SD_STATE_RCV) {
+
+        SDSPI_StopTranToken((SdSpi *)pSdDriver);
+        pSd->state = SD_STATE_STBY;
+        while (SDSPI_WaitDataBusy((SdSpi *)pSdDriver) == 1);
+        while (SDSPI_WaitDataBusy((SdSpi *)pSdDriver) == 1);
+    }
+    else if (pSd->state == SD_STATE_DATA) {
+
+        return Cmd12(pSd);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Erases a range of blocks (CMD32, CMD33 and CMD38) and waits for the end of
+/// the erase. The multiple blocks transfer left open is ended first. The erased
+/// blocks read as all 0 or all 1 depending on the card. When the card cannot
+/// erase single blocks (CSD ERASE_BLK_EN), it erases the whole sectors of the
+/// range: the caller shall only erase ranges aligned on erase sectors.
+/// Only SD cards are supported; MMC cards erase by groups with other commands.
+/// Returns 0 if successful; otherwise returns an SD_ERROR code.
+/// \param pSd  Pointer to a SD card driver instance.
+/// \param address  Address of the first block to erase.
+/// \param nbBlocks  Number of blocks to erase.
+//------------------------------------------------------------------------------
+unsigned char SD_Erase(SdCard *pSd,
+                       unsigned int address,
+                       unsigned int nbBlocks)
+{
+    unsigned char error;
+
+    SANITY_CHECK(pSd);
+
+    if (nbBlocks == 0) {
+        return 0;
+    }
+    if (pSd->cardType == CARD_MMC) {
+        TRACE_WARNING("SD_Erase: MMC card not supported\n\r");
+        return SD_ERROR_DRIVER;
+    }
+
+    error = SD_StopTransfer(pSd);
+    if (error) {
+        return error;
+    }
+
+    TRACE_DEBUG("SD_Erase(%u, %u)\n\r", address, nbBlocks);
+    error = Cmd32(pSd, SD_ADDRESS(pSd, address));
+    if (error) {
+        TRACE_ERROR("SD_Erase: Cmd32 failed (%d)\n\r", error);
+        return error;
+    }
+    error = Cmd33(pSd, SD_ADDRESS(pSd, address + nbBlocks - 1));
+    if (error) {
+        TRACE_ERROR("SD_Erase: Cmd33 failed (%d)\n\r", error);
+        return error;
+    }
+    error = Cmd38(pSd);
+    if (error) {
+        TRACE_ERROR("SD_Erase: Cmd38 failed (%d)\n\r", error);
+        return error;
+    }
+
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 /// Read Block of data in a buffer pointed by pData. The buffer size must be at
 /// least 512 byte long. This function checks the SD card status register and
@@ -1119,6 +1610,7 @@ unsigned char SD_ReadBlock(SdCard *pSd,
     else {
         error = MoveToTransferState(pSd, address, nbBlocks, pData, 1);
     }
+    UpdateClock(pSd, error);
     return error;
 }
 
@@ -1156,6 +1648,7 @@ unsigned char SD_WriteBlock(SdCard *pSd,
         error = MoveToTransferState(pSd, address, nbBlocks,
                                     (unsigned char *)pData, 0);
     }
+    UpdateClock(pSd, error);
     return error;
 }
 
@@ -1273,7 +1766,9 @@ unsigned char SD_SPI_Init(SdCard *pSd, SdDriver *pSpi)
         // The host issues CRC_ON_OFF (CMD59) to set data CRC on/off
         // The host can turn the CRC option on and off using the CRC_ON_OFF command (CMD59).
         // Host should enable CRC verification before issuing ACMD41.
-        error = Cmd59(pSd,0);  // turn crc option OFF
+        // The card checks the commands and data blocks it receives when
+        // the driver checks the blocks it reads (SDSPI_CRC_ON).
+        error = Cmd59(pSd, SDSPI_CRC_ON);
         if (error) {
 
             TRACE_ERROR("Error during initialization (%d)\n\r, 59", error);
@@ -1305,6 +1800,7 @@ unsigned char SD_SPI_Init(SdCard *pSd, SdDriver *pSpi)
 unsigned char SD_Init(SdCard *pSd, SdDriver *pSdDriver)
 {
     unsigned char error;
+    unsigned int clock;
 
     //TRACE_DEBUG("SD_Init()\n\r");
 
@@ -1314,6 +1810,10 @@ unsigned char SD_Init(SdCard *pSd, SdDriver *pSdDriver)
     pSd->preBlock = 0xffffffff;
     pSd->state = SD_STATE_STBY;
     pSd->cardType = UNKNOWN_CARD;
+    pSd->callback = 0;
+    pSd->pArg = 0;
+    pSd->spiClock = 0;
+    pSd->clockErrors = 0;
     memset(&(pSd->command), 0, sizeof(SdCmd));
 
     // Initialization delay: The maximum of 1 msec, 74 clock cycles and supply ramp up time
@@ -1369,9 +1869,17 @@ unsigned char SD_Init(SdCard *pSd, SdDriver *pSdDriver)
     if (pSd->cardType == UNKNOWN_CARD) {
         return SD_ERROR_NOT_INITIALIZED;
     }
-    else {
-        return 0;
+
+    // Raise SPCK to the fastest clock the card and MCK allow; high speed is
+    // only worth it if the SPI can go beyond the default speed of the card
+    clock = TranSpeed(pSd);
+    if ((clock < (BOARD_MCK / SDSPI_SCBR_MIN)) && SwitchHighSpeed(pSd)) {
+
+        clock = SD_CLOCK_HIGH_SPEED;
     }
+    SetClock(pSd, clock);
+
+    return 0;
 }
 
 //------------------------------------------------------------------------------
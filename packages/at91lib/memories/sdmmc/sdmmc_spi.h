@@ -42,6 +42,11 @@
 /// -# SD_Stop: Stop the SDcard by sending Cmd12
 /// -# SD_ReadBlock : Read blocks of data
 /// -# SD_WriteBlock : Write blocks of data
+/// -# SD_Submit : Start reading or writing blocks without waiting; the
+///    callback is invoked from SDSPI_Handler when the transfer ends
+/// -# SD_StopTransfer : End the multiple blocks transfer left open by
+///    SD_ReadBlock or SD_WriteBlock
+/// -# SD_Erase : Erase a range of blocks
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
@@ -88,8 +93,12 @@
 /// - Card Initialize
 ///       - At this stage, the initialization and identification process is over, the following steps are done
 ///          for the sdcard's succeeding operation.
-///       - Host sends Cmd59 to turn sdcard's CRC option off.
+///       - Host sends Cmd59 to turn sdcard's CRC option on (or off, see SDSPI_CRC_ON).
 ///       - Host sends Cmd9 to get the Card Specific Data (CSD).
+///       - If the SPI clock may exceed the CSD TRAN_SPEED, host sends Cmd6 to switch the sdcard
+///          to high speed when it supports it.
+///       - Host raises SPCK to the fastest clock the card and MCK allow (see SD_CLOCK). SPCK is
+///          halved each time SD_CLOCK_ERRORS transfers fail in a row on a CRC or data token error.
 ///
 ///     \note Send Cmd55 before send ACmd41. \endnote
 ///     \note sdcard include ver 1.x sdcard, ver2.0 standard capacity sdcard, ver2.0 high capacity sdcard \endnote
@@ -170,12 +179,32 @@
 #define SD_ERROR_NORESPONSE      2
 /// The SD card did not answer the command.
 #define SD_ERROR_NOT_INITIALIZED 3
+/// The SD card stayed busy longer than allowed.
+#define SD_ERROR_BUSY            4
+
+/// Card types (SdCard cardType).
+#define UNKNOWN_CARD      0
+#define CARD_SD           1
+#define CARD_SDHC         2
+#define CARD_MMC          3
 
 /// SD card block size in bytes.
 #define SD_BLOCK_SIZE           512
 /// SD card block size binary shift value
 #define SD_BLOCK_SIZE_BIT     9
 
+/// Number of transfers failing in a row on a CRC or data token error before
+/// SPCK is lowered.
+#define SD_CLOCK_ERRORS         3
+/// SPCK below which the clock is not lowered any more, in Hz.
+#define SD_CLOCK_MIN            400000
+
+/// Number of busy polls (one byte each) before an erase is considered failed,
+/// about 10s at 400kHz and more at higher clocks.
+#ifndef SD_ERASE_RETRY
+#define SD_ERASE_RETRY          0x80000
+#endif
+
 //------------------------------------------------------------------------------
 //         Macros
 //------------------------------------------------------------------------------
@@ -186,6 +215,7 @@
 #define SD_CSD_TAAC(pSd)               SD_CSD(pSd, 112, 8) ///< Data read-access-time-1
 #define SD_CSD_NSAC(pSd)               SD_CSD(pSd, 104, 8) ///< Data read access-time-2 in CLK cycles
 #define SD_CSD_TRAN_SPEED(pSd)         SD_CSD(pSd, 96,  8) ///< Max. data transfer rate
+#define SD_CSD_CCC(pSd)                SD_CSD(pSd, 84, 12) ///< Card command classes
 #define SD_CSD_READ_BL_LEN(pSd)        SD_CSD(pSd, 80,  4) ///< Max. read data block length
 #define SD_CSD_READ_BL_PARTIAL(pSd)    SD_CSD(pSd, 79,  1) ///< Bartial blocks for read allowed
 #define SD_CSD_WRITE_BLK_MISALIGN(pSd) SD_CSD(pSd, 78,  1) ///< Write block misalignment
@@ -223,6 +253,7 @@
 #define SD_CSD_TOTAL_SIZE_HC(pSd)      ((SD_CSD_C_SIZE_HC(pSd) + 1) * 512* 1024)
 #define SD_TOTAL_SIZE(pSd)             ((pSd)->totalSize)
 #define SD_TOTAL_BLOCK(pSd)            ((pSd)->blockNr)
+#define SD_CLOCK(pSd)                  ((pSd)->spiClock) ///< SPCK in Hz
 
 // SCR register access macros.
 #define SD_SCR_BUS_WIDTHS(pScr)        ((pScr[1] >> 16) & 0xF) ///< Describes all the DAT bus that are supported by this card
@@ -236,6 +267,10 @@
 /// SD end-of-transfer callback function.
 typedef void (*SdCallback)(unsigned char status, void *pCommand);
 
+/// Callback invoked at the end of a SD_Submit transfer, with the argument
+/// given to SD_Submit and 0 if the transfer succeeded.
+typedef void (*SdTransferCallback)(void *pArg, unsigned char status);
+
 //------------------------------------------------------------------------------
 /// SD Transfer Request prepared by the application upper layer. This structure
 /// is sent to the SD_SendCommand function to start the transfer. At the end of
@@ -267,6 +302,10 @@ typedef struct _SdCmd {
     SdCallback callback;
     /// Optional argument to the callback function.
     void *pArg;
+    /// Open transfer to end before the command.
+    unsigned char stop;
+    /// Number of blocks to pre-erase before the command.
+    unsigned short preErase;
 
 } SdCmd;
 
@@ -313,6 +352,14 @@ typedef struct _SdCard {
     unsigned int blockNr;
     /// Card access mode
     unsigned char mode;
+    /// SPI clock (SPCK) negotiated with the card, in Hz.
+    unsigned int spiClock;
+    /// Number of transfers failed in a row at this clock.
+    unsigned char clockErrors;
+    /// Callback of the SD_Submit transfer in progress.
+    SdTransferCallback callback;
+    /// Argument of the SD_Submit callback.
+    void *pArg;
 
 } SdCard;
 
@@ -335,6 +382,22 @@ extern unsigned char SD_WriteBlock(
     unsigned short nbBlocks,
     const unsigned char *pData);
 
+extern unsigned char SD_Submit(
+    SdCard *pSd,
+    unsigned char isRead,
+    unsigned int address,
+    unsigned short nbBlocks,
+    unsigned char *pData,
+    SdTransferCallback callback,
+    void *pArg);
+
+extern unsigned char SD_StopTransfer(SdCard *pSd);
+
+extern unsigned char SD_Erase(
+    SdCard *pSd,
+    unsigned int address,
+    unsigned int nbBlocks);
+
 extern unsigned char SD_Stop(SdCard *pSd, SdDriver *pSdDriver);
 
 #endif //#ifndef SDCARD_H
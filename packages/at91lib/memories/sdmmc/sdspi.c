@@ -35,10 +35,8 @@
 #include <utility/assert.h>
 #include <utility/trace.h>
 #include <board.h>
-#include <crc7.h>
-#include <crc-itu-t.h>
-#include <crc16.h>
-#include <crc-ccitt.h>
+#include "sdcrc.h"
+#include <utility/crc16.h>
 #include <string.h>
 
 //------------------------------------------------------------------------------
@@ -58,6 +56,43 @@
 #define SDSPI_START_BLOCK_2 0xFC  // Multiple block write
 #define SDSPI_STOP_TRAN     0xFD  // Cmd12
 
+// Steps of the asynchronous commands
+#define SDSPI_STATE_IDLE        0  // No asynchronous command
+#define SDSPI_STATE_STOP        1  // Sending the stop transmission token
+#define SDSPI_STATE_CMD         2  // Sending the command token
+#define SDSPI_STATE_RESP        3  // Polling the R1 response
+#define SDSPI_STATE_TOKEN       4  // Polling the start token of a data block
+#define SDSPI_STATE_READ        5  // Receiving a data block and its CRC
+#define SDSPI_STATE_WRITE       6  // Sending the start token and a data block
+#define SDSPI_STATE_CRC         7  // Sending the CRC of a data block
+#define SDSPI_STATE_DATA_RESP   8  // Polling the data response
+#define SDSPI_STATE_BUSY        9  // Polling the end of programming
+
+// Number of polls before a timeout
+#define SDSPI_RETRY_RESP    18
+#define SDSPI_RETRY_TOKEN   0x8000
+#define SDSPI_RETRY_BUSY    0x20000
+
+/// Number of bytes read by each poll of the programming busy.
+#define SDSPI_BUSY_POLL_SIZE    4
+
+/// Number of polls between two SDSPI_Poll calls, when paced by a timer.
+#define SDSPI_POLL_BURST    8
+
+/// Size of the dummy buffers: a data block, its CRC and the first byte of the
+/// next data token.
+#define SDSPI_DUMMY_SIZE    (512 + 3)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// 0xFF bytes sent while receiving data; MOSI must be held high during reads.
+static unsigned char sdSpiDummy[SDSPI_DUMMY_SIZE];
+
+/// Receives the bytes clocked in while sending data, which are discarded.
+static unsigned char sdSpiSink[SDSPI_DUMMY_SIZE];
+
 //------------------------------------------------------------------------------
 //         Exported functions
 //------------------------------------------------------------------------------
@@ -75,7 +110,19 @@ void SDSPI_Configure(SdSpi *pSdSpi,
     // Initialize the SPI structure
     pSdSpi->pSpiHw = pSpiHw;
     pSdSpi->spiId = spiId;
+    pSdSpi->cs = 0;
     pSdSpi->semaphore = 1;
+    pSdSpi->pCommand = 0;
+    pSdSpi->state = SDSPI_STATE_IDLE;
+    pSdSpi->timerPolling = 0;
+    pSdSpi->pollPending = 0;
+    pSdSpi->preCmd = 0;
+    pSdSpi->crc = 0;
+    pSdSpi->crcDone = 0;
+    pSdSpi->queued = 0;
+
+    // Dummy data sent during the reads
+    memset(sdSpiDummy, 0xff, SDSPI_DUMMY_SIZE);
 
     // Enable the SPI clock
     AT91C_BASE_PMC->PMC_PCER = (1 << pSdSpi->spiId);
@@ -114,6 +161,7 @@ void SDSPI_ConfigureCS(SdSpi *pSdSpi, unsigned char cs, unsigned int csr)
 
     //TRACE_DEBUG("CSR[%d]=0x%8X\n\r", cs, csr);
     pSpiHw->SPI_CSR[cs] = csr;
+    pSdSpi->cs = cs;
 
 //jcb to put in sendcommand
     // Write to the MR register
@@ -127,13 +175,65 @@ void SDSPI_ConfigureCS(SdSpi *pSdSpi, unsigned char cs, unsigned int csr)
 }
 
 //------------------------------------------------------------------------------
-/// Use PDC for SPI data transfer.
+/// Sets the SPCK of the card to the fastest value MCK allows which does not
+/// exceed the given speed; the other parameters set by SDSPI_ConfigureCS are
+/// kept. Must not be called while a transfer is in progress.
+/// Returns the resulting SPCK in Hz.
+/// \param pSdSpi  Pointer to a SdSpi instance.
+/// \param spiSpeed  Maximum SPCK in Hz.
+//------------------------------------------------------------------------------
+unsigned int SDSPI_SetSpeed(SdSpi *pSdSpi, unsigned int spiSpeed)
+{
+    AT91S_SPI *pSpiHw = pSdSpi->pSpiHw;
+    unsigned int scbr;
+    unsigned int csr;
+
+    SANITY_CHECK(spiSpeed);
+
+    scbr = (BOARD_MCK + spiSpeed - 1) / spiSpeed;
+    if (scbr < SDSPI_SCBR_MIN) {
+
+        scbr = SDSPI_SCBR_MIN;
+    }
+    else if (scbr > 0xff) {
+
+        scbr = 0xff;
+    }
+
+    // Enable the SPI clock
+    AT91C_BASE_PMC->PMC_PCER = (1 << pSdSpi->spiId);
+
+    csr = pSpiHw->SPI_CSR[pSdSpi->cs] & ~AT91C_SPI_SCBR;
+    pSpiHw->SPI_CSR[pSdSpi->cs] = csr | ((scbr << 8) & AT91C_SPI_SCBR);
+
+    // Disable the SPI clock
+    AT91C_BASE_PMC->PMC_PCDR = (1 << pSdSpi->spiId);
+
+    TRACE_DEBUG("SDSPI_SetSpeed: SCBR %u\n\r", scbr);
+    return BOARD_MCK / scbr;
+}
+
+//------------------------------------------------------------------------------
+/// Use PDC for SPI data transfer. The data received and the data sent are in
+/// separate buffers. A second buffer pair can be chained through the PDC next
+/// pointers, so that both parts are exchanged without a gap; the interrupt
+/// occurs at the end of the second part.
 /// Return 0 if no error, otherwise return error status.
 /// \param pSdSpi  Pointer to a SdSpi instance.
-/// \param pData  Data pointer.
+/// \param pRxData  Buffer receiving the data.
+/// \param pTxData  Data to send.
 /// \param size  Data transfer byte count.
+/// \param pRxNext  Buffer receiving the data of the chained part.
+/// \param pTxNext  Data to send in the chained part.
+/// \param sizeNext  Byte count of the chained part, 0 if there is none.
 //------------------------------------------------------------------------------
-unsigned char SDSPI_PDC(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
+unsigned char SDSPI_PDC(SdSpi *pSdSpi,
+                        unsigned char *pRxData,
+                        const unsigned char *pTxData,
+                        unsigned int size,
+                        unsigned char *pRxNext,
+                        const unsigned char *pTxNext,
+                        unsigned int sizeNext)
 {
     AT91PS_SPI pSpiHw = pSdSpi->pSpiHw;
     unsigned int spiIer;
@@ -151,14 +251,20 @@ unsigned char SDSPI_PDC(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
     pSpiHw->SPI_PTCR = AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS;
 
     // Receive Pointer Register
-    pSpiHw->SPI_RPR = (int)pData;
+    pSpiHw->SPI_RPR = (int) pRxData;
     // Receive Counter Register
     pSpiHw->SPI_RCR = size;
     // Transmit Pointer Register
-    pSpiHw->SPI_TPR = (int) pData;
+    pSpiHw->SPI_TPR = (int) pTxData;
     // Transmit Counter Register
     pSpiHw->SPI_TCR = size;
 
+    // Chained part, taken over by the PDC when the counters above reach 0
+    pSpiHw->SPI_RNPR = (int) pRxNext;
+    pSpiHw->SPI_RNCR = sizeNext;
+    pSpiHw->SPI_TNPR = (int) pTxNext;
+    pSpiHw->SPI_TNCR = sizeNext;
+
     spiIer = AT91C_SPI_RXBUFF;
 
     // Enable transmitter and receiver
@@ -172,20 +278,68 @@ unsigned char SDSPI_PDC(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
 
 //! Should be moved to a new file
 //------------------------------------------------------------------------------
-/// Read data on SPI data bus;
+/// Read data on SPI data bus; 0xFF is sent meanwhile.
 /// Returns 1 if read fails, returns 0 if no error.
 /// \param pSdSpi  Pointer to a SD SPI driver instance.
 /// \param pData  Data pointer.
 /// \param size Data size.
 //------------------------------------------------------------------------------
 unsigned char SDSPI_Read(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
+{
+    unsigned char error = 0;
+    unsigned int count;
+
+    while ((size > 0) && (error == 0)) {
+
+        count = (size > SDSPI_DUMMY_SIZE) ? SDSPI_DUMMY_SIZE : size;
+        error = SDSPI_PDC(pSdSpi, pData, sdSpiDummy, count, 0, 0, 0);
+
+        while(SDSPI_IsBusy(pSdSpi) == 1);
+
+        pData += count;
+        size -= count;
+    }
+
+    if( error == 0 ) {
+        return 0;
+    }
+    else {
+        TRACE_DEBUG("PB SDSPI_Read\n\r");
+        return 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Read a data block and the bytes following it (CRC, next token) on SPI
+/// data bus, within a single chained PDC transfer.
+/// Returns 1 if read fails, returns 0 if no error.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param pData  Data pointer.
+/// \param size  Data size.
+/// \param pTrailer  Buffer receiving the bytes following the data.
+/// \param trailerSize  Number of bytes following the data.
+//------------------------------------------------------------------------------
+static unsigned char SDSPI_ReadBlock(SdSpi *pSdSpi,
+                                     unsigned char *pData,
+                                     unsigned int size,
+                                     unsigned char *pTrailer,
+                                     unsigned int trailerSize)
 {
     unsigned char error;
 
-    // MOSI should hold high during read, or there will be wrong data in received data.
-    memset(pData, 0xff, size);
+    // Blocks larger than the dummy buffer are read in several parts
+    if ((size + trailerSize) > SDSPI_DUMMY_SIZE) {
+
+        error = SDSPI_Read(pSdSpi, pData, size);
+        if (error == 0) {
 
-    error = SDSPI_PDC(pSdSpi, pData, size);
+            error = SDSPI_Read(pSdSpi, pTrailer, trailerSize);
+        }
+        return error;
+    }
+
+    error = SDSPI_PDC(pSdSpi, pData, sdSpiDummy, size,
+                      pTrailer, sdSpiDummy, trailerSize);
 
     while(SDSPI_IsBusy(pSdSpi) == 1);
 
@@ -193,25 +347,56 @@ unsigned char SDSPI_Read(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
         return 0;
     }
     else {
-        TRACE_DEBUG("PB SDSPI_Read\n\r");
+        TRACE_DEBUG("PB SDSPI_ReadBlock\n\r");
         return 1;
     }
 }
 
 //------------------------------------------------------------------------------
-/// Write data on SPI data bus;
+/// Write data on SPI data bus; the data received meanwhile is discarded. A
+/// second buffer can be chained to the first one.
 /// Returns 1 if write fails, returns 0 if no error.
 /// \param pSdSpi  Pointer to a SD SPI driver instance.
 /// \param pData  Data pointer.
 /// \param size Data size.
+/// \param pNext  Pointer to the data sent after pData.
+/// \param sizeNext  Size of the data sent after pData, 0 if there is none.
 //------------------------------------------------------------------------------
-unsigned char SDSPI_Write(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
+static unsigned char SDSPI_WriteChained(SdSpi *pSdSpi,
+                                        const unsigned char *pData,
+                                        unsigned int size,
+                                        const unsigned char *pNext,
+                                        unsigned int sizeNext)
 {
-    unsigned char error;
+    unsigned char error = 0;
+    unsigned int count;
 
-    error = SDSPI_PDC(pSdSpi, pData, size);
+    // Send the first buffer alone while it does not fit in the sink
+    while ((size + sizeNext) > SDSPI_DUMMY_SIZE) {
 
-    while(SDSPI_IsBusy(pSdSpi) == 1);
+        count = (size > SDSPI_DUMMY_SIZE) ? SDSPI_DUMMY_SIZE : size;
+        error = SDSPI_PDC(pSdSpi, sdSpiSink, pData, count, 0, 0, 0);
+        while(SDSPI_IsBusy(pSdSpi) == 1);
+        if (error) {
+            break;
+        }
+
+        pData += count;
+        size -= count;
+        if (size == 0) {
+
+            pData = pNext;
+            size = sizeNext;
+            sizeNext = 0;
+        }
+    }
+
+    if ((error == 0) && ((size + sizeNext) > 0)) {
+
+        error = SDSPI_PDC(pSdSpi, sdSpiSink, pData, size,
+                          sdSpiSink + size, pNext, sizeNext);
+        while(SDSPI_IsBusy(pSdSpi) == 1);
+    }
 
     if( error == 0 ) {
         return 0;
@@ -222,6 +407,18 @@ unsigned char SDSPI_Write(SdSpi *pSdSpi, unsigned char *pData, unsigned int size
     }
 }
 
+//------------------------------------------------------------------------------
+/// Write data on SPI data bus; the data received meanwhile is discarded.
+/// Returns 1 if write fails, returns 0 if no error.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param pData  Data pointer.
+/// \param size Data size.
+//------------------------------------------------------------------------------
+unsigned char SDSPI_Write(SdSpi *pSdSpi, unsigned char *pData, unsigned int size)
+{
+    return SDSPI_WriteChained(pSdSpi, pData, size, 0, 0);
+}
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 unsigned char SDSPI_WaitDataBusy(SdSpi *pSdSpi)
@@ -246,8 +443,7 @@ unsigned char SDSPI_WaitDataBusy(SdSpi *pSdSpi)
 void SDSPI_MakeCmd(unsigned char *pCmdToken, unsigned int arg)
 {
     unsigned char sdCmdNum;
-    unsigned char crc = 0;
-    unsigned char crcPrev = 0;
+    unsigned char crc;
 
     sdCmdNum = 0x3f & *pCmdToken;
     *pCmdToken = sdCmdNum | 0x40;
@@ -256,7 +452,7 @@ void SDSPI_MakeCmd(unsigned char *pCmdToken, unsigned int arg)
     *(pCmdToken+3) = (arg >> 8) & 0xff;
     *(pCmdToken+4) = arg & 0xff;
 
-    crc = crc7(crcPrev, (unsigned char *)(pCmdToken), 5);
+    crc = SDCRC_Crc7(0, pCmdToken, 5);
 
     *(pCmdToken+5) = (crc << 1) | 1;
 }
@@ -380,16 +576,23 @@ unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pCommand)
     unsigned int i;
     unsigned char error;
     unsigned char dataHeader;
-    unsigned int dataRetry1 = 100;
-    unsigned int dataRetry2 = 100;
-    unsigned char crc[2];
-    unsigned char crcPrev = 0;
-    unsigned char crcPrev2 = 0;
+    unsigned int dataRetry1;
+    unsigned int dataRetry2;
+    unsigned char crc[3];
+    unsigned int trailerSize;
+    unsigned char tokenRead = 0;
+    unsigned short dataCrc;
 
     SANITY_CHECK(pSdSpi);
     SANITY_CHECK(pSpiHw);
     SANITY_CHECK(pCommand);
 
+    // An asynchronous command is in progress
+    if (pSdSpi->state != SDSPI_STATE_IDLE) {
+        TRACE_DEBUG("SDSPI_SendCommand: Busy\n\r");
+        return SDSPI_ERROR_LOCK;
+    }
+
     CmdToken[0] = pCommand->cmd & 0x3F;
     pData = pCommand->pData;
     blockSize = pCommand->blockSize;
@@ -398,6 +601,7 @@ unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pCommand)
 
     // Command is now being executed
     pSdSpi->pCommand = pCommand;
+    pSdSpi->dataError = 0;
     pCommand->status = SDSPI_STATUS_PENDING;
 
     // Send the command
@@ -440,39 +644,59 @@ unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pCommand)
 
         // DATA transfer from card to host
         if (pCommand->isRead) {
-            do {
+            // The first byte of the token search may have been read together
+            // with the previous block
+            dataRetry1 = 100;
+            if (tokenRead) {
+                dataHeader = crc[2];
+                tokenRead = 0;
+            }
+            else {
                 SDSPI_Read(pSdSpi, &dataHeader, 1);
-                dataRetry1 --;
-                if (dataHeader == SDSPI_START_BLOCK_1) {
-                    break;
-                }
-                else if((dataHeader & 0xf0) == 0x00) {
+            }
+            while (dataHeader != SDSPI_START_BLOCK_1) {
+
+                if((dataHeader & 0xf0) == 0x00) {
                     pCommand->status = SDSPI_STATUS_ERROR;
+                    pSdSpi->dataError = 1;
                     TRACE_DEBUG("Data Error 0x%X!\n\r", dataHeader);
                     return 1;
                 }
-            } while(dataRetry1 > 0);
+                dataRetry1--;
+                if (dataRetry1 == 0) {
+                    TRACE_DEBUG("Timeout dataretry1\n\r");
+                    return 1;
+                }
+                SDSPI_Read(pSdSpi, &dataHeader, 1);
+            }
 
-            if (dataRetry1 == 0) {
-                TRACE_DEBUG("Timeout dataretry1\n\r");
+            // Chain the data block with its CRC and, when another block
+            // follows, with the first byte of its token search
+            // Specific for Cmd9(): no CRC read
+            if ((pCommand->cmd & 0x3f) == 0x9) {
+                trailerSize = 0;
+            }
+            else if (pCommand->nbBlock > 1) {
+                trailerSize = 3;
+            }
+            else {
+                trailerSize = 2;
+            }
+            if (SDSPI_ReadBlock(pSdSpi, pData, blockSize, crc, trailerSize)) {
                 return 1;
             }
+            tokenRead = (trailerSize == 3);
 
-            SDSPI_Read(pSdSpi, pData, blockSize);
+            if (trailerSize > 0) {
 
-            // Specific for Cmd9()
-            if ((pCommand->cmd & 0x3f) != 0x9) {
-
-                SDSPI_Read(pSdSpi, crc, 2);
-#ifdef SDSPI_CRC_ON
+#if SDSPI_CRC_ON
                 // Check data CRC
                 TRACE_DEBUG("Check Data CRC\n\r");
-                crcPrev = 0;
-                crcPrev2 = 0;
-                if (crc[0] != ((crc_itu_t(crcPrev, pData, blockSize) & 0xff00) >> 8 )
-                 || crc[1] !=  (crc_itu_t(crcPrev2, pData, blockSize) & 0xff)) {
-                    TRACE_ERROR("CRC error 0x%X 0x%X 0x%X\n\r", \
-                        crc[0], crc[1], crc_itu_t(pData, blockSize));
+                dataCrc = CRC16_Ccitt(0, pData, blockSize);
+                if (((crc[0] << 8) | crc[1]) != dataCrc) {
+                    TRACE_ERROR("CRC error 0x%X 0x%X 0x%X\n\r",
+                        crc[0], crc[1], dataCrc);
+                    pSdSpi->dataError = 1;
                     return 1;
                 }
 #endif
@@ -489,20 +713,20 @@ unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pCommand)
                 dataHeader = SDSPI_START_BLOCK_1;
             }
 
-            crcPrev = 0;
-            crc[0] = (crc_itu_t(crcPrev, pData, blockSize) & 0xff00) >> 8;
-            crcPrev2 = 0;
-            crc[1] = (crc_itu_t(crcPrev2, pData, blockSize) & 0xff);
+            dataCrc = CRC16_Ccitt(0, pData, blockSize);
+            crc[0] = (dataCrc >> 8) & 0xff;
+            crc[1] = dataCrc & 0xff;
             SDSPI_Write(pSdSpi, &dataHeader, 1);
-            SDSPI_Write(pSdSpi, pData, blockSize);
-            SDSPI_Write(pSdSpi, crc, 2);
+            SDSPI_WriteChained(pSdSpi, pData, blockSize, crc, 2);
 
             // If status bits in data response is not "data accepted", return error
             if ((SDSPI_GetDataResp(pSdSpi, pCommand) & 0xe) != 0x4) {
                 TRACE_ERROR("Write resp error!\n\r");
+                pSdSpi->dataError = 1;
                 return 1;
             }
 
+            dataRetry2 = 100;
             do {
                 if (SDSPI_WaitDataBusy(pSdSpi) == 0) {
                     break;
@@ -523,6 +747,621 @@ unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pCommand)
 }
 //!
 
+//------------------------------------------------------------------------------
+//         Asynchronous commands
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Ends the asynchronous command in progress and invokes its callback.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param error  0 if the command succeeded, 1 otherwise.
+//------------------------------------------------------------------------------
+static void SDSPI_Complete(SdSpi *pSdSpi, unsigned char error)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+
+    // The callback may submit the next command; the following synchronous
+    // transfers must not invoke it again
+    pSdSpi->state = SDSPI_STATE_IDLE;
+    pSdSpi->pCommand = 0;
+    pCommand->status = error ? SDSPI_STATUS_ERROR : 0;
+
+    if (pCommand->callback) {
+        pCommand->callback(error, pCommand);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Starts the next step of the asynchronous command. If the transfer can not
+/// be started, the command ends and its callback is invoked.
+/// Returns 0 if the transfer has been started; otherwise returns an error.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param state  Step started (SDSPI_STATE_xxx).
+/// \param pRxData  Buffer receiving the data.
+/// \param pTxData  Data to send.
+/// \param size  Data transfer byte count.
+/// \param pRxNext  Buffer receiving the data of the chained part.
+/// \param pTxNext  Data to send in the chained part.
+/// \param sizeNext  Byte count of the chained part, 0 if there is none.
+//------------------------------------------------------------------------------
+static unsigned char SDSPI_Exchange(SdSpi *pSdSpi,
+                                    unsigned char state,
+                                    unsigned char *pRxData,
+                                    const unsigned char *pTxData,
+                                    unsigned int size,
+                                    unsigned char *pRxNext,
+                                    const unsigned char *pTxNext,
+                                    unsigned int sizeNext)
+{
+    pSdSpi->state = state;
+    if (SDSPI_PDC(pSdSpi, pRxData, pTxData, size, pRxNext, pTxNext, sizeNext)) {
+
+        SDSPI_Complete(pSdSpi, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the next poll bytes, or waits for SDSPI_Poll when the polls are
+/// paced by a timer. Ends the command if the card does not answer in time.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_Repoll(SdSpi *pSdSpi)
+{
+    if (pSdSpi->retry == 0) {
+
+        TRACE_DEBUG("SDSPI: Timeout in state %d\n\r", pSdSpi->state);
+        SDSPI_Complete(pSdSpi, 1);
+        return;
+    }
+    pSdSpi->retry--;
+
+    if (pSdSpi->timerPolling) {
+
+        pSdSpi->burst--;
+        if (pSdSpi->burst == 0) {
+
+            pSdSpi->burst = SDSPI_POLL_BURST;
+            pSdSpi->pollPending = 1;
+            return;
+        }
+    }
+
+    SDSPI_Exchange(pSdSpi,
+                   pSdSpi->state,
+                   pSdSpi->rxBuffer,
+                   sdSpiDummy,
+                   (pSdSpi->state == SDSPI_STATE_BUSY) ? SDSPI_BUSY_POLL_SIZE : 1,
+                   0, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Starts polling the card.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param state  Polling step (SDSPI_STATE_RESP, _TOKEN, _DATA_RESP or _BUSY).
+/// \param retry  Number of polls before a timeout.
+//------------------------------------------------------------------------------
+static void SDSPI_StartPoll(SdSpi *pSdSpi,
+                            unsigned char state,
+                            unsigned int retry)
+{
+    pSdSpi->state = state;
+    pSdSpi->retry = retry;
+    pSdSpi->burst = SDSPI_POLL_BURST;
+    SDSPI_Repoll(pSdSpi);
+}
+
+//------------------------------------------------------------------------------
+/// Sends a command token, preceded by a dummy byte.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param cmd  Command code.
+/// \param arg  Command argument.
+//------------------------------------------------------------------------------
+static void SDSPI_StartCommand(SdSpi *pSdSpi,
+                               unsigned char cmd,
+                               unsigned int arg)
+{
+    unsigned char *pTx = pSdSpi->txBuffer;
+    unsigned int size = 7;
+
+    pTx[0] = 0xff;
+    pTx[1] = cmd & 0x3f;
+    SDSPI_MakeCmd(&pTx[1], arg);
+
+    // Skip the stuff byte which follows Cmd12
+    if ((cmd & 0x3f) == 12) {
+        pTx[7] = 0xff;
+        size = 8;
+    }
+
+    SDSPI_Exchange(pSdSpi, SDSPI_STATE_CMD, sdSpiSink, pTx, size, 0, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Sends the command of the asynchronous command, preceded by CMD55 and ACMD23
+/// when blocks are pre-erased.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_StartFirstCommand(SdSpi *pSdSpi)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+
+    if (pCommand->preErase) {
+        pSdSpi->preCmd = 55;
+        SDSPI_StartCommand(pSdSpi, 55, 0);
+    }
+    else {
+        pSdSpi->preCmd = 0;
+        SDSPI_StartCommand(pSdSpi, pCommand->cmd, pCommand->arg);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads a data block whose start token has been received, chained with its
+/// CRC and with the first byte of the next token search. With
+/// SDSPI_CRC_CHUNK_SIZE, the block is received by chunks and SDSPI_ReadChunk
+/// queues the next one at the end of each chunk.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_StartRead(SdSpi *pSdSpi)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+#if SDSPI_CRC_ON && (SDSPI_CRC_CHUNK_SIZE > 0)
+    unsigned int sizeNext;
+#endif
+
+    pSdSpi->crc = 0;
+    pSdSpi->crcDone = 0;
+
+#if SDSPI_CRC_ON && (SDSPI_CRC_CHUNK_SIZE > 0)
+    if (pCommand->blockSize > SDSPI_CRC_CHUNK_SIZE) {
+
+        sizeNext = pCommand->blockSize - SDSPI_CRC_CHUNK_SIZE;
+        if (sizeNext > SDSPI_CRC_CHUNK_SIZE) {
+
+            sizeNext = SDSPI_CRC_CHUNK_SIZE;
+        }
+        pSdSpi->queued = SDSPI_CRC_CHUNK_SIZE + sizeNext;
+        if (SDSPI_Exchange(pSdSpi,
+                           SDSPI_STATE_READ,
+                           pCommand->pData,
+                           sdSpiDummy,
+                           SDSPI_CRC_CHUNK_SIZE,
+                           pCommand->pData + SDSPI_CRC_CHUNK_SIZE,
+                           sdSpiDummy + SDSPI_CRC_CHUNK_SIZE,
+                           sizeNext) == 0) {
+
+            pSdSpi->pSpiHw->SPI_IER = AT91C_SPI_ENDRX;
+        }
+        return;
+    }
+#endif
+
+    SDSPI_Exchange(pSdSpi,
+                   SDSPI_STATE_READ,
+                   pCommand->pData,
+                   sdSpiDummy,
+                   pCommand->blockSize,
+                   pSdSpi->rxBuffer,
+                   sdSpiDummy,
+                   (pCommand->nbBlock > 1) ? 3 : 2);
+}
+
+#if SDSPI_CRC_ON && (SDSPI_CRC_CHUNK_SIZE > 0)
+//------------------------------------------------------------------------------
+/// Queues the next chunk of the data block being read, or its CRC and the
+/// next token after the last chunk, then updates the CRC with the chunks
+/// received so far. Invoked by SDSPI_Handler at the end of each chunk.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_ReadChunk(SdSpi *pSdSpi)
+{
+    AT91PS_SPI pSpiHw = pSdSpi->pSpiHw;
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+    unsigned int blockSize = pCommand->blockSize;
+    unsigned int queued = pSdSpi->queued;
+    unsigned char *pRx;
+    unsigned int size;
+    unsigned int received;
+
+    if (queued < blockSize) {
+
+        pRx = pCommand->pData + queued;
+        size = blockSize - queued;
+        if (size > SDSPI_CRC_CHUNK_SIZE) {
+
+            size = SDSPI_CRC_CHUNK_SIZE;
+        }
+    }
+    else {
+
+        pRx = pSdSpi->rxBuffer;
+        size = (pCommand->nbBlock > 1) ? 3 : 2;
+        pSpiHw->SPI_IDR = AT91C_SPI_ENDRX;
+    }
+    pSdSpi->queued = queued + size;
+
+    // The counters do not move while the PDC is disabled; if the interrupt
+    // came too late and the queued chunks are over, restart from the new one
+    pSpiHw->SPI_PTCR = AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS;
+    if (pSpiHw->SPI_RCR == 0) {
+
+        pSpiHw->SPI_RPR = (int) pRx;
+        pSpiHw->SPI_RCR = size;
+    }
+    else {
+
+        pSpiHw->SPI_RNPR = (int) pRx;
+        pSpiHw->SPI_RNCR = size;
+    }
+    if (pSpiHw->SPI_TCR == 0) {
+
+        pSpiHw->SPI_TPR = (int) (sdSpiDummy + queued);
+        pSpiHw->SPI_TCR = size;
+    }
+    else {
+
+        pSpiHw->SPI_TNPR = (int) (sdSpiDummy + queued);
+        pSpiHw->SPI_TNCR = size;
+    }
+    pSpiHw->SPI_PTCR = AT91C_PDC_RXTEN | AT91C_PDC_TXTEN;
+
+    // Checksum what has been received while the PDC goes on
+    received = pSpiHw->SPI_RPR - (unsigned int) pCommand->pData;
+    if (received > blockSize) {
+
+        received = blockSize;
+    }
+    if (received > pSdSpi->crcDone) {
+
+        pSdSpi->crc = CRC16_Ccitt(pSdSpi->crc,
+                                  pCommand->pData + pSdSpi->crcDone,
+                                  received - pSdSpi->crcDone);
+        pSdSpi->crcDone = received;
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+/// Sends the start token and a data block. Its CRC is computed while the
+/// block is sent, and sent by the next step.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_StartWrite(SdSpi *pSdSpi)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+    unsigned char *pTx = pSdSpi->txBuffer;
+    unsigned short crc;
+
+    pTx[0] = 0xff;
+    if ((pCommand->conTrans == SPI_CONTINUE_TRANSFER)
+        || ((pCommand->cmd & 0x3f) == 25)) {
+        pTx[1] = SDSPI_START_BLOCK_2;
+    }
+    else {
+        pTx[1] = SDSPI_START_BLOCK_1;
+    }
+    pTx[4] = 0xff;
+
+    if (SDSPI_Exchange(pSdSpi,
+                       SDSPI_STATE_WRITE,
+                       sdSpiSink,
+                       pTx,
+                       2,
+                       sdSpiSink + 2,
+                       pCommand->pData,
+                       pCommand->blockSize) == 0) {
+
+        crc = CRC16_Ccitt(0, pCommand->pData, pCommand->blockSize);
+        pTx[2] = (crc >> 8) & 0xff;
+        pTx[3] = crc & 0xff;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Starts the data phase of the asynchronous command, or ends it if it has no
+/// data.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_StartData(SdSpi *pSdSpi)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+
+    if (pCommand->nbBlock == 0) {
+        SDSPI_Complete(pSdSpi, 0);
+    }
+    else if (pCommand->isRead) {
+        SDSPI_StartPoll(pSdSpi, SDSPI_STATE_TOKEN, SDSPI_RETRY_TOKEN);
+    }
+    else {
+        SDSPI_StartWrite(pSdSpi);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks a data response token; starts waiting for the end of programming
+/// if the data was accepted.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param resp  Byte received after the data block.
+//------------------------------------------------------------------------------
+static void SDSPI_CheckDataResp(SdSpi *pSdSpi, unsigned char resp)
+{
+    // Not a data response token yet
+    if ((resp & 0x11) != 0x01) {
+        SDSPI_Repoll(pSdSpi);
+    }
+    // If status bits in data response is not "data accepted", return error
+    else if ((resp & 0xe) != 0x4) {
+        TRACE_ERROR("Write resp error 0x%X!\n\r", resp);
+        pSdSpi->dataError = 1;
+        SDSPI_Complete(pSdSpi, 1);
+    }
+    else {
+        SDSPI_StartPoll(pSdSpi, SDSPI_STATE_BUSY, SDSPI_RETRY_BUSY);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Proceeds with the asynchronous command when a step ends. Invoked by
+/// SDSPI_Handler.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+static void SDSPI_Continue(SdSpi *pSdSpi)
+{
+    SdSpiCmd *pCommand = pSdSpi->pCommand;
+    unsigned char *pRx = pSdSpi->rxBuffer;
+
+    switch (pSdSpi->state) {
+
+    // Stop transmission token sent
+    case SDSPI_STATE_STOP:
+        SDSPI_StartPoll(pSdSpi, SDSPI_STATE_BUSY, SDSPI_RETRY_BUSY);
+        break;
+
+    // Command token sent
+    case SDSPI_STATE_CMD:
+        SDSPI_StartPoll(pSdSpi, SDSPI_STATE_RESP, SDSPI_RETRY_RESP);
+        break;
+
+    // Waiting for the R1 response
+    case SDSPI_STATE_RESP:
+        if (pRx[0] & 0x80) {
+            SDSPI_Repoll(pSdSpi);
+        }
+        else if ((pRx[0] & ~0x01) != 0) {
+            TRACE_DEBUG("SDSPI: R1 error 0x%X\n\r", pRx[0]);
+            if (pCommand->pResp && (pCommand->stop == SDSPI_STOP_NONE)
+                && (pSdSpi->preCmd == 0)) {
+                *(pCommand->pResp) = pRx[0];
+            }
+            SDSPI_Complete(pSdSpi, 1);
+        }
+        // Cmd12 has a R1b response
+        else if (pCommand->stop == SDSPI_STOP_CMD) {
+            SDSPI_StartPoll(pSdSpi, SDSPI_STATE_BUSY, SDSPI_RETRY_BUSY);
+        }
+        // Cmd55 accepted, set the pre-erase count
+        else if (pSdSpi->preCmd == 55) {
+            pSdSpi->preCmd = 23;
+            SDSPI_StartCommand(pSdSpi, 23, pCommand->preErase);
+        }
+        // Acmd23 accepted, send the command
+        else if (pSdSpi->preCmd == 23) {
+            pSdSpi->preCmd = 0;
+            SDSPI_StartCommand(pSdSpi, pCommand->cmd, pCommand->arg);
+        }
+        else {
+            if (pCommand->pResp) {
+                *(pCommand->pResp) = pRx[0];
+            }
+            SDSPI_StartData(pSdSpi);
+        }
+        break;
+
+    // Waiting for the start token of a data block
+    case SDSPI_STATE_TOKEN:
+        if (pRx[0] == SDSPI_START_BLOCK_1) {
+            SDSPI_StartRead(pSdSpi);
+        }
+        else if ((pRx[0] & 0xf0) == 0x00) {
+            TRACE_DEBUG("Data Error 0x%X!\n\r", pRx[0]);
+            pSdSpi->dataError = 1;
+            SDSPI_Complete(pSdSpi, 1);
+        }
+        else {
+            SDSPI_Repoll(pSdSpi);
+        }
+        break;
+
+    // Data block and CRC received
+    case SDSPI_STATE_READ:
+#if SDSPI_CRC_ON
+        // Check data CRC, partly computed already in chunk mode
+        pSdSpi->crc = CRC16_Ccitt(pSdSpi->crc,
+                                  pCommand->pData + pSdSpi->crcDone,
+                                  pCommand->blockSize - pSdSpi->crcDone);
+        if (((pRx[0] << 8) | pRx[1]) != pSdSpi->crc) {
+            TRACE_ERROR("CRC error 0x%X 0x%X\n\r", pRx[0], pRx[1]);
+            pSdSpi->dataError = 1;
+            SDSPI_Complete(pSdSpi, 1);
+            break;
+        }
+#endif
+        pCommand->pData += pCommand->blockSize;
+        pCommand->nbBlock--;
+        if (pCommand->nbBlock == 0) {
+            SDSPI_Complete(pSdSpi, 0);
+        }
+        // The byte read after the CRC may already be the next start token
+        else {
+            pSdSpi->state = SDSPI_STATE_TOKEN;
+            pSdSpi->retry = SDSPI_RETRY_TOKEN;
+            pSdSpi->burst = SDSPI_POLL_BURST;
+            pRx[0] = pRx[2];
+            SDSPI_Continue(pSdSpi);
+        }
+        break;
+
+    // Start token and data block sent, send the CRC
+    case SDSPI_STATE_WRITE:
+        SDSPI_Exchange(pSdSpi,
+                       SDSPI_STATE_CRC,
+                       pRx,
+                       &(pSdSpi->txBuffer[2]),
+                       3,
+                       0, 0, 0);
+        break;
+
+    // CRC sent, the data response may follow it immediately
+    case SDSPI_STATE_CRC:
+        pSdSpi->state = SDSPI_STATE_DATA_RESP;
+        pSdSpi->retry = SDSPI_RETRY_RESP;
+        pSdSpi->burst = SDSPI_POLL_BURST;
+        SDSPI_CheckDataResp(pSdSpi, pRx[2]);
+        break;
+
+    // Waiting for the data response
+    case SDSPI_STATE_DATA_RESP:
+        SDSPI_CheckDataResp(pSdSpi, pRx[0]);
+        break;
+
+    // Waiting for the end of programming
+    case SDSPI_STATE_BUSY:
+        if (pRx[SDSPI_BUSY_POLL_SIZE - 1] != 0xff) {
+            SDSPI_Repoll(pSdSpi);
+        }
+        // Open transfer ended, send the command
+        else if (pCommand->stop != SDSPI_STOP_NONE) {
+            pCommand->stop = SDSPI_STOP_NONE;
+            SDSPI_StartFirstCommand(pSdSpi);
+        }
+        else {
+            pCommand->pData += pCommand->blockSize;
+            pCommand->nbBlock--;
+            if (pCommand->nbBlock == 0) {
+                SDSPI_Complete(pSdSpi, 0);
+            }
+            else {
+                SDSPI_StartWrite(pSdSpi);
+            }
+        }
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Starts a SD command and its data blocks without waiting. The command then
+/// proceeds from SDSPI_Handler, one step per SPI interrupt: command token,
+/// R1 response, start token, data block and CRC, data response and
+/// programming busy. The command callback is invoked from SDSPI_Handler when
+/// it ends, with 0 if it succeeded; the callback may submit another command.
+/// A multiple blocks write must be continued with SPI_CONTINUE_TRANSFER
+/// commands, or ended with SDSPI_STOP_TOKEN before the next command;
+/// a multiple blocks read with SDSPI_STOP_CMD. When preErase is set, CMD55 and
+/// ACMD23 are sent before the command to pre-erase the blocks it writes.
+/// Returns 0 if the command has been started; otherwise returns an error.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param pCommand  Pointer to the command to execute.
+//------------------------------------------------------------------------------
+unsigned char SDSPI_Submit(SdSpi *pSdSpi, SdSpiCmd *pCommand)
+{
+    unsigned int aicImr;
+
+    SANITY_CHECK(pSdSpi);
+    SANITY_CHECK(pCommand);
+
+    if ((pSdSpi->state != SDSPI_STATE_IDLE) || (pSdSpi->semaphore == 0)) {
+        TRACE_DEBUG("SDSPI_Submit: Busy\n\r");
+        return SDSPI_ERROR_LOCK;
+    }
+
+    // Block, CRC and next token are received within the dummy buffers
+    if ((pCommand->blockSize + 3) > SDSPI_DUMMY_SIZE) {
+        TRACE_ERROR("SDSPI_Submit: Block size %d\n\r", pCommand->blockSize);
+        return 1;
+    }
+    if( (pCommand->blockSize > 0) && (pCommand->nbBlock == 0) ) {
+        pCommand->nbBlock = 1;
+    }
+    if (pCommand->blockSize == 0) {
+        pCommand->nbBlock = 0;
+    }
+
+    // Command is now being executed
+    pSdSpi->pCommand = pCommand;
+    pSdSpi->pollPending = 0;
+    pSdSpi->dataError = 0;
+    pCommand->status = SDSPI_STATUS_PENDING;
+
+    // The first step must be set up before SDSPI_Handler proceeds with it
+    // (e.g. the CRC of a block computed while the block is sent)
+    aicImr = AT91C_BASE_AIC->AIC_IMR & (1 << pSdSpi->spiId);
+    AT91C_BASE_AIC->AIC_IDCR = aicImr;
+
+    if ((pCommand->conTrans == SPI_CONTINUE_TRANSFER)
+        && (pCommand->nbBlock > 0)) {
+
+        pCommand->stop = SDSPI_STOP_NONE;
+        SDSPI_StartData(pSdSpi);
+    }
+    else if (pCommand->stop == SDSPI_STOP_TOKEN) {
+
+        pSdSpi->txBuffer[0] = SDSPI_STOP_TRAN;
+        pSdSpi->txBuffer[1] = 0xff;
+        SDSPI_Exchange(pSdSpi, SDSPI_STATE_STOP,
+                       sdSpiSink, pSdSpi->txBuffer, 2, 0, 0, 0);
+    }
+    else if (pCommand->stop == SDSPI_STOP_CMD) {
+
+        pSdSpi->preCmd = 0;
+        SDSPI_StartCommand(pSdSpi, 12, 0);
+    }
+    else {
+
+        SDSPI_StartFirstCommand(pSdSpi);
+    }
+
+    AT91C_BASE_AIC->AIC_IECR = aicImr;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Selects how the card is polled while it prepares a response or programs
+/// data. By default the polls follow each other from the SPI interrupt; when
+/// paced by a timer, the driver waits for the next SDSPI_Poll call after
+/// SDSPI_POLL_BURST polls, and leaves the CPU and the SPI bus meanwhile.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+/// \param timer  1 if SDSPI_Poll is called periodically, 0 otherwise.
+//------------------------------------------------------------------------------
+void SDSPI_ConfigurePolling(SdSpi *pSdSpi, unsigned char timer)
+{
+    pSdSpi->timerPolling = timer;
+}
+
+//------------------------------------------------------------------------------
+/// Resumes the polling of the card paused by the asynchronous command. Must
+/// be called periodically (e.g. from a timer interrupt which does not preempt
+/// SDSPI_Handler) when the polling is paced by a timer.
+/// \param pSdSpi  Pointer to a SD SPI driver instance.
+//------------------------------------------------------------------------------
+void SDSPI_Poll(SdSpi *pSdSpi)
+{
+    if (pSdSpi->pollPending) {
+
+        pSdSpi->pollPending = 0;
+        SDSPI_Exchange(pSdSpi,
+                       pSdSpi->state,
+                       pSdSpi->rxBuffer,
+                       sdSpiDummy,
+                       (pSdSpi->state == SDSPI_STATE_BUSY) ?
+                           SDSPI_BUSY_POLL_SIZE : 1,
+                       0, 0, 0);
+    }
+}
+
 //------------------------------------------------------------------------------
 /// The SPI_Handler must be called by the SPI Interrupt Service Routine with the
 /// corresponding Spi instance.
@@ -538,9 +1377,19 @@ void SDSPI_Handler(SdSpi *pSdSpi)
 
     // Read the status register
     spiSr = pSpiHw->SPI_SR;
+#if SDSPI_CRC_ON && (SDSPI_CRC_CHUNK_SIZE > 0)
+    // A chunk of the data block being read has been received
+    if ((pSdSpi->state == SDSPI_STATE_READ)
+        && (spiSr & pSpiHw->SPI_IMR & AT91C_SPI_ENDRX)) {
+
+        SDSPI_ReadChunk(pSdSpi);
+        return;
+    }
+#endif
     if(spiSr & AT91C_SPI_RXBUFF) {
 
-        if (pCommand->status == SDSPI_STATUS_PENDING) {
+        if (pCommand && (pSdSpi->state == SDSPI_STATE_IDLE)
+            && (pCommand->status == SDSPI_STATUS_PENDING)) {
             pCommand->status = 0;
         }
         // Disable transmitter and receiver
@@ -550,10 +1399,16 @@ void SDSPI_Handler(SdSpi *pSdSpi)
         AT91C_BASE_PMC->PMC_PCDR = (1 << pSdSpi->spiId);
 
         // Disable buffer complete interrupt
-        pSpiHw->SPI_IDR = AT91C_SPI_RXBUFF | AT91C_SPI_ENDTX;
+        pSpiHw->SPI_IDR = AT91C_SPI_RXBUFF | AT91C_SPI_ENDTX | AT91C_SPI_ENDRX;
 
         // Release the SPI semaphore
         pSdSpi->semaphore++;
+
+        // An asynchronous command proceeds with its next step
+        if (pSdSpi->state != SDSPI_STATE_IDLE) {
+            SDSPI_Continue(pSdSpi);
+            return;
+        }
     }
 
     // Invoke the callback associated with the current command
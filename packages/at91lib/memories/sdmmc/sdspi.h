@@ -38,10 +38,16 @@
 ///
 /// -# SDSPI_Configure: Initializes the SD Spi structure and the corresponding SPI hardware
 /// -# SDSPI_ConfigureCS : Configures the parameters for the device corresponding to the cs
+/// -# SDSPI_SetSpeed : Changes the SPCK of the card, e.g. once it is initialized
 /// -# SDSPI_Read: Read data on SPI data bus
 /// -# SDSPI_Write : Write data on SPI data bus
 /// -# SDSPI_SendCommand : Starts a SPI master transfer
 /// -# SDSPI_StopTranToken : Send stop transfer data token
+/// -# SDSPI_Submit : Starts a command and its data blocks without waiting; the
+///    transfer is driven by SDSPI_Handler and the command callback is invoked
+///    when it ends
+/// -# SDSPI_ConfigurePolling / SDSPI_Poll : Pace the polling of the card by a
+///    timer instead of polling it continuously
 //------------------------------------------------------------------------------
 
 #ifndef SDSPI_H
@@ -85,6 +91,36 @@
 /// Continue data transfer
 #define SPI_CONTINUE_TRANSFER   1
 
+/// No open transfer to end before the command
+#define SDSPI_STOP_NONE         0
+/// End an open multiple blocks write with the stop transmission token
+#define SDSPI_STOP_TOKEN        1
+/// End an open multiple blocks read with CMD12
+#define SDSPI_STOP_CMD          2
+
+/// Size of the buffers of the asynchronous commands.
+#define SDSPI_BUFFER_SIZE       8
+
+/// Checks the CRC of the data blocks read; the card checks the CRC of the
+/// commands and blocks it receives after CMD59. Define to 0 to turn it off.
+#ifndef SDSPI_CRC_ON
+#define SDSPI_CRC_ON            1
+#endif
+
+/// When not 0, the asynchronous commands receive the data blocks by chunks of
+/// this size and compute the CRC of each chunk while the next one is received,
+/// instead of computing the whole CRC once the block is received. The chunks
+/// must be long enough for the SPI interrupt to queue the next one in time.
+#ifndef SDSPI_CRC_CHUNK_SIZE
+#define SDSPI_CRC_CHUNK_SIZE    0
+#endif
+
+/// Smallest SCBR divisor used by SDSPI_SetSpeed, which bounds SPCK to
+/// MCK / SDSPI_SCBR_MIN.
+#ifndef SDSPI_SCBR_MIN
+#define SDSPI_SCBR_MIN          2
+#endif
+
 /// SD end-of-transfer callback function.
 typedef void (*SdSpiCallback)(unsigned char status, void *pCommand);
 
@@ -119,6 +155,12 @@ typedef struct _SdSpiCmd {
     SdSpiCallback callback;
     /// Optional argument to the callback function.
     void *pArg;
+    /// Open transfer to end before the command (SDSPI_STOP_xxx), used by
+    /// SDSPI_Submit.
+    unsigned char stop;
+    /// Number of blocks to pre-erase with ACMD23 before the command, 0 if
+    /// none, used by SDSPI_Submit.
+    unsigned short preErase;
 
 } SdSpiCmd;
 
@@ -134,19 +176,53 @@ typedef struct {
     AT91S_SPI *pSpiHw;
     /// SPI peripheral identifier.
     unsigned char spiId;
+    /// Chip select of the card, set by SDSPI_ConfigureCS.
+    unsigned char cs;
     /// Pointer to currently executing command.
     SdSpiCmd *pCommand;
     /// Mutex.
     volatile char semaphore;
+    /// Step of the asynchronous command in progress.
+    volatile unsigned char state;
+    /// Set when the polling of the card is paced by SDSPI_Poll.
+    unsigned char timerPolling;
+    /// Set while a poll waits for the next SDSPI_Poll call.
+    volatile unsigned char pollPending;
+    /// Number of polls left before waiting for SDSPI_Poll.
+    unsigned char burst;
+    /// Number of polls left before a timeout.
+    unsigned int retry;
+    /// Command sent before the one of the asynchronous command (CMD55 and
+    /// ACMD23 of a pre-erase), 0 otherwise.
+    unsigned char preCmd;
+    /// CRC of the part of the data block already checked.
+    unsigned short crc;
+    /// Number of bytes of the data block covered by crc.
+    unsigned short crcDone;
+    /// Number of bytes of the data block and its CRC given to the PDC.
+    unsigned short queued;
+    /// Set when the last command failed on a corrupted data block (CRC error,
+    /// error token or rejected data), which a too fast SPCK may cause.
+    unsigned char dataError;
+    /// Bytes sent by the asynchronous command.
+    unsigned char txBuffer[SDSPI_BUFFER_SIZE];
+    /// Bytes received by the asynchronous command.
+    unsigned char rxBuffer[SDSPI_BUFFER_SIZE];
 
 } SdSpi;
 
 extern void SDSPI_Configure(SdSpi *pSdSpi,AT91PS_SPI pSpiHw,unsigned char spiId);
 
-extern void SDSPI_SetSpeed(SdSpi *pSdSpi, unsigned int spiSpeed);
+extern unsigned int SDSPI_SetSpeed(SdSpi *pSdSpi, unsigned int spiSpeed);
 
 extern unsigned char SDSPI_SendCommand(SdSpi *pSdSpi, SdSpiCmd *pSdSpiCmd);
 
+extern unsigned char SDSPI_Submit(SdSpi *pSdSpi, SdSpiCmd *pSdSpiCmd);
+
+extern void SDSPI_ConfigurePolling(SdSpi *pSdSpi, unsigned char timer);
+
+extern void SDSPI_Poll(SdSpi *pSdSpi);
+
 extern void SDSPI_Handler(SdSpi *pSdSpi);
 
 extern unsigned char SDSPI_IsTxComplete(SdSpiCmd *pSdSpiCmd);
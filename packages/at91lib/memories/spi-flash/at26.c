@@ -34,19 +34,36 @@
 #include "at26.h"
 #include <board.h>
 #include <utility/assert.h>
+#include <utility/math.h>
 
 //------------------------------------------------------------------------------
 //         Internal definitions
 //------------------------------------------------------------------------------
 
-/// SPI clock frequency used in Hz.
-#define SPCK            1000000
-
-/// SPI chip select configuration value.
-#define CSR             (AT91C_SPI_NCPHA | \
+/// Highest SPI clock frequency used in Hz. The reads use the fast read
+/// command; once identified, each device is clocked at the lower of this
+/// frequency and its rating (At26Desc).
+#if !defined(AT26_SPCK)
+#define AT26_SPCK       (BOARD_MCK / 2)
+#endif
+
+/// SPI clock frequency used in Hz until the device is identified, the rating
+/// of the slowest known devices.
+#if !defined(AT26_ID_SPCK)
+#define AT26_ID_SPCK    20000000
+#endif
+
+/// SPI chip select configuration value for an SPI clock of at most spck Hz:
+/// the divider is rounded up.
+#define CSR(spck)       (AT91C_SPI_NCPHA | \
                          SPID_CSR_DLYBCT(BOARD_MCK, 100) | \
                          SPID_CSR_DLYBS(BOARD_MCK, 5) | \
-                         SPID_CSR_SCBR(BOARD_MCK, SPCK))
+                         ((((BOARD_MCK) + (spck) - 1) / (spck) << 8) \
+                          & AT91C_SPI_SCBR))
+
+/// Size of the optional erase blocks.
+#define ERASE_4K        (4 * 1024)
+#define ERASE_32K       (32 * 1024)
 
 /// Number of recognized dataflash.
 #define NUMDATAFLASH    (sizeof(at26Devices) / sizeof(At26Desc))
@@ -57,35 +74,330 @@
 
 /// Array of recognized serial firmware dataflash chips.
 static const At26Desc at26Devices[] = {
-    // name, Jedec ID, size, page size, block size, block erase command
-    {"AT25DF041A" , 0x0001441F, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"AT25DF161"  , 0x0002461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"AT26DF081A" , 0x0001451F, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"AT26DF0161" , 0x0000461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"AT26DF161A" , 0x0001461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"AT26DF321 " , 0x0000471F, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
+    // name, Jedec ID, size, page size, block size, block erase command, flags,
+    // SPI clock rating
+    {"AT25DF041A" , 0x0001441F, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 70000000},
+    {"AT25DF161"  , 0x0002461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 85000000},
+    {"AT26DF081A" , 0x0001451F, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 70000000},
+    {"AT26DF0161" , 0x0000461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 66000000},
+    {"AT26DF161A" , 0x0001461F, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 70000000},
+    {"AT26DF321 " , 0x0000471F, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K | AT26_FLAG_ERASE_32K | AT26_FLAG_EPE, 66000000},
     // Manufacturer: ST
-    {"M25P05"     , 0x00102020,       64 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P10"     , 0x00112020,      128 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P20"     , 0x00122020,      256 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P40"     , 0x00132020,      512 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P80"     , 0x00142020, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P16"     , 0x00152020, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P32"     , 0x00162020, 4 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"M25P64"     , 0x00172020, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
+    {"M25P05"     , 0x00102020,       64 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_64K, 0, 20000000},
+    {"M25P10"     , 0x00112020,      128 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_64K, 0, 20000000},
+    {"M25P20"     , 0x00122020,      256 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 25000000},
+    {"M25P40"     , 0x00132020,      512 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 25000000},
+    {"M25P80"     , 0x00142020, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 40000000},
+    {"M25P16"     , 0x00152020, 2 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 50000000},
+    {"M25P32"     , 0x00162020, 4 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 50000000},
+    {"M25P64"     , 0x00172020, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 50000000},
     // Manufacturer: Windbond
-    {"W25X10"     , 0x001130EF,      128 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"W25X20"     , 0x001230EF,      256 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"W25X40"     , 0x001330EF,      512 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"W25X80"     , 0x001430EF, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
+    {"W25X10"     , 0x001130EF,      128 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K, 75000000},
+    {"W25X20"     , 0x001230EF,      256 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K, 75000000},
+    {"W25X40"     , 0x001330EF,      512 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K, 75000000},
+    {"W25X80"     , 0x001430EF, 1 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K, 75000000},
     // Manufacturer: Macronix
-    {"MX25L512"   , 0x001020C2,       64 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"MX25L3205"  , 0x001620C2, 4 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
-    {"MX25L6405"  , 0x001720C2, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K},
+    {"MX25L512"   , 0x001020C2,       64 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, AT26_FLAG_ERASE_4K, 50000000},
+    {"MX25L3205"  , 0x001620C2, 4 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 50000000},
+    {"MX25L6405"  , 0x001720C2, 8 * 1024 * 1024, 256, 64 * 1024, AT26_BLOCK_ERASE_64K, 0, 50000000},
     // Other
-    {"SST25VF512" , 0x000048BF,       64 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_32K}
+    {"SST25VF512" , 0x000048BF,       64 * 1024, 256, 32 * 1024, AT26_BLOCK_ERASE_32K, AT26_FLAG_ERASE_4K | AT26_FLAG_SEQUENTIAL, 20000000}
 };
 
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+static void AT26_Callback(unsigned char status, void *pArgument);
+
+//------------------------------------------------------------------------------
+/// Ends the current command and invokes its callback, which may send the next
+/// command.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the At26 driver instance.
+//------------------------------------------------------------------------------
+static void AT26_CommandCallback(unsigned char status, void *pArgument)
+{
+    At26 *pAt26 = (At26 *) pArgument;
+
+    pAt26->commandPending = 0;
+    if (pAt26->commandCallback) {
+
+        pAt26->commandCallback(status, pAt26->pCommandArgument);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes the given value in the status register of the serial flash device.
+/// \param pAt26  Pointer to an AT26 driver instance.
+/// \param status  Status to write.
+//------------------------------------------------------------------------------
+static void AT26_WriteStatus(At26 *pAt26, unsigned char status)
+{
+    unsigned char error;
+
+    SANITY_CHECK(pAt26);
+
+    // Issue a write status command
+    error = AT26_SendCommand(pAt26, AT26_WRITE_STATUS, 1, &status, 1, 0, 0, 0);
+    ASSERT(!error, "-F- AT26_WriteStatus: Failed to issue command.\n\r");
+    while (AT26_IsBusy(pAt26));
+}
+
+//------------------------------------------------------------------------------
+/// Enables critical writes operation on a serial flash device, such as sector
+/// protection, status register, etc.
+/// \param pAt26  Pointer to an AT26 driver instance.
+//------------------------------------------------------------------------------
+static void AT26_EnableWrite(At26 *pAt26)
+{
+    unsigned char error;
+
+    SANITY_CHECK(pAt26);
+
+    // Issue a write enable command
+    error = AT26_SendCommand(pAt26, AT26_WRITE_ENABLE, 1, 0, 0, 0, 0, 0);
+    ASSERT(!error, "-F- AT26_EnableWrite: Could not issue command.\n\r");
+
+    // Wait for end of transfer
+    while (AT26_IsBusy(pAt26));
+}
+
+//------------------------------------------------------------------------------
+/// Ends the erase or write operation and invokes its callback.
+/// \param pAt26  Pointer to an At26 driver instance.
+/// \param error  0 if successful; otherwise an AT26_ERROR_xxx code.
+//------------------------------------------------------------------------------
+static void AT26_End(At26 *pAt26, unsigned char error)
+{
+    pAt26->state = AT26_STATE_IDLE;
+    if (pAt26->callback) {
+
+        pAt26->callback(error, pAt26->pArgument);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sends a step of the erase or write operation, whose end is handled by
+/// AT26_Callback in the given state.
+/// \param pAt26  Pointer to an At26 driver instance.
+/// \param state  Step of the operation (AT26_STATE_xxx).
+/// \param cmd  Command byte.
+/// \param cmdSize  Size of command.
+/// \param pData  Data buffer.
+/// \param dataSize  Number of bytes to send/receive.
+/// \param address  Address to transmit.
+//------------------------------------------------------------------------------
+static void AT26_Step(
+    At26 *pAt26,
+    unsigned char state,
+    unsigned char cmd,
+    unsigned char cmdSize,
+    unsigned char *pData,
+    unsigned int dataSize,
+    unsigned int address)
+{
+    pAt26->state = state;
+    if (AT26_SendCommand(pAt26, cmd, cmdSize, pData, dataSize, address,
+                         AT26_Callback, pAt26)) {
+
+        AT26_End(pAt26, AT26_ERROR_SPI);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Selects the largest erase unit aligned on the current address and contained
+/// in the rest of the range, and returns its size.
+/// \param pAt26  Pointer to an At26 driver instance.
+//------------------------------------------------------------------------------
+static unsigned int AT26_EraseUnit(At26 *pAt26)
+{
+    const At26Desc *pDesc = pAt26->pDesc;
+    unsigned int address = pAt26->address;
+    unsigned int size = pAt26->size;
+
+    if ((address == 0) && (size >= pDesc->size)) {
+
+        pAt26->opcode = AT26_CHIP_ERASE_2;
+        return size;
+    }
+    if (((address & (pDesc->blockSize - 1)) == 0) && (size >= pDesc->blockSize)) {
+
+        pAt26->opcode = pDesc->blockEraseCmd;
+        return pDesc->blockSize;
+    }
+    if ((pDesc->flags & AT26_FLAG_ERASE_32K)
+        && ((address & (ERASE_32K - 1)) == 0) && (size >= ERASE_32K)) {
+
+        pAt26->opcode = AT26_BLOCK_ERASE_32K;
+        return ERASE_32K;
+    }
+
+    // AT26_Erase rounded the range to the smallest unit
+    pAt26->opcode = AT26_BLOCK_ERASE_4K;
+    return ERASE_4K;
+}
+
+//------------------------------------------------------------------------------
+/// Starts the next program or erase of the operation.
+/// \param pAt26  Pointer to an At26 driver instance.
+//------------------------------------------------------------------------------
+static void AT26_Next(At26 *pAt26)
+{
+    unsigned int pageSize = AT26_PageSize(pAt26);
+
+    if (pAt26->erase) {
+
+        pAt26->chunk = AT26_EraseUnit(pAt26);
+    }
+    else if (pAt26->pDesc->flags & AT26_FLAG_SEQUENTIAL) {
+
+        pAt26->chunk = 1;
+        pAt26->opcode = AT26_SEQUENTIAL_PROGRAM_2;
+
+        // The device is still write enabled, and increments the address
+        if (pAt26->sequential) {
+
+            pAt26->dataByte = *(pAt26->pData);
+            AT26_Step(pAt26, AT26_STATE_COMMAND, pAt26->opcode, 1,
+                      &(pAt26->dataByte), 1, 0);
+            return;
+        }
+    }
+    else {
+
+        pAt26->chunk = min(pAt26->size,
+                           pageSize - (pAt26->address & (pageSize - 1)));
+        pAt26->opcode = AT26_BYTE_PAGE_PROGRAM;
+    }
+
+    AT26_Step(pAt26, AT26_STATE_ENABLE, AT26_WRITE_ENABLE, 1, 0, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Advances the erase or write operation at the end of each of its SPI
+/// transfers: each program or erase is preceded by a write enable and followed
+/// by status reads until the device is ready.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the At26 driver instance.
+//------------------------------------------------------------------------------
+static void AT26_Callback(unsigned char status, void *pArgument)
+{
+    At26 *pAt26 = (At26 *) pArgument;
+
+    switch (pAt26->state) {
+
+        case AT26_STATE_ENABLE:
+            if (pAt26->erase) {
+
+                AT26_Step(pAt26, AT26_STATE_COMMAND, pAt26->opcode,
+                          (pAt26->opcode == AT26_CHIP_ERASE_2) ? 1 : 4,
+                          0, 0, pAt26->address);
+            }
+            else if (pAt26->opcode == AT26_SEQUENTIAL_PROGRAM_2) {
+
+                // The first byte gives the start address
+                pAt26->sequential = 1;
+                pAt26->dataByte = *(pAt26->pData);
+                AT26_Step(pAt26, AT26_STATE_COMMAND, pAt26->opcode, 4,
+                          &(pAt26->dataByte), 1, pAt26->address);
+            }
+            else {
+
+                AT26_Step(pAt26, AT26_STATE_COMMAND, pAt26->opcode, 4,
+                          pAt26->pData, pAt26->chunk, pAt26->address);
+            }
+            break;
+
+        case AT26_STATE_COMMAND:
+            if (!pAt26->erase) {
+
+                pAt26->pData += pAt26->chunk;
+            }
+            pAt26->address += pAt26->chunk;
+            pAt26->size -= pAt26->chunk;
+            AT26_Step(pAt26, AT26_STATE_POLL, AT26_READ_STATUS, 1,
+                      &(pAt26->status), 1, 0);
+            break;
+
+        case AT26_STATE_POLL:
+            if ((pAt26->status & AT26_STATUS_RDYBSY) == AT26_STATUS_RDYBSY_BUSY) {
+
+                AT26_Step(pAt26, AT26_STATE_POLL, AT26_READ_STATUS, 1,
+                          &(pAt26->status), 1, 0);
+            }
+            else if ((pAt26->pDesc->flags & AT26_FLAG_EPE)
+                     && ((pAt26->status & AT26_STATUS_EPE) == AT26_STATUS_EPE_ERROR)) {
+
+                AT26_End(pAt26, AT26_ERROR_PROGRAM);
+            }
+            else if (pAt26->size > 0) {
+
+                AT26_Next(pAt26);
+            }
+            else if (pAt26->sequential) {
+
+                AT26_Step(pAt26, AT26_STATE_DISABLE, AT26_WRITE_DISABLE, 1,
+                          0, 0, 0);
+            }
+            else {
+
+                AT26_End(pAt26, 0);
+            }
+            break;
+
+        case AT26_STATE_DISABLE:
+            AT26_End(pAt26, 0);
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Starts an erase or write operation.
+/// Returns 0 if successful; otherwise returns AT26_ERROR_BUSY if the AT26
+/// driver is in use.
+/// \param pAt26  Pointer to an At26 driver instance.
+/// \param erase  1 for an erase, 0 for a write.
+/// \param address  Start address.
+/// \param pData  Data to write.
+/// \param size  Number of bytes to erase or write.
+/// \param callback  Optional callback to invoke at the end of the operation.
+/// \param pArgument  Optional argument to the callback function.
+//------------------------------------------------------------------------------
+static unsigned char AT26_Start(
+    At26 *pAt26,
+    unsigned char erase,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument)
+{
+    if (AT26_IsBusy(pAt26)) {
+
+        return AT26_ERROR_BUSY;
+    }
+    if (size == 0) {
+
+        if (callback) {
+
+            callback(0, pArgument);
+        }
+        return 0;
+    }
+
+    pAt26->erase = erase;
+    pAt26->sequential = 0;
+    pAt26->address = address;
+    pAt26->pData = pData;
+    pAt26->size = size;
+    pAt26->callback = callback;
+    pAt26->pArgument = pArgument;
+    AT26_Next(pAt26);
+
+    return 0;
+}
+
 //------------------------------------------------------------------------------
 //         Exported functions
 //------------------------------------------------------------------------------
@@ -105,12 +417,14 @@ void AT26_Configure(At26 *pAt26, Spid *pSpid, unsigned char cs)
     SANITY_CHECK(pSpid);
     SANITY_CHECK(cs < 4);
 
-    // Configure the SPI chip select for the serial flash
-    SPID_ConfigureCS(pSpid, cs, CSR);
+    // Configure the SPI chip select for the serial flash, at a clock rate
+    // accepted by every device until it is identified
+    SPID_ConfigureCS(pSpid, cs, CSR(min(AT26_SPCK, AT26_ID_SPCK)));
 
     // Initialize the AT26 fields
     pAt26->pSpid = pSpid;
     pAt26->pDesc = 0;
+    pAt26->cs = cs;
 
     // Initialize the command structure
     pCommand = &(pAt26->command);
@@ -118,16 +432,20 @@ void AT26_Configure(At26 *pAt26, Spid *pSpid, unsigned char cs)
     pCommand->callback = 0;
     pCommand->pArgument = 0;
     pCommand->spiCs = cs;
+
+    // No command nor operation in progress
+    pAt26->commandPending = 0;
+    pAt26->state = AT26_STATE_IDLE;
 }
 
 //------------------------------------------------------------------------------
-/// Returns 1 if the serial flash driver is currently busy executing a command;
-/// otherwise returns 0.
+/// Returns 1 if the serial flash driver is currently busy executing a command
+/// or an erase or write operation; otherwise returns 0.
 /// \param pAt26  Pointer to an At26 driver instance.
 //------------------------------------------------------------------------------
 unsigned char AT26_IsBusy(At26 *pAt26)
 {
-    return SPID_IsBusy(pAt26->pSpid);
+    return pAt26->commandPending || (pAt26->state != AT26_STATE_IDLE);
 }
 
 //------------------------------------------------------------------------------
@@ -163,8 +481,8 @@ unsigned char AT26_SendCommand(
 
     SANITY_CHECK(pAt26);
 
-    // Check if the SPI driver is available
-    if (AT26_IsBusy(pAt26)) {
+    // Check if the previous command has ended
+    if (pAt26->commandPending) {
 
         return AT26_ERROR_BUSY;
     }
@@ -180,12 +498,16 @@ unsigned char AT26_SendCommand(
      pCommand->cmdSize = cmdSize;
      pCommand->pData = pData;
      pCommand->dataSize = dataSize;
-     pCommand->callback = callback;
-     pCommand->pArgument = pArgument;
+     pCommand->callback = AT26_CommandCallback;
+     pCommand->pArgument = pAt26;
+     pAt26->commandCallback = callback;
+     pAt26->pCommandArgument = pArgument;
 
-     // Start the SPI transfer
-     if (SPID_SendCommand(pAt26->pSpid, pCommand)) {
+     // Queue the SPI transfer, the SPI may be shared with other devices
+     pAt26->commandPending = 1;
+     if (SPID_QueueCommand(pAt26->pSpid, pCommand)) {
 
+         pAt26->commandPending = 0;
          return AT26_ERROR_SPI;
      }
 
@@ -195,7 +517,9 @@ unsigned char AT26_SendCommand(
 //------------------------------------------------------------------------------
 /// Tries to detect a serial firmware flash device given its JEDEC identifier.
 /// The JEDEC id can be retrieved by sending the correct command to the device.
-/// Returns the corresponding AT26 descriptor if found; otherwise returns 0.
+/// Once found, the SPI clock is raised to the rating of the device, up to
+/// AT26_SPCK. Returns the corresponding AT26 descriptor if found; otherwise
+/// returns 0.
 /// \param pAt26  Pointer to an AT26 driver instance.
 /// \param jedecId  JEDEC identifier of device.
 //------------------------------------------------------------------------------
@@ -217,6 +541,232 @@ const At26Desc * AT26_FindDevice(At26 *pAt26, unsigned int jedecId)
         i++;
     }
 
+    // Clock the device at its rating
+    if (pAt26->pDesc) {
+
+        SPID_ConfigureCS(pAt26->pSpid, pAt26->cs,
+                         CSR(min(AT26_SPCK, pAt26->pDesc->maxSpck)));
+    }
+
     return pAt26->pDesc;
 }
 
+//------------------------------------------------------------------------------
+/// Reads and returns the status register of the serial flash.
+/// \param pAt26  Pointer to an AT26 driver instance.
+//------------------------------------------------------------------------------
+unsigned char AT26_ReadStatus(At26 *pAt26)
+{
+    unsigned char error, status;
+
+    SANITY_CHECK(pAt26);
+
+    // Issue a status read command
+    error = AT26_SendCommand(pAt26, AT26_READ_STATUS, 1, &status, 1, 0, 0, 0);
+    ASSERT(!error, "-F- AT26_ReadStatus: Failed to issue command.\n\r");
+
+    // Wait for transfer to finish
+    while (AT26_IsBusy(pAt26));
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+/// Waits for the serial flash device to become ready to accept new commands.
+/// \param pAt26  Pointer to an AT26 driver instance.
+//------------------------------------------------------------------------------
+void AT26_WaitReady(At26 *pAt26)
+{
+    unsigned char ready = 0;
+
+    SANITY_CHECK(pAt26);
+
+    // Read status register and check busy bit
+    while (!ready) {
+
+        ready = ((AT26_ReadStatus(pAt26) & AT26_STATUS_RDYBSY) == AT26_STATUS_RDYBSY_READY);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads and returns the serial flash device ID.
+/// \param pAt26  Pointer to an AT26 driver instance.
+//------------------------------------------------------------------------------
+unsigned int AT26_ReadJedecId(At26 *pAt26)
+{
+    unsigned char error;
+    unsigned int id = 0;
+
+    SANITY_CHECK(pAt26);
+
+    // Issue a read ID command
+    error = AT26_SendCommand(pAt26, AT26_READ_JEDEC_ID, 1,
+                             (unsigned char *) &id, 3, 0, 0, 0);
+    ASSERT(!error, "-F- AT26_ReadJedecId: Could not issue command.\n\r");
+
+    // Wait for transfer to finish
+    while (AT26_IsBusy(pAt26));
+
+    return id;
+}
+
+//------------------------------------------------------------------------------
+/// Unprotects the contents of the serial flash device.
+/// Returns 0 if the device has been unprotected; otherwise returns
+/// AT26_ERROR_PROTECTED.
+/// \param pAt26  Pointer to an AT26 driver instance.
+//------------------------------------------------------------------------------
+unsigned char AT26_Unprotect(At26 *pAt26)
+{
+    unsigned char status;
+
+    SANITY_CHECK(pAt26);
+
+    // Get the status register value to check the current protection
+    status = AT26_ReadStatus(pAt26);
+    if ((status & AT26_STATUS_SWP) == AT26_STATUS_SWP_PROTNONE) {
+
+        // Protection already disabled
+        return 0;
+    }
+
+    // Check if sector protection registers are locked
+    if ((status & AT26_STATUS_SPRL) == AT26_STATUS_SPRL_LOCKED) {
+
+        // Unprotect sector protection registers by writing the status reg.
+        AT26_EnableWrite(pAt26);
+        AT26_WriteStatus(pAt26, 0);
+    }
+
+    // Perform a global unprotect command
+    AT26_EnableWrite(pAt26);
+    AT26_WriteStatus(pAt26, 0);
+
+    // Check the new status
+    status = AT26_ReadStatus(pAt26);
+    if ((status & (AT26_STATUS_SPRL | AT26_STATUS_SWP)) != 0) {
+
+        return AT26_ERROR_PROTECTED;
+    }
+    else {
+
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Starts reading data from the specified address on the serial flash, with
+/// the fast read command. The callback is invoked at the end of the transfer.
+/// Returns 0 if successful; otherwise returns AT26_ERROR_BUSY if the AT26
+/// driver is in use, or AT26_ERROR_SPI if there was a SPI error.
+/// \param pAt26  Pointer to an AT26 driver instance.
+/// \param address  Read address.
+/// \param pData  Data buffer.
+/// \param size  Number of bytes to read.
+/// \param callback  Optional callback to invoke at the end of the transfer.
+/// \param pArgument  Optional argument to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT26_Read(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument)
+{
+    SANITY_CHECK(pAt26);
+    SANITY_CHECK(pData);
+
+    if (AT26_IsBusy(pAt26)) {
+
+        return AT26_ERROR_BUSY;
+    }
+
+    // The fast read command is followed by a dummy byte
+    return AT26_SendCommand(pAt26, AT26_READ_ARRAY, 5, pData, size, address,
+                            callback, pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing data at the specified address on the serial firmware
+/// dataflash. The area to program must have been erased prior to writing. The
+/// data is programmed page by page, or byte by byte in sequential mode on the
+/// devices without page program; the callback is invoked from the SPI
+/// interrupt with 0 or AT26_ERROR_PROGRAM when the last byte is programmed.
+/// The data buffer is overwritten by the SPI transfers.
+/// Returns 0 if successful; otherwise returns AT26_ERROR_BUSY if the AT26
+/// driver is in use.
+/// \param pAt26  Pointer to an AT26 driver instance.
+/// \param address  Write address.
+/// \param pData  Data buffer.
+/// \param size  Number of bytes in buffer.
+/// \param callback  Optional callback to invoke at the end of the write.
+/// \param pArgument  Optional argument to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT26_Write(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument)
+{
+    SANITY_CHECK(pAt26);
+    SANITY_CHECK(pAt26->pDesc);
+    SANITY_CHECK(pData);
+
+    return AT26_Start(pAt26, 0, address, pData, size, callback, pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Starts erasing the given range of the serial firmware dataflash. The range
+/// is extended to the smallest erase unit of the device, then erased with the
+/// largest units it contains, or with a chip erase if it covers the whole
+/// device. The callback is invoked from the SPI interrupt when the last unit
+/// is erased.
+/// Returns 0 if successful; otherwise returns AT26_ERROR_BUSY if the AT26
+/// driver is in use.
+/// \param pAt26  Pointer to an AT26 driver instance.
+/// \param address  Start address of the range.
+/// \param size  Size of the range in bytes.
+/// \param callback  Optional callback to invoke at the end of the erase.
+/// \param pArgument  Optional argument to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT26_Erase(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument)
+{
+    const At26Desc *pDesc = pAt26->pDesc;
+    unsigned int unit;
+
+    SANITY_CHECK(pAt26);
+    SANITY_CHECK(pDesc);
+    SANITY_CHECK((address + size) <= pDesc->size);
+
+    // Smallest erase unit of the device
+    if (pDesc->flags & AT26_FLAG_ERASE_4K) {
+
+        unit = ERASE_4K;
+    }
+    else if (pDesc->flags & AT26_FLAG_ERASE_32K) {
+
+        unit = ERASE_32K;
+    }
+    else {
+
+        unit = pDesc->blockSize;
+    }
+
+    // Extend the range to whole units
+    if (size > 0) {
+
+        size += address & (unit - 1);
+        address &= ~(unit - 1);
+        size = (size + unit - 1) & ~(unit - 1);
+    }
+
+    return AT26_Start(pAt26, 1, address, 0, size, callback, pArgument);
+}
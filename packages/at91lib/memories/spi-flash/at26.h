@@ -44,10 +44,12 @@
 /// !Usage
 ///
 /// -# Initializes an AT26 instance and configures SPI chip select pin
-///    using AT26_Configure().
+///    using AT26_Configure(). The SPI clock is set to the rating of the
+///    slowest known device (AT26_ID_SPCK) until the device is identified.
 /// -# Detect DF and returns DF description corresponding to the device
 ///    connected using AT26_FindDevice().This function shall be called by
-///    the application before AT26_SendCommand().
+///    the application before AT26_SendCommand(). It raises the SPI clock to
+///    the rating of the device, up to AT26_SPCK.
 /// -# Sends a command to the DF through the SPI using AT26_SendCommand().
 ///    The command is identified by its command code and the number of
 ///    bytes to transfer.
@@ -68,6 +70,15 @@
 ///    -# This function does not block; its optional callback will
 ///       be invoked when the transfer completes.
 /// -# Check the AT26 driver is ready or not by polling AT26_IsBusy().
+/// -# Read data with AT26_Read(), which uses the fast read command. Erase
+///    with AT26_Erase(), which covers the range with the largest erase units
+///    it contains, down to the smallest unit the device supports, and write
+///    erased areas with AT26_Write(). These functions return as soon as the
+///    operation is started; the device status is polled from the SPI
+///    interrupt and the callback is invoked when the operation ends. The data
+///    buffer of a write is overwritten by the SPI transfers.
+/// -# AT26_ReadStatus(), AT26_WaitReady(), AT26_ReadJedecId() and
+///    AT26_Unprotect() wait for the end of their transfers.
 ///
 //------------------------------------------------------------------------------
 #ifndef AT26_H
@@ -105,6 +116,28 @@
 /// There was an SPI communication error.
 #define AT26_ERROR_SPI              4
 
+/// The device can erase 4K blocks.
+#define AT26_FLAG_ERASE_4K          (1 << 0)
+/// The device can erase 32K blocks.
+#define AT26_FLAG_ERASE_32K         (1 << 1)
+/// The device has no page program and is programmed byte by byte in
+/// sequential (auto address increment) mode.
+#define AT26_FLAG_SEQUENTIAL        (1 << 2)
+/// The status register reports program and erase errors (AT26_STATUS_EPE);
+/// on the other devices this bit is a protection bit.
+#define AT26_FLAG_EPE               (1 << 3)
+
+/// No operation in progress.
+#define AT26_STATE_IDLE             0
+/// The write enable command of the operation is sent.
+#define AT26_STATE_ENABLE           1
+/// The program or erase command is sent.
+#define AT26_STATE_COMMAND          2
+/// The status register is read until the device is ready.
+#define AT26_STATE_POLL             3
+/// The write disable command ending a sequential program is sent.
+#define AT26_STATE_DISABLE          4
+
 /// Device ready/busy status bit.
 #define AT26_STATUS_RDYBSY          (1 << 0)
 /// Device is ready.
@@ -131,7 +164,7 @@
 #define AT26_STATUS_WPP_NOTASSERTED (0 << 4)
 /// Write protect signal is asserted.
 #define AT26_STATUS_WPP_ASSERTED    (1 << 4)
-/// Erase/program error bit.
+/// Erase/program error bit (devices with AT26_FLAG_EPE only).
 #define AT26_STATUS_EPE             (1 << 5)
 /// Erase or program operation was successful.
 #define AT26_STATUS_EPE_SUCCESS     (0 << 5)
@@ -206,6 +239,10 @@ typedef struct _At26Desc {
 	unsigned int blockSize;
     /// Block erase command.
     unsigned int blockEraseCmd;
+    /// Supported features (AT26_FLAG_xxx).
+    unsigned char flags;
+    /// Maximum SPI clock frequency of the device, in Hz.
+    unsigned int maxSpck;
 
 } At26Desc;
 
@@ -221,8 +258,40 @@ typedef struct _At26 {
 	SpidCmd command;
     /// Pointer to a descriptor for the serial firmware flash device.
 	const At26Desc *pDesc;
+    /// Chip select of the device.
+    unsigned char cs;
     /// Command buffer.
 	unsigned int pCmdBuffer[2];
+    /// Set while the command is queued or transferred by the SPI driver.
+    volatile unsigned char commandPending;
+    /// Callback of the current command.
+    SpidCallback commandCallback;
+    /// Argument of the current command callback.
+    void *pCommandArgument;
+    /// Step of the operation in progress (AT26_STATE_xxx).
+    volatile unsigned char state;
+    /// 1 if the operation is an erase, 0 if it is a write.
+    unsigned char erase;
+    /// Set once a sequential program has been started.
+    unsigned char sequential;
+    /// Program or erase command of the current step.
+    unsigned char opcode;
+    /// Status register read by the operation.
+    unsigned char status;
+    /// Data byte of a sequential program.
+    unsigned char dataByte;
+    /// Data left to write.
+    unsigned char *pData;
+    /// Address of the current step.
+    unsigned int address;
+    /// Number of bytes left to write or erase.
+    unsigned int size;
+    /// Number of bytes written or erased by the current step.
+    unsigned int chunk;
+    /// Callback invoked at the end of the operation.
+    SpidCallback callback;
+    /// Argument of the callback.
+    void *pArgument;
 
 } At26;
 
@@ -248,5 +317,36 @@ extern const At26Desc * AT26_FindDevice(
     At26 *pAt26,
     unsigned int jedecId);
 
+extern unsigned char AT26_ReadStatus(At26 *pAt26);
+
+extern void AT26_WaitReady(At26 *pAt26);
+
+extern unsigned int AT26_ReadJedecId(At26 *pAt26);
+
+extern unsigned char AT26_Unprotect(At26 *pAt26);
+
+extern unsigned char AT26_Read(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument);
+
+extern unsigned char AT26_Write(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument);
+
+extern unsigned char AT26_Erase(
+    At26 *pAt26,
+    unsigned int address,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument);
+
 #endif //#ifndef AT26_H
 
@@ -34,6 +34,7 @@
 #include "at45.h"
 #include <board.h>
 #include <utility/assert.h>
+#include <utility/trace.h>
 
 #include <string.h>
 
@@ -56,69 +57,44 @@ static unsigned char configuredBinaryPage;
 //------------------------------------------------------------------------------
 
 static const At45Desc at45Devices[] = {
-    {  512,  1, 264,   9, 0x0C, "AT45DB011D"},
-    { 1024,  1, 264,   9, 0x14, "AT45DB021D"},
-    { 2048,  1, 264,   9, 0x1C, "AT45DB041D"},
-    { 4096,  1, 264,   9, 0x24, "AT45DB081D"},
-    { 4096,  1, 528,  10, 0x2C, "AT45DB161D"},
-    { 8192,  1, 528,  10, 0x34, "AT45DB321D"},
-    { 8192,  1, 1056, 11, 0x3C, "AT45DB642D"},
-    {16384,  1, 1056, 11, 0x10, "AT45DB1282"},
-    {16384,  1, 2112, 12, 0x18, "AT45DB2562"},
-    {32768,  1, 2112, 12, 0x20, "AT45DB5122"}
+    {  512,  1,  264,  9, 3, AT45_RECIPROCAL(264, 3), 0x0C, "AT45DB011D"},
+    { 1024,  1,  264,  9, 3, AT45_RECIPROCAL(264, 3), 0x14, "AT45DB021D"},
+    { 2048,  1,  264,  9, 3, AT45_RECIPROCAL(264, 3), 0x1C, "AT45DB041D"},
+    { 4096,  1,  264,  9, 3, AT45_RECIPROCAL(264, 3), 0x24, "AT45DB081D"},
+    { 4096,  1,  528, 10, 4, AT45_RECIPROCAL(528, 4), 0x2C, "AT45DB161D"},
+    { 8192,  1,  528, 10, 4, AT45_RECIPROCAL(528, 4), 0x34, "AT45DB321D"},
+    { 8192,  1, 1056, 11, 5, AT45_RECIPROCAL(1056, 5), 0x3C, "AT45DB642D"},
+    {16384,  1, 1056, 11, 5, AT45_RECIPROCAL(1056, 5), 0x10, "AT45DB1282"},
+    {16384,  1, 2112, 12, 6, AT45_RECIPROCAL(2112, 6), 0x18, "AT45DB2562"},
+    {32768,  1, 2112, 12, 6, AT45_RECIPROCAL(2112, 6), 0x20, "AT45DB5122"}
 };
 
 //------------------------------------------------------------------------------
-//         Exported functions
+//         Internal functions
 //------------------------------------------------------------------------------
 
+static void AT45_StreamCallback(unsigned char status, void *pArgument);
+
 //------------------------------------------------------------------------------
-/// Initializes an AT45 instance and configures SPI chip select register.
-/// Always returns 0.
-/// \param pAt45  Pointer to the At45 instance to initialize.
-/// \param pSpid  Pointer to the underlying SPI driver.
-/// \param spiCs  Chip select value to connect to the At45.
+/// Ends the current command and invokes its callback, which may send the next
+/// command.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the At45 driver instance.
 //------------------------------------------------------------------------------
-unsigned char AT45_Configure(At45 *pAt45, Spid *pSpid, unsigned char spiCs)
+static void AT45_CommandCallback(unsigned char status, void *pArgument)
 {
-    SpidCmd *pCommand;
-
-    // Sanity checks
-    ASSERT(pSpid, "AT45_Configure: pSpid is 0.\n\r");
-    ASSERT(pAt45, "AT45_Configure: pAt45 is 0.\n\r");
-
-    // Initialize the At45 instance
-    pAt45->pSpid = pSpid;
-    pAt45->pDesc = 0;
-    memset(pAt45->pCmdBuffer, 0, 8);
-
-    // Initialize the spidCmd structure
-    pCommand = &(pAt45->command);
-    pCommand->pCmd = pAt45->pCmdBuffer;
-    pCommand->callback = 0;
-    pCommand->pArgument = 0;
-    pCommand->spiCs = spiCs;
+    At45 *pAt45 = (At45 *) pArgument;
 
-    return 0;
-}
+    pAt45->commandPending = 0;
+    if (pAt45->commandCallback) {
 
-//------------------------------------------------------------------------------
-/// This function returns 1 if the At45 driver is not executing any command;
-/// otherwise it returns 0.
-/// \param pAt45  Pointer to an At45 instance.
-//------------------------------------------------------------------------------
-unsigned char AT45_IsBusy(At45 *pAt45)
-{
-    return SPID_IsBusy(pAt45->pSpid);
+        pAt45->commandCallback(status, pAt45->pCommandArgument);
+    }
 }
 
 //------------------------------------------------------------------------------
-/// Sends a command to the dataflash through the SPI. The command is identified
-/// by its command code and the number of bytes to transfer (1 + number of
-/// address bytes + number of dummy bytes). If data needs to be received, then
-/// a data buffer must be provided.
-/// This function does not block; its optional callback will be invoked when
-/// the transfer completes.
+/// Sends a command to the dataflash through the SPI, whether a streaming
+/// write is in progress or not (see AT45_SendCommand).
 /// \param pAt45  Pointer to an At45 driver instance.
 /// \param cmd  Command code.
 /// \param cmdSize  Size of command code + address bytes + dummy bytes.
@@ -128,7 +104,7 @@ unsigned char AT45_IsBusy(At45 *pAt45)
 /// \param callback  Optional callback to invoke at end of transfer.
 /// \param pArgument  Optional parameter to the callback function.
 //------------------------------------------------------------------------------
-unsigned char AT45_SendCommand(
+static unsigned char AT45_Send(
     At45 *pAt45,
     unsigned char cmd,
     unsigned char cmdSize,
@@ -141,14 +117,15 @@ unsigned char AT45_SendCommand(
     SpidCmd *pCommand;
     const At45Desc *pDesc = pAt45->pDesc;
     unsigned int dfAddress = 0;
+    unsigned int page;
 
     // Sanity checks
     ASSERT(pAt45, "AT45_Command: pAt45 is 0.\n\r");
     ASSERT(pDesc || (cmd == AT45_STATUS_READ),
            "AT45_Command: Device has no descriptor, only STATUS_READ command allowed\n\r");
 
-    // Check if the SPI driver is available
-    if (AT45_IsBusy(pAt45)) {
+    // Check if the previous command has ended
+    if (pAt45->commandPending) {
 
         return AT45_ERROR_LOCK;
     }
@@ -161,9 +138,14 @@ unsigned char AT45_SendCommand(
 
         ASSERT(pDesc, "AT45_Command: No descriptor for dataflash.\n\r");
         if (!configuredBinaryPage) {
-            dfAddress =
-                ((address / (pDesc->pageSize)) << pDesc->pageOffset)
-                 + (address % (pDesc->pageSize));
+
+            // Divide by the page size with a shift and a multiply by the
+            // reciprocal of its odd factor, there is no hardware divider
+            page = (unsigned int)
+                   (((unsigned long long) (address >> pDesc->pageShift)
+                     * pDesc->pageReciprocal) >> 32);
+            dfAddress = (page << pDesc->pageOffset)
+                        + (address - page * pDesc->pageSize);
         }
         else {
             dfAddress = address;
@@ -194,18 +176,406 @@ unsigned char AT45_SendCommand(
     pCommand->cmdSize = cmdSize;
     pCommand->pData = pData;
     pCommand->dataSize = dataSize;
-    pCommand->callback = callback;
-    pCommand->pArgument = pArgument;
+    pCommand->callback = AT45_CommandCallback;
+    pCommand->pArgument = pAt45;
+    pAt45->commandCallback = callback;
+    pAt45->pCommandArgument = pArgument;
 
-    // Send Command and data through the SPI
-    if (SPID_SendCommand(pAt45->pSpid, pCommand)) {
+    // Queue Command and data, the SPI may be shared with other devices
+    pAt45->commandPending = 1;
+    if (SPID_QueueCommand(pAt45->pSpid, pCommand)) {
 
+        pAt45->commandPending = 0;
         return AT45_ERROR_SPI;
     }
 
     return 0;
 }
 
+//------------------------------------------------------------------------------
+/// Ends the streaming write and invokes its callback.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param status  0 if successful; otherwise AT45_ERROR_SPI or
+///                AT45_ERROR_VERIFY.
+//------------------------------------------------------------------------------
+static void AT45_StreamEnd(At45 *pAt45, unsigned char status)
+{
+    pAt45->streamState = AT45_STREAM_IDLE;
+    pAt45->pollPending = 0;
+    if (pAt45->streamCallback) {
+
+        pAt45->streamCallback(status, pAt45->pStreamArgument);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads the status register for the streaming write, right away or at the
+/// next AT45_Poll call when the reads are paced by a timer.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param now  1 to read the status at once in any case.
+//------------------------------------------------------------------------------
+static void AT45_StreamReadStatus(At45 *pAt45, unsigned char now)
+{
+    if (pAt45->timerPolling && !now) {
+
+        pAt45->pollPending = 1;
+        return;
+    }
+
+    if (AT45_Send(pAt45, AT45_STATUS_READ, 1, pAt45->streamStatus,
+                  AT45_STATUS_POLL_SIZE, 0, AT45_StreamCallback, pAt45)) {
+
+        AT45_StreamEnd(pAt45, AT45_ERROR_SPI);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sends the next part of a page loaded by the streaming write: its data, then
+/// its trailer, copied first in the scratch buffer if there is one. Loads the
+/// page being programmed when its trailer is reloaded after a failed compare,
+/// the current page otherwise.
+/// \param pAt45  Pointer to an At45 driver instance.
+//------------------------------------------------------------------------------
+static void AT45_StreamLoad(At45 *pAt45)
+{
+    At45StreamPage *pPage;
+    unsigned char buffer;
+    unsigned int offset = pAt45->loadOffset;
+    unsigned char *pData;
+    unsigned int size;
+
+    if (pAt45->programRetry) {
+
+        pPage = &(pAt45->programPage);
+        buffer = pAt45->programBuffer;
+    }
+    else {
+
+        pPage = &(pAt45->streamPage);
+        buffer = pAt45->streamBuffer;
+    }
+
+    if (offset < pPage->size) {
+
+        pData = pPage->pData + offset;
+        size = pPage->size - offset;
+    }
+    else {
+
+        pData = pPage->pTrailer + (offset - pPage->size);
+        size = pPage->size + pPage->trailerSize - offset;
+    }
+    if (pAt45->pStreamScratch) {
+
+        if (size > pAt45->streamScratchSize) {
+
+            size = pAt45->streamScratchSize;
+        }
+        memcpy(pAt45->pStreamScratch, pData, size);
+        pData = pAt45->pStreamScratch;
+    }
+
+    pAt45->streamState = AT45_STREAM_LOAD;
+    pAt45->loadOffset += size;
+    if (AT45_Send(pAt45, buffer ? AT45_BUF2_WRITE : AT45_BUF1_WRITE,
+                  4, pData, size, offset, AT45_StreamCallback, pAt45)) {
+
+        AT45_StreamEnd(pAt45, AT45_ERROR_SPI);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Sends the program command of the page loaded in the program buffer.
+/// \param pAt45  Pointer to an At45 driver instance.
+//------------------------------------------------------------------------------
+static void AT45_StreamProgram(At45 *pAt45)
+{
+    pAt45->streamState = AT45_STREAM_PROGRAM;
+    pAt45->programCompared = 0;
+    if (AT45_Send(pAt45,
+                  pAt45->programBuffer ?
+                      AT45_BUF2_MEM_ERASE : AT45_BUF1_MEM_ERASE,
+                  4, 0, 0, pAt45->programPage.address,
+                  AT45_StreamCallback, pAt45)) {
+
+        AT45_StreamEnd(pAt45, AT45_ERROR_SPI);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Asks the source for the next page and starts loading it in the current
+/// device buffer; waits for the end of the last program if there is none.
+/// \param pAt45  Pointer to an At45 driver instance.
+//------------------------------------------------------------------------------
+static void AT45_StreamNext(At45 *pAt45)
+{
+    if (pAt45->streamSource(pAt45->pSourceArgument,
+                            AT45_STREAM_NEXT, &(pAt45->streamPage))) {
+
+        pAt45->loadOffset = 0;
+        AT45_StreamLoad(pAt45);
+    }
+    else {
+
+        pAt45->streamState = AT45_STREAM_WAIT;
+        AT45_StreamReadStatus(pAt45, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Handles the device ready after a program or a compare: compares the
+/// programmed page with its buffer when the write is verified, programs it
+/// again at the replacement address given by the source if it does not match,
+/// then programs the loaded page and loads the next one in the other buffer.
+/// \param pAt45  Pointer to an At45 driver instance.
+//------------------------------------------------------------------------------
+static void AT45_StreamReady(At45 *pAt45)
+{
+    unsigned char status = pAt45->streamStatus[AT45_STATUS_POLL_SIZE - 1];
+
+    if (pAt45->programPending) {
+
+        if (pAt45->streamVerify && !pAt45->programCompared) {
+
+            pAt45->programCompared = 1;
+            pAt45->streamState = AT45_STREAM_COMPARE;
+            if (AT45_Send(pAt45,
+                          pAt45->programBuffer ?
+                              AT45_PAGE_BUF2_CMP : AT45_PAGE_BUF1_CMP,
+                          4, 0, 0, pAt45->programPage.address,
+                          AT45_StreamCallback, pAt45)) {
+
+                AT45_StreamEnd(pAt45, AT45_ERROR_SPI);
+            }
+            return;
+        }
+        if (pAt45->streamVerify && AT45_STATUS_COMPARE(status)) {
+
+            if (!pAt45->streamSource(pAt45->pSourceArgument,
+                                     AT45_STREAM_FAILED,
+                                     &(pAt45->programPage))) {
+
+                AT45_StreamEnd(pAt45, AT45_ERROR_VERIFY);
+            }
+            else if (pAt45->programPage.trailerSize > 0) {
+
+                pAt45->programRetry = 1;
+                pAt45->loadOffset = pAt45->programPage.size;
+                AT45_StreamLoad(pAt45);
+            }
+            else {
+
+                AT45_StreamProgram(pAt45);
+            }
+            return;
+        }
+        pAt45->programPending = 0;
+        pAt45->streamSource(pAt45->pSourceArgument,
+                            AT45_STREAM_DONE, &(pAt45->programPage));
+    }
+
+    if (pAt45->pageLoaded) {
+
+        pAt45->pageLoaded = 0;
+        pAt45->programPending = 1;
+        pAt45->programPage = pAt45->streamPage;
+        pAt45->programBuffer = pAt45->streamBuffer;
+        pAt45->streamBuffer ^= 1;
+        AT45_StreamProgram(pAt45);
+    }
+    else {
+
+        AT45_StreamEnd(pAt45, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Advances the streaming write at the end of each of its SPI transfers. A
+/// page is programmed once the device is done with the previous one, then the
+/// next page is loaded in the other buffer while it is programmed.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the At45 driver instance.
+//------------------------------------------------------------------------------
+static void AT45_StreamCallback(unsigned char status, void *pArgument)
+{
+    At45 *pAt45 = (At45 *) pArgument;
+    At45StreamPage *pPage;
+
+    switch (pAt45->streamState) {
+
+        // Load the rest of the page, then wait for the previous page
+        case AT45_STREAM_LOAD:
+            pPage = pAt45->programRetry ?
+                        &(pAt45->programPage) : &(pAt45->streamPage);
+            if (pAt45->loadOffset < pPage->size + pPage->trailerSize) {
+
+                AT45_StreamLoad(pAt45);
+            }
+            else if (pAt45->programRetry) {
+
+                pAt45->programRetry = 0;
+                AT45_StreamProgram(pAt45);
+            }
+            else {
+
+                pAt45->pageLoaded = 1;
+                pAt45->streamState = AT45_STREAM_WAIT;
+                AT45_StreamReadStatus(pAt45, 1);
+            }
+            break;
+
+        // Load the next page while the device programs this one
+        case AT45_STREAM_PROGRAM:
+            if (!pAt45->pageLoaded) {
+
+                AT45_StreamNext(pAt45);
+            }
+            else {
+
+                pAt45->streamState = AT45_STREAM_WAIT;
+                AT45_StreamReadStatus(pAt45, 0);
+            }
+            break;
+
+        case AT45_STREAM_COMPARE:
+            pAt45->streamState = AT45_STREAM_WAIT;
+            AT45_StreamReadStatus(pAt45, 0);
+            break;
+
+        case AT45_STREAM_WAIT:
+            if (!AT45_STATUS_READY(
+                     pAt45->streamStatus[AT45_STATUS_POLL_SIZE - 1])) {
+
+                AT45_StreamReadStatus(pAt45, 0);
+            }
+            else {
+
+                AT45_StreamReady(pAt45);
+            }
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Source of AT45_StreamWrite, giving the pages of a contiguous run.
+/// \param pArgument  Pointer to the At45 driver instance.
+/// \param event  AT45_STREAM_xxx event.
+/// \param pPage  Page to fill.
+//------------------------------------------------------------------------------
+static unsigned char AT45_StreamRun(void *pArgument,
+                                    unsigned char event,
+                                    At45StreamPage *pPage)
+{
+    At45 *pAt45 = (At45 *) pArgument;
+    unsigned int pageSize = AT45_PageSize(pAt45);
+
+    if ((event != AT45_STREAM_NEXT) || (pAt45->streamSize == 0)) {
+
+        return 0;
+    }
+
+    pPage->pData = pAt45->pStreamData;
+    pPage->size = pageSize;
+    pPage->pTrailer = 0;
+    pPage->trailerSize = 0;
+    pPage->address = pAt45->streamAddress;
+    pAt45->pStreamData += pageSize;
+    pAt45->streamAddress += pageSize;
+    pAt45->streamSize -= pageSize;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes an AT45 instance and configures SPI chip select register.
+/// Always returns 0.
+/// \param pAt45  Pointer to the At45 instance to initialize.
+/// \param pSpid  Pointer to the underlying SPI driver.
+/// \param spiCs  Chip select value to connect to the At45.
+//------------------------------------------------------------------------------
+unsigned char AT45_Configure(At45 *pAt45, Spid *pSpid, unsigned char spiCs)
+{
+    SpidCmd *pCommand;
+
+    // Sanity checks
+    ASSERT(pSpid, "AT45_Configure: pSpid is 0.\n\r");
+    ASSERT(pAt45, "AT45_Configure: pAt45 is 0.\n\r");
+
+    // Initialize the At45 instance
+    pAt45->pSpid = pSpid;
+    pAt45->pDesc = 0;
+    memset(pAt45->pCmdBuffer, 0, 8);
+
+    // Initialize the spidCmd structure
+    pCommand = &(pAt45->command);
+    pCommand->pCmd = pAt45->pCmdBuffer;
+    pCommand->callback = 0;
+    pCommand->pArgument = 0;
+    pCommand->spiCs = spiCs;
+
+    // No command nor streaming write in progress
+    pAt45->commandPending = 0;
+    pAt45->streamState = AT45_STREAM_IDLE;
+    pAt45->timerPolling = 0;
+    pAt45->pollPending = 0;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// This function returns 1 if the At45 driver is executing a command or a
+/// streaming write; otherwise it returns 0.
+/// \param pAt45  Pointer to an At45 instance.
+//------------------------------------------------------------------------------
+unsigned char AT45_IsBusy(At45 *pAt45)
+{
+    return pAt45->commandPending
+           || (pAt45->streamState != AT45_STREAM_IDLE);
+}
+
+//------------------------------------------------------------------------------
+/// Sends a command to the dataflash through the SPI. The command is identified
+/// by its command code and the number of bytes to transfer (1 + number of
+/// address bytes + number of dummy bytes). If data needs to be received, then
+/// a data buffer must be provided.
+/// This function does not block; its optional callback will be invoked when
+/// the transfer completes.
+/// Returns 0 if the command has been sent; otherwise returns AT45_ERROR_LOCK
+/// if the At45 driver is in use (SPI transfer or streaming write in progress)
+/// or AT45_ERROR_SPI if there was an error with the SPI driver.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param cmd  Command code.
+/// \param cmdSize  Size of command code + address bytes + dummy bytes.
+/// \param pData  Data buffer.
+/// \param dataSize  Number of data bytes to send/receive.
+/// \param address  Address at which the command is performed if meaningful.
+/// \param callback  Optional callback to invoke at end of transfer.
+/// \param pArgument  Optional parameter to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT45_SendCommand(
+    At45 *pAt45,
+    unsigned char cmd,
+    unsigned char cmdSize,
+    unsigned char *pData,
+    unsigned int dataSize,
+    unsigned int address,
+    SpidCallback callback,
+    void *pArgument)
+{
+    // The commands of a streaming write must not be interleaved with others
+    if (pAt45->streamState != AT45_STREAM_IDLE) {
+
+        return AT45_ERROR_LOCK;
+    }
+
+    return AT45_Send(pAt45, cmd, cmdSize, pData, dataSize, address,
+                     callback, pArgument);
+}
+
 //------------------------------------------------------------------------------
 /// This function returns the At45Desc structure corresponding to the device
 /// connected
@@ -255,3 +625,185 @@ unsigned int  AT45_PageSize(At45 *pAt45)
     }
     return ((pagesize >> 8) << 8);
 }
+
+//------------------------------------------------------------------------------
+/// Starts writing a run of whole pages, loading each page in a device buffer
+/// while the previous one is programmed from the other buffer. The callback
+/// is invoked from the SPI interrupt when the last page is programmed; the
+/// data buffer is overwritten by the SPI transfers.
+/// Returns 0 if the write is started; otherwise returns AT45_ERROR_LOCK if
+/// the At45 driver is in use.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param address  Address of the first page, aligned on a page.
+/// \param pData  Data to write.
+/// \param size  Number of bytes to write, a multiple of the page size.
+/// \param callback  Optional callback to invoke at the end of the write.
+/// \param pArgument  Optional parameter to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT45_StreamWrite(
+    At45 *pAt45,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size,
+    SpidCallback callback,
+    void *pArgument)
+{
+    // Sanity checks
+    ASSERT(pAt45, "AT45_StreamWrite: pAt45 is 0.\n\r");
+    ASSERT(pAt45->pDesc, "AT45_StreamWrite: No descriptor for dataflash.\n\r");
+    ASSERT((address % AT45_PageSize(pAt45)) == 0,
+           "AT45_StreamWrite: Address not aligned on a page.\n\r");
+    ASSERT((size % AT45_PageSize(pAt45)) == 0,
+           "AT45_StreamWrite: Size not a multiple of the page size.\n\r");
+
+    if (AT45_IsBusy(pAt45)) {
+
+        return AT45_ERROR_LOCK;
+    }
+
+    pAt45->pStreamData = pData;
+    pAt45->streamSize = size;
+    pAt45->streamAddress = address;
+
+    return AT45_StreamWritePages(pAt45, AT45_StreamRun, pAt45, 0, 0, 0,
+                                 callback, pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing the pages given one by one by a source, loading each page in
+/// a device buffer while the previous one is programmed from the other buffer.
+/// The source gives the first page before this function returns, the other
+/// events come from the SPI interrupt; so does the callback, invoked when the
+/// last page is done.
+/// When verify is set, each page is compared with its buffer once programmed;
+/// a page which does not match is reported to the source, which can give
+/// another address (and trailer) to program the buffer again.
+/// Returns 0 if the write is started; otherwise returns AT45_ERROR_LOCK if
+/// the At45 driver is in use.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param source  Source of the pages.
+/// \param pSourceArgument  Argument of the source.
+/// \param pScratch  Optional buffer through which the pages are sent, leaving
+///                  the data of the source intact; 0 to send the data directly,
+///                  overwriting it.
+/// \param scratchSize  Size of the scratch buffer.
+/// \param verify  1 to compare each programmed page with its buffer.
+/// \param callback  Optional callback to invoke at the end of the write.
+/// \param pArgument  Optional parameter to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT45_StreamWritePages(
+    At45 *pAt45,
+    At45StreamSource source,
+    void *pSourceArgument,
+    unsigned char *pScratch,
+    unsigned int scratchSize,
+    unsigned char verify,
+    SpidCallback callback,
+    void *pArgument)
+{
+    // Sanity checks
+    ASSERT(pAt45, "AT45_StreamWritePages: pAt45 is 0.\n\r");
+    ASSERT(source, "AT45_StreamWritePages: source is 0.\n\r");
+    ASSERT(!pScratch || (scratchSize > 0),
+           "AT45_StreamWritePages: Empty scratch buffer.\n\r");
+
+    if (AT45_IsBusy(pAt45)) {
+
+        return AT45_ERROR_LOCK;
+    }
+    if (!source(pSourceArgument, AT45_STREAM_NEXT, &(pAt45->streamPage))) {
+
+        if (callback) {
+
+            callback(0, pArgument);
+        }
+        return 0;
+    }
+
+    pAt45->streamSource = source;
+    pAt45->pSourceArgument = pSourceArgument;
+    pAt45->pStreamScratch = pScratch;
+    pAt45->streamScratchSize = scratchSize;
+    pAt45->streamVerify = verify;
+    pAt45->streamBuffer = 0;
+    pAt45->pageLoaded = 0;
+    pAt45->programPending = 0;
+    pAt45->programRetry = 0;
+    pAt45->loadOffset = 0;
+    pAt45->streamCallback = callback;
+    pAt45->pStreamArgument = pArgument;
+    AT45_StreamLoad(pAt45);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Selects how the device status is read while a streaming write waits for a
+/// page to be programmed. By default the reads follow each other from the SPI
+/// interrupt; when paced by a timer, each read waits for the next AT45_Poll
+/// call and leaves the SPI bus meanwhile.
+/// \param pAt45  Pointer to an At45 driver instance.
+/// \param timer  1 if AT45_Poll is called periodically, 0 otherwise.
+//------------------------------------------------------------------------------
+void AT45_ConfigurePolling(At45 *pAt45, unsigned char timer)
+{
+    pAt45->timerPolling = timer;
+}
+
+//------------------------------------------------------------------------------
+/// Resumes the status reads of a streaming write paced by a timer. Must be
+/// called periodically (e.g. from a timer interrupt which does not preempt
+/// SPID_Handler) when the reads are paced by a timer.
+/// \param pAt45  Pointer to an At45 driver instance.
+//------------------------------------------------------------------------------
+void AT45_Poll(At45 *pAt45)
+{
+    if (pAt45->pollPending) {
+
+        pAt45->pollPending = 0;
+        AT45_StreamReadStatus(pAt45, 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Configures a device with the optional power-of-two page size in binary page
+/// mode, so that its linear addresses are sent as is. This configuration is
+/// one-time programmable: it can not be undone, and the spare bytes of each
+/// page are lost (see at45ftl). It takes effect once the device is ready and
+/// has been power cycled.
+/// Returns 0 if successful or if the device is already in binary page mode;
+/// otherwise returns AT45_ERROR_DEVICE if the device has no binary page mode,
+/// AT45_ERROR_LOCK if the At45 driver is in use or AT45_ERROR_SPI if there was
+/// an error with the SPI driver.
+/// \param pAt45  Pointer to an AT45 driver instance.
+//------------------------------------------------------------------------------
+unsigned char AT45_ConfigureBinaryPage(At45 *pAt45)
+{
+    unsigned char pSequence[] = {AT45_BINARY_PAGE};
+    unsigned char error;
+
+    // Sanity checks
+    ASSERT(pAt45, "AT45_ConfigureBinaryPage: pAt45 is 0.\n\r");
+    ASSERT(pAt45->pDesc, "AT45_ConfigureBinaryPage: No descriptor for dataflash.\n\r");
+
+    if (configuredBinaryPage) {
+
+        return 0;
+    }
+    if (!pAt45->pDesc->hasBinaryPage) {
+
+        return AT45_ERROR_DEVICE;
+    }
+
+    // The three last bytes of the opcode are sent as data
+    error = AT45_SendCommand(pAt45, AT45_BINARY_PAGE_FIRST_OPCODE, 1,
+                             pSequence, sizeof(pSequence), 0, 0, 0);
+    if (error) {
+
+        return error;
+    }
+    while (AT45_IsBusy(pAt45));
+
+    TRACE_WARNING("AT45_ConfigureBinaryPage: Power cycle the device\n\r");
+    return 0;
+}
@@ -66,6 +66,30 @@
 ///    -# This function does not block; its optional callback will
 ///       be invoked when the transfer completes.
 /// -# Check the AT45 driver is ready or not by polling AT45_IsBusy().
+/// -# A device with the optional power-of-two page size can be configured
+///    once for all in binary page mode with AT45_ConfigureBinaryPage(), which
+///    removes the page/offset split of the addresses; AT45_FindDevice()
+///    detects the mode of the device. Otherwise the split is computed without
+///    division, from the pageShift and pageReciprocal fields of At45Desc.
+/// -# Write runs of whole pages with AT45_StreamWrite(). The pages are loaded
+///    in the SRAM buffers 1 and 2 of the device in turn, each page being
+///    loaded while the previous one is programmed from the other buffer;
+///    the callback is invoked from the SPI interrupt once the last page is
+///    programmed. The data buffer is overwritten by the SPI transfers, and
+///    AT45_SendCommand() returns AT45_ERROR_LOCK until AT45_IsBusy() returns 0.
+/// -# AT45_StreamWritePages() pipelines pages given one by one by a source
+///    (At45StreamSource) at any address, each with an optional trailer. The
+///    pages can be copied through a scratch buffer to keep the data intact,
+///    and compared with their buffer once programmed; a page which does not
+///    match is programmed again at the address given by the source.
+/// -# By default the device status is read again as soon as the previous
+///    read ends while it programs a page. Each read clocks out
+///    AT45_STATUS_POLL_SIZE status bytes, so the SPI interrupt fires about
+///    every (AT45_STATUS_POLL_SIZE + 1) * 8 SPCK periods, i.e. every 72us at
+///    1MHz or 9us at 8MHz, during the few milliseconds of each page program.
+///    Call AT45_ConfigurePolling() and then AT45_Poll() periodically (e.g.
+///    from a timer interrupt) to pace these reads instead and leave the CPU
+///    and the SPI bus to other tasks.
 ///
 //------------------------------------------------------------------------------
 
@@ -86,6 +110,40 @@
 #define AT45_ERROR_LOCK         1
 /// There was an error with the SPI driver.
 #define AT45_ERROR_SPI          2
+/// The device does not support the operation.
+#define AT45_ERROR_DEVICE       3
+/// A page of a streaming write did not match its buffer once programmed, and
+/// the source gave no replacement page.
+#define AT45_ERROR_VERIFY       4
+
+/// No streaming write in progress.
+#define AT45_STREAM_IDLE        0
+/// A page is loaded in a buffer of the device.
+#define AT45_STREAM_LOAD        1
+/// Waiting for the device to end a program or a compare.
+#define AT45_STREAM_WAIT        2
+/// The program command of a page is sent.
+#define AT45_STREAM_PROGRAM     3
+/// The compare command of the programmed page is sent.
+#define AT45_STREAM_COMPARE     4
+
+/// Event of a streaming write source: give the next page to load, or return 0
+/// if there is none.
+#define AT45_STREAM_NEXT        0
+/// Event of a streaming write source: the given page is programmed (and
+/// matches its buffer when the write is verified).
+#define AT45_STREAM_DONE        1
+/// Event of a streaming write source: the given page does not match its
+/// buffer once programmed. Change its address (and trailer) to program the
+/// buffer again elsewhere, or return 0 to abort the write.
+#define AT45_STREAM_FAILED      2
+
+/// Number of status bytes read by each status poll of a streaming write. The
+/// device updates the status register continuously while it is clocked out,
+/// so that a longer read means fewer SPI interrupts.
+#ifndef AT45_STATUS_POLL_SIZE
+#define AT45_STATUS_POLL_SIZE   8
+#endif
 
 /// AT45 dataflash SPI CSR settings given MCK and SPCK.
 #define AT45_CSR(mck, spck) \
@@ -96,6 +154,10 @@
 //         Macros
 //------------------------------------------------------------------------------
 
+/// Reciprocal of the odd factor of a page size, scaled by 2^32, given the
+/// page size and the number of its trailing zero bits.
+#define AT45_RECIPROCAL(size, shift)    ((0xFFFFFFFF / ((size) >> (shift))) + 1)
+
 #define AT45_PageOffset(pAt45) ((pAt45)->pDesc->pageOffset)
 #define AT45_PageNumber(pAt45) ((pAt45)->pDesc->pageNumber)
 
@@ -105,6 +167,8 @@
 #define AT45_STATUS_ID(status)          (status & 0x3c)
 /// Returns 1 if the device is configured in binary page mode; otherwise 0.
 #define AT45_STATUS_BINARY(status)      (status & 0x01)
+/// Returns 1 if the last compared page differs from the buffer; otherwise 0.
+#define AT45_STATUS_COMPARE(status)     (status & 0x40)
 
 //------------------------------------------------------------------------------
 //         Definitions
@@ -202,6 +266,10 @@ typedef struct {
 	unsigned int pageSize;
     /// page offset in command.
 	unsigned int pageOffset;
+    /// Number of trailing zero bits of the page size.
+	unsigned char pageShift;
+    /// Reciprocal of the odd factor of the page size (AT45_RECIPROCAL).
+	unsigned int pageReciprocal;
     /// Dataflash ID.
 	unsigned char id;
     /// Identifier.
@@ -209,6 +277,32 @@ typedef struct {
 
 } At45Desc;
 
+//------------------------------------------------------------------------------
+/// Page of a streaming write, given by its source. The data is loaded at the
+/// start of a device buffer, followed by the optional trailer (e.g. a spare
+/// area).
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Data of the page.
+    unsigned char *pData;
+    /// Number of data bytes.
+    unsigned int size;
+    /// Optional bytes loaded after the data, 0 if none.
+    unsigned char *pTrailer;
+    /// Number of trailer bytes.
+    unsigned int trailerSize;
+    /// Address of the page to program.
+    unsigned int address;
+
+} At45StreamPage;
+
+/// Source of the pages of a streaming write, invoked with an AT45_STREAM_xxx
+/// event. Except for the first page, it is invoked from the SPI interrupt.
+typedef unsigned char (*At45StreamSource)(void *pArgument,
+                                          unsigned char event,
+                                          At45StreamPage *pPage);
+
 //------------------------------------------------------------------------------
 /// Dataflash driver structure. It holds the current command being processed.
 /// This structure is initialized by the DF_Init() command.
@@ -227,6 +321,61 @@ typedef struct _Dataflash {
 	const At45Desc *pDesc;
     /// Buffer to store the current command (opcode + dataflash address.
 	unsigned char pCmdBuffer[8];
+    /// Set while the command is queued or transferred by the SPI driver.
+    volatile unsigned char commandPending;
+    /// Callback of the current command.
+    SpidCallback commandCallback;
+    /// Argument of the current command callback.
+    void *pCommandArgument;
+    /// Step of the streaming write (AT45_STREAM_xxx).
+    volatile unsigned char streamState;
+    /// Device buffer loaded by the streaming write, 0 or 1.
+    unsigned char streamBuffer;
+    /// Status register read by the streaming write, the last byte is the
+    /// most recent one.
+    unsigned char streamStatus[AT45_STATUS_POLL_SIZE];
+    /// Set when the status reads are paced by AT45_Poll.
+    unsigned char timerPolling;
+    /// Set while a status read waits for the next AT45_Poll call.
+    volatile unsigned char pollPending;
+    /// Data left to load by AT45_StreamWrite.
+    unsigned char *pStreamData;
+    /// Number of bytes left to load by AT45_StreamWrite.
+    unsigned int streamSize;
+    /// Address of the next page to load by AT45_StreamWrite.
+    unsigned int streamAddress;
+    /// Source of the pages of the streaming write.
+    At45StreamSource streamSource;
+    /// Argument of the source.
+    void *pSourceArgument;
+    /// Optional buffer through which the pages are copied before being sent,
+    /// which leaves the data of the source intact, 0 if none.
+    unsigned char *pStreamScratch;
+    /// Size of the scratch buffer.
+    unsigned int streamScratchSize;
+    /// Set when each programmed page is compared with its buffer.
+    unsigned char streamVerify;
+    /// Page loaded, or being loaded, in the current device buffer.
+    At45StreamPage streamPage;
+    /// Number of bytes of the page (data and trailer) already loaded.
+    unsigned int loadOffset;
+    /// Set once streamPage is loaded and waits to be programmed.
+    unsigned char pageLoaded;
+    /// Page programmed from the other device buffer.
+    At45StreamPage programPage;
+    /// Device buffer of the programmed page, 0 or 1.
+    unsigned char programBuffer;
+    /// Set while the programmed page is not done.
+    unsigned char programPending;
+    /// Set once the programmed page is compared with its buffer.
+    unsigned char programCompared;
+    /// Set while the trailer of a page which failed its compare is loaded
+    /// again before programming it elsewhere.
+    unsigned char programRetry;
+    /// Callback invoked at the end of the streaming write.
+    SpidCallback streamCallback;
+    /// Argument of the streaming write callback.
+    void *pStreamArgument;
 
 } At45;
 
@@ -251,5 +400,30 @@ extern unsigned char AT45_SendCommand(
 extern const At45Desc * AT45_FindDevice(At45 *pAt45, unsigned char status);
 
 extern unsigned int  AT45_PageSize(At45 *pAt45);
+
+extern unsigned char AT45_ConfigureBinaryPage(At45 *pAt45);
+
+extern unsigned char AT45_StreamWrite(
+	At45 *pAt45,
+	unsigned int address,
+	unsigned char *pData,
+	unsigned int size,
+	SpidCallback callback,
+	void *pArgument);
+
+extern unsigned char AT45_StreamWritePages(
+	At45 *pAt45,
+	At45StreamSource source,
+	void *pSourceArgument,
+	unsigned char *pScratch,
+	unsigned int scratchSize,
+	unsigned char verify,
+	SpidCallback callback,
+	void *pArgument);
+
+extern void AT45_ConfigurePolling(At45 *pAt45, unsigned char timer);
+
+extern void AT45_Poll(At45 *pAt45);
+
 #endif // #ifndef AT45_H
 
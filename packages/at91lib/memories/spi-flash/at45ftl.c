@@ -0,0 +1,996 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "at45ftl.h"
+#include <utility/assert.h>
+#include <utility/trace.h>
+#include <utility/math.h>
+
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Internal definitions
+//------------------------------------------------------------------------------
+
+/// Logical page number stored in the spare area of a bad page.
+#define AT45FTL_BAD             0xFFFE
+
+/// Bit map of the pages in use.
+#define USED(pFtl)              ((pFtl)->pFlags)
+/// Bit map of the bad pages.
+#define BAD(pFtl)               ((pFtl)->pFlags + ((pFtl)->numPages + 7) / 8)
+
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the bit of a page in a bit map.
+/// \param pBits  Bit map.
+/// \param page  Page number.
+//------------------------------------------------------------------------------
+static unsigned char TestFlag(const unsigned char *pBits, unsigned int page)
+{
+    return (pBits[page >> 3] >> (page & 7)) & 1;
+}
+
+//------------------------------------------------------------------------------
+/// Sets the bit of a page in a bit map.
+/// \param pBits  Bit map.
+/// \param page  Page number.
+//------------------------------------------------------------------------------
+static void SetFlag(unsigned char *pBits, unsigned int page)
+{
+    pBits[page >> 3] |= 1 << (page & 7);
+}
+
+//------------------------------------------------------------------------------
+/// Clears the bit of a page in a bit map.
+/// \param pBits  Bit map.
+/// \param page  Page number.
+//------------------------------------------------------------------------------
+static void ClearFlag(unsigned char *pBits, unsigned int page)
+{
+    pBits[page >> 3] &= ~(1 << (page & 7));
+}
+
+//------------------------------------------------------------------------------
+/// Sends a command to the DataFlash and waits for the end of its SPI transfer,
+/// at most AT45FTL_COMMAND_TIMEOUT polls. Returns 0 if successful; otherwise
+/// returns AT45FTL_ERROR_AT45 or AT45FTL_ERROR_TIMEOUT.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param cmd  Command opcode.
+/// \param cmdSize  Size of the command in bytes.
+/// \param pData  Data buffer, overwritten by the transfer.
+/// \param size  Number of data bytes to send/receive.
+/// \param address  Linear address of the command.
+//------------------------------------------------------------------------------
+static unsigned char Command(
+    At45Ftl *pFtl,
+    unsigned char cmd,
+    unsigned char cmdSize,
+    unsigned char *pData,
+    unsigned int size,
+    unsigned int address)
+{
+    unsigned int timeout = AT45FTL_COMMAND_TIMEOUT;
+
+    if (AT45_SendCommand(pFtl->pAt45, cmd, cmdSize, pData, size, address, 0, 0)) {
+
+        TRACE_ERROR("AT45FTL: Command 0x%02X failed\n\r", cmd);
+        return AT45FTL_ERROR_AT45;
+    }
+    while (AT45_IsBusy(pFtl->pAt45)) {
+
+        if (--timeout == 0) {
+
+            TRACE_ERROR("AT45FTL: Command 0x%02X timeout\n\r", cmd);
+            return AT45FTL_ERROR_TIMEOUT;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Waits for the DataFlash to be ready, reading its status register at most
+/// AT45FTL_READY_TIMEOUT times, and returns it in pStatus. Returns 0 if
+/// successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param pStatus  Pointer to the status register value.
+//------------------------------------------------------------------------------
+static unsigned char WaitReady(At45Ftl *pFtl, unsigned char *pStatus)
+{
+    unsigned int timeout = AT45FTL_READY_TIMEOUT;
+    unsigned char error;
+
+    do {
+
+        if (timeout-- == 0) {
+
+            TRACE_ERROR("AT45FTL: DataFlash busy\n\r");
+            return AT45FTL_ERROR_TIMEOUT;
+        }
+        error = Command(pFtl, AT45_STATUS_READ, 1, pStatus, 1, 0);
+        if (error) {
+
+            return error;
+        }
+    }
+    while (!AT45_STATUS_READY(*pStatus));
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads the spare area of a page in pFtl->pSpare and returns the logical page
+/// it holds, AT45FTL_BAD if it is bad, or AT45FTL_NONE if it is free or
+/// its spare area is invalid.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Physical page number.
+/// \param pLogical  Pointer to the logical page number.
+//------------------------------------------------------------------------------
+static unsigned char ReadSpare(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned int *pLogical)
+{
+    unsigned char *pSpare = pFtl->pSpare;
+    unsigned short logical;
+    unsigned short check;
+    unsigned char error;
+
+    error = Command(pFtl, AT45_CONTINUOUS_READ_LEG, 8, pSpare,
+                    AT45FTL_SPARE_SIZE, page * pFtl->pageSize + pFtl->dataSize);
+    if (error) {
+
+        return error;
+    }
+
+    logical = pSpare[0] | (pSpare[1] << 8);
+    check = pSpare[2] | (pSpare[3] << 8);
+    if ((unsigned short) ~logical != check) {
+
+        *pLogical = AT45FTL_NONE;
+    }
+    else {
+
+        *pLogical = logical;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the sequence number of the spare area read by ReadSpare.
+/// \param pFtl  Pointer to an At45Ftl instance.
+//------------------------------------------------------------------------------
+static unsigned int SpareSequence(const At45Ftl *pFtl)
+{
+    const unsigned char *pSpare = pFtl->pSpare;
+
+    return pSpare[4] | (pSpare[5] << 8) | (pSpare[6] << 16) | (pSpare[7] << 24);
+}
+
+//------------------------------------------------------------------------------
+/// Fills pFtl->pSpare with the spare area of a logical page, with a new
+/// sequence number.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param logical  Logical page number, or AT45FTL_BAD.
+//------------------------------------------------------------------------------
+static void FillSpare(At45Ftl *pFtl, unsigned int logical)
+{
+    unsigned char *pSpare = pFtl->pSpare;
+    unsigned int sequence = ++pFtl->sequence;
+
+    pSpare[0] = logical & 0xFF;
+    pSpare[1] = (logical >> 8) & 0xFF;
+    pSpare[2] = ~pSpare[0];
+    pSpare[3] = ~pSpare[1];
+    pSpare[4] = sequence & 0xFF;
+    pSpare[5] = (sequence >> 8) & 0xFF;
+    pSpare[6] = (sequence >> 16) & 0xFF;
+    pSpare[7] = (sequence >> 24) & 0xFF;
+}
+
+//------------------------------------------------------------------------------
+/// Writes the spare area of a logical page in a chip buffer, with a new
+/// sequence number. Returns 0 if successful; otherwise returns an
+/// AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param buffer  Buffer write opcode, AT45_BUF1_WRITE or AT45_BUF2_WRITE.
+/// \param logical  Logical page number, or AT45FTL_BAD.
+//------------------------------------------------------------------------------
+static unsigned char WriteSpare(
+    At45Ftl *pFtl,
+    unsigned char buffer,
+    unsigned int logical)
+{
+    FillSpare(pFtl, logical);
+
+    return Command(pFtl, buffer, 4, pFtl->pSpare, AT45FTL_SPARE_SIZE,
+                   pFtl->dataSize);
+}
+
+//------------------------------------------------------------------------------
+/// Programs a page from a chip buffer, then compares it with the buffer.
+/// Returns 0 if successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Physical page number.
+/// \param buffer2  1 to program from the buffer 2, 0 for the buffer 1.
+/// \param pMatch  Set to 1 if the page matches the buffer; otherwise 0.
+//------------------------------------------------------------------------------
+static unsigned char Program(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char buffer2,
+    unsigned char *pMatch)
+{
+    unsigned int address = page * pFtl->pageSize;
+    unsigned char status;
+    unsigned char error;
+
+    error = Command(pFtl, buffer2 ? AT45_BUF2_MEM_ERASE : AT45_BUF1_MEM_ERASE,
+                    4, 0, 0, address);
+    if (!error) {
+
+        error = WaitReady(pFtl, &status);
+    }
+    if (!error) {
+
+        error = Command(pFtl, buffer2 ? AT45_PAGE_BUF2_CMP : AT45_PAGE_BUF1_CMP,
+                        4, 0, 0, address);
+    }
+    if (!error) {
+
+        error = WaitReady(pFtl, &status);
+    }
+    *pMatch = !error && !AT45_STATUS_COMPARE(status);
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+/// Marks a page which failed its compare as bad. The marker is programmed from
+/// the given chip buffer, whose data area is kept for the next attempt.
+/// Returns 0 if successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Physical page number.
+/// \param buffer2  1 if the data is in the buffer 2, 0 for the buffer 1.
+//------------------------------------------------------------------------------
+static unsigned char MarkBad(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char buffer2)
+{
+    unsigned char match;
+    unsigned char error;
+
+    TRACE_WARNING("AT45FTL: Page %u is bad\n\r", page);
+    SetFlag(BAD(pFtl), page);
+    pFtl->badPages++;
+
+    // The marker is best effort, a page holding garbage is free for the mount
+    error = WriteSpare(pFtl, buffer2 ? AT45_BUF2_WRITE : AT45_BUF1_WRITE,
+                       AT45FTL_BAD);
+    if (!error) {
+
+        error = Program(pFtl, page, buffer2, &match);
+    }
+
+    return error;
+}
+
+static unsigned char Allocate(At45Ftl *pFtl, unsigned int *pPage);
+
+//------------------------------------------------------------------------------
+/// Moves the data of a page in use to a free page, through the buffer 2.
+/// Returns 0 if successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Physical page number.
+//------------------------------------------------------------------------------
+static unsigned char Move(At45Ftl *pFtl, unsigned int page)
+{
+    unsigned int logical;
+    unsigned int destination;
+    unsigned char status;
+    unsigned char match;
+    unsigned char error;
+
+    error = ReadSpare(pFtl, page, &logical);
+    if (error || (logical >= pFtl->numLogical) || (pFtl->pMap[logical] != page)) {
+
+        return error;
+    }
+
+    // Copy the page in the buffer 2
+    error = Command(pFtl, AT45_PAGE_BUF2_TX, 4, 0, 0, page * pFtl->pageSize);
+    if (!error) {
+
+        error = WaitReady(pFtl, &status);
+    }
+
+    pFtl->moving = 1;
+    while (!error) {
+
+        error = Allocate(pFtl, &destination);
+        if (!error) {
+
+            error = WriteSpare(pFtl, AT45_BUF2_WRITE, logical);
+        }
+        if (!error) {
+
+            error = Program(pFtl, destination, 1, &match);
+        }
+        if (!error && match) {
+
+            pFtl->pMap[logical] = destination;
+            SetFlag(USED(pFtl), destination);
+            ClearFlag(USED(pFtl), page);
+            pFtl->moved++;
+            break;
+        }
+        if (!error) {
+
+            error = MarkBad(pFtl, destination, 1);
+        }
+    }
+    pFtl->moving = 0;
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+/// Takes the next good free page from the allocation pointer. Every
+/// AT45FTL_LEVELING_PERIOD pages in use passed by the pointer, the data of the
+/// last one is moved forward and the page it leaves is taken. Returns 0 if successful; otherwise returns an
+/// AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param pPage  Pointer to the allocated physical page number.
+//------------------------------------------------------------------------------
+static unsigned char Allocate(At45Ftl *pFtl, unsigned int *pPage)
+{
+    unsigned int page;
+    unsigned int i;
+    unsigned char error;
+
+    for (i = 0; i < pFtl->numPages; i++) {
+
+        page = pFtl->next;
+        pFtl->next++;
+        if (pFtl->next == pFtl->numPages) {
+
+            pFtl->next = 0;
+        }
+
+        if (TestFlag(BAD(pFtl), page)) {
+
+            continue;
+        }
+        if (!TestFlag(USED(pFtl), page)) {
+
+            *pPage = page;
+            return 0;
+        }
+
+        // Static data is recycled as the pointer goes around
+        pFtl->skipped++;
+        if (!pFtl->moving && (pFtl->skipped >= AT45FTL_LEVELING_PERIOD)) {
+
+            pFtl->skipped = 0;
+            error = Move(pFtl, page);
+            if (error) {
+
+                return error;
+            }
+
+            // The move consumed a free page ahead, take the one it released
+            if (!TestFlag(USED(pFtl), page)) {
+
+                *pPage = page;
+                return 0;
+            }
+        }
+    }
+
+    TRACE_ERROR("AT45FTL: No free page\n\r");
+    return AT45FTL_ERROR_FULL;
+}
+
+//------------------------------------------------------------------------------
+/// Loads data in the buffer 1 of the chip, through the chunk buffer since the
+/// SPI transfer overwrites the data it sends. Returns 0 if successful;
+/// otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param offset  Offset of the data in the buffer.
+/// \param pData  Data to load, 0 to fill with erased bytes.
+/// \param size  Number of bytes to load.
+//------------------------------------------------------------------------------
+static unsigned char LoadBuffer(
+    At45Ftl *pFtl,
+    unsigned int offset,
+    const unsigned char *pData,
+    unsigned int size)
+{
+    unsigned int chunk;
+    unsigned char error = 0;
+
+    while (!error && (size > 0)) {
+
+        chunk = min(size, AT45FTL_CHUNK_SIZE);
+        if (pData) {
+
+            memcpy(pFtl->pChunk, pData, chunk);
+            pData += chunk;
+        }
+        else {
+
+            memset(pFtl->pChunk, 0xFF, chunk);
+        }
+        error = Command(pFtl, AT45_BUF1_WRITE, 4, pFtl->pChunk, chunk, offset);
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+/// Ends an asynchronous transfer and invokes its callback.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param error  0 or an AT45FTL_ERROR_xxx code.
+//------------------------------------------------------------------------------
+static void EndTransfer(At45Ftl *pFtl, unsigned char error)
+{
+    pFtl->busy = 0;
+    if (pFtl->callback) {
+
+        pFtl->callback(pFtl->pArgument, error, pFtl->runDone);
+    }
+}
+
+static void ReadNext(At45Ftl *pFtl);
+
+//------------------------------------------------------------------------------
+/// Counts a page read by an asynchronous read and reads the next one.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the At45Ftl instance.
+//------------------------------------------------------------------------------
+static void ReadCallback(unsigned char status, void *pArgument)
+{
+    At45Ftl *pFtl = (At45Ftl *) pArgument;
+
+    pFtl->runDone++;
+    ReadNext(pFtl);
+}
+
+//------------------------------------------------------------------------------
+/// Fills the next logical pages of an asynchronous read which were never
+/// written, and starts reading the next mapped one; ends the read after the
+/// last page.
+/// \param pFtl  Pointer to an At45Ftl instance.
+//------------------------------------------------------------------------------
+static void ReadNext(At45Ftl *pFtl)
+{
+    unsigned char *pData;
+    unsigned int physical;
+
+    while (pFtl->runDone < pFtl->runPages) {
+
+        pData = pFtl->pRunData + (pFtl->runDone << pFtl->dataShift);
+        physical = pFtl->pMap[pFtl->runPage + pFtl->runDone];
+        if (physical != AT45FTL_NONE) {
+
+            if (AT45_SendCommand(pFtl->pAt45, AT45_CONTINUOUS_READ_LEG, 8,
+                                 pData, pFtl->dataSize,
+                                 physical * pFtl->pageSize,
+                                 ReadCallback, pFtl)) {
+
+                TRACE_ERROR("AT45FTL: Read failed\n\r");
+                EndTransfer(pFtl, AT45FTL_ERROR_AT45);
+            }
+            return;
+        }
+        memset(pData, 0xFF, pFtl->dataSize);
+        pFtl->runDone++;
+    }
+
+    EndTransfer(pFtl, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Source of the AT45 streaming write of an asynchronous write. Gives each
+/// logical page with its spare area, in the page allocated to it; commits a
+/// page in the map once it is verified; replaces a page which fails its
+/// compare. Runs from the SPI interrupt except for the first page, so that
+/// the allocation never moves pages.
+/// \param pArgument  Pointer to the At45Ftl instance.
+/// \param event  AT45_STREAM_xxx event.
+/// \param pPage  Page of the streaming write.
+//------------------------------------------------------------------------------
+static unsigned char WriteSource(
+    void *pArgument,
+    unsigned char event,
+    At45StreamPage *pPage)
+{
+    At45Ftl *pFtl = (At45Ftl *) pArgument;
+    unsigned int *pPhysical;
+    unsigned int logical;
+    unsigned int previous;
+    unsigned char error;
+
+    switch (event) {
+
+        case AT45_STREAM_NEXT:
+            if (pFtl->runError || (pFtl->runStarted == pFtl->runPages)) {
+
+                return 0;
+            }
+            pPhysical = &(pFtl->pRunPhysical[pFtl->runStarted & 1]);
+            if (pFtl->runStarted > 0) {
+
+                pFtl->moving = 1;
+                error = Allocate(pFtl, pPhysical);
+                pFtl->moving = 0;
+                if (error) {
+
+                    pFtl->runError = error;
+                    return 0;
+                }
+                SetFlag(USED(pFtl), *pPhysical);
+            }
+            FillSpare(pFtl, pFtl->runPage + pFtl->runStarted);
+            pPage->pData = pFtl->pRunData
+                           + (pFtl->runStarted << pFtl->dataShift);
+            pPage->size = pFtl->dataSize;
+            pPage->pTrailer = pFtl->pSpare;
+            pPage->trailerSize = AT45FTL_SPARE_SIZE;
+            pPage->address = *pPhysical * pFtl->pageSize;
+            pFtl->runStarted++;
+            return 1;
+
+        case AT45_STREAM_DONE:
+            // The wear leveling may have moved the previous page
+            logical = pFtl->runPage + pFtl->runDone;
+            previous = pFtl->pMap[logical];
+            pFtl->pMap[logical] = pFtl->pRunPhysical[pFtl->runDone & 1];
+            if (previous != AT45FTL_NONE) {
+
+                ClearFlag(USED(pFtl), previous);
+            }
+            pFtl->runDone++;
+            return 1;
+
+        case AT45_STREAM_FAILED:
+            pPhysical = &(pFtl->pRunPhysical[pFtl->runDone & 1]);
+            TRACE_WARNING("AT45FTL: Page %u is bad\n\r", *pPhysical);
+            ClearFlag(USED(pFtl), *pPhysical);
+            SetFlag(BAD(pFtl), *pPhysical);
+            pFtl->badPages++;
+
+            pFtl->moving = 1;
+            error = Allocate(pFtl, pPhysical);
+            pFtl->moving = 0;
+            if (error) {
+
+                pFtl->runError = error;
+                return 0;
+            }
+            SetFlag(USED(pFtl), *pPhysical);
+            FillSpare(pFtl, pFtl->runPage + pFtl->runDone);
+            pPage->pTrailer = pFtl->pSpare;
+            pPage->trailerSize = AT45FTL_SPARE_SIZE;
+            pPage->address = *pPhysical * pFtl->pageSize;
+            return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Ends an asynchronous write at the end of its AT45 streaming write, and
+/// frees the pages allocated to the logical pages which were not written.
+/// \param status  Status of the streaming write.
+/// \param pArgument  Pointer to the At45Ftl instance.
+//------------------------------------------------------------------------------
+static void WriteCallback(unsigned char status, void *pArgument)
+{
+    At45Ftl *pFtl = (At45Ftl *) pArgument;
+    unsigned char error = pFtl->runError;
+    unsigned int i;
+
+    if (!error && status) {
+
+        TRACE_ERROR("AT45FTL: Streaming write failed (%u)\n\r", status);
+        error = AT45FTL_ERROR_AT45;
+    }
+    for (i = pFtl->runDone; i < pFtl->runStarted; i++) {
+
+        ClearFlag(USED(pFtl), pFtl->pRunPhysical[i & 1]);
+    }
+
+    EndTransfer(pFtl, error);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Mounts the FTL on an identified AT45 device: rebuilds the logical page map
+/// and the page flags from the spare areas of all the pages. Returns 0 if
+/// successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to the At45Ftl instance to initialize.
+/// \param pAt45  Pointer to an AT45 driver instance, with a device found.
+/// \param pMap  Logical page map of AT45FTL_LOGICAL_PAGES(n) entries.
+/// \param pFlags  Flag array of AT45FTL_FLAGS_SIZE(n) bytes.
+//------------------------------------------------------------------------------
+unsigned char AT45FTL_Mount(
+    At45Ftl *pFtl,
+    At45 *pAt45,
+    unsigned short *pMap,
+    unsigned char *pFlags)
+{
+    const At45Desc *pDesc = pAt45->pDesc;
+    unsigned int page;
+    unsigned int logical;
+    unsigned int other;
+    unsigned int stale;
+    unsigned int sequence;
+    unsigned char error;
+
+    SANITY_CHECK(pFtl);
+    SANITY_CHECK(pAt45);
+    SANITY_CHECK(pMap);
+    SANITY_CHECK(pFlags);
+    ASSERT(pDesc, "AT45FTL_Mount: No device found\n\r");
+
+    pFtl->pAt45 = pAt45;
+    pFtl->pMap = pMap;
+    pFtl->pFlags = pFlags;
+    pFtl->numPages = pDesc->pageNumber;
+    pFtl->numLogical = AT45FTL_LOGICAL_PAGES(pDesc->pageNumber);
+    pFtl->pageSize = pDesc->pageSize;
+    pFtl->dataShift = pDesc->pageOffset - 1;
+    pFtl->dataSize = 1 << pFtl->dataShift;
+    pFtl->moving = 0;
+    pFtl->next = 0;
+    pFtl->sequence = 0;
+    pFtl->skipped = 0;
+    pFtl->moved = 0;
+    pFtl->badPages = 0;
+    pFtl->busy = 0;
+
+    // The spare area is lost in binary page mode
+    if ((AT45_PageSize(pAt45) != pDesc->pageSize)
+        || ((pFtl->pageSize - pFtl->dataSize) < AT45FTL_SPARE_SIZE)) {
+
+        TRACE_ERROR("AT45FTL_Mount: Device in binary page mode\n\r");
+        return AT45FTL_ERROR_DEVICE;
+    }
+
+    memset(pMap, 0xFF, pFtl->numLogical * sizeof(unsigned short));
+    memset(pFlags, 0, AT45FTL_FLAGS_SIZE(pFtl->numPages));
+
+    for (page = 0; page < pFtl->numPages; page++) {
+
+        error = ReadSpare(pFtl, page, &logical);
+        if (error) {
+
+            return error;
+        }
+        if (logical == AT45FTL_BAD) {
+
+            SetFlag(BAD(pFtl), page);
+            pFtl->badPages++;
+            continue;
+        }
+        if (logical >= pFtl->numLogical) {
+
+            continue;
+        }
+        sequence = SpareSequence(pFtl);
+
+        // Keep the most recent copy of the logical page
+        other = pMap[logical];
+        if (other != AT45FTL_NONE) {
+
+            error = ReadSpare(pFtl, other, &stale);
+            if (error) {
+
+                return error;
+            }
+            if (SpareSequence(pFtl) > sequence) {
+
+                continue;
+            }
+            ClearFlag(USED(pFtl), other);
+        }
+        pMap[logical] = page;
+        SetFlag(USED(pFtl), page);
+
+        // Resume the allocation after the last written page
+        if (sequence >= pFtl->sequence) {
+
+            pFtl->sequence = sequence;
+            pFtl->next = (page + 1 == pFtl->numPages) ? 0 : page + 1;
+        }
+    }
+
+    TRACE_INFO("AT45FTL_Mount: %u logical pages, %u bad pages\n\r",
+               pFtl->numLogical, pFtl->badPages);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads data from a logical page; a page never written reads as erased.
+/// Returns 0 if successful; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Logical page number.
+/// \param offset  Offset of the data in the page.
+/// \param pData  Buffer receiving the data.
+/// \param size  Number of bytes to read.
+//------------------------------------------------------------------------------
+unsigned char AT45FTL_Read(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned int offset,
+    unsigned char *pData,
+    unsigned int size)
+{
+    unsigned int physical;
+
+    SANITY_CHECK(pFtl);
+    SANITY_CHECK(page < pFtl->numLogical);
+    SANITY_CHECK((offset + size) <= pFtl->dataSize);
+
+    if (pFtl->busy) {
+
+        return AT45FTL_ERROR_LOCK;
+    }
+
+    physical = pFtl->pMap[page];
+    if (physical == AT45FTL_NONE) {
+
+        memset(pData, 0xFF, size);
+        return 0;
+    }
+
+    return Command(pFtl, AT45_CONTINUOUS_READ_LEG, 8, pData, size,
+                   physical * pFtl->pageSize + offset);
+}
+
+//------------------------------------------------------------------------------
+/// Writes data in a logical page. The new contents of the page are gathered
+/// in the buffer 1 of the chip, with the rest of the page copied from its
+/// previous location, and programmed in a free page; the previous page is
+/// freed once the new one is verified. Returns 0 if successful; otherwise
+/// returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  Logical page number.
+/// \param offset  Offset of the data in the page.
+/// \param pData  Data to write.
+/// \param size  Number of bytes to write.
+//------------------------------------------------------------------------------
+unsigned char AT45FTL_Write(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned int offset,
+    const unsigned char *pData,
+    unsigned int size)
+{
+    unsigned int previous;
+    unsigned int physical;
+    unsigned char status;
+    unsigned char match;
+    unsigned char error = 0;
+
+    SANITY_CHECK(pFtl);
+    SANITY_CHECK(page < pFtl->numLogical);
+    SANITY_CHECK((offset + size) <= pFtl->dataSize);
+
+    if (pFtl->busy) {
+
+        return AT45FTL_ERROR_LOCK;
+    }
+
+    // Complete a partial write with the rest of the page
+    previous = pFtl->pMap[page];
+    if (size < pFtl->dataSize) {
+
+        if (previous != AT45FTL_NONE) {
+
+            error = Command(pFtl, AT45_PAGE_BUF1_TX, 4, 0, 0,
+                            previous * pFtl->pageSize);
+            if (!error) {
+
+                error = WaitReady(pFtl, &status);
+            }
+        }
+        else {
+
+            error = LoadBuffer(pFtl, 0, 0, pFtl->dataSize);
+        }
+    }
+    if (!error) {
+
+        error = LoadBuffer(pFtl, offset, pData, size);
+    }
+
+    // Program a free page until one is verified
+    while (!error) {
+
+        error = Allocate(pFtl, &physical);
+        if (!error) {
+
+            error = WriteSpare(pFtl, AT45_BUF1_WRITE, page);
+        }
+        if (!error) {
+
+            error = Program(pFtl, physical, 0, &match);
+        }
+        if (!error && match) {
+
+            break;
+        }
+        if (!error) {
+
+            error = MarkBad(pFtl, physical, 0);
+        }
+    }
+    if (error) {
+
+        return error;
+    }
+
+    // The wear leveling may have moved the previous page
+    previous = pFtl->pMap[page];
+    pFtl->pMap[page] = physical;
+    SetFlag(USED(pFtl), physical);
+    if (previous != AT45FTL_NONE) {
+
+        ClearFlag(USED(pFtl), previous);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Starts reading whole logical pages in the background; the pages never
+/// written read as erased. The callback is invoked when the pages are read,
+/// from the SPI interrupt (or before returning if no page is mapped). Returns
+/// 0 if the read is started; otherwise returns AT45FTL_ERROR_LOCK.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  First logical page number.
+/// \param pData  Buffer receiving the data.
+/// \param numPages  Number of logical pages to read.
+/// \param callback  Optional callback to invoke at the end of the read.
+/// \param pArgument  Optional parameter to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT45FTL_ReadPages(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char *pData,
+    unsigned int numPages,
+    At45FtlCallback callback,
+    void *pArgument)
+{
+    SANITY_CHECK(pFtl);
+    SANITY_CHECK((page + numPages) <= pFtl->numLogical);
+
+    if (pFtl->busy) {
+
+        return AT45FTL_ERROR_LOCK;
+    }
+
+    pFtl->busy = 1;
+    pFtl->pRunData = pData;
+    pFtl->runPage = page;
+    pFtl->runPages = numPages;
+    pFtl->runDone = 0;
+    pFtl->callback = callback;
+    pFtl->pArgument = pArgument;
+    ReadNext(pFtl);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Starts writing whole logical pages in the background, through an AT45
+/// streaming write: each page is loaded in a chip buffer, through the chunk
+/// buffer, while the previous one is programmed and verified from the other.
+/// The data is left intact. The first page is allocated before returning,
+/// which may move a page for the wear leveling; the callback is invoked from
+/// the SPI interrupt when the pages are written. Returns 0 if the write is
+/// started; otherwise returns an AT45FTL_ERROR_xxx code.
+/// \param pFtl  Pointer to an At45Ftl instance.
+/// \param page  First logical page number.
+/// \param pData  Data to write.
+/// \param numPages  Number of logical pages to write.
+/// \param callback  Optional callback to invoke at the end of the write.
+/// \param pArgument  Optional parameter to the callback function.
+//------------------------------------------------------------------------------
+unsigned char AT45FTL_WritePages(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char *pData,
+    unsigned int numPages,
+    At45FtlCallback callback,
+    void *pArgument)
+{
+    unsigned char error;
+
+    SANITY_CHECK(pFtl);
+    SANITY_CHECK((page + numPages) <= pFtl->numLogical);
+
+    if (pFtl->busy) {
+
+        return AT45FTL_ERROR_LOCK;
+    }
+
+    pFtl->busy = 1;
+    pFtl->pRunData = pData;
+    pFtl->runPage = page;
+    pFtl->runPages = numPages;
+    pFtl->runStarted = 0;
+    pFtl->runDone = 0;
+    pFtl->runError = 0;
+    pFtl->callback = callback;
+    pFtl->pArgument = pArgument;
+
+    if (numPages > 0) {
+
+        error = Allocate(pFtl, &(pFtl->pRunPhysical[0]));
+        if (error) {
+
+            pFtl->busy = 0;
+            return error;
+        }
+        SetFlag(USED(pFtl), pFtl->pRunPhysical[0]);
+    }
+
+    if (AT45_StreamWritePages(pFtl->pAt45, WriteSource, pFtl,
+                              pFtl->pChunk, AT45FTL_CHUNK_SIZE, 1,
+                              WriteCallback, pFtl)) {
+
+        TRACE_ERROR("AT45FTL_WritePages: AT45 driver busy\n\r");
+        if (numPages > 0) {
+
+            ClearFlag(USED(pFtl), pFtl->pRunPhysical[0]);
+        }
+        pFtl->busy = 0;
+        return AT45FTL_ERROR_AT45;
+    }
+
+    return 0;
+}
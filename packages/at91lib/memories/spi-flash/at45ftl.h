@@ -0,0 +1,253 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !!!Purpose
+///
+/// Flash translation layer (FTL) over an AT45 DataFlash, giving a linear
+/// array of logical pages which can be rewritten at will, e.g. to back a
+/// media (see MEDAt45) or a logger.
+///
+/// Each DataFlash page holds a power-of-two data area followed by a spare
+/// area (e.g. 256 + 8 bytes), in which the FTL stores the number of the
+/// logical page held by the page and a sequence number. A logical page is
+/// never rewritten in place: its new contents are programmed in a free page
+/// and its previous page becomes free. The free pages are used in turn, from
+/// an allocation pointer going around the chip, which spreads the wear; every
+/// AT45FTL_LEVELING_PERIOD pages in use found on its way, the pointer moves
+/// the data of one of them forward, so that pages holding data never written
+/// again are recycled too.
+///
+/// The data never goes through the microcontroller when it is not needed:
+/// a page is loaded in the SRAM buffer 1 of the chip and programmed from it,
+/// a partially written page is first copied in the buffer from its previous
+/// page, and the pages moved by the wear leveling are copied through the
+/// SRAM buffer 2. Each programmed page is compared with the buffer; a page
+/// which does not match is marked bad and never used again.
+///
+/// The mapping of the logical pages is rebuilt by AT45FTL_Mount from the
+/// spare areas; when two pages hold the same logical page, the one with the
+/// highest sequence number wins.
+///
+/// !!!Usage
+///
+/// -# Configure the SPI driver and the At45 instance, and identify the device
+///    with AT45_FindDevice; the SPI interrupt must call SPID_Handler. The
+///    device must use its standard page size, the spare areas are needed.
+/// -# Allocate a logical page map of AT45FTL_LOGICAL_PAGES(n) unsigned short,
+///    and a flag array of AT45FTL_FLAGS_SIZE(n) bytes, where n is the number
+///    of pages of the device.
+/// -# Call AT45FTL_Mount, then read and write logical pages with
+///    AT45FTL_Read and AT45FTL_Write, which wait for the end of the transfer.
+/// -# Runs of whole logical pages can be read and written in the background
+///    with AT45FTL_ReadPages and AT45FTL_WritePages; the callback is invoked
+///    from the SPI interrupt when the run is transferred. The writes go
+///    through AT45_StreamWritePages: each page is loaded in one chip buffer
+///    while the previous one is programmed and verified from the other. A
+///    page which fails its compare is flagged bad in RAM and its buffer is
+///    programmed again in another page, without the bad page marker: its
+///    sequence number is older than the replacement's, and it is found bad
+///    again after the next mount. The wear leveling only moves pages when
+///    the first page of a run is allocated, in the caller's context.
+//------------------------------------------------------------------------------
+
+#ifndef AT45FTL_H
+#define AT45FTL_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "at45.h"
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// There was an error with the AT45 driver.
+#define AT45FTL_ERROR_AT45      1
+/// The device has no spare area (binary page size).
+#define AT45FTL_ERROR_DEVICE    2
+/// No good free page is left.
+#define AT45FTL_ERROR_FULL      3
+/// The DataFlash or the AT45 driver stayed busy too long.
+#define AT45FTL_ERROR_TIMEOUT   4
+/// An asynchronous transfer is in progress.
+#define AT45FTL_ERROR_LOCK      5
+
+/// Size of the FTL data in the spare area of each page.
+#define AT45FTL_SPARE_SIZE      8
+
+/// Size of the chunks in which the written data is loaded in the chip buffer.
+#ifndef AT45FTL_CHUNK_SIZE
+#define AT45FTL_CHUNK_SIZE      64
+#endif
+
+/// Number of polls of the AT45 driver before a synchronous command is
+/// considered lost.
+#ifndef AT45FTL_COMMAND_TIMEOUT
+#define AT45FTL_COMMAND_TIMEOUT 0x100000
+#endif
+
+/// Number of status reads before a busy DataFlash is considered faulty; a
+/// page erase and program takes up to 35ms.
+#ifndef AT45FTL_READY_TIMEOUT
+#define AT45FTL_READY_TIMEOUT   0x10000
+#endif
+
+/// Number of pages in use passed by the allocation pointer between two moves
+/// of their data.
+#ifndef AT45FTL_LEVELING_PERIOD
+#define AT45FTL_LEVELING_PERIOD 16
+#endif
+
+/// Number of logical pages given a device of the given number of pages; the
+/// other pages are always free for the allocation and replace the bad pages.
+#define AT45FTL_LOGICAL_PAGES(pages)    ((pages) - (pages) / 32 - 2)
+
+/// Size of the flag array given the number of pages of the device, in bytes.
+#define AT45FTL_FLAGS_SIZE(pages)       (((pages) + 7) / 8 * 2)
+
+/// Value of an unmapped entry of the logical page map.
+#define AT45FTL_NONE                    0xFFFF
+
+//------------------------------------------------------------------------------
+//         Types
+//------------------------------------------------------------------------------
+
+/// Callback of the asynchronous transfers, invoked with their status (0 or an
+/// AT45FTL_ERROR_xxx code) and the number of pages transferred.
+typedef void (*At45FtlCallback)(void *pArgument,
+                                unsigned char status,
+                                unsigned int pages);
+
+//------------------------------------------------------------------------------
+/// Flash translation layer instance.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Pointer to the AT45 driver.
+    At45 *pAt45;
+    /// Physical page of each logical page, AT45FTL_NONE if not written.
+    unsigned short *pMap;
+    /// Bit map of the pages in use, followed by the bit map of the bad pages.
+    unsigned char *pFlags;
+    /// Number of pages of the device.
+    unsigned int numPages;
+    /// Number of logical pages.
+    unsigned int numLogical;
+    /// Size of a page, data and spare areas.
+    unsigned int pageSize;
+    /// Size of the data area of a page.
+    unsigned int dataSize;
+    /// Log2 of the size of the data area.
+    unsigned char dataShift;
+    /// Set while the wear leveling moves a page.
+    unsigned char moving;
+    /// Next page examined by the allocation.
+    unsigned int next;
+    /// Sequence number of the last written page.
+    unsigned int sequence;
+    /// Number of pages in use passed by the allocation pointer.
+    unsigned int skipped;
+    /// Number of pages moved by the wear leveling.
+    unsigned int moved;
+    /// Number of bad pages.
+    unsigned int badPages;
+    /// Spare area being read or written.
+    unsigned char pSpare[AT45FTL_SPARE_SIZE];
+    /// Chunk of data being loaded in the chip buffer.
+    unsigned char pChunk[AT45FTL_CHUNK_SIZE];
+    /// Set while an asynchronous transfer is in progress.
+    volatile unsigned char busy;
+    /// Data of the asynchronous transfer.
+    unsigned char *pRunData;
+    /// First logical page of the asynchronous transfer.
+    unsigned int runPage;
+    /// Number of pages of the asynchronous transfer.
+    unsigned int runPages;
+    /// Number of pages given to the AT45 streaming write.
+    unsigned int runStarted;
+    /// Number of pages transferred.
+    unsigned int runDone;
+    /// Physical pages allocated to the pages in flight, by page parity.
+    unsigned int pRunPhysical[2];
+    /// Error which stopped the asynchronous transfer.
+    unsigned char runError;
+    /// Callback of the asynchronous transfer.
+    At45FtlCallback callback;
+    /// Argument of the callback.
+    void *pArgument;
+
+} At45Ftl;
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+extern unsigned char AT45FTL_Mount(
+    At45Ftl *pFtl,
+    At45 *pAt45,
+    unsigned short *pMap,
+    unsigned char *pFlags);
+
+extern unsigned char AT45FTL_Read(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned int offset,
+    unsigned char *pData,
+    unsigned int size);
+
+extern unsigned char AT45FTL_Write(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned int offset,
+    const unsigned char *pData,
+    unsigned int size);
+
+extern unsigned char AT45FTL_ReadPages(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char *pData,
+    unsigned int numPages,
+    At45FtlCallback callback,
+    void *pArgument);
+
+extern unsigned char AT45FTL_WritePages(
+    At45Ftl *pFtl,
+    unsigned int page,
+    unsigned char *pData,
+    unsigned int numPages,
+    At45FtlCallback callback,
+    void *pArgument);
+
+#endif //#ifndef AT45FTL_H
+
@@ -0,0 +1,331 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "sfcache.h"
+#include <utility/assert.h>
+#include <utility/trace.h>
+#include <utility/math.h>
+
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Ends a read of the device: the line becomes valid, or stays empty if the
+/// transfer failed.
+/// \param status  SPI transfer status.
+/// \param pArgument  Pointer to the Sfc instance.
+//------------------------------------------------------------------------------
+static void SFC_ReadCallback(unsigned char status, void *pArgument)
+{
+    Sfc *pSfc = (Sfc *) pArgument;
+
+    if (status) {
+
+        pSfc->readError = 1;
+    }
+    else {
+
+        pSfc->pTags[pSfc->readSet][pSfc->readWay] = pSfc->readLine;
+    }
+    pSfc->reading = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Makes a way the most recently used one of its set.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param set  Set number.
+/// \param way  Way number.
+//------------------------------------------------------------------------------
+static void SFC_Touch(Sfc *pSfc, unsigned char set, unsigned char way)
+{
+    unsigned char *pOrder = pSfc->pOrder[set];
+    unsigned char i = 0;
+
+    while (pOrder[i] != way) {
+
+        i++;
+    }
+    while (i > 0) {
+
+        pOrder[i] = pOrder[i - 1];
+        i--;
+    }
+    pOrder[0] = way;
+}
+
+//------------------------------------------------------------------------------
+/// Starts reading a line of the device in the least recently used way of its
+/// set. Returns 0 if successful; otherwise returns SFC_ERROR_READ.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param line  Line number.
+//------------------------------------------------------------------------------
+static unsigned char SFC_StartRead(Sfc *pSfc, unsigned int line)
+{
+    unsigned char set = line & (SFC_SETS - 1);
+    unsigned char way = pSfc->pOrder[set][SFC_WAYS - 1];
+
+    // The line being read is not replaced before it is used
+    SFC_Touch(pSfc, set, way);
+
+    pSfc->pTags[set][way] = SFC_NONE;
+    pSfc->readLine = line;
+    pSfc->readSet = set;
+    pSfc->readWay = way;
+    pSfc->readError = 0;
+    pSfc->reading = 1;
+    if (pSfc->read(pSfc->pInterface,
+                   line << SFC_LINE_SHIFT,
+                   pSfc->pLines[set][way],
+                   SFC_LINE_SIZE,
+                   SFC_ReadCallback,
+                   pSfc)) {
+
+        TRACE_ERROR("SFC_StartRead: Could not read line %u\n\r", line);
+        pSfc->reading = 0;
+        return SFC_ERROR_READ;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the way of a set holding a line, or SFC_WAYS if none.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param line  Line number.
+//------------------------------------------------------------------------------
+static unsigned char SFC_Lookup(Sfc *pSfc, unsigned int line)
+{
+    unsigned char set = line & (SFC_SETS - 1);
+    unsigned char way;
+
+    for (way = 0; way < SFC_WAYS; way++) {
+
+        if (pSfc->pTags[set][way] == line) {
+
+            break;
+        }
+    }
+
+    return way;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the data of a line, read from the device if it is not in the cache,
+/// or 0 if it could not be read. The line after it is prefetched when the
+/// accesses are sequential.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param line  Line number.
+//------------------------------------------------------------------------------
+static unsigned char * SFC_GetLine(Sfc *pSfc, unsigned int line)
+{
+    unsigned char set = line & (SFC_SETS - 1);
+    unsigned char way;
+
+    // The line may be on its way, and the device is needed anyway on a miss
+    way = SFC_Lookup(pSfc, line);
+    if (way == SFC_WAYS) {
+
+        while (pSfc->reading);
+        way = SFC_Lookup(pSfc, line);
+    }
+
+    if (way < SFC_WAYS) {
+
+        pSfc->hits++;
+        if (pSfc->pPrefetched[set][way]) {
+
+            pSfc->pPrefetched[set][way] = 0;
+            pSfc->prefetchHits++;
+        }
+    }
+    else {
+
+        pSfc->misses++;
+        if (SFC_StartRead(pSfc, line)) {
+
+            return 0;
+        }
+        while (pSfc->reading);
+        way = pSfc->readWay;
+        pSfc->pPrefetched[set][way] = 0;
+        if (pSfc->readError) {
+
+            TRACE_ERROR("SFC_GetLine: Could not read line %u\n\r", line);
+            return 0;
+        }
+    }
+    SFC_Touch(pSfc, set, way);
+
+    // Prefetch the next line in the background on sequential accesses
+    if ((line == pSfc->lastLine + 1)
+        && !pSfc->reading
+        && (SFC_Lookup(pSfc, line + 1) == SFC_WAYS)) {
+
+        if (!SFC_StartRead(pSfc, line + 1)) {
+
+            pSfc->pPrefetched[pSfc->readSet][pSfc->readWay] = 1;
+            pSfc->prefetches++;
+        }
+    }
+    pSfc->lastLine = line;
+
+    return pSfc->pLines[set][way];
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Initializes a serial flash read cache, empty.
+/// \param pSfc  Pointer to the Sfc instance to initialize.
+/// \param read  Function starting an asynchronous read of the device.
+/// \param pInterface  Device driver instance given to the read function.
+//------------------------------------------------------------------------------
+void SFC_Initialize(Sfc *pSfc, SfcRead read, void *pInterface)
+{
+    SANITY_CHECK(pSfc);
+    SANITY_CHECK(read);
+
+    pSfc->read = read;
+    pSfc->pInterface = pInterface;
+    pSfc->reading = 0;
+    pSfc->readError = 0;
+    pSfc->hits = 0;
+    pSfc->misses = 0;
+    pSfc->prefetches = 0;
+    pSfc->prefetchHits = 0;
+    SFC_Invalidate(pSfc);
+}
+
+//------------------------------------------------------------------------------
+/// Empties the cache, e.g. after the device has been erased or written.
+/// \param pSfc  Pointer to a Sfc instance.
+//------------------------------------------------------------------------------
+void SFC_Invalidate(Sfc *pSfc)
+{
+    unsigned int set;
+    unsigned int way;
+
+    SANITY_CHECK(pSfc);
+
+    // Wait for the end of a prefetch, whose data may be stale
+    while (pSfc->reading);
+
+    for (set = 0; set < SFC_SETS; set++) {
+
+        for (way = 0; way < SFC_WAYS; way++) {
+
+            pSfc->pTags[set][way] = SFC_NONE;
+            pSfc->pPrefetched[set][way] = 0;
+            pSfc->pOrder[set][way] = way;
+        }
+    }
+    pSfc->lastLine = SFC_NONE;
+}
+
+//------------------------------------------------------------------------------
+/// Reads data from the device through the cache.
+/// Returns 0 if successful; otherwise returns SFC_ERROR_READ.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param address  Address of the data in the device.
+/// \param pData  Buffer receiving the data.
+/// \param size  Number of bytes to read.
+//------------------------------------------------------------------------------
+unsigned char SFC_Read(
+    Sfc *pSfc,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size)
+{
+    unsigned int offset = address & (SFC_LINE_SIZE - 1);
+    unsigned int line = address >> SFC_LINE_SHIFT;
+    unsigned int chunk;
+    unsigned char *pLine;
+
+    SANITY_CHECK(pSfc);
+    SANITY_CHECK(pData || (size == 0));
+
+    while (size > 0) {
+
+        pLine = SFC_GetLine(pSfc, line);
+        if (!pLine) {
+
+            return SFC_ERROR_READ;
+        }
+
+        chunk = min(size, SFC_LINE_SIZE - offset);
+        memcpy(pData, pLine + offset, chunk);
+        pData += chunk;
+        size -= chunk;
+        offset = 0;
+        line++;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Returns a pointer to data of the device held by a single cache line, read
+/// in the cache if needed, or 0 if the data crosses a line boundary or could
+/// not be read. The pointer is valid until the next call to the cache.
+/// \param pSfc  Pointer to a Sfc instance.
+/// \param address  Address of the data in the device.
+/// \param size  Number of bytes of the data.
+//------------------------------------------------------------------------------
+const unsigned char * SFC_Map(
+    Sfc *pSfc,
+    unsigned int address,
+    unsigned int size)
+{
+    unsigned int offset = address & (SFC_LINE_SIZE - 1);
+    unsigned char *pLine;
+
+    SANITY_CHECK(pSfc);
+
+    if ((offset + size) > SFC_LINE_SIZE) {
+
+        return 0;
+    }
+
+    pLine = SFC_GetLine(pSfc, address >> SFC_LINE_SHIFT);
+    if (!pLine) {
+
+        return 0;
+    }
+
+    return pLine + offset;
+}
@@ -0,0 +1,178 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+///
+/// !!!Purpose
+///
+/// Read cache over a serial flash (AT26 or AT45), for the small random reads
+/// of tables and assets stored in it. Each read of the device pays a command,
+/// address and dummy phase; the cache reads whole lines instead and serves the
+/// following accesses from SRAM.
+///
+/// The cache is set-associative: a line of SFC_LINE_SIZE bytes can be held by
+/// any of the SFC_WAYS ways of the set selected by its address, and replaces
+/// the least recently used one. A line whose read fails is left empty. When an
+/// access goes on from the previous line
+/// to the next one, the line after it is prefetched in the background, from
+/// the SPI interrupt, while the application uses the current line.
+///
+/// !!!Usage
+///
+/// -# Provide a function starting an asynchronous read of the device, which
+///    invokes its callback at the end of the transfer, e.g. for an AT26:
+/// \code
+///    static unsigned char ReadAt26(void *pInterface, unsigned int address,
+///        unsigned char *pData, unsigned int size,
+///        SpidCallback callback, void *pArgument)
+///    {
+///        return AT26_Read((At26 *) pInterface, address, pData, size,
+///                         callback, pArgument);
+///    }
+/// \endcode
+///    or for an AT45, with AT45_SendCommand(pAt45, AT45_CONTINUOUS_READ_LEG,
+///    8, pData, size, address, callback, pArgument).
+/// -# Initialize the cache with SFC_Initialize().
+/// -# Copy data with SFC_Read(), or get a pointer to data held by a single
+///    line with SFC_Map(); the pointer is valid until the next call.
+/// -# Call SFC_Invalidate() after the device has been erased or written.
+/// -# The hits, misses, prefetches and prefetchHits fields of the cache count
+///    the accesses since the initialization.
+//------------------------------------------------------------------------------
+
+#ifndef SFCACHE_H
+#define SFCACHE_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "spid.h"
+
+//------------------------------------------------------------------------------
+//         Definitions
+//------------------------------------------------------------------------------
+
+/// The device could not be read.
+#define SFC_ERROR_READ          1
+
+/// Log2 of the size of a cache line in bytes.
+#ifndef SFC_LINE_SHIFT
+#define SFC_LINE_SHIFT          6
+#endif
+
+/// Size of a cache line in bytes.
+#define SFC_LINE_SIZE           (1 << SFC_LINE_SHIFT)
+
+/// Number of sets of the cache, a power of two greater than 1.
+#ifndef SFC_SETS
+#define SFC_SETS                8
+#endif
+
+/// Number of lines of each set.
+#ifndef SFC_WAYS
+#define SFC_WAYS                2
+#endif
+
+/// Tag of an empty line.
+#define SFC_NONE                0xFFFFFFFF
+
+//------------------------------------------------------------------------------
+//         Types
+//------------------------------------------------------------------------------
+
+/// Starts an asynchronous read of the device; returns 0 if the read is
+/// started.
+typedef unsigned char (*SfcRead)(void *pInterface,
+                                 unsigned int address,
+                                 unsigned char *pData,
+                                 unsigned int size,
+                                 SpidCallback callback,
+                                 void *pArgument);
+
+//------------------------------------------------------------------------------
+/// Serial flash read cache.
+//------------------------------------------------------------------------------
+typedef struct {
+
+    /// Function reading the device.
+    SfcRead read;
+    /// Device driver instance given to the read function.
+    void *pInterface;
+    /// Line number held by each line, SFC_NONE if none.
+    volatile unsigned int pTags[SFC_SETS][SFC_WAYS];
+    /// Ways of each set, from the most to the least recently used.
+    unsigned char pOrder[SFC_SETS][SFC_WAYS];
+    /// Set for the lines brought by a prefetch and not used yet.
+    unsigned char pPrefetched[SFC_SETS][SFC_WAYS];
+    /// Data of the lines.
+    unsigned char pLines[SFC_SETS][SFC_WAYS][SFC_LINE_SIZE];
+    /// Line accessed last.
+    unsigned int lastLine;
+    /// Line being read.
+    unsigned int readLine;
+    /// Set and way of the line being read.
+    unsigned char readSet;
+    unsigned char readWay;
+    /// Set while a read of the device is in progress.
+    volatile unsigned char reading;
+    /// Set when the last read of the device failed.
+    volatile unsigned char readError;
+    /// Number of accesses to a line found in the cache.
+    unsigned int hits;
+    /// Number of accesses to a line read from the device.
+    unsigned int misses;
+    /// Number of lines prefetched.
+    unsigned int prefetches;
+    /// Number of prefetched lines which have been accessed.
+    unsigned int prefetchHits;
+
+} Sfc;
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+extern void SFC_Initialize(Sfc *pSfc, SfcRead read, void *pInterface);
+
+extern void SFC_Invalidate(Sfc *pSfc);
+
+extern unsigned char SFC_Read(
+    Sfc *pSfc,
+    unsigned int address,
+    unsigned char *pData,
+    unsigned int size);
+
+extern const unsigned char * SFC_Map(
+    Sfc *pSfc,
+    unsigned int address,
+    unsigned int size);
+
+#endif //#ifndef SFCACHE_H
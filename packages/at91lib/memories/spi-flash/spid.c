@@ -47,6 +47,78 @@
 /// Read SPI registers
 #define READ_SPI(pSpi, regName) (pSpi->regName)
 
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Starts the transfer of a command, the driver being locked.
+/// \param pSpid  Pointer to a Spid instance.
+/// \param pCommand Pointer to the SPI command to execute.
+//------------------------------------------------------------------------------
+static void SPID_Start(Spid *pSpid, SpidCmd *pCommand)
+{
+    AT91S_SPI *pSpiHw = pSpid->pSpiHw;
+    unsigned int spiMr;
+
+    // Enable the SPI clock
+    WRITE_PMC(AT91C_BASE_PMC, PMC_PCER, (1 << pSpid->spiId));
+
+    // Disable transmitter and receiver
+    WRITE_SPI(pSpiHw, SPI_PTCR, AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS);
+
+    // Write to the MR register
+    spiMr = READ_SPI(pSpiHw, SPI_MR);
+    spiMr |= AT91C_SPI_PCS;
+    spiMr &= ~((1 << pCommand->spiCs) << 16);
+    WRITE_SPI(pSpiHw, SPI_MR, spiMr);
+
+    // Initialize the two SPI PDC buffer
+    WRITE_SPI(pSpiHw, SPI_RPR, (int) pCommand->pCmd);
+    WRITE_SPI(pSpiHw, SPI_RCR, pCommand->cmdSize);
+    WRITE_SPI(pSpiHw, SPI_TPR, (int) pCommand->pCmd);
+    WRITE_SPI(pSpiHw, SPI_TCR, pCommand->cmdSize);
+
+    WRITE_SPI(pSpiHw, SPI_RNPR, (int) pCommand->pData);
+    WRITE_SPI(pSpiHw, SPI_RNCR, pCommand->dataSize);
+    WRITE_SPI(pSpiHw, SPI_TNPR, (int) pCommand->pData);
+    WRITE_SPI(pSpiHw, SPI_TNCR, pCommand->dataSize);
+
+    // Initialize the callback
+    pSpid->pCurrentCommand = pCommand;
+
+    // Enable transmitter and receiver
+    WRITE_SPI(pSpiHw, SPI_PTCR, AT91C_PDC_RXTEN | AT91C_PDC_TXTEN);
+
+    // Enable buffer complete interrupt
+    WRITE_SPI(pSpiHw, SPI_IER, AT91C_SPI_RXBUFF);
+}
+
+//------------------------------------------------------------------------------
+/// Removes and returns the next command of the queue, or 0 if it is empty.
+/// \param pSpid  Pointer to a Spid instance.
+//------------------------------------------------------------------------------
+static SpidCmd * SPID_Dequeue(Spid *pSpid)
+{
+    unsigned char head = pSpid->head;
+    SpidCmd *pCommand;
+
+    if (head == pSpid->tail) {
+
+        return 0;
+    }
+
+    pCommand = pSpid->pQueue[head];
+    head++;
+    if (head == SPID_QUEUE_SIZE) {
+
+        head = 0;
+    }
+    pSpid->head = head;
+
+    return pCommand;
+}
+
 //------------------------------------------------------------------------------
 //         Exported functions
 //------------------------------------------------------------------------------
@@ -65,6 +137,8 @@ unsigned char SPID_Configure(Spid *pSpid, AT91S_SPI *pSpiHw, unsigned char spiId
     pSpid->spiId  = spiId;
     pSpid->semaphore = 1;
     pSpid->pCurrentCommand = 0;
+    pSpid->head = 0;
+    pSpid->tail = 0;
 
     // Enable the SPI clock
     WRITE_PMC(AT91C_BASE_PMC, PMC_PCER, (1 << pSpid->spiId));
@@ -111,61 +185,79 @@ void SPID_ConfigureCS(Spid *pSpid, unsigned char cs, unsigned int csr)
 //------------------------------------------------------------------------------
 unsigned char SPID_SendCommand(Spid *pSpid, SpidCmd *pCommand)
 {
-    AT91S_SPI *pSpiHw = pSpid->pSpiHw;
-     unsigned int spiMr;
-
-     // Try to get the dataflash semaphore
-     if (pSpid->semaphore == 0) {
+    // Try to get the dataflash semaphore
+    if (pSpid->semaphore == 0) {
 
-         return SPID_ERROR_LOCK;
+        return SPID_ERROR_LOCK;
     }
-     pSpid->semaphore--;
+    pSpid->semaphore--;
 
-    // Enable the SPI clock
-    WRITE_PMC(AT91C_BASE_PMC, PMC_PCER, (1 << pSpid->spiId));
+    SPID_Start(pSpid, pCommand);
 
-    // Disable transmitter and receiver
-    WRITE_SPI(pSpiHw, SPI_PTCR, AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS);
+    return 0;
+}
 
-     // Write to the MR register
-     spiMr = READ_SPI(pSpiHw, SPI_MR);
-     spiMr |= AT91C_SPI_PCS;
-     spiMr &= ~((1 << pCommand->spiCs) << 16);
-    WRITE_SPI(pSpiHw, SPI_MR, spiMr);
+//------------------------------------------------------------------------------
+/// Queues a SPI master transfer, which starts at once if the driver is idle
+/// or from SPID_Handler when the commands queued before it have ended. This is
+/// a non blocking function, which may be called from the application and from
+/// interrupt handlers (e.g. command callbacks): the interrupts are masked
+/// while the queue is updated.
+/// Returns 0 if the command has been queued; otherwise returns
+/// SPID_ERROR_LOCK if the queue is full.
+/// \param pSpid  Pointer to a Spid instance.
+/// \param pCommand Pointer to the SPI command to execute.
+//------------------------------------------------------------------------------
+unsigned char SPID_QueueCommand(Spid *pSpid, SpidCmd *pCommand)
+{
+    unsigned int aicImr;
+    unsigned char tail;
+    unsigned char next;
+    unsigned char error = 0;
 
-    // Initialize the two SPI PDC buffer
-    WRITE_SPI(pSpiHw, SPI_RPR, (int) pCommand->pCmd);
-    WRITE_SPI(pSpiHw, SPI_RCR, pCommand->cmdSize);
-    WRITE_SPI(pSpiHw, SPI_TPR, (int) pCommand->pCmd);
-    WRITE_SPI(pSpiHw, SPI_TCR, pCommand->cmdSize);
+    aicImr = AT91C_BASE_AIC->AIC_IMR;
+    AT91C_BASE_AIC->AIC_IDCR = aicImr;
 
-    WRITE_SPI(pSpiHw, SPI_RNPR, (int) pCommand->pData);
-    WRITE_SPI(pSpiHw, SPI_RNCR, pCommand->dataSize);
-    WRITE_SPI(pSpiHw, SPI_TNPR, (int) pCommand->pData);
-    WRITE_SPI(pSpiHw, SPI_TNCR, pCommand->dataSize);
+    tail = pSpid->tail;
+    next = tail + 1;
+    if (next == SPID_QUEUE_SIZE) {
 
-    // Initialize the callback
-    pSpid->pCurrentCommand = pCommand;
+        next = 0;
+    }
+    if (next == pSpid->head) {
 
-    // Enable transmitter and receiver
-    WRITE_SPI(pSpiHw, SPI_PTCR, AT91C_PDC_RXTEN | AT91C_PDC_TXTEN);
+        error = SPID_ERROR_LOCK;
+    }
+    else {
 
-    // Enable buffer complete interrupt
-    WRITE_SPI(pSpiHw, SPI_IER, AT91C_SPI_RXBUFF);
+        pSpid->pQueue[tail] = pCommand;
+        pSpid->tail = next;
 
-    return 0;
+        // Start the oldest command now if the driver is idle
+        if (pSpid->semaphore != 0) {
+
+            pSpid->semaphore--;
+            SPID_Start(pSpid, SPID_Dequeue(pSpid));
+        }
+    }
+
+    AT91C_BASE_AIC->AIC_IECR = aicImr;
+
+    return error;
 }
 
 //------------------------------------------------------------------------------
 /// The SPI_Handler must be called by the SPI Interrupt Service Routine with the
 /// corresponding Spi instance.
-/// The SPI_Handler will unlock the Spi semaphore and invoke the upper application
-/// callback.
+/// The SPI_Handler unlocks the Spi semaphore and invokes the upper application
+/// callback, which may send the next step of its operation at once; otherwise
+/// it starts the next queued command.
 /// \param pSpid  Pointer to a Spid instance.
 //------------------------------------------------------------------------------
 void SPID_Handler(Spid *pSpid)
 {
     SpidCmd *pSpidCmd = pSpid->pCurrentCommand;
+    SpidCmd *pNextCmd;
     AT91S_SPI *pSpiHw = pSpid->pSpiHw;
     volatile unsigned int spiSr;
 
@@ -176,23 +268,35 @@ void SPID_Handler(Spid *pSpid)
         // Disable transmitter and receiver
         WRITE_SPI(pSpiHw, SPI_PTCR, AT91C_PDC_RXTDIS | AT91C_PDC_TXTDIS);
 
-        // Disable the SPI clock
-        WRITE_PMC(AT91C_BASE_PMC, PMC_PCDR, (1 << pSpid->spiId));
-
         // Disable buffer complete interrupt
         WRITE_SPI(pSpiHw, SPI_IDR, AT91C_SPI_RXBUFF);
 
         // Release the dataflash semaphore
+        pSpid->pCurrentCommand = 0;
         pSpid->semaphore++;
 
-        // Invoke the callback associated with the current command
+        // Invoke the callback associated with the current command, before
+        // the queued commands so that it can chain its next command
         if (pSpidCmd && pSpidCmd->callback) {
 
             pSpidCmd->callback(0, pSpidCmd->pArgument);
         }
 
-        // Nothing must be done after. A new DF operation may have been started
-        // in the callback function.
+        // Start the next queued command, unless the callback started one
+        if (pSpid->semaphore != 0) {
+
+            pNextCmd = SPID_Dequeue(pSpid);
+            if (pNextCmd) {
+
+                pSpid->semaphore--;
+                SPID_Start(pSpid, pNextCmd);
+            }
+            else {
+
+                // Disable the SPI clock
+                WRITE_PMC(AT91C_BASE_PMC, PMC_PCDR, (1 << pSpid->spiId));
+            }
+        }
     }
 }
 
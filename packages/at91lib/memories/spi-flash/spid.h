@@ -73,6 +73,15 @@
 /// \code
 ///	      AIC_ConfigureIT(AT91C_ID_SPI, 0, SPI_Handler);
 /// \endcode
+/// -# Queue commands with SPID_QueueCommand() to share the SPI between several
+///    devices (each with its own chip select): when a transfer ends,
+///    SPID_Handler() invokes its callback, then starts the next queued command
+///    if the callback has not sent one. A driver chaining the steps of an
+///    operation from its callbacks (see AT45_StreamWrite() and AT26_Write())
+///    thus keeps the bus between its steps when it uses SPID_SendCommand(),
+///    and interleaves its steps with the other devices when it queues them.
+///    Each queued command needs its own SpidCmd and command buffer until its
+///    callback is invoked.
 //------------------------------------------------------------------------------
 
 #ifndef SPID_H
@@ -94,6 +103,11 @@
 /// SPI driver is currently in use.
 #define SPID_ERROR_LOCK     2
 
+/// Number of commands which can wait in the queue of the SPI driver.
+#ifndef SPID_QUEUE_SIZE
+#define SPID_QUEUE_SIZE     8
+#endif
+
 //------------------------------------------------------------------------------
 //         Macros
 //------------------------------------------------------------------------------
@@ -157,6 +171,13 @@ typedef struct {
 	SpidCmd *pCurrentCommand;
     /// Mutual exclusion semaphore.
 	volatile char semaphore;
+    /// Commands waiting for the current one to end, filled by
+    /// SPID_QueueCommand and emptied by SPID_Handler.
+	SpidCmd *pQueue[SPID_QUEUE_SIZE];
+    /// Index of the next command to start in the queue.
+	volatile unsigned char head;
+    /// Index of the next free entry of the queue.
+	volatile unsigned char tail;
 
 } Spid;
 
@@ -175,6 +196,10 @@ extern unsigned char SPID_SendCommand(
 	Spid *pSpid,
 	SpidCmd *pCommand);
 
+extern unsigned char SPID_QueueCommand(
+	Spid *pSpid,
+	SpidCmd *pCommand);
+
 extern void SPID_Handler(Spid *pSpid);
 
 extern unsigned char SPID_IsBusy(const Spid *pSpid);
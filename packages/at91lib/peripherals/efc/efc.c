@@ -233,13 +233,7 @@ void EFC_ComputeAddress(
 /// \param command  Command to execute.
 /// \param argument  Command argument (should be 0 if not used).
 //------------------------------------------------------------------------------
-#if defined(flash)
-   #ifdef __ICCARM__
-__ramfunc
-   #else
-__attribute__ ((section (".ramfunc")))
-   #endif
-#endif
+RAMFUNC
 void EFC_StartCommand(
     AT91S_EFC *pEfc,
     unsigned char command,
@@ -315,13 +309,7 @@ void EFC_StartCommand(
 /// \param command  Command to perform.
 /// \param argument  Optional command argument.
 //------------------------------------------------------------------------------
-#if defined(flash)
-   #ifdef __ICCARM__
-__ramfunc
-   #else
-__attribute__ ((section (".ramfunc")))
-   #endif
-#endif
+RAMFUNC
 unsigned char EFC_PerformCommand(
     AT91S_EFC *pEfc,
     unsigned char command,
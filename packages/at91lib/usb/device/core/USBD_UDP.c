@@ -302,6 +302,7 @@ static void UDP_ClearRxFlag(unsigned char bEndpoint)
 /// FIFO
 /// \param bEndpoint Number of the endpoint which is sending data.
 //------------------------------------------------------------------------------
+RAMFUNC
 static void UDP_WritePayload(unsigned char bEndpoint)
 {
     Endpoint *pEndpoint = &(endpoints[bEndpoint]);
@@ -334,6 +335,7 @@ static void UDP_WritePayload(unsigned char bEndpoint)
 /// \param bEndpoint Endpoint number.
 /// \param wPacketSize Size of received data packet
 //------------------------------------------------------------------------------
+RAMFUNC
 static void UDP_ReadPayload(unsigned char bEndpoint, int wPacketSize)
 {
     Endpoint *pEndpoint = &(endpoints[bEndpoint]);
@@ -455,6 +457,7 @@ static unsigned char UDP_IsTransferFinished(unsigned char bEndpoint)
 /// Handle IN/OUT transfers, received SETUP packets and STALLing
 /// \param bEndpoint Index of endpoint
 //------------------------------------------------------------------------------
+RAMFUNC
 static void UDP_EndpointHandler(unsigned char bEndpoint)
 {
     Endpoint *pEndpoint = &(endpoints[bEndpoint]);
@@ -626,6 +629,7 @@ static void UDP_EndpointHandler(unsigned char bEndpoint)
 /// Manages device resume, suspend, end of bus reset.
 /// Forwards endpoint interrupts to the appropriate handler.
 //------------------------------------------------------------------------------
+RAMFUNC
 void USBD_InterruptHandler(void)
 {
     unsigned int status;
@@ -297,6 +297,17 @@ static unsigned char MSDD_ProcessCommand(MSDDriver * pMsdDriver)
             TRACE_INFO_WP("LUN%d ", cbw->bCBWLUN);
         }
 
+        // A new command replaces the sense data of the previous one, which
+        // REQUEST SENSE reports
+        if ((commandState->state == 0)
+            && (cbw->pCommand[0] != SBC_REQUEST_SENSE)) {
+
+            SBC_UpdateSenseData(&(lun->requestSenseData),
+                                SBC_SENSE_KEY_NO_SENSE,
+                                0,
+                                0);
+        }
+
         status = SBC_ProcessCommand(lun, commandState);
     }
 
@@ -336,30 +347,32 @@ static unsigned char MSDD_ProcessCommand(MSDDriver * pMsdDriver)
 
         TRACE_WARNING("MSD_ProcessCommand: Command failed\n\r");
 
-        // Update sense data
-// TODO (jjoannic#1#): Change code
-        SBC_UpdateSenseData(&(lun->requestSenseData),
-                            SBC_SENSE_KEY_MEDIUM_ERROR,
-                            SBC_ASC_INVALID_FIELD_IN_CDB,
-                            0);
+        // Update sense data, unless the command has already reported the
+        // cause of the failure (e.g. a media error in the middle of a
+        // READ (10) or WRITE (10))
+        if (lun->requestSenseData.bSenseKey == SBC_SENSE_KEY_NO_SENSE) {
+
+            SBC_UpdateSenseData(&(lun->requestSenseData),
+                                SBC_SENSE_KEY_MEDIUM_ERROR,
+                                SBC_ASC_INVALID_FIELD_IN_CDB,
+                                0);
+        }
 
         // Result codes
         csw->bCSWStatus = MSD_CSW_COMMAND_FAILED;
         isCommandComplete = 1;
     }
-    else {
+    else if (status == MSDD_STATUS_SUCCESS) {
 
-        // Update sense data
+        // Update sense data; an incomplete command keeps the sense data set
+        // by a failure until it ends (e.g. while a READ (10) is aborted)
         SBC_UpdateSenseData(&(lun->requestSenseData),
                             SBC_SENSE_KEY_NO_SENSE,
                             0,
                             0);
 
-        // Is command complete ?
-        if (status == MSDD_STATUS_SUCCESS) {
-
-            isCommandComplete = 1;
-        }
+        // Command is complete
+        isCommandComplete = 1;
     }
 
     // Check if command has been completed
@@ -405,6 +418,7 @@ void MSDD_StateMachine(MSDDriver * pMsdDriver)
     MSCsw           *csw = &(commandState->csw);
     MSDTransfer     *transfer = &(commandState->transfer);
     unsigned char   status;
+    unsigned char   i;
 
     // Identify current driver state
     switch (pMsdDriver->state) {
@@ -455,6 +469,14 @@ void MSDD_StateMachine(MSDDriver * pMsdDriver)
                 pMsdDriver->state = MSDD_STATE_READ_CBW;
             }
         }
+        else {
+
+            // No command in progress, perform the LUNs background work
+            for (i = 0; i <= pMsdDriver->maxLun; i++) {
+
+                LUN_Idle(&(pMsdDriver->luns[i]));
+            }
+        }
         break;
 
     //-------------------------
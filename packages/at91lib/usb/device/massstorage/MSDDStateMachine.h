@@ -171,6 +171,7 @@ typedef struct {
 typedef struct {
 
     MSDTransfer transfer;       /// Current transfer status
+    MSDTransfer disktransfer;   /// Current media transfer status
     MSCbw      cbw;             /// Received CBW
     MSCsw      csw;             /// CSW to send
     unsigned char  state;       /// Current command state
@@ -61,11 +61,19 @@ static USBDDriver usbdDriver;
 //-----------------------------------------------------------------------------
 static void MSDDriver_Reset(void)
 {
+    unsigned char i;
+
     TRACE_INFO_WP("MSDReset ");
 
     msdDriver.state = MSDD_STATE_READ_CBW;
     msdDriver.waitResetRecovery = 0;
     msdDriver.commandState.state = 0;
+
+    // Write back the cached data as soon as the driver is idle
+    for (i = 0; i <= msdDriver.maxLun; i++) {
+
+        LUN_RequestFlush(&(msdDriver.luns[i]));
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -175,6 +183,7 @@ void MSDDriver_Initialize(MSDLun *luns, unsigned char numLuns)
     msdDriver.commandState.postprocess = 0;
     msdDriver.commandState.length = 0;
     msdDriver.commandState.transfer.semaphore = 0;
+    msdDriver.commandState.disktransfer.semaphore = 0;
 
     // LUNs
     msdDriver.luns = luns;
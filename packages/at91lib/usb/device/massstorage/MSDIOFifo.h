@@ -0,0 +1,238 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+/// !Purpose
+///
+/// Block FIFO used by the SBC READ (10) and WRITE (10) commands to overlap
+/// the USB transfers with the media transfers.
+///
+/// !Usage
+///
+/// The FIFO splits the LUN buffer into block slots. One side of the command
+/// (the "input") fills slots, the other side (the "output") drains them:
+/// - READ (10): the media is the input and the USB bulk IN pipe the output.
+/// - WRITE (10): the USB bulk OUT pipe is the input and the media the output.
+///
+/// Each side transfers at most chunkSize blocks at once, i.e. half of the
+/// buffer, so that one half can be filled while the other one is drained.
+/// -# Assign the buffer once with MSDIOFifo_Initialize.
+/// -# Invoke MSDIOFifo_Reset at the beginning of each command.
+/// -# Start an input (resp. output) transfer of MSDIOFifo_InputSpace (resp.
+///    MSDIOFifo_OutputSpace) blocks at MSDIOFifo_InputBuffer (resp.
+///    MSDIOFifo_OutputBuffer), and record its size in inputPending (resp.
+///    outputPending).
+/// -# Call MSDIOFifo_InputDone (resp. MSDIOFifo_OutputDone) when it
+///    completes successfully.
+//------------------------------------------------------------------------------
+
+#ifndef MSDIOFIFO_H
+#define MSDIOFIFO_H
+
+//------------------------------------------------------------------------------
+//      Types
+//------------------------------------------------------------------------------
+
+/// Block FIFO
+typedef struct {
+
+    /// Buffer holding bufferSize blocks.
+    unsigned char *pBuffer;
+    /// Number of block slots in the buffer.
+    unsigned int  bufferSize;
+    /// Maximum number of blocks moved by one transfer.
+    unsigned int  chunkSize;
+    /// Slot filled by the next input transfer.
+    unsigned int  inputIndex;
+    /// Slot drained by the next output transfer.
+    unsigned int  outputIndex;
+    /// Number of slots holding data.
+    unsigned int  count;
+    /// Number of blocks of the input transfer in progress.
+    unsigned int  inputPending;
+    /// Number of blocks of the output transfer in progress.
+    unsigned int  outputPending;
+    /// Number of blocks the command still has to input.
+    unsigned int  inputTotal;
+    /// Number of blocks the command still has to output.
+    unsigned int  outputTotal;
+
+} MSDIOFifo;
+
+//------------------------------------------------------------------------------
+//      Inline functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Assigns a buffer to a FIFO.
+/// \param  fifo       Pointer to a MSDIOFifo instance.
+/// \param  buffer     Buffer of numBlocks blocks.
+/// \param  numBlocks  Number of block slots in the buffer.
+//------------------------------------------------------------------------------
+static inline void MSDIOFifo_Initialize(MSDIOFifo     *fifo,
+                                        unsigned char *buffer,
+                                        unsigned int  numBlocks)
+{
+    fifo->pBuffer = buffer;
+    fifo->bufferSize = numBlocks;
+    fifo->chunkSize = (numBlocks > 1) ? (numBlocks / 2) : 1;
+}
+
+//------------------------------------------------------------------------------
+/// Empties a FIFO and prepares it for the transfer of the given number of
+/// blocks.
+/// \param  fifo       Pointer to a MSDIOFifo instance.
+/// \param  numBlocks  Number of blocks to transfer through the FIFO.
+//------------------------------------------------------------------------------
+static inline void MSDIOFifo_Reset(MSDIOFifo *fifo, unsigned int numBlocks)
+{
+    fifo->inputIndex = 0;
+    fifo->outputIndex = 0;
+    fifo->count = 0;
+    fifo->inputPending = 0;
+    fifo->outputPending = 0;
+    fifo->inputTotal = numBlocks;
+    fifo->outputTotal = numBlocks;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of blocks the next input transfer can fill, or 0 if
+/// an input transfer is in progress or no slot is free.
+/// \param  fifo  Pointer to a MSDIOFifo instance.
+//------------------------------------------------------------------------------
+static inline unsigned int MSDIOFifo_InputSpace(const MSDIOFifo *fifo)
+{
+    unsigned int space;
+
+    if (fifo->inputPending > 0) {
+
+        return 0;
+    }
+
+    space = fifo->bufferSize - fifo->count;
+    if (space > fifo->bufferSize - fifo->inputIndex) {
+
+        space = fifo->bufferSize - fifo->inputIndex;
+    }
+    if (space > fifo->chunkSize) {
+
+        space = fifo->chunkSize;
+    }
+    if (space > fifo->inputTotal) {
+
+        space = fifo->inputTotal;
+    }
+
+    return space;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of blocks the next output transfer can drain, or 0 if
+/// an output transfer is in progress or no slot holds data.
+/// \param  fifo  Pointer to a MSDIOFifo instance.
+//------------------------------------------------------------------------------
+static inline unsigned int MSDIOFifo_OutputSpace(const MSDIOFifo *fifo)
+{
+    unsigned int space;
+
+    if (fifo->outputPending > 0) {
+
+        return 0;
+    }
+
+    space = fifo->count;
+    if (space > fifo->bufferSize - fifo->outputIndex) {
+
+        space = fifo->bufferSize - fifo->outputIndex;
+    }
+    if (space > fifo->chunkSize) {
+
+        space = fifo->chunkSize;
+    }
+
+    return space;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the address of the slot filled by the next input transfer.
+/// \param  fifo       Pointer to a MSDIOFifo instance.
+/// \param  blockSize  Size of one block in bytes.
+//------------------------------------------------------------------------------
+static inline unsigned char * MSDIOFifo_InputBuffer(const MSDIOFifo *fifo,
+                                                    unsigned int    blockSize)
+{
+    return fifo->pBuffer + fifo->inputIndex * blockSize;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the address of the slot drained by the next output transfer.
+/// \param  fifo       Pointer to a MSDIOFifo instance.
+/// \param  blockSize  Size of one block in bytes.
+//------------------------------------------------------------------------------
+static inline unsigned char * MSDIOFifo_OutputBuffer(const MSDIOFifo *fifo,
+                                                     unsigned int    blockSize)
+{
+    return fifo->pBuffer + fifo->outputIndex * blockSize;
+}
+
+//------------------------------------------------------------------------------
+/// Commits the blocks of the input transfer in progress.
+/// \param  fifo  Pointer to a MSDIOFifo instance.
+//------------------------------------------------------------------------------
+static inline void MSDIOFifo_InputDone(MSDIOFifo *fifo)
+{
+    fifo->count += fifo->inputPending;
+    fifo->inputTotal -= fifo->inputPending;
+    fifo->inputIndex += fifo->inputPending;
+    if (fifo->inputIndex >= fifo->bufferSize) {
+
+        fifo->inputIndex = 0;
+    }
+    fifo->inputPending = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Releases the slots of the output transfer in progress.
+/// \param  fifo  Pointer to a MSDIOFifo instance.
+//------------------------------------------------------------------------------
+static inline void MSDIOFifo_OutputDone(MSDIOFifo *fifo)
+{
+    fifo->count -= fifo->outputPending;
+    fifo->outputTotal -= fifo->outputPending;
+    fifo->outputIndex += fifo->outputPending;
+    if (fifo->outputIndex >= fifo->bufferSize) {
+
+        fifo->outputIndex = 0;
+    }
+    fifo->outputPending = 0;
+}
+
+#endif //#ifndef MSDIOFIFO_H
+
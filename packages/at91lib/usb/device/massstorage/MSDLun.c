@@ -35,6 +35,7 @@
 #include "MSDLun.h"
 #include <utility/trace.h>
 #include <usb/device/core/USBD.h>
+#include <string.h>
 
 //------------------------------------------------------------------------------
 //         Internal variables
@@ -78,36 +79,332 @@ static SBCInquiryData inquiryData = {
     {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0} // Reserved
 };
 
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//! \brief  Reads blocks from the cache of a LUN if it has one, otherwise queues
+//!         a read on its media.
+//! \param  lun          Pointer to a MSDLun instance
+//! \param  blockAddress First block address to read
+//! \param  data         Pointer to a data buffer in which to store the data
+//! \param  length       Number of blocks to read
+//! \param  callback     Optional callback to invoke when the read finishes
+//! \param  argument     Optional argument for the callback
+//! \return MED_STATUS_SUCCESS if the read has been started
+//------------------------------------------------------------------------------
+static unsigned char LUN_ReadMedia(MSDLun        *lun,
+                                   unsigned int  blockAddress,
+                                   void          *data,
+                                   unsigned int  length,
+                                   MediaCallback callback,
+                                   void          *argument)
+{
+    unsigned char status;
+
+    if (lun->cache) {
+
+        status = LUNCache_Read(lun->cache,
+                               blockAddress,
+                               data,
+                               length,
+                               callback,
+                               argument);
+    }
+    else {
+
+        status = MED_Submit(lun->media,
+                            0,
+                            lun->media->baseAddress
+                            + lun->baseAddress
+                            + blockAddress * lun->blockSize,
+                            data,
+                            length * lun->blockSize,
+                            callback,
+                            argument);
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked when a prefetch ends.
+//! \param  readAhead   Pointer to the MSDLunReadAhead instance
+//! \param  status      Transfer status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void LUN_PrefetchCallback(MSDLunReadAhead *readAhead,
+                                 unsigned char   status,
+                                 unsigned int    transferred,
+                                 unsigned int    remaining)
+{
+    if (status == MED_STATUS_SUCCESS) {
+
+        readAhead->count = readAhead->pendingCount;
+    }
+    readAhead->pending = 0;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Invoked when the media part of a read partially served from the
+//!         read-ahead buffer ends. Reports the whole read to the caller.
+//! \param  readAhead   Pointer to the MSDLunReadAhead instance
+//! \param  status      Transfer status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void LUN_ReadAheadCallback(MSDLunReadAhead *readAhead,
+                                  unsigned char   status,
+                                  unsigned int    transferred,
+                                  unsigned int    remaining)
+{
+    if (readAhead->callback) {
+
+        readAhead->callback(readAhead->argument,
+                            status,
+                            readAhead->served + transferred,
+                            remaining);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Waits for the end of the background work in progress on a LUN
+//!         (prefetch, cache write back), if any, at most LUN_WAIT_TIMEOUT
+//!         polls.
+//! \param  lun Pointer to a MSDLun instance
+//! \return MED_STATUS_SUCCESS, or MED_STATUS_ERROR if the work never ends
+//------------------------------------------------------------------------------
+static unsigned char LUN_WaitIdle(MSDLun *lun)
+{
+    unsigned int timeout = LUN_WAIT_TIMEOUT;
+
+    while ((lun->readAhead && lun->readAhead->pending)
+           || (lun->cache && LUNCache_IsBusy(lun->cache))) {
+
+        if (--timeout == 0) {
+
+            TRACE_WARNING("LUN_WaitIdle: Timeout\n\r");
+            return MED_STATUS_ERROR;
+        }
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes back the cache of a LUN and waits for the end of the write
+//!         back, at most LUN_WAIT_TIMEOUT polls.
+//! \param  lun Pointer to a MSDLun instance, with a cache
+//! \return MED_STATUS_SUCCESS or MED_STATUS_ERROR
+//------------------------------------------------------------------------------
+static unsigned char LUN_WriteBack(MSDLun *lun)
+{
+    if ((LUN_WaitIdle(lun) != MED_STATUS_SUCCESS)
+        || (LUNCache_Flush(lun->cache, 0, 0) != MED_STATUS_SUCCESS)
+        || (LUN_WaitIdle(lun) != MED_STATUS_SUCCESS)) {
+
+        return MED_STATUS_ERROR;
+    }
+
+    return lun->cache->status;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Updates the sequential stream detection with a new read, and serves
+//!         its first blocks from the read-ahead buffer when possible. No
+//!         prefetch must be in progress.
+//! \param  lun          Pointer to a MSDLun instance
+//! \param  blockAddress First block address to read
+//! \param  data         Pointer to a data buffer in which to store the data
+//! \param  length       Number of blocks to read
+//! \return Number of blocks copied from the read-ahead buffer
+//------------------------------------------------------------------------------
+static unsigned int LUN_ReadAhead(MSDLun        *lun,
+                                  unsigned int  blockAddress,
+                                  unsigned char *data,
+                                  unsigned int  length)
+{
+    MSDLunReadAhead *readAhead = lun->readAhead;
+    unsigned int numBlocks = 0;
+
+    // Follow the sequential stream, the window grows with its length
+    if (blockAddress == readAhead->nextBlock) {
+
+        readAhead->streamLength += length;
+    }
+    else {
+
+        readAhead->streamLength = length;
+    }
+    readAhead->nextBlock = blockAddress + length;
+    readAhead->window = readAhead->streamLength;
+    if (readAhead->window < readAhead->minWindow) {
+
+        readAhead->window = readAhead->minWindow;
+    }
+    else if (readAhead->window > readAhead->maxWindow) {
+
+        readAhead->window = readAhead->maxWindow;
+    }
+
+    // Serve the first blocks from the buffer
+    if ((blockAddress >= readAhead->start)
+        && (blockAddress < (readAhead->start + readAhead->count))) {
+
+        numBlocks = readAhead->start + readAhead->count - blockAddress;
+        if (numBlocks > length) {
+
+            numBlocks = length;
+        }
+        memcpy(data,
+               readAhead->pBuffer
+               + (blockAddress - readAhead->start) * lun->blockSize,
+               numBlocks * lun->blockSize);
+    }
+
+    readAhead->hits += numBlocks;
+    readAhead->misses += length - numBlocks;
+
+    return numBlocks;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts prefetching the blocks following the current sequential
+//!         stream, if not already done.
+//! \param  lun Pointer to a MSDLun instance
+//! \return MED_STATUS_SUCCESS, or MED_STATUS_ERROR if the prefetch failed
+//------------------------------------------------------------------------------
+static unsigned char LUN_Prefetch(MSDLun *lun)
+{
+    MSDLunReadAhead *readAhead = lun->readAhead;
+    unsigned int numBlocks = lun->size / lun->blockSize;
+    unsigned int start = readAhead->nextBlock;
+
+    // Only prefetch sequential streams, once the cache is written back
+    if (readAhead->pending
+        || (lun->cache && LUNCache_IsBusy(lun->cache))
+        || (readAhead->streamLength < 2)
+        || (start >= numBlocks)) {
+
+        return MED_STATUS_SUCCESS;
+    }
+
+    // Check if the next blocks are already in the buffer
+    if ((start >= readAhead->start)
+        && (start < (readAhead->start + readAhead->count))) {
+
+        return MED_STATUS_SUCCESS;
+    }
+
+    numBlocks -= start;
+    if (numBlocks > readAhead->window) {
+
+        numBlocks = readAhead->window;
+    }
+
+    TRACE_INFO_WP("Prefetch(%u,%u) ", start, numBlocks);
+    readAhead->start = start;
+    readAhead->count = 0;
+    readAhead->pendingCount = numBlocks;
+    readAhead->pending = 1;
+    if (LUN_ReadMedia(lun,
+                      start,
+                      readAhead->pBuffer,
+                      numBlocks,
+                      (MediaCallback) LUN_PrefetchCallback,
+                      readAhead) != MED_STATUS_SUCCESS) {
+
+        readAhead->pending = 0;
+        return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
 //------------------------------------------------------------------------------
 //         Exported functions
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
-//! \brief  Initializes a LUN instance.
+//! \brief  Initializes a LUN instance. The erase unit and the optimal transfer
+//!         length of the media are queried to report the LUN block limits.
 //! \param  lun         Pointer to the MSDLun instance to initialize
 //! \param  media       Media on which the LUN is constructed
-//! \param  buffer      Pointer to a buffer used for read/write operation and
-//!                      which must be blockSize bytes long.
+//! \param  buffer      Pointer to a buffer used for read/write operation.
+//! \param  bufferSize  Size of the buffer in bytes, at least blockSize. With
+//!                      two blocks or more, the media and USB transfers of
+//!                      READ (10) and WRITE (10) are overlapped.
 //! \param  baseAddress Base address of the LUN on the media
 //! \param  size        Total size of the LUN in bytes
-//! \param  blockSize   Length of one block of the LUN
+//! \param  blockSize   Length of one block of the LUN, or 0 to use the sector
+//!                     size of the media (at least LUN_DEFAULT_BLOCK_SIZE)
 //------------------------------------------------------------------------------
 void LUN_Init(MSDLun         *lun,
               Media       *media,
               unsigned char *buffer,
+              unsigned int  bufferSize,
               unsigned int  baseAddress,
               unsigned int  size,
               unsigned int  blockSize)
 {
-    unsigned int logicalBlockAddress = (size / blockSize) - 1;
+    unsigned int logicalBlockAddress;
+    unsigned int sectorSize;
+    unsigned int value;
+    MEDRange range;
     TRACE_INFO("LUN init\n\r");
 
+    // Derive the block size from the media geometry
+    if (MED_Ioctl(media, MED_IOCTL_GET_SECTOR_SIZE, &sectorSize)
+        != MED_STATUS_SUCCESS) {
+
+        sectorSize = 1;
+    }
+    if (blockSize == 0) {
+
+        blockSize = LUN_DEFAULT_BLOCK_SIZE;
+        if (sectorSize > blockSize) {
+
+            blockSize = sectorSize;
+        }
+    }
+    else if ((blockSize % sectorSize) != 0) {
+
+        TRACE_WARNING("LUN_Init: Block size not a multiple of sector size\n\r");
+    }
+    logicalBlockAddress = (size / blockSize) - 1;
+
     // Initialize LUN
     lun->media = media;
     lun->baseAddress = baseAddress;
     lun->size = size;
     lun->blockSize = blockSize;
     lun->readWriteBuffer = buffer;
+    lun->cache = 0;
+    lun->readAhead = 0;
+    MSDIOFifo_Initialize(&(lun->ioFifo), buffer, bufferSize / blockSize);
+
+    // Block limits
+    lun->eraseBlocks = 1;
+    if ((MED_Ioctl(media, MED_IOCTL_GET_ERASE_UNIT, &value)
+         == MED_STATUS_SUCCESS)
+        && (value > blockSize)) {
+
+        lun->eraseBlocks = value / blockSize;
+    }
+    lun->optimalTransferBlocks = 0;
+    if (MED_Ioctl(media, MED_IOCTL_GET_OPTIMAL_TRANSFER, &value)
+        == MED_STATUS_SUCCESS) {
+
+        lun->optimalTransferBlocks = (value + blockSize - 1) / blockSize;
+    }
+
+    // An empty range tells whether the media knows about discards
+    range.address = media->baseAddress + baseAddress;
+    range.length = 0;
+    lun->canUnmap = (MED_Ioctl(media, MED_IOCTL_TRIM, &range)
+                     == MED_STATUS_SUCCESS);
 
     // Initialize request sense data
     lun->requestSenseData.bResponseCode = SBC_SENSE_DATA_FIXED_CURRENT;
@@ -141,6 +438,24 @@ void LUN_Init(MSDLun         *lun,
     STORE_DWORDB(blockSize, lun->readCapacityData.pLogicalBlockLength);
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Indicates if the media of a LUN cannot be written.
+//! \param  lun Pointer to a MSDLun instance
+//! \return 1 if the LUN is write-protected, 0 otherwise
+//------------------------------------------------------------------------------
+unsigned char LUN_IsWriteProtected(MSDLun *lun)
+{
+    unsigned char isProtected;
+
+    if (MED_Ioctl(lun->media, MED_IOCTL_GET_WRITE_PROTECT, &isProtected)
+        != MED_STATUS_SUCCESS) {
+
+        return 0;
+    }
+
+    return isProtected;
+}
+
 //------------------------------------------------------------------------------
 //! \brief  Writes data on the a LUN starting at the specified block address.
 //! \param  pLUN          Pointer to a MSDLun instance
@@ -171,18 +486,49 @@ unsigned char LUN_Write(MSDLun        *lun,
     }
     else {
 
-        // Compute write start address
-        address = lun->media->baseAddress
-                   + lun->baseAddress
-                   + blockAddress * lun->blockSize;
+        // Wait for the background work
+        if (LUN_WaitIdle(lun) != MED_STATUS_SUCCESS) {
 
-        // Start write operation
-        status = MED_Write(lun->media,
-                           address,
-                           data,
-                           length * lun->blockSize,
-                           callback,
-                           argument);
+            return USBD_STATUS_ABORTED;
+        }
+
+        // Drop the prefetched blocks which are overwritten
+        if (lun->readAhead) {
+
+            if ((blockAddress < (lun->readAhead->start
+                                 + lun->readAhead->count))
+                && ((blockAddress + length) > lun->readAhead->start)) {
+
+                lun->readAhead->count = 0;
+            }
+        }
+
+        // Write through the cache
+        if (lun->cache) {
+
+            status = LUNCache_Write(lun->cache,
+                                    blockAddress,
+                                    data,
+                                    length,
+                                    callback,
+                                    argument);
+        }
+        else {
+
+            // Compute write start address
+            address = lun->media->baseAddress
+                       + lun->baseAddress
+                       + blockAddress * lun->blockSize;
+
+            // Queue write operation
+            status = MED_Submit(lun->media,
+                                1,
+                                address,
+                                data,
+                                length * lun->blockSize,
+                                callback,
+                                argument);
+        }
 
         // Check operation result code
         if (status == MED_STATUS_SUCCESS) {
@@ -215,7 +561,7 @@ unsigned char LUN_Read(MSDLun        *lun,
                        MediaCallback   callback,
                        void         *argument)
 {
-    unsigned int address;
+    unsigned int numBlocks;
     unsigned char status;
 
     // Check that the data is not too big
@@ -229,18 +575,45 @@ unsigned char LUN_Read(MSDLun        *lun,
 
         TRACE_INFO_WP("LUNRead(%u) ", blockAddress);
 
-        // Compute read start address
-        address = lun->media->baseAddress
-                   + lun->baseAddress
-                   + blockAddress * lun->blockSize;
+        // Wait for the background work
+        if (LUN_WaitIdle(lun) != MED_STATUS_SUCCESS) {
 
-        // Start write operation
-        status = MED_Read(lun->media,
-                          address,
-                          data,
-                          length * lun->blockSize,
-                          callback,
-                          argument);
+            return USBD_STATUS_ABORTED;
+        }
+
+        // Serve the prefetched blocks
+        if (lun->readAhead) {
+
+            numBlocks = LUN_ReadAhead(lun, blockAddress, data, length);
+            if (numBlocks == length) {
+
+                if (callback) {
+
+                    callback(argument, MED_STATUS_SUCCESS,
+                             length * lun->blockSize, 0);
+                }
+                return USBD_STATUS_SUCCESS;
+            }
+            else if (numBlocks > 0) {
+
+                // Read the other blocks, then report the whole transfer
+                lun->readAhead->callback = callback;
+                lun->readAhead->argument = argument;
+                lun->readAhead->served = numBlocks * lun->blockSize;
+                callback = (MediaCallback) LUN_ReadAheadCallback;
+                argument = lun->readAhead;
+                blockAddress += numBlocks;
+                data = (unsigned char *) data + numBlocks * lun->blockSize;
+                length -= numBlocks;
+            }
+        }
+
+        status = LUN_ReadMedia(lun,
+                               blockAddress,
+                               data,
+                               length,
+                               callback,
+                               argument);
 
         // Check result code
         if (status == MED_STATUS_SUCCESS) {
@@ -256,3 +629,206 @@ unsigned char LUN_Read(MSDLun        *lun,
 
     return status;
 }
+
+//------------------------------------------------------------------------------
+//! \brief  Discards blocks of a LUN which are no longer used. The cached data
+//!         is written back first, so that it does not land on the media after
+//!         the discard; the discarded blocks then have undefined contents.
+//! \param  lun          Pointer to a MSDLun instance
+//! \param  blockAddress First block address to discard
+//! \param  length       Number of blocks to discard
+//! \return Operation result code
+//------------------------------------------------------------------------------
+unsigned char LUN_Unmap(MSDLun       *lun,
+                        unsigned int blockAddress,
+                        unsigned int length)
+{
+    MEDRange range;
+
+    TRACE_INFO_WP("LUNUnmap(%u, %u) ", blockAddress, length);
+
+    // Check that the range is inside the LUN
+    if ((blockAddress > (lun->size / lun->blockSize))
+        || (length > ((lun->size / lun->blockSize) - blockAddress))) {
+
+        TRACE_WARNING("LUN_Unmap: Range too big\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+    if (length == 0) {
+
+        return USBD_STATUS_SUCCESS;
+    }
+
+    // Wait for the background work
+    if (LUN_WaitIdle(lun) != MED_STATUS_SUCCESS) {
+
+        return USBD_STATUS_ABORTED;
+    }
+
+    // Drop the prefetched blocks which are discarded
+    if (lun->readAhead) {
+
+        if ((blockAddress < (lun->readAhead->start + lun->readAhead->count))
+            && ((blockAddress + length) > lun->readAhead->start)) {
+
+            lun->readAhead->count = 0;
+        }
+    }
+
+    if (lun->cache && (LUN_WriteBack(lun) != MED_STATUS_SUCCESS)) {
+
+        TRACE_WARNING("LUN_Unmap: Cannot write back cache\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    range.address = lun->media->baseAddress
+                    + lun->baseAddress
+                    + blockAddress * lun->blockSize;
+    range.length = length * lun->blockSize;
+    if (MED_Ioctl(lun->media, MED_IOCTL_TRIM, &range) != MED_STATUS_SUCCESS) {
+
+        TRACE_WARNING("LUN_Unmap: Cannot discard media range\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    return USBD_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Attaches a write-back cache to a LUN. Must be called after LUN_Init.
+//! \param  lun        Pointer to a MSDLun instance
+//! \param  cache      Pointer to the MSDLunCache instance to use
+//! \param  lines      Array of numLines line descriptors
+//! \param  buffer     Buffer of numLines * lineSize blocks
+//! \param  numLines   Number of cache lines
+//! \param  lineSize   Number of blocks per line; should match the write unit
+//!                    of the media (e.g. a flash page)
+//! \param  flushDelay Number of LUN_Tick ticks without write before the dirty
+//!                    blocks are written back, 0 to disable
+//------------------------------------------------------------------------------
+void LUN_ConfigureCache(MSDLun          *lun,
+                        MSDLunCache     *cache,
+                        MSDLunCacheLine *lines,
+                        unsigned char   *buffer,
+                        unsigned int    numLines,
+                        unsigned int    lineSize,
+                        unsigned int    flushDelay)
+{
+    LUNCache_Initialize(cache,
+                        lun->media,
+                        lun->media->baseAddress + lun->baseAddress,
+                        lun->blockSize,
+                        lines,
+                        buffer,
+                        numLines,
+                        lineSize,
+                        flushDelay);
+    lun->cache = cache;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Enables the read-ahead of a LUN. Must be called after LUN_Init and
+//!         LUN_ConfigureCache.
+//! \param  lun       Pointer to a MSDLun instance
+//! \param  readAhead Pointer to the MSDLunReadAhead instance to use
+//! \param  buffer    Buffer of maxWindow blocks receiving the prefetched data
+//! \param  minWindow Number of blocks prefetched after a short stream
+//! \param  maxWindow Maximum number of blocks prefetched
+//------------------------------------------------------------------------------
+void LUN_ConfigureReadAhead(MSDLun          *lun,
+                            MSDLunReadAhead *readAhead,
+                            unsigned char   *buffer,
+                            unsigned int    minWindow,
+                            unsigned int    maxWindow)
+{
+    readAhead->pBuffer = buffer;
+    readAhead->minWindow = minWindow;
+    readAhead->maxWindow = maxWindow;
+    readAhead->window = minWindow;
+    readAhead->start = 0;
+    readAhead->count = 0;
+    readAhead->nextBlock = 0;
+    readAhead->streamLength = 0;
+    readAhead->pendingCount = 0;
+    readAhead->pending = 0;
+    readAhead->hits = 0;
+    readAhead->misses = 0;
+    readAhead->callback = 0;
+    readAhead->argument = 0;
+    readAhead->served = 0;
+    lun->readAhead = readAhead;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Writes back the cached data of a LUN and flushes its media.
+//! \param  lun Pointer to a MSDLun instance
+//! \return Operation result code
+//------------------------------------------------------------------------------
+unsigned char LUN_Flush(MSDLun *lun)
+{
+    if (lun->cache && (LUN_WriteBack(lun) != MED_STATUS_SUCCESS)) {
+
+        TRACE_WARNING("LUN_Flush: Cannot write back cache\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    if (MED_Flush(lun->media) != MED_STATUS_SUCCESS) {
+
+        TRACE_WARNING("LUN_Flush: Cannot flush media\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    return USBD_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Advances the cache flush timer of a LUN. May be called from an
+//!         interrupt handler.
+//! \param  lun   Pointer to a MSDLun instance
+//! \param  ticks Number of ticks elapsed since the last call
+//------------------------------------------------------------------------------
+void LUN_Tick(MSDLun *lun, unsigned int ticks)
+{
+    if (lun->cache) {
+
+        LUNCache_Tick(lun->cache, ticks);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Requests the cached data of a LUN to be written back at the next
+//!         call to LUN_Idle. May be called from an interrupt handler.
+//! \param  lun Pointer to a MSDLun instance
+//------------------------------------------------------------------------------
+void LUN_RequestFlush(MSDLun *lun)
+{
+    if (lun->cache) {
+
+        LUNCache_RequestFlush(lun->cache);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs the background work of a LUN (delayed cache write back,
+//!         prefetch of the next blocks of a sequential stream).
+//!         Must be called when no media transfer of a command is in
+//!         progress on the LUN.
+//! \param  lun Pointer to a MSDLun instance
+//! \return Operation result code
+//------------------------------------------------------------------------------
+unsigned char LUN_Idle(MSDLun *lun)
+{
+    if (lun->cache && (LUNCache_Idle(lun->cache) != MED_STATUS_SUCCESS)) {
+
+        TRACE_WARNING("LUN_Idle: Cannot write back cache\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    if (lun->readAhead && (LUN_Prefetch(lun) != MED_STATUS_SUCCESS)) {
+
+        TRACE_WARNING("LUN_Idle: Cannot prefetch\n\r");
+        return USBD_STATUS_ABORTED;
+    }
+
+    return USBD_STATUS_SUCCESS;
+}
@@ -40,6 +40,14 @@
 /// -# Initlalize the LUN with LUN_Init, and link to the initialized Media.
 /// -# To read data from the LUN linked media, uses LUN_Read.
 /// -# To write data to the LUN linked media, uses LUN_Write.
+/// -# To discard blocks which are no longer used, uses LUN_Unmap.
+/// -# Optionally, attach a write-back cache with LUN_ConfigureCache; then call
+///    LUN_Tick periodically, LUN_Idle when no command is in progress and
+///    LUN_Flush before the media is powered down.
+/// -# Optionally, attach a read-ahead buffer with LUN_ConfigureReadAhead. When
+///    sequential reads are detected, LUN_Idle prefetches the blocks following
+///    the last read while its last blocks and the CSW are sent, and the host
+///    sends its next command.
 //------------------------------------------------------------------------------
 
 #ifndef MSDLUN_H
@@ -50,6 +58,8 @@
 //------------------------------------------------------------------------------
 
 #include "SBC.h"
+#include "MSDIOFifo.h"
+#include "MSDLunCache.h"
 #include <memories/Media.h>
 #include <usb/device/core/USBD.h>
 
@@ -60,10 +70,55 @@
 #define LUN_STATUS_SUCCESS          0x00
 #define LUN_STATUS_ERROR            0x02
 
+/// Block size used when the media sectors are smaller.
+#define LUN_DEFAULT_BLOCK_SIZE      512
+
+/// Number of polls of the background work of a LUN (prefetch, cache write
+/// back) before an access to the LUN fails (about half a second at 48MHz).
+#ifndef LUN_WAIT_TIMEOUT
+#define LUN_WAIT_TIMEOUT            0x400000
+#endif
+
 //------------------------------------------------------------------------------
 //      Structures
 //------------------------------------------------------------------------------
 
+/// Read-ahead state of a LUN
+typedef struct {
+
+    /// Buffer receiving the prefetched blocks.
+    unsigned char         *pBuffer;
+    /// Minimum number of blocks to prefetch.
+    unsigned int          minWindow;
+    /// Maximum number of blocks to prefetch (size of pBuffer in blocks).
+    unsigned int          maxWindow;
+    /// Number of blocks to prefetch, follows the length of the current stream.
+    unsigned int          window;
+    /// First block held in pBuffer.
+    unsigned int          start;
+    /// Number of valid blocks in pBuffer.
+    unsigned int          count;
+    /// Block following the last read.
+    unsigned int          nextBlock;
+    /// Number of blocks read sequentially up to nextBlock.
+    unsigned int          streamLength;
+    /// Number of blocks being prefetched.
+    unsigned int          pendingCount;
+    /// Set while a prefetch is in progress.
+    volatile unsigned char pending;
+    /// Number of blocks read from pBuffer.
+    unsigned int          hits;
+    /// Number of blocks read from the media.
+    unsigned int          misses;
+    /// Callback of a read partially served from pBuffer.
+    MediaCallback         callback;
+    /// Argument of the callback.
+    void                  *argument;
+    /// Number of bytes of the read already served from pBuffer.
+    unsigned int          served;
+
+} MSDLunReadAhead;
+
 /// LUN structure
 typedef struct {
 
@@ -71,6 +126,8 @@ typedef struct {
     SBCInquiryData        *inquiryData;
     /// Buffer for USB transfer, must be assigned.
     unsigned char         *readWriteBuffer;
+    /// Block FIFO built on readWriteBuffer.
+    MSDIOFifo             ioFifo;
     /// Data for the RequestSense command.
     SBCRequestSenseData   requestSenseData;
     /// Data for the ReadCapacity command.
@@ -83,6 +140,16 @@ typedef struct {
     unsigned int          size;
     /// Sector size of the media
     unsigned int          blockSize;
+    /// Number of blocks erased at once by the media.
+    unsigned int          eraseBlocks;
+    /// Number of blocks per transfer giving the best throughput, 0 if unknown.
+    unsigned int          optimalTransferBlocks;
+    /// 1 if the media accepts the discard of unused blocks, 0 otherwise.
+    unsigned char         canUnmap;
+    /// Optional write-back cache, 0 if the media is accessed directly.
+    MSDLunCache           *cache;
+    /// Optional read-ahead state, 0 if disabled.
+    MSDLunReadAhead       *readAhead;
 
 } MSDLun;
 
@@ -92,10 +159,13 @@ typedef struct {
 extern void LUN_Init(MSDLun         *lun,
                      Media       *media,
                      unsigned char *buffer,
+                     unsigned int  bufferSize,
                      unsigned int  baseAddress,
                      unsigned int  size,
                      unsigned int  blockSize);
 
+extern unsigned char LUN_IsWriteProtected(MSDLun *lun);
+
 extern unsigned char LUN_Write(MSDLun *lun,
                                unsigned int blockAddress,
                                void         *data,
@@ -110,5 +180,31 @@ extern unsigned char LUN_Read(MSDLun        *lun,
                               MediaCallback   callback,
                               void         *argument);
 
+extern unsigned char LUN_Unmap(MSDLun       *lun,
+                               unsigned int blockAddress,
+                               unsigned int length);
+
+extern void LUN_ConfigureCache(MSDLun          *lun,
+                               MSDLunCache     *cache,
+                               MSDLunCacheLine *lines,
+                               unsigned char   *buffer,
+                               unsigned int    numLines,
+                               unsigned int    lineSize,
+                               unsigned int    flushDelay);
+
+extern void LUN_ConfigureReadAhead(MSDLun          *lun,
+                                   MSDLunReadAhead *readAhead,
+                                   unsigned char   *buffer,
+                                   unsigned int    minWindow,
+                                   unsigned int    maxWindow);
+
+extern unsigned char LUN_Flush(MSDLun *lun);
+
+extern void LUN_Tick(MSDLun *lun, unsigned int ticks);
+
+extern void LUN_RequestFlush(MSDLun *lun);
+
+extern unsigned char LUN_Idle(MSDLun *lun);
+
 #endif //#ifndef MSDLUN_H
 
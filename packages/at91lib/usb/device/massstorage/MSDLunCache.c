@@ -0,0 +1,657 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include "MSDLunCache.h"
+#include <utility/assert.h>
+#include <utility/trace.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//         Internal functions
+//------------------------------------------------------------------------------
+
+static void LUNCache_Next(MSDLunCache *cache);
+
+//------------------------------------------------------------------------------
+//! \brief  Ends the operation in progress and reports it to its callback.
+//! \param  cache  Pointer to a MSDLunCache instance
+//! \param  status Operation result code
+//------------------------------------------------------------------------------
+static void LUNCache_End(MSDLunCache *cache, unsigned char status)
+{
+    MediaCallback callback = cache->callback;
+    unsigned int total = cache->total;
+
+    cache->status = status;
+    cache->operation = LUNCACHE_OPERATION_NONE;
+
+    if (callback) {
+
+        if (status == MED_STATUS_SUCCESS) {
+
+            callback(cache->argument, status, total, 0);
+        }
+        else {
+
+            callback(cache->argument, status, 0, total);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Callback invoked when a media transfer started by the cache ends;
+//!         goes on with the operation in progress.
+//! \param  cache       Pointer to the MSDLunCache instance
+//! \param  status      Transfer status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void LUNCache_MediaCallback(MSDLunCache *cache,
+                                   unsigned char status,
+                                   unsigned int transferred,
+                                   unsigned int remaining)
+{
+    MSDLunCacheLine *pLine;
+
+    if (status != MED_STATUS_SUCCESS) {
+
+        TRACE_WARNING("LUNCache_MediaCallback: Media transfer failed\n\r");
+        LUNCache_End(cache, MED_STATUS_ERROR);
+        return;
+    }
+
+    // The blocks written back are clean
+    if (cache->writeLine < cache->numLines) {
+
+        pLine = &(cache->pLines[cache->writeLine]);
+        while (cache->writeFirst < cache->writeLast) {
+
+            pLine->dirtyMask &= ~(1 << cache->writeFirst);
+            cache->writeFirst++;
+        }
+        cache->writeLine = cache->numLines;
+    }
+
+    LUNCache_Next(cache);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Queues a read or write of blocks on the cached media. The operation
+//!         goes on when the transfer ends; the caller must return at once.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  write        1 to write the media, 0 to read it
+//! \param  blockAddress First block to transfer
+//! \param  data         Pointer to the data buffer
+//! \param  length       Number of blocks to transfer
+//------------------------------------------------------------------------------
+static void LUNCache_Transfer(MSDLunCache   *cache,
+                              unsigned char write,
+                              unsigned int  blockAddress,
+                              unsigned char *data,
+                              unsigned int  length)
+{
+    unsigned int address = cache->baseAddress
+                           + blockAddress * cache->blockSize;
+
+    if (MED_Submit(cache->media, write, address, data,
+                   length * cache->blockSize,
+                   (MediaCallback) LUNCache_MediaCallback, cache)
+        != MED_STATUS_SUCCESS) {
+
+        TRACE_WARNING("LUNCache_Transfer: Cannot queue media transfer\n\r");
+        cache->writeLine = cache->numLines;
+        LUNCache_End(cache, MED_STATUS_ERROR);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Returns a pointer to the data of a block in a cache line.
+//! \param  cache  Pointer to a MSDLunCache instance
+//! \param  line   Index of the line
+//! \param  offset Index of the block in the line
+//------------------------------------------------------------------------------
+static unsigned char * LUNCache_BlockData(MSDLunCache  *cache,
+                                          unsigned int line,
+                                          unsigned int offset)
+{
+    return cache->pBuffer
+           + (line * cache->lineSize + offset) * cache->blockSize;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Looks for the line holding the given block.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  blockAddress Address of the block
+//! \return Index of the line, or cache->numLines if no line is allocated for
+//!         the block.
+//------------------------------------------------------------------------------
+static unsigned int LUNCache_Find(MSDLunCache *cache, unsigned int blockAddress)
+{
+    unsigned int tag = blockAddress - (blockAddress % cache->lineSize);
+    unsigned int i;
+
+    for (i = 0; i < cache->numLines; i++) {
+
+        if ((cache->pLines[i].validMask != 0)
+            && (cache->pLines[i].tag == tag)) {
+
+            break;
+        }
+    }
+
+    return i;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Indicates if a block is held by the cache.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  blockAddress Address of the block
+//! \param  pLine        Receives the index of the line holding the block
+//------------------------------------------------------------------------------
+static unsigned char LUNCache_Hit(MSDLunCache  *cache,
+                                  unsigned int blockAddress,
+                                  unsigned int *pLine)
+{
+    unsigned int line = LUNCache_Find(cache, blockAddress);
+    unsigned int offset = blockAddress % cache->lineSize;
+
+    *pLine = line;
+
+    return ((line < cache->numLines)
+            && ((cache->pLines[line].validMask & (1 << offset)) != 0));
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts writing back the first run of consecutive dirty blocks of a
+//!         cache line, in a single media write.
+//! \param  cache Pointer to a MSDLunCache instance
+//! \param  line  Index of the line to write back
+//! \return 1 if a write has been started, 0 if the line is clean
+//------------------------------------------------------------------------------
+static unsigned char LUNCache_WriteBack(MSDLunCache *cache, unsigned int line)
+{
+    MSDLunCacheLine *pLine = &(cache->pLines[line]);
+    unsigned int first = 0;
+    unsigned int last;
+
+    // Skip clean blocks
+    while ((first < cache->lineSize)
+           && ((pLine->dirtyMask & (1 << first)) == 0)) {
+
+        first++;
+    }
+    if (first == cache->lineSize) {
+
+        return 0;
+    }
+
+    // Find the end of the dirty run
+    last = first + 1;
+    while ((last < cache->lineSize)
+           && ((pLine->dirtyMask & (1 << last)) != 0)) {
+
+        last++;
+    }
+
+    cache->writeLine = line;
+    cache->writeFirst = first;
+    cache->writeLast = last;
+    LUNCache_Transfer(cache, 1, pLine->tag + first,
+                      LUNCache_BlockData(cache, line, first),
+                      last - first);
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Chooses the line receiving a new block: a free line, or the least
+//!         recently used one.
+//! \param  cache Pointer to a MSDLunCache instance
+//! \return Index of the line
+//------------------------------------------------------------------------------
+static unsigned int LUNCache_Victim(MSDLunCache *cache)
+{
+    unsigned int line = 0;
+    unsigned int i;
+
+    for (i = 0; i < cache->numLines; i++) {
+
+        if (cache->pLines[i].validMask == 0) {
+
+            return i;
+        }
+        if ((cache->clock - cache->pLines[i].lastUse)
+            > (cache->clock - cache->pLines[line].lastUse)) {
+
+            line = i;
+        }
+    }
+
+    return line;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Goes on with a read: copies the blocks held by the cache and reads
+//!         the next run of missing blocks from the media, which are not
+//!         loaded in the cache.
+//! \param  cache Pointer to a MSDLunCache instance
+//------------------------------------------------------------------------------
+static void LUNCache_NextRead(MSDLunCache *cache)
+{
+    unsigned int line;
+    unsigned int count;
+
+    while (cache->length > 0) {
+
+        if (LUNCache_Hit(cache, cache->blockAddress, &line)) {
+
+            memcpy(cache->pData,
+                   LUNCache_BlockData(cache, line,
+                                      cache->blockAddress % cache->lineSize),
+                   cache->blockSize);
+            cache->pLines[line].lastUse = ++cache->clock;
+            cache->blockAddress++;
+            cache->pData += cache->blockSize;
+            cache->length--;
+        }
+        else {
+
+            // Read the consecutive missing blocks at once
+            count = 1;
+            while ((count < cache->length)
+                   && !LUNCache_Hit(cache, cache->blockAddress + count,
+                                    &line)) {
+
+                count++;
+            }
+            cache->blockAddress += count;
+            cache->pData += count * cache->blockSize;
+            cache->length -= count;
+            LUNCache_Transfer(cache, 0, cache->blockAddress - count,
+                              cache->pData - count * cache->blockSize,
+                              count);
+            return;
+        }
+    }
+
+    LUNCache_End(cache, MED_STATUS_SUCCESS);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Goes on with a write: copies the blocks in their lines, writing
+//!         back the least recently used line when a new one is needed.
+//! \param  cache Pointer to a MSDLunCache instance
+//------------------------------------------------------------------------------
+static void LUNCache_NextWrite(MSDLunCache *cache)
+{
+    unsigned int line;
+    unsigned int offset;
+
+    while (cache->length > 0) {
+
+        line = LUNCache_Find(cache, cache->blockAddress);
+        if (line == cache->numLines) {
+
+            // The replaced line is written back first
+            line = LUNCache_Victim(cache);
+            if (LUNCache_WriteBack(cache, line)) {
+
+                return;
+            }
+            cache->pLines[line].tag = cache->blockAddress
+                                      - (cache->blockAddress
+                                         % cache->lineSize);
+            cache->pLines[line].validMask = 0;
+            cache->pLines[line].dirtyMask = 0;
+        }
+
+        offset = cache->blockAddress % cache->lineSize;
+        memcpy(LUNCache_BlockData(cache, line, offset),
+               cache->pData,
+               cache->blockSize);
+        cache->pLines[line].validMask |= (1 << offset);
+        cache->pLines[line].dirtyMask |= (1 << offset);
+        cache->pLines[line].lastUse = ++cache->clock;
+
+        cache->blockAddress++;
+        cache->pData += cache->blockSize;
+        cache->length--;
+    }
+
+    // Restart the flush timer
+    cache->flushTimer = cache->flushDelay;
+
+    LUNCache_End(cache, MED_STATUS_SUCCESS);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Goes on with a flush: writes back the dirty line with the lowest
+//!         address, until all the lines are clean.
+//! \param  cache Pointer to a MSDLunCache instance
+//------------------------------------------------------------------------------
+static void LUNCache_NextFlush(MSDLunCache *cache)
+{
+    unsigned int line = cache->numLines;
+    unsigned int i;
+
+    for (i = 0; i < cache->numLines; i++) {
+
+        if ((cache->pLines[i].dirtyMask != 0)
+            && ((line == cache->numLines)
+                || (cache->pLines[i].tag < cache->pLines[line].tag))) {
+
+            line = i;
+        }
+    }
+
+    if ((line == cache->numLines) || !LUNCache_WriteBack(cache, line)) {
+
+        LUNCache_End(cache, MED_STATUS_SUCCESS);
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Goes on with the operation in progress, until it waits for a media
+//!         transfer or ends.
+//! \param  cache Pointer to a MSDLunCache instance
+//------------------------------------------------------------------------------
+static void LUNCache_Next(MSDLunCache *cache)
+{
+    switch (cache->operation) {
+
+        case LUNCACHE_OPERATION_READ:
+            LUNCache_NextRead(cache);
+            break;
+
+        case LUNCACHE_OPERATION_WRITE:
+            LUNCache_NextWrite(cache);
+            break;
+
+        case LUNCACHE_OPERATION_FLUSH:
+            LUNCache_NextFlush(cache);
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Callback invoked when a write back started by LUNCache_Idle ends.
+//! \param  cache       Pointer to the MSDLunCache instance
+//! \param  status      Write back status
+//! \param  transferred Number of bytes transferred
+//! \param  remaining   Number of bytes not transferred
+//------------------------------------------------------------------------------
+static void LUNCache_IdleCallback(MSDLunCache *cache,
+                                  unsigned char status,
+                                  unsigned int transferred,
+                                  unsigned int remaining)
+{
+    if (status != MED_STATUS_SUCCESS) {
+
+        TRACE_WARNING("LUNCache_Idle: Cannot write back cache\n\r");
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts an operation of the cache.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  operation    Operation (LUNCACHE_OPERATION_xxx)
+//! \param  blockAddress First block of the operation
+//! \param  data         Data buffer of the operation
+//! \param  length       Number of blocks of the operation
+//! \param  callback     Optional callback invoked when the operation ends
+//! \param  argument     Optional argument of the callback
+//! \return MED_STATUS_SUCCESS if the operation has been started, or
+//!         MED_STATUS_BUSY if another one is in progress
+//------------------------------------------------------------------------------
+static unsigned char LUNCache_Start(MSDLunCache   *cache,
+                                    unsigned char operation,
+                                    unsigned int  blockAddress,
+                                    unsigned char *data,
+                                    unsigned int  length,
+                                    MediaCallback callback,
+                                    void          *argument)
+{
+    if (cache->operation != LUNCACHE_OPERATION_NONE) {
+
+        return MED_STATUS_BUSY;
+    }
+
+    cache->operation = operation;
+    cache->blockAddress = blockAddress;
+    cache->pData = data;
+    cache->length = length;
+    cache->total = length * cache->blockSize;
+    cache->callback = callback;
+    cache->argument = argument;
+    cache->writeLine = cache->numLines;
+
+    LUNCache_Next(cache);
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//! \brief  Initializes a write-back cache.
+//! \param  cache       Pointer to the MSDLunCache instance to initialize
+//! \param  media       Media holding the cached blocks
+//! \param  baseAddress Media address of block 0
+//! \param  blockSize   Size of one block in bytes
+//! \param  lines       Array of numLines line descriptors
+//! \param  buffer      Buffer of numLines * lineSize blocks
+//! \param  numLines    Number of lines
+//! \param  lineSize    Number of blocks in a line, at most
+//!                     LUNCACHE_MAX_LINE_SIZE
+//! \param  flushDelay  Number of ticks without write before the dirty blocks
+//!                     are written back, 0 to disable
+//------------------------------------------------------------------------------
+void LUNCache_Initialize(MSDLunCache     *cache,
+                         Media           *media,
+                         unsigned int    baseAddress,
+                         unsigned int    blockSize,
+                         MSDLunCacheLine *lines,
+                         unsigned char   *buffer,
+                         unsigned int    numLines,
+                         unsigned int    lineSize,
+                         unsigned int    flushDelay)
+{
+    unsigned int i;
+
+    ASSERT((lineSize > 0) && (lineSize <= LUNCACHE_MAX_LINE_SIZE),
+           "LUNCache_Initialize: Bad line size\n\r");
+    ASSERT(numLines > 0, "LUNCache_Initialize: No line\n\r");
+
+    cache->media = media;
+    cache->baseAddress = baseAddress;
+    cache->blockSize = blockSize;
+    cache->pLines = lines;
+    cache->pBuffer = buffer;
+    cache->numLines = numLines;
+    cache->lineSize = lineSize;
+    cache->clock = 0;
+    cache->flushDelay = flushDelay;
+    cache->flushTimer = 0;
+    cache->flushRequest = 0;
+    cache->operation = LUNCACHE_OPERATION_NONE;
+    cache->status = MED_STATUS_SUCCESS;
+    cache->writeLine = numLines;
+
+    for (i = 0; i < numLines; i++) {
+
+        lines[i].tag = 0;
+        lines[i].validMask = 0;
+        lines[i].dirtyMask = 0;
+        lines[i].lastUse = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts reading blocks through the cache. Blocks present in the
+//!         cache are copied from it, consecutive missing blocks are read from
+//!         the media in a single transfer. Missing blocks are not loaded in
+//!         the cache.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  blockAddress First block to read
+//! \param  data         Buffer receiving the data
+//! \param  length       Number of blocks to read
+//! \param  callback     Optional callback invoked when the read ends
+//! \param  argument     Optional argument of the callback
+//! \return MED_STATUS_SUCCESS if the read has been started, or
+//!         MED_STATUS_BUSY if another operation is in progress
+//------------------------------------------------------------------------------
+unsigned char LUNCache_Read(MSDLunCache   *cache,
+                            unsigned int  blockAddress,
+                            unsigned char *data,
+                            unsigned int  length,
+                            MediaCallback callback,
+                            void          *argument)
+{
+    return LUNCache_Start(cache, LUNCACHE_OPERATION_READ, blockAddress,
+                          data, length, callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts writing blocks in the cache. The blocks are written back to
+//!         the media when their line is replaced, when the flush timer
+//!         expires or when the cache is flushed.
+//! \param  cache        Pointer to a MSDLunCache instance
+//! \param  blockAddress First block to write
+//! \param  data         Data to write
+//! \param  length       Number of blocks to write
+//! \param  callback     Optional callback invoked when the write ends
+//! \param  argument     Optional argument of the callback
+//! \return MED_STATUS_SUCCESS if the write has been started, or
+//!         MED_STATUS_BUSY if another operation is in progress
+//------------------------------------------------------------------------------
+unsigned char LUNCache_Write(MSDLunCache   *cache,
+                             unsigned int  blockAddress,
+                             unsigned char *data,
+                             unsigned int  length,
+                             MediaCallback callback,
+                             void          *argument)
+{
+    return LUNCache_Start(cache, LUNCACHE_OPERATION_WRITE, blockAddress,
+                          data, length, callback, argument);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts writing back all the dirty blocks of the cache, in ascending
+//!         block order. The data remains valid in the cache.
+//! \param  cache    Pointer to a MSDLunCache instance
+//! \param  callback Optional callback invoked when the write back ends
+//! \param  argument Optional argument of the callback
+//! \return MED_STATUS_SUCCESS if the write back has been started, or
+//!         MED_STATUS_BUSY if another operation is in progress
+//------------------------------------------------------------------------------
+unsigned char LUNCache_Flush(MSDLunCache   *cache,
+                             MediaCallback callback,
+                             void          *argument)
+{
+    unsigned char status;
+
+    status = LUNCache_Start(cache, LUNCACHE_OPERATION_FLUSH, 0, 0, 0,
+                            callback, argument);
+    if (status == MED_STATUS_SUCCESS) {
+
+        cache->flushRequest = 0;
+        cache->flushTimer = 0;
+    }
+
+    return status;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Indicates if an operation of the cache is in progress.
+//! \param  cache Pointer to a MSDLunCache instance
+//! \return 1 if the cache is busy, 0 otherwise
+//------------------------------------------------------------------------------
+unsigned char LUNCache_IsBusy(MSDLunCache *cache)
+{
+    return (cache->operation != LUNCACHE_OPERATION_NONE);
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Advances the flush timer of the cache. May be called from an
+//!         interrupt handler; the write back itself is done by LUNCache_Idle.
+//! \param  cache Pointer to a MSDLunCache instance
+//! \param  ticks Number of ticks elapsed since the last call
+//------------------------------------------------------------------------------
+void LUNCache_Tick(MSDLunCache *cache, unsigned int ticks)
+{
+    if (cache->flushTimer == 0) {
+
+        return;
+    }
+
+    if (cache->flushTimer > ticks) {
+
+        cache->flushTimer -= ticks;
+    }
+    else {
+
+        cache->flushTimer = 0;
+        cache->flushRequest = 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Requests the cache to be written back at the next call to
+//!         LUNCache_Idle. May be called from an interrupt handler.
+//! \param  cache Pointer to a MSDLunCache instance
+//------------------------------------------------------------------------------
+void LUNCache_RequestFlush(MSDLunCache *cache)
+{
+    cache->flushRequest = 1;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Starts writing back the cache if the flush timer has expired or if
+//!         a flush has been requested, and the cache is not busy. Must be
+//!         called when no command is in progress.
+//! \param  cache Pointer to a MSDLunCache instance
+//! \return MED_STATUS_SUCCESS or MED_STATUS_ERROR
+//------------------------------------------------------------------------------
+unsigned char LUNCache_Idle(MSDLunCache *cache)
+{
+    if (cache->flushRequest && !LUNCache_IsBusy(cache)) {
+
+        return LUNCache_Flush(cache,
+                              (MediaCallback) LUNCache_IdleCallback,
+                              cache);
+    }
+
+    return MED_STATUS_SUCCESS;
+}
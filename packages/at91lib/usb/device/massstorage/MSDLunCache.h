@@ -0,0 +1,193 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \unit
+/// !Purpose
+///
+/// Write-back block cache for the Mass Storage LUNs.
+///
+/// The cache is made of lines of lineSize consecutive blocks, aligned on
+/// lineSize blocks; choosing a line as large as the erase/program unit of the
+/// media lets the cache write back all the dirty blocks of a unit in a single
+/// media write. Lines are allocated when blocks are written and replaced in
+/// least-recently-used order. Reads are served from the cache when the
+/// blocks are present, and from the media otherwise.
+///
+/// The operations of the cache are asynchronous: the media transfers they
+/// need (reads of missing blocks, write back of a replaced line) are chained
+/// from the media callbacks, and the caller is notified by a callback when
+/// the whole operation ends. One operation runs at a time.
+///
+/// !Usage
+/// -# Allocate a MSDLunCache, an array of numLines MSDLunCacheLine and a
+///    buffer of numLines * lineSize blocks, then attach them to a LUN with
+///    LUN_ConfigureCache (see MSDLun.h).
+/// -# Call LUN_Tick periodically so that dirty blocks are written back after
+///    flushDelay ticks without write.
+/// -# The cache is also written back on SYNCHRONIZE CACHE (10) and VERIFY (10)
+///    commands, on Bulk-Only reset and whenever LUN_Flush is invoked (e.g.
+///    before entering USB suspend).
+//------------------------------------------------------------------------------
+
+#ifndef MSDLUNCACHE_H
+#define MSDLUNCACHE_H
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <memories/Media.h>
+
+//------------------------------------------------------------------------------
+//      Definitions
+//------------------------------------------------------------------------------
+
+/// Maximum number of blocks in a cache line.
+#define LUNCACHE_MAX_LINE_SIZE      32
+
+/// No operation in progress.
+#define LUNCACHE_OPERATION_NONE     0
+/// Blocks are read through the cache.
+#define LUNCACHE_OPERATION_READ     1
+/// Blocks are written in the cache.
+#define LUNCACHE_OPERATION_WRITE    2
+/// The dirty blocks are written back.
+#define LUNCACHE_OPERATION_FLUSH    3
+
+//------------------------------------------------------------------------------
+//      Structures
+//------------------------------------------------------------------------------
+
+/// Cache line descriptor
+typedef struct {
+
+    /// Address of the first block of the line.
+    unsigned int tag;
+    /// Bit n is set when block n of the line holds data.
+    unsigned int validMask;
+    /// Bit n is set when block n of the line must be written back.
+    unsigned int dirtyMask;
+    /// Value of the cache clock at the last access to the line.
+    unsigned int lastUse;
+
+} MSDLunCacheLine;
+
+/// Write-back cache
+typedef struct {
+
+    /// Media holding the cached blocks.
+    Media           *media;
+    /// Media address of block 0.
+    unsigned int    baseAddress;
+    /// Size of one block in bytes.
+    unsigned int    blockSize;
+    /// Line descriptors.
+    MSDLunCacheLine *pLines;
+    /// Line data, numLines * lineSize blocks.
+    unsigned char   *pBuffer;
+    /// Number of lines.
+    unsigned int    numLines;
+    /// Number of blocks in a line.
+    unsigned int    lineSize;
+    /// Incremented on each access, used for LRU replacement.
+    unsigned int    clock;
+    /// Number of ticks without write before the dirty blocks are written back
+    /// (0 to disable the flush timer).
+    unsigned int    flushDelay;
+    /// Remaining ticks before the dirty blocks are written back.
+    volatile unsigned int  flushTimer;
+    /// Set when the dirty blocks shall be written back as soon as possible.
+    volatile unsigned char flushRequest;
+    /// Operation in progress (LUNCACHE_OPERATION_xxx).
+    volatile unsigned char operation;
+    /// Result code of the last operation.
+    volatile unsigned char status;
+    /// Next block of the operation.
+    unsigned int    blockAddress;
+    /// Data of the next block of the operation.
+    unsigned char   *pData;
+    /// Number of blocks left to the operation.
+    unsigned int    length;
+    /// Size of the operation in bytes.
+    unsigned int    total;
+    /// Callback invoked when the operation ends.
+    MediaCallback   callback;
+    /// Argument of the callback.
+    void            *argument;
+    /// Line being written back, numLines if none.
+    unsigned int    writeLine;
+    /// First and last plus one blocks of the line being written back.
+    unsigned int    writeFirst;
+    unsigned int    writeLast;
+
+} MSDLunCache;
+
+//------------------------------------------------------------------------------
+//      Exported functions
+//------------------------------------------------------------------------------
+
+extern void LUNCache_Initialize(MSDLunCache     *cache,
+                                Media           *media,
+                                unsigned int    baseAddress,
+                                unsigned int    blockSize,
+                                MSDLunCacheLine *lines,
+                                unsigned char   *buffer,
+                                unsigned int    numLines,
+                                unsigned int    lineSize,
+                                unsigned int    flushDelay);
+
+extern unsigned char LUNCache_Read(MSDLunCache   *cache,
+                                   unsigned int  blockAddress,
+                                   unsigned char *data,
+                                   unsigned int  length,
+                                   MediaCallback callback,
+                                   void          *argument);
+
+extern unsigned char LUNCache_Write(MSDLunCache   *cache,
+                                    unsigned int  blockAddress,
+                                    unsigned char *data,
+                                    unsigned int  length,
+                                    MediaCallback callback,
+                                    void          *argument);
+
+extern unsigned char LUNCache_Flush(MSDLunCache   *cache,
+                                    MediaCallback callback,
+                                    void          *argument);
+
+extern unsigned char LUNCache_IsBusy(MSDLunCache *cache);
+
+extern void LUNCache_Tick(MSDLunCache *cache, unsigned int ticks);
+
+extern void LUNCache_RequestFlush(MSDLunCache *cache);
+
+extern unsigned char LUNCache_Idle(MSDLunCache *cache);
+
+#endif //#ifndef MSDLUNCACHE_H
+
@@ -70,6 +70,11 @@
 /// - SBC_PREVENT_ALLOW_MEDIUM_REMOVAL
 /// - SBC_MODE_SENSE_6
 /// - SBC_VERIFY_10
+///
+/// !Optional Codes
+/// - SBC_SYNCHRONIZE_CACHE_10
+/// - SBC_UNMAP
+/// - SBC_SERVICE_ACTION_IN_16
 
 /// Request information regarding parameters of the target and Logical Unit.
 #define SBC_INQUIRY                                     0x12
@@ -91,6 +96,16 @@
 #define SBC_MODE_SENSE_6                                0x1A
 /// Request that the %device verify the data on the medium.
 #define SBC_VERIFY_10                                   0x2F
+
+/// Request that the %device write its cached data on the medium.
+#define SBC_SYNCHRONIZE_CACHE_10                        0x35
+/// Request that the %device discard the data of ranges of blocks.
+#define SBC_UNMAP                                       0x42
+/// Request a service action (READ CAPACITY (16)).
+#define SBC_SERVICE_ACTION_IN_16                        0x9E
+
+/// SERVICE ACTION IN (16) action returning the capacity of the medium.
+#define SBC_SAI_READ_CAPACITY_16                        0x10
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
@@ -251,6 +266,8 @@
 ///
 /// !Additional Codes
 /// - SBC_ASC_LOGICAL_UNIT_NOT_READY
+/// - SBC_ASC_WRITE_ERROR
+/// - SBC_ASC_UNRECOVERED_READ_ERROR
 /// - SBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE
 /// - SBC_ASC_INVALID_FIELD_IN_CDB
 /// - SBC_ASC_WRITE_PROTECTED
@@ -261,6 +278,8 @@
 /// - SBC_ASC_MEDIUM_NOT_PRESENT
 
 #define SBC_ASC_LOGICAL_UNIT_NOT_READY                0x04
+#define SBC_ASC_WRITE_ERROR                           0x0C
+#define SBC_ASC_UNRECOVERED_READ_ERROR                0x11
 #define SBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE    0x21
 #define SBC_ASC_INVALID_FIELD_IN_CDB                  0x24
 #define SBC_ASC_WRITE_PROTECTED                       0x27
@@ -289,15 +308,37 @@
 #define SBC_MRIE_ON_REQUEST                           0x06
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+/// \brief  Supported vital product data pages (INQUIRY with EVPD set)
+/// \see    spc4r06.pdf - Section 7.6.1
+#define SBC_VPD_SUPPORTED_PAGES                       0x00
+#define SBC_VPD_BLOCK_LIMITS                          0xB0
+#define SBC_VPD_LOGICAL_BLOCK_PROVISIONING            0xB2
+
+/// \brief  Provisioning types of the logical block provisioning page
+#define SBC_PROVISIONING_TYPE_FULL                    0x0
+#define SBC_PROVISIONING_TYPE_THIN                    0x2
+//------------------------------------------------------------------------------
+
 //------------------------------------------------------------------------------
 /// \brief  Supported mode pages
 /// \see    sbc3r06.pdf - Section 6.3.1 - Table 115
 #define SBC_PAGE_READ_WRITE_ERROR_RECOVERY            0x01
+#define SBC_PAGE_CACHING                              0x08
 #define SBC_PAGE_INFORMATIONAL_EXCEPTIONS_CONTROL     0x1C
 #define SBC_PAGE_RETURN_ALL                           0x3F
 #define SBC_PAGE_VENDOR_SPECIFIC                      0x00
 //------------------------------------------------------------------------------
 
+//------------------------------------------------------------------------------
+/// \brief  Page control values of the MODE SENSE commands
+/// \see    spc4r06.pdf - Section 6.9.1 - Table 99
+#define SBC_PC_CURRENT                                0x0
+#define SBC_PC_CHANGEABLE                             0x1
+#define SBC_PC_DEFAULT                                0x2
+#define SBC_PC_SAVED                                  0x3
+//------------------------------------------------------------------------------
+
 //------------------------------------------------------------------------------
 /// \page "MSD Endian Macros"
 /// This page lists the macros for endianness conversion.
@@ -393,6 +434,60 @@ typedef struct {
 
 } __attribute__ ((packed)) SBCInquiryData; // GCC
 
+//------------------------------------------------------------------------------
+/// \brief  Header of the vital product data pages returned by the device
+/// \see    spc4r06.pdf - Section 7.6.1 - Table 345
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char bPeripheralDeviceType:5, //!< Peripheral device type
+                  bPeripheralQualifier :3; //!< Peripheral qualifier
+    unsigned char bPageCode;               //!< SBC_VPD_xxx
+    unsigned char pPageLength[2];          //!< Length of the page data
+
+} __attribute__ ((packed)) SBCVpdPageHeader; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Block limits vital product data page
+/// \see    sbc3r16.pdf - Section 6.4.2 - Table 148
+//------------------------------------------------------------------------------
+typedef struct {
+
+    SBCVpdPageHeader header;                     //!< Page code 0xB0
+    unsigned char    bReserved1;                 //!< Reserved byte
+    unsigned char    bMaximumCompareAndWriteLength; //!< Not supported : 0
+    unsigned char    pOptimalTransferLengthGranularity[2]; //!< In blocks
+    unsigned char    pMaximumTransferLength[4];  //!< In blocks, 0 if no limit
+    unsigned char    pOptimalTransferLength[4];  //!< In blocks, 0 if unknown
+    unsigned char    pMaximumPrefetchLength[4];  //!< Not supported : 0
+    unsigned char    pMaximumUnmapLbaCount[4];   //!< Blocks per UNMAP command
+    unsigned char    pMaximumUnmapDescriptorCount[4]; //!< UNMAP descriptors
+    unsigned char    pOptimalUnmapGranularity[4];  //!< In blocks
+    unsigned char    pUnmapGranularityAlignment[4]; //!< Bit 31 : UGAVALID
+    unsigned char    pReserved2[28];             //!< Reserved bytes
+
+} __attribute__ ((packed)) SBCBlockLimitsPage; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Logical block provisioning vital product data page
+/// \see    sbc3r25.pdf - Section 6.5.4 - Table 185
+//------------------------------------------------------------------------------
+typedef struct {
+
+    SBCVpdPageHeader header;               //!< Page code 0xB2
+    unsigned char    bThresholdExponent;   //!< Not supported : 0
+    unsigned char    isDP:1,               //!< Provisioning group descriptor
+                     isANC_SUP:1,          //!< Anchored blocks supported
+                     bLBPRZ:3,             //!< Unmapped blocks read as zero
+                     isLBPWS10:1,          //!< WRITE SAME (10) unmaps blocks
+                     isLBPWS:1,            //!< WRITE SAME (16) unmaps blocks
+                     isLBPU:1;             //!< UNMAP command supported
+    unsigned char    bProvisioningType:3,  //!< Resource or thin provisioned
+                     bMinimumPercentage:5; //!< Not supported : 0
+    unsigned char    bThresholdPercentage; //!< Not supported : 0
+
+} __attribute__ ((packed)) SBCLogicalBlockProvisioningPage; // GCC
+
 //------------------------------------------------------------------------------
 /// \brief  Data structure for the READ (10) command
 /// \see    sbc3r07.pdf - Section 5.7 - Table 34
@@ -442,6 +537,44 @@ typedef struct {
 
 } SBCReadCapacity10Data;
 
+//------------------------------------------------------------------------------
+/// \brief  Structure for the READ CAPACITY (16) command
+/// \see    sbc3r25.pdf - Section 5.16.1 - Table 62
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char bOperationCode;          //!< 0x9E : SBC_SERVICE_ACTION_IN_16
+    unsigned char bServiceAction:5,        //!< 0x10 : SBC_SAI_READ_CAPACITY_16
+                  bReserved1:3;            //!< Reserved bits
+    unsigned char pLogicalBlockAddress[8]; //!< Block to evaluate if PMI is set
+    unsigned char pAllocationLength[4];    //!< Host buffer allocated size
+    unsigned char isPMI:1,                 //!< Partial medium indicator bit
+                  bReserved2:7;            //!< Reserved bits
+    unsigned char bControl;                //!< 0x00
+
+} __attribute__ ((packed)) SBCReadCapacity16; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Data returned by the device after a READ CAPACITY (16) command
+/// \see    sbc3r25.pdf - Section 5.16.2 - Table 63
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char pLogicalBlockAddress[8]; //!< Address of last logical block
+    unsigned char pLogicalBlockLength[4];  //!< Length of last logical block
+    unsigned char isPROT_EN:1,             //!< Protection information enabled
+                  bP_TYPE:3,               //!< Protection type
+                  bReserved1:4;            //!< Reserved bits
+    unsigned char bLogicalBlocksPerPhysicalBlockExponent:4, //!< Not used : 0
+                  bP_I_Exponent:4;         //!< Protection intervals
+    unsigned char bLowestAlignedLogicalBlockAddressHigh:6, //!< Not used : 0
+                  isLBPRZ:1,               //!< Unmapped blocks read as zero
+                  isLBPME:1;               //!< Logical block provisioning
+    unsigned char bLowestAlignedLogicalBlockAddressLow; //!< Not used : 0
+    unsigned char pReserved2[16];          //!< Reserved bytes
+
+} __attribute__ ((packed)) SBCReadCapacity16Data; // GCC
+
 //------------------------------------------------------------------------------
 /// \brief  Structure for the REQUEST SENSE command
 /// \see    spc4r06.pdf - Section 6.26 - Table 170
@@ -617,6 +750,103 @@ typedef struct {
 
 } __attribute__ ((packed)) SBCReadWriteErrorRecovery; // GCC
 
+//------------------------------------------------------------------------------
+/// \brief  Caching mode page
+/// \see    sbc3r07.pdf - Section 6.3.3 - Table 117
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char bPageCode:6,              //!< 0x08 : SBC_PAGE_CACHING
+                  isSPF:1,                  //!< Page or subpage data format
+                  isPS:1;                   //!< Parameters saveable ?
+    unsigned char bPageLength;              //!< Length of page data (0x12)
+    unsigned char isRCD:1,                  //!< Read cache disable bit
+                  isMF:1,                   //!< Multiplication factor bit
+                  isWCE:1,                  //!< Write-back cache enabled bit
+                  isSIZE:1,                 //!< Size enable bit
+                  isDISC:1,                 //!< Discontinuity bit
+                  isCAP:1,                  //!< Caching analysis permitted bit
+                  isABPF:1,                 //!< Abort pre-fetch bit
+                  isIC:1;                   //!< Initiator control bit
+    unsigned char bWriteRetentionPriority:4,    //!< Write retention priority
+                  bDemandReadRetentionPriority:4; //!< Read retention priority
+    unsigned char pDisablePrefetchTransferLength[2]; //!< No pre-fetch above
+    unsigned char pMinimumPrefetch[2];      //!< Minimum pre-fetch length
+    unsigned char pMaximumPrefetch[2];      //!< Maximum pre-fetch length
+    unsigned char pMaximumPrefetchCeiling[2]; //!< Maximum pre-fetch ceiling
+    unsigned char isNV_DIS:1,               //!< Non-volatile cache disabled
+                  bReserved1:2,             //!< Reserved bits
+                  bVendorSpecific:2,        //!< Vendor-specific bits
+                  isDRA:1,                  //!< Disable read-ahead bit
+                  isLBCSS:1,                //!< Logical block cache segment size
+                  isFSW:1;                  //!< Force sequential write bit
+    unsigned char bNumberOfCacheSegments;   //!< Number of cache segments
+    unsigned char pCacheSegmentSize[2];     //!< Size of one cache segment
+    unsigned char bReserved2;               //!< Reserved byte
+    unsigned char pObsolete1[3];            //!< Obsolete bytes
+
+} __attribute__ ((packed)) SBCCachingModePage; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Structure for the SYNCHRONIZE CACHE (10) command
+/// \see    sbc3r07.pdf - Section 5.18 - Table 58
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char bOperationCode;          //!< 0x35 : SBC_SYNCHRONIZE_CACHE_10
+    unsigned char bObsolete1:1,            //!< Obsolete bit
+                  isIMMED:1,               //!< Return before the end of sync
+                  isSYNC_NV:1,             //!< Synchronize non-volatile cache
+                  bReserved1:5;            //!< Reserved bits
+    unsigned char pLogicalBlockAddress[4]; //!< First block to synchronize
+    unsigned char bGroupNumber:5,          //!< Information grouping
+                  bReserved2:3;            //!< Reserved bits
+    unsigned char pNumberOfBlocks[2];      //!< Number of blocks to synchronize
+    unsigned char bControl;                //!< 0x00
+
+} __attribute__ ((packed)) SBCSynchronizeCache10; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Structure for the UNMAP command
+/// \see    sbc3r25.pdf - Section 5.28.1 - Table 95
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char bOperationCode;          //!< 0x42 : SBC_UNMAP
+    unsigned char isANCHOR:1,              //!< Anchor the blocks, not supported
+                  bReserved1:7;            //!< Reserved bits
+    unsigned char pReserved2[4];           //!< Reserved bytes
+    unsigned char bGroupNumber:5,          //!< Information grouping
+                  bReserved3:3;            //!< Reserved bits
+    unsigned char pParameterListLength[2]; //!< Length of the parameter data
+    unsigned char bControl;                //!< 0x00
+
+} __attribute__ ((packed)) SBCUnmap; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  Header of the parameter data sent by the host with UNMAP
+/// \see    sbc3r25.pdf - Section 5.28.2 - Table 96
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char pUnmapDataLength[2];     //!< Length of the data to follow
+    unsigned char pBlockDescriptorDataLength[2]; //!< Length of descriptors
+    unsigned char pReserved1[4];           //!< Reserved bytes
+
+} __attribute__ ((packed)) SBCUnmapParameterListHeader; // GCC
+
+//------------------------------------------------------------------------------
+/// \brief  UNMAP block descriptor, one range of blocks to discard
+/// \see    sbc3r25.pdf - Section 5.28.2 - Table 97
+//------------------------------------------------------------------------------
+typedef struct {
+
+    unsigned char pLogicalBlockAddress[8]; //!< First block to discard
+    unsigned char pNumberOfBlocks[4];      //!< Number of blocks to discard
+    unsigned char pReserved1[4];           //!< Reserved bytes
+
+} __attribute__ ((packed)) SBCUnmapBlockDescriptor; // GCC
+
 //------------------------------------------------------------------------------
 /// \brief  Generic structure for holding information about SBC commands
 /// \see    SBCInquiry
@@ -627,6 +857,9 @@ typedef struct {
 /// \see    SBCWrite10
 /// \see    SBCMediumRemoval
 /// \see    SBCModeSense6
+/// \see    SBCSynchronizeCache10
+/// \see    SBCUnmap
+/// \see    SBCReadCapacity16
 //------------------------------------------------------------------------------
 typedef union {
 
@@ -639,6 +872,9 @@ typedef union {
     SBCWrite10        write10;        //!< WRITE (10) command
     SBCMediumRemoval  mediumRemoval;  //!< PREVENT/ALLOW MEDIUM REMOVAL command
     SBCModeSense6     modeSense6;     //!< MODE SENSE (6) command
+    SBCSynchronizeCache10 synchronizeCache10; //!< SYNCHRONIZE CACHE (10)
+    SBCUnmap          unmap;          //!< UNMAP command
+    SBCReadCapacity16 readCapacity16; //!< READ CAPACITY (16) command
 
 } SBCCommand;
 
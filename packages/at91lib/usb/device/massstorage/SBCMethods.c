@@ -34,6 +34,15 @@
 #include "SBCMethods.h"
 #include "MSDDStateMachine.h"
 #include <usb/device/core/USBD.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+//      Definitions
+//------------------------------------------------------------------------------
+
+//! \brief  Maximum number of blocks discarded by one UNMAP command, bounds the
+//!         time spent by the media to erase them
+#define SBC_MAX_UNMAP_BLOCKS        0x8000
 
 //------------------------------------------------------------------------------
 //      Global variables
@@ -57,11 +66,113 @@ static const SBCModeParameterHeader6 modeParameterHeader6 = {
 //------------------------------------------------------------------------------
 //      Internal functions
 //------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//! \brief  Returns the size of a supported vital product data page.
+//! \param  pageCode Page code (SBC_VPD_xxx)
+//! \return Size of the page in bytes, 0 if the page is not supported
+//------------------------------------------------------------------------------
+static unsigned int SBC_GetVpdPageSize(unsigned char pageCode)
+{
+    switch (pageCode) {
+
+        case SBC_VPD_SUPPORTED_PAGES:
+            return sizeof(SBCVpdPageHeader) + 3;
+
+        case SBC_VPD_BLOCK_LIMITS:
+            return sizeof(SBCBlockLimitsPage);
+
+        case SBC_VPD_LOGICAL_BLOCK_PROVISIONING:
+            return sizeof(SBCLogicalBlockProvisioningPage);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Builds a vital product data page in the LUN read/write buffer.
+//!         The block limits page reports the erase unit and the optimal
+//!         transfer length of the LUN media, and the UNMAP limits when the
+//!         media accepts discards.
+//! \param  lun      Pointer to the LUN affected by the command
+//! \param  pageCode Page code (SBC_VPD_xxx), must be supported
+//------------------------------------------------------------------------------
+static void SBC_BuildVpdPage(MSDLun *lun, unsigned char pageCode)
+{
+    unsigned int size = SBC_GetVpdPageSize(pageCode);
+    SBCVpdPageHeader *header = (SBCVpdPageHeader *) lun->readWriteBuffer;
+    SBCBlockLimitsPage *blockLimits = (SBCBlockLimitsPage *) header;
+    SBCLogicalBlockProvisioningPage *provisioning =
+        (SBCLogicalBlockProvisioningPage *) header;
+    unsigned char *pPages = lun->readWriteBuffer + sizeof(SBCVpdPageHeader);
+
+    memset(lun->readWriteBuffer, 0, size);
+    header->bPeripheralDeviceType = SBC_DIRECT_ACCESS_BLOCK_DEVICE;
+    header->bPeripheralQualifier = SBC_PERIPHERAL_DEVICE_CONNECTED;
+    header->bPageCode = pageCode;
+    STORE_WORDB(size - sizeof(SBCVpdPageHeader), header->pPageLength);
+
+    switch (pageCode) {
+
+        case SBC_VPD_SUPPORTED_PAGES:
+            pPages[0] = SBC_VPD_SUPPORTED_PAGES;
+            pPages[1] = SBC_VPD_BLOCK_LIMITS;
+            pPages[2] = SBC_VPD_LOGICAL_BLOCK_PROVISIONING;
+            break;
+
+        case SBC_VPD_BLOCK_LIMITS:
+            STORE_WORDB(lun->eraseBlocks,
+                        blockLimits->pOptimalTransferLengthGranularity);
+            STORE_DWORDB(lun->optimalTransferBlocks,
+                         blockLimits->pOptimalTransferLength);
+            if (lun->canUnmap) {
+
+                // The descriptors must fit in one block of the buffer
+                STORE_DWORDB(SBC_MAX_UNMAP_BLOCKS,
+                             blockLimits->pMaximumUnmapLbaCount);
+                STORE_DWORDB((lun->blockSize
+                              - sizeof(SBCUnmapParameterListHeader))
+                             / sizeof(SBCUnmapBlockDescriptor),
+                             blockLimits->pMaximumUnmapDescriptorCount);
+                STORE_DWORDB(lun->eraseBlocks,
+                             blockLimits->pOptimalUnmapGranularity);
+            }
+            break;
+
+        case SBC_VPD_LOGICAL_BLOCK_PROVISIONING:
+            if (lun->canUnmap) {
+
+                provisioning->isLBPU = 1;
+                provisioning->bProvisioningType = SBC_PROVISIONING_TYPE_THIN;
+            }
+            break;
+    }
+}
+
+#if defined(AT91C_EBI_SDRAM) || defined(BOARD_USB_UDPHS)
+//------------------------------------------------------------------------------
+//! \brief  Returns the address of a block of a directly accessible media.
+//! \param  lun    Pointer to the LUN holding the block
+//! \param  block  Logical block address
+//! \return Address of the block in the media memory
+//------------------------------------------------------------------------------
+static unsigned char * SBC_MediaBlock(MSDLun *lun, unsigned int block)
+{
+    return (unsigned char *) (lun->media->baseAddress
+                              + lun->baseAddress
+                              + block * lun->blockSize);
+}
+#endif
+
 //------------------------------------------------------------------------------
 //! \brief  Performs a WRITE (10) command on the specified LUN.
 //!
-//!         The data to write is first received from the USB host and then
-//!         actually written on the media.
+//!         The data sent by the USB host is received in the LUN block FIFO
+//!         and written on the media from there. The bulk OUT endpoint is
+//!         re-armed for the next chunk of blocks before the previous chunk is
+//!         committed to the media, so the host does not wait for the media.
+//!         When the media is directly accessible, the data is received
+//!         straight into the media memory and the media write is a no-op.
 //!         This function operates asynchronously and must be called multiple
 //!         times to complete. A result code of MSDDriver_STATUS_INCOMPLETE
 //!         indicates that at least another call of the method is necessary.
@@ -70,6 +181,7 @@ static const SBCModeParameterHeader6 modeParameterHeader6 = {
 //! \return Operation result code (SUCCESS, ERROR, INCOMPLETE or PARAMETER)
 //! \see    MSDLun
 //! \see    MSDCommandState
+//! \see    MSDIOFifo
 //------------------------------------------------------------------------------
 static unsigned char SBC_Write10(MSDLun          *lun,
                                  MSDCommandState *commandState)
@@ -77,19 +189,24 @@ static unsigned char SBC_Write10(MSDLun          *lun,
     unsigned char  status;
     unsigned char  result = MSDD_STATUS_INCOMPLETE;
     MSDTransfer *transfer = &(commandState->transfer);
+    MSDTransfer *disktransfer = &(commandState->disktransfer);
     SBCWrite10 *command = (SBCWrite10 *) commandState->cbw.pCommand;
+    MSDIOFifo *fifo = &(lun->ioFifo);
+    unsigned int numBlocks;
+    unsigned char *buffer;
+
+    // Convert length from bytes to blocks
+    commandState->length /= lun->blockSize;
 
     // Init command state
     if (commandState->state == 0) {
 
-        commandState->state = SBC_STATE_READ;
+        MSDIOFifo_Reset(fifo, commandState->length);
+        transfer->semaphore = 0;
+        disktransfer->semaphore = 0;
+        commandState->state = SBC_STATE_WRITE;
     }
 
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-    // Convert length from bytes to blocks
-    commandState->length /= lun->blockSize;
-#endif
-
     // Check if length equals 0
     if (commandState->length == 0) {
 
@@ -98,84 +215,108 @@ static unsigned char SBC_Write10(MSDLun          *lun,
     }
     else {
 
-        // Current command status
-        switch (commandState->state) {
-        //------------------
-        case SBC_STATE_READ:
-        //------------------
-            TRACE_INFO_WP("Receive ");
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-            // Read one block of data sent by the host
-            status = MSDD_Read((void*)lun->readWriteBuffer,
-                               lun->blockSize,
-                               (TransferCallback) MSDDriver_Callback,
-                               (void *) transfer);
-#else
-            status = MSDD_Read((void*)(lun->media->baseAddress
-                                   + lun->baseAddress
-                                   + DWORDB(command->pLogicalBlockAddress) * lun->blockSize),
-                                commandState->length,
-                                (TransferCallback) MSDDriver_Callback,
-                                (void *) transfer);
-#endif
+        // Check if data has been received from the host
+        if ((fifo->inputPending > 0) && (transfer->semaphore > 0)) {
 
-            // Check operation result code
-            if (status != USBD_STATUS_SUCCESS) {
+            transfer->semaphore--;
+            if (transfer->status != USBD_STATUS_SUCCESS) {
 
                 TRACE_WARNING(
-                    "RBC_Write10: Failed to start receiving data\n\r");
+                    "RBC_Write10: Failed to received data\n\r");
                 SBC_UpdateSenseData(&(lun->requestSenseData),
                                     SBC_SENSE_KEY_HARDWARE_ERROR,
                                     0,
                                     0);
-                result = MSDD_STATUS_ERROR;
+                fifo->inputPending = 0;
+                commandState->state = SBC_STATE_ABORT;
             }
             else {
 
-                // Prepare next device state
-                commandState->state = SBC_STATE_WAIT_READ;
+                TRACE_INFO_WP("Received ");
+                MSDIOFifo_InputDone(fifo);
             }
-            break;
+        }
 
-        //-----------------------
-        case SBC_STATE_WAIT_READ:
-        //-----------------------
-            TRACE_INFO_WP("Wait ");
+        // Check if a media write is finished
+        if ((fifo->outputPending > 0) && (disktransfer->semaphore > 0)) {
 
-            // Check semaphore
-            if (transfer->semaphore > 0) {
+            disktransfer->semaphore--;
+            if (disktransfer->status != USBD_STATUS_SUCCESS) {
 
-                transfer->semaphore--;
-                commandState->state = SBC_STATE_WRITE;
+                TRACE_WARNING(
+                    "RBC_Write10: Failed to write media\n\r");
+                SBC_UpdateSenseData(&(lun->requestSenseData),
+                                    SBC_SENSE_KEY_MEDIUM_ERROR,
+                                    SBC_ASC_WRITE_ERROR,
+                                    0);
+                fifo->outputPending = 0;
+                commandState->state = SBC_STATE_ABORT;
             }
-            break;
+            else {
 
+                TRACE_INFO_WP("Written ");
+
+                // Update remaining length
+                commandState->length -= fifo->outputPending;
+                MSDIOFifo_OutputDone(fifo);
+            }
+        }
+
+        // Current command status
+        switch (commandState->state) {
         //-------------------
         case SBC_STATE_WRITE:
         //-------------------
-            // Check the result code of the read operation
-            if (transfer->status != USBD_STATUS_SUCCESS) {
+            // Get ready to receive the next blocks sent by the host
+            numBlocks = MSDIOFifo_InputSpace(fifo);
+            if (numBlocks > 0) {
 
-                TRACE_WARNING(
-                    "RBC_Write10: Failed to received data\n\r");
-                SBC_UpdateSenseData(&(lun->requestSenseData),
-                                    SBC_SENSE_KEY_HARDWARE_ERROR,
-                                    0,
-                                    0);
-                result = MSDD_STATUS_ERROR;
+                TRACE_INFO_WP("Receive ");
+                fifo->inputPending = numBlocks;
+#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
+                buffer = MSDIOFifo_InputBuffer(fifo, lun->blockSize);
+#else
+                // Blocks in the FIFO are not written yet
+                buffer = SBC_MediaBlock(lun,
+                                        DWORDB(command->pLogicalBlockAddress)
+                                        + fifo->count - fifo->outputPending);
+#endif
+                status = MSDD_Read(buffer,
+                                   numBlocks * lun->blockSize,
+                                   (TransferCallback) MSDDriver_Callback,
+                                   (void *) transfer);
+
+                // Check operation result code
+                if (status != USBD_STATUS_SUCCESS) {
+
+                    TRACE_WARNING(
+                        "RBC_Write10: Failed to start receiving data\n\r");
+                    SBC_UpdateSenseData(&(lun->requestSenseData),
+                                        SBC_SENSE_KEY_HARDWARE_ERROR,
+                                        0,
+                                        0);
+                    fifo->inputPending = 0;
+                    commandState->state = SBC_STATE_ABORT;
+                    break;
+                }
             }
-            else {
 
+            // Meanwhile, write the blocks already received on the media
+            numBlocks = MSDIOFifo_OutputSpace(fifo);
+            if (numBlocks > 0) {
+
+                fifo->outputPending = numBlocks;
 #if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-                // Write the block to the media
                 status = LUN_Write(lun,
-                                    DWORDB(command->pLogicalBlockAddress),
-                                    lun->readWriteBuffer,
-                                    1,
-                                    (TransferCallback) MSDDriver_Callback,
-                                    (void *) transfer);
+                                   DWORDB(command->pLogicalBlockAddress),
+                                   MSDIOFifo_OutputBuffer(fifo,
+                                                          lun->blockSize),
+                                   numBlocks,
+                                   (TransferCallback) MSDDriver_Callback,
+                                   (void *) disktransfer);
 #else
-                MSDDriver_Callback(transfer, MED_STATUS_SUCCESS, 0, 0);
+                // Nothing to write, the data is already in the media memory
+                MSDDriver_Callback(disktransfer, MED_STATUS_SUCCESS, 0, 0);
                 status = LUN_STATUS_SUCCESS;
 #endif
 
@@ -188,73 +329,37 @@ static unsigned char SBC_Write10(MSDLun          *lun,
                                         SBC_SENSE_KEY_NOT_READY,
                                         0,
                                         0);
-                    result = MSDD_STATUS_ERROR;
+                    fifo->outputPending = 0;
+                    commandState->state = SBC_STATE_ABORT;
+                    break;
                 }
-                else {
 
-                    // Prepare next state
-                    commandState->state = SBC_STATE_WAIT_WRITE;
-                }
+                // Update block address
+                STORE_DWORDB(DWORDB(command->pLogicalBlockAddress) + numBlocks,
+                             command->pLogicalBlockAddress);
             }
-            break;
-
-        //------------------------
-        case SBC_STATE_WAIT_WRITE:
-        //------------------------
-            TRACE_INFO_WP("Wait ");
 
-            // Check semaphore value
-            if (transfer->semaphore > 0) {
+            // Check if transfer is finished
+            if (fifo->outputTotal == 0) {
 
-                // Take semaphore and move to next state
-                transfer->semaphore--;
-                commandState->state = SBC_STATE_NEXT_BLOCK;
+                result = MSDD_STATUS_SUCCESS;
             }
             break;
 
-        //------------------------
-        case SBC_STATE_NEXT_BLOCK:
-        //------------------------
-            // Check operation result code
-            if (transfer->status != USBD_STATUS_SUCCESS) {
+        //-------------------
+        case SBC_STATE_ABORT:
+        //-------------------
+            // Wait for the transfers in progress before failing
+            if ((fifo->inputPending == 0) && (fifo->outputPending == 0)) {
 
-                TRACE_WARNING(
-                    "RBC_Write10: Failed to write media\n\r");
-                SBC_UpdateSenseData(&(lun->requestSenseData),
-                                    SBC_SENSE_KEY_RECOVERED_ERROR,
-                                    SBC_ASC_TOO_MUCH_WRITE_DATA,
-                                    0);
                 result = MSDD_STATUS_ERROR;
             }
-            else {
-
-                // Update transfer length and block address
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-                commandState->length--;
-#else
-                commandState->length = 0;
-#endif
-                STORE_DWORDB(DWORDB(command->pLogicalBlockAddress) + 1,
-                             command->pLogicalBlockAddress);
-
-                // Check if transfer is finished
-                if (commandState->length == 0) {
-
-                    result = MSDD_STATUS_SUCCESS;
-                }
-                else {
-
-                    commandState->state = SBC_STATE_READ;
-                }
-            }
             break;
         }
     }
 
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
     // Convert length from blocks to bytes
     commandState->length *= lun->blockSize;
-#endif
 
     return result;
 }
@@ -262,7 +367,12 @@ static unsigned char SBC_Write10(MSDLun          *lun,
 //------------------------------------------------------------------------------
 //! \brief  Performs a READ (10) command on specified LUN.
 //!
-//!         The data is first read from the media and then sent to the USB host.
+//!         The blocks are read from the media into the LUN block FIFO and
+//!         sent to the USB host from there. While a chunk of blocks is being
+//!         sent on the bulk IN endpoint, the following chunk is already read
+//!         from the media.
+//!         When the media is directly accessible, the media read is a no-op
+//!         and the data is sent straight from the media memory.
 //!         This function operates asynchronously and must be called multiple
 //!         times to complete. A result code of MSDDriver_STATUS_INCOMPLETE
 //!         indicates that at least another call of the method is necessary.
@@ -271,6 +381,7 @@ static unsigned char SBC_Write10(MSDLun          *lun,
 //! \return Operation result code (SUCCESS, ERROR, INCOMPLETE or PARAMETER)
 //! \see    MSDLun
 //! \see    MSDCommandState
+//! \see    MSDIOFifo
 //------------------------------------------------------------------------------
 static unsigned char SBC_Read10(MSDLun          *lun,
                                 MSDCommandState *commandState)
@@ -279,107 +390,100 @@ static unsigned char SBC_Read10(MSDLun          *lun,
     unsigned char result = MSDD_STATUS_INCOMPLETE;
     SBCRead10 *command = (SBCRead10 *) commandState->cbw.pCommand;
     MSDTransfer *transfer = &(commandState->transfer);
+    MSDTransfer *disktransfer = &(commandState->disktransfer);
+    MSDIOFifo *fifo = &(lun->ioFifo);
+    unsigned int numBlocks;
+    unsigned char *buffer;
+
+    // Convert length from bytes to blocks
+    commandState->length /= lun->blockSize;
 
     // Init command state
     if (commandState->state == 0) {
 
+        MSDIOFifo_Reset(fifo, commandState->length);
+        transfer->semaphore = 0;
+        disktransfer->semaphore = 0;
         commandState->state = SBC_STATE_READ;
     }
 
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-    // Convert length from bytes to blocks
-    commandState->length /= lun->blockSize;
-#endif
-
-    // Check length
+    // Check if length equals 0
     if (commandState->length == 0) {
 
         result = MSDD_STATUS_SUCCESS;
     }
     else {
 
-        // Command state management
-        switch (commandState->state) {
-        //------------------
-        case SBC_STATE_READ:
-        //------------------
-            // Read one block of data from the media
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-            status = LUN_Read(lun,
-                               DWORDB(command->pLogicalBlockAddress),
-                               lun->readWriteBuffer,
-                               1,
-                               (TransferCallback) MSDDriver_Callback,
-                               (void *) transfer);
-#else
-            MSDDriver_Callback(transfer, MED_STATUS_SUCCESS, 0, 0);
-            status = LUN_STATUS_SUCCESS;
-#endif
-            // Check operation result code
-            if (status != LUN_STATUS_SUCCESS) {
+        // Check if a media read is finished
+        if ((fifo->inputPending > 0) && (disktransfer->semaphore > 0)) {
+
+            disktransfer->semaphore--;
+            if (disktransfer->status != USBD_STATUS_SUCCESS) {
 
                 TRACE_WARNING(
-                    "RBC_Read10: Failed to start reading media\n\r");
+                    "RBC_Read10: Failed to read media\n\r");
                 SBC_UpdateSenseData(&(lun->requestSenseData),
-                                    SBC_SENSE_KEY_NOT_READY,
-                                    SBC_ASC_LOGICAL_UNIT_NOT_READY,
+                                    SBC_SENSE_KEY_MEDIUM_ERROR,
+                                    SBC_ASC_UNRECOVERED_READ_ERROR,
                                     0);
-                result = MSDD_STATUS_ERROR;
+                fifo->inputPending = 0;
+                commandState->state = SBC_STATE_ABORT;
             }
             else {
 
-                // Move to next command state
-                commandState->state = SBC_STATE_WAIT_READ;
-            }
-            break;
-
-        //-----------------------
-        case SBC_STATE_WAIT_READ:
-        //-----------------------
-            // Check semaphore value
-            if (transfer->semaphore > 0) {
-
                 TRACE_INFO_WP("Ok ");
-
-                // Take semaphore and move to next state
-                transfer->semaphore--;
-                commandState->state = SBC_STATE_WRITE;
+                MSDIOFifo_InputDone(fifo);
             }
-            break;
+        }
 
-        //-------------------
-        case SBC_STATE_WRITE:
-        //-------------------
-            // Check the operation result code
+        // Check if a transfer to the host is finished
+        if ((fifo->outputPending > 0) && (transfer->semaphore > 0)) {
+
+            transfer->semaphore--;
             if (transfer->status != USBD_STATUS_SUCCESS) {
 
                 TRACE_WARNING(
-                    "RBC_Read10: Failed to read media\n\r");
+                    "RBC_Read10: Failed to send data\n\r");
                 SBC_UpdateSenseData(&(lun->requestSenseData),
-                                    SBC_SENSE_KEY_RECOVERED_ERROR,
-                                    SBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE,
+                                    SBC_SENSE_KEY_HARDWARE_ERROR,
+                                    0,
                                     0);
-                result = MSDD_STATUS_ERROR;
+                fifo->outputPending = 0;
+                commandState->state = SBC_STATE_ABORT;
             }
             else {
 
-                // Send the block to the host
+                TRACE_INFO_WP("Sent ");
+
+                // Update remaining length
+                commandState->length -= fifo->outputPending;
+                MSDIOFifo_OutputDone(fifo);
+            }
+        }
+
+        // Command state management
+        switch (commandState->state) {
+        //------------------
+        case SBC_STATE_READ:
+        //------------------
+            // Send the blocks available in the FIFO to the host
+            numBlocks = MSDIOFifo_OutputSpace(fifo);
+            if (numBlocks > 0) {
+
+                fifo->outputPending = numBlocks;
 #if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-                status = MSDD_Write((void*)lun->readWriteBuffer,
-                                    lun->blockSize,
-                                    (TransferCallback) MSDDriver_Callback,
-                                    (void *) transfer);
+                buffer = MSDIOFifo_OutputBuffer(fifo, lun->blockSize);
 #else
-
-                status = MSDD_Write((void*)(lun->media->baseAddress
-                                       + lun->baseAddress
-                                       + DWORDB(command->pLogicalBlockAddress) * lun->blockSize),
-                                    commandState->length,
+                // Blocks in the FIFO are not sent yet
+                buffer = SBC_MediaBlock(lun,
+                                        DWORDB(command->pLogicalBlockAddress)
+                                        - fifo->inputPending - fifo->count);
+#endif
+                status = MSDD_Write(buffer,
+                                    numBlocks * lun->blockSize,
                                     (TransferCallback) MSDDriver_Callback,
                                     (void *) transfer);
 
-#endif
-
                 // Check operation result code
                 if (status != USBD_STATUS_SUCCESS) {
 
@@ -389,80 +493,85 @@ static unsigned char SBC_Read10(MSDLun          *lun,
                                         SBC_SENSE_KEY_HARDWARE_ERROR,
                                         0,
                                         0);
-                    result = MSDD_STATUS_ERROR;
+                    fifo->outputPending = 0;
+                    commandState->state = SBC_STATE_ABORT;
+                    break;
                 }
-                else {
 
-                    TRACE_INFO_WP("Sending ");
-
-                    // Move to next command state
-                    commandState->state = SBC_STATE_WAIT_WRITE;
-                }
+                TRACE_INFO_WP("Sending ");
             }
-            break;
 
-        //------------------------
-        case SBC_STATE_WAIT_WRITE:
-        //------------------------
-            // Check semaphore value
-            if (transfer->semaphore > 0) {
+            // Meanwhile, read the next blocks from the media
+            numBlocks = MSDIOFifo_InputSpace(fifo);
+            if (numBlocks > 0) {
 
-                TRACE_INFO_WP("Sent ");
+                fifo->inputPending = numBlocks;
+#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
+                status = LUN_Read(lun,
+                                  DWORDB(command->pLogicalBlockAddress),
+                                  MSDIOFifo_InputBuffer(fifo, lun->blockSize),
+                                  numBlocks,
+                                  (TransferCallback) MSDDriver_Callback,
+                                  (void *) disktransfer);
+#else
+                // Nothing to read, the data is already in the media memory
+                MSDDriver_Callback(disktransfer, MED_STATUS_SUCCESS, 0, 0);
+                status = LUN_STATUS_SUCCESS;
+#endif
 
-                // Take semaphore and move to next state
-                transfer->semaphore--;
-                commandState->state = SBC_STATE_NEXT_BLOCK;
+                // Check operation result code
+                if (status != LUN_STATUS_SUCCESS) {
+
+                    TRACE_WARNING(
+                        "RBC_Read10: Failed to start reading media\n\r");
+                    SBC_UpdateSenseData(&(lun->requestSenseData),
+                                        SBC_SENSE_KEY_NOT_READY,
+                                        SBC_ASC_LOGICAL_UNIT_NOT_READY,
+                                        0);
+                    fifo->inputPending = 0;
+                    commandState->state = SBC_STATE_ABORT;
+                    break;
+                }
+
+                // Update block address
+                STORE_DWORDB(DWORDB(command->pLogicalBlockAddress) + numBlocks,
+                             command->pLogicalBlockAddress);
             }
-            break;
 
-        //------------------------------
-        case SBC_STATE_NEXT_BLOCK:
-        //------------------------------
-            // Check operation result code
-            if (transfer->status != USBD_STATUS_SUCCESS) {
+            // Once the media part is done, prefetch the next blocks while
+            // the last ones and the CSW are sent
+            if ((fifo->inputTotal == 0) && (fifo->inputPending == 0)
+                && lun->readAhead) {
 
-                TRACE_WARNING(
-                    "RBC_Read10: Failed to send data\n\r");
-                SBC_UpdateSenseData(&(lun->requestSenseData),
-                                    SBC_SENSE_KEY_HARDWARE_ERROR,
-                                    0,
-                                    0);
-                result = MSDD_STATUS_ERROR;
+                LUN_Idle(lun);
             }
-            else {
-                TRACE_INFO_WP("Next ");
 
-                // Update transfer length and block address
-                STORE_DWORDB(DWORDB(command->pLogicalBlockAddress) + 1,
-                             command->pLogicalBlockAddress);
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
-                commandState->length--;
-#else
-                commandState->length = 0;
-#endif
+            // Check if transfer is finished
+            if (fifo->outputTotal == 0) {
 
-                // Check if transfer is finished
-                if (commandState->length == 0) {
+                result = MSDD_STATUS_SUCCESS;
+            }
+            break;
 
-                    result = MSDD_STATUS_SUCCESS;
-                }
-                else {
+        //-------------------
+        case SBC_STATE_ABORT:
+        //-------------------
+            // Wait for the transfers in progress before failing
+            if ((fifo->inputPending == 0) && (fifo->outputPending == 0)) {
 
-                    commandState->state = SBC_STATE_READ;
-                }
+                result = MSDD_STATUS_ERROR;
             }
             break;
         }
     }
 
-#if !defined(AT91C_EBI_SDRAM) && !defined(BOARD_USB_UDPHS)
     // Convert length from blocks to bytes
     commandState->length *= lun->blockSize;
-#endif
 
     return result;
 }
 
+
 //------------------------------------------------------------------------------
 //! \brief  Performs a READ CAPACITY (10) command.
 //!
@@ -541,6 +650,241 @@ static unsigned char SBC_ReadCapacity10(MSDLun               *lun,
     return result;
 }
 
+//------------------------------------------------------------------------------
+//! \brief  Performs a READ CAPACITY (16) command. The returned data is built
+//!         in the LUN read/write buffer; it reports if the LUN accepts the
+//!         UNMAP command (LBPME bit).
+//!
+//!         This function operates asynchronously and must be called multiple
+//!         times to complete. A result code of MSDDriver_STATUS_INCOMPLETE
+//!         indicates that at least another call of the method is necessary.
+//! \param  lun          Pointer to the LUN affected by the command
+//! \param  commandState Current state of the command
+//! \return Operation result code (SUCCESS, ERROR, INCOMPLETE or PARAMETER)
+//! \see    MSDLun
+//! \see    MSDCommandState
+//------------------------------------------------------------------------------
+static unsigned char SBC_ReadCapacity16(MSDLun          *lun,
+                                        MSDCommandState *commandState)
+{
+    unsigned char result = MSDD_STATUS_INCOMPLETE;
+    unsigned char status;
+    MSDTransfer *transfer = &(commandState->transfer);
+    SBCReadCapacity16Data *data =
+        (SBCReadCapacity16Data *) lun->readWriteBuffer;
+
+    // Check if required length is 0
+    if (commandState->length == 0) {
+
+        // Nothing to do
+        result = MSDD_STATUS_SUCCESS;
+    }
+    // Initialize command state if needed
+    else if (commandState->state == 0) {
+
+        commandState->state = SBC_STATE_WRITE;
+
+        memset(data, 0, sizeof(SBCReadCapacity16Data));
+        memcpy(&(data->pLogicalBlockAddress[4]),
+               lun->readCapacityData.pLogicalBlockAddress,
+               4);
+        memcpy(data->pLogicalBlockLength,
+               lun->readCapacityData.pLogicalBlockLength,
+               4);
+        data->isLBPME = lun->canUnmap;
+    }
+
+    // Identify current command state
+    switch (commandState->state) {
+    //-------------------
+    case SBC_STATE_WRITE:
+    //-------------------
+        // Start the write operation
+        status = MSDD_Write(data,
+                            commandState->length,
+                            (TransferCallback) MSDDriver_Callback,
+                            (void *) transfer);
+
+        // Check operation result code
+        if (status != USBD_STATUS_SUCCESS) {
+
+            TRACE_WARNING(
+                "RBC_ReadCapacity16: Cannot start sending data\n\r");
+            result = MSDD_STATUS_ERROR;
+        }
+        else {
+
+            // Proceed to next command state
+            TRACE_INFO_WP("Sending ");
+            commandState->state = SBC_STATE_WAIT_WRITE;
+        }
+        break;
+
+    //------------------------
+    case SBC_STATE_WAIT_WRITE:
+    //------------------------
+        // Check semaphore value
+        if (transfer->semaphore > 0) {
+
+            // Take semaphore and terminate command
+            transfer->semaphore--;
+
+            if (transfer->status != USBD_STATUS_SUCCESS) {
+
+                TRACE_WARNING("RBC_ReadCapacity16: Cannot send data\n\r");
+                result = MSDD_STATUS_ERROR;
+            }
+            else {
+
+                TRACE_INFO_WP("Sent ");
+                result = MSDD_STATUS_SUCCESS;
+            }
+            commandState->length -= transfer->transferred;
+        }
+        break;
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+//! \brief  Performs an UNMAP command. The parameter data sent by the host is
+//!         received in the LUN read/write buffer, then each of its block
+//!         descriptors is discarded on the LUN.
+//!
+//!         This function operates asynchronously and must be called multiple
+//!         times to complete. A result code of MSDDriver_STATUS_INCOMPLETE
+//!         indicates that at least another call of the method is necessary.
+//! \param  lun          Pointer to the LUN affected by the command
+//! \param  commandState Current state of the command
+//! \return Operation result code (SUCCESS, ERROR, INCOMPLETE or PARAMETER)
+//! \see    MSDLun
+//! \see    MSDCommandState
+//------------------------------------------------------------------------------
+static unsigned char SBC_Unmap(MSDLun          *lun,
+                               MSDCommandState *commandState)
+{
+    unsigned char result = MSDD_STATUS_INCOMPLETE;
+    unsigned char status;
+    MSDTransfer *transfer = &(commandState->transfer);
+    SBCUnmapParameterListHeader *header =
+        (SBCUnmapParameterListHeader *) lun->readWriteBuffer;
+    SBCUnmapBlockDescriptor *descriptor =
+        (SBCUnmapBlockDescriptor *) (header + 1);
+    unsigned int numDescriptors;
+    unsigned int numBlocks = lun->size / lun->blockSize;
+    unsigned int blockAddress;
+    unsigned int length;
+
+    // Check if the parameter list is empty
+    if (commandState->length == 0) {
+
+        // Nothing to do
+        result = MSDD_STATUS_SUCCESS;
+    }
+    // Initialize command state if needed
+    else if (commandState->state == 0) {
+
+        commandState->state = SBC_STATE_READ;
+    }
+
+    // Identify current command state
+    switch (commandState->state) {
+    //------------------
+    case SBC_STATE_READ:
+    //------------------
+        // Receive the parameter data
+        status = MSDD_Read(lun->readWriteBuffer,
+                           commandState->length,
+                           (TransferCallback) MSDDriver_Callback,
+                           (void *) transfer);
+
+        // Check operation result code
+        if (status != USBD_STATUS_SUCCESS) {
+
+            TRACE_WARNING("SBC_Unmap: Cannot start receiving data\n\r");
+            result = MSDD_STATUS_ERROR;
+        }
+        else {
+
+            // Proceed to next command state
+            TRACE_INFO_WP("Receive ");
+            commandState->state = SBC_STATE_WAIT_READ;
+        }
+        break;
+
+    //-----------------------
+    case SBC_STATE_WAIT_READ:
+    //-----------------------
+        // Check semaphore value
+        if (transfer->semaphore == 0) {
+
+            break;
+        }
+        transfer->semaphore--;
+        commandState->length -= transfer->transferred;
+
+        if (transfer->status != USBD_STATUS_SUCCESS) {
+
+            TRACE_WARNING("SBC_Unmap: Cannot receive data\n\r");
+            result = MSDD_STATUS_ERROR;
+            break;
+        }
+
+        // Count the block descriptors actually received
+        numDescriptors = 0;
+        if (transfer->transferred >= sizeof(SBCUnmapParameterListHeader)) {
+
+            numDescriptors = (transfer->transferred
+                              - sizeof(SBCUnmapParameterListHeader))
+                             / sizeof(SBCUnmapBlockDescriptor);
+            if (numDescriptors > (WORDB(header->pBlockDescriptorDataLength)
+                                  / sizeof(SBCUnmapBlockDescriptor))) {
+
+                numDescriptors = WORDB(header->pBlockDescriptorDataLength)
+                                 / sizeof(SBCUnmapBlockDescriptor);
+            }
+        }
+
+        // Discard each range
+        result = MSDD_STATUS_SUCCESS;
+        while (numDescriptors > 0) {
+
+            blockAddress = DWORDB((descriptor->pLogicalBlockAddress + 4));
+            length = DWORDB(descriptor->pNumberOfBlocks);
+            if ((DWORDB(descriptor->pLogicalBlockAddress) != 0)
+                || (blockAddress > numBlocks)
+                || (length > (numBlocks - blockAddress))) {
+
+                TRACE_WARNING("SBC_Unmap: Range out of the LUN\n\r");
+                SBC_UpdateSenseData(&(lun->requestSenseData),
+                                    SBC_SENSE_KEY_ILLEGAL_REQUEST,
+                                    SBC_ASC_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE,
+                                    0);
+                result = MSDD_STATUS_ERROR;
+                break;
+            }
+
+            if (LUN_Unmap(lun, blockAddress, length) != USBD_STATUS_SUCCESS) {
+
+                TRACE_WARNING("SBC_Unmap: Cannot discard blocks\n\r");
+                SBC_UpdateSenseData(&(lun->requestSenseData),
+                                    SBC_SENSE_KEY_MEDIUM_ERROR,
+                                    SBC_ASC_WRITE_ERROR,
+                                    0);
+                result = MSDD_STATUS_ERROR;
+                break;
+            }
+
+            descriptor++;
+            numDescriptors--;
+        }
+        break;
+    }
+
+    return result;
+}
+
 //------------------------------------------------------------------------------
 //! \brief  Handles an INQUIRY command.
 //!
@@ -559,6 +903,14 @@ static unsigned char SBC_Inquiry(MSDLun               *lun,
     unsigned char  result = MSDD_STATUS_INCOMPLETE;
     unsigned char  status;
     MSDTransfer *transfer = &(commandState->transfer);
+    SBCInquiry *command = (SBCInquiry *) commandState->cbw.pCommand;
+    void *pData = (void *) lun->inquiryData;
+
+    // Vital product data is built in the read/write buffer
+    if (command->isEVPD) {
+
+        pData = lun->readWriteBuffer;
+    }
 
     // Check if required length is 0
     if (commandState->length == 0) {
@@ -571,9 +923,16 @@ static unsigned char SBC_Inquiry(MSDLun               *lun,
 
         commandState->state = SBC_STATE_WRITE;
 
-        // Change additional length field of inquiry data
-        lun->inquiryData->bAdditionalLength
-            = (unsigned char) (commandState->length - 5);
+        if (command->isEVPD) {
+
+            SBC_BuildVpdPage(lun, command->bPageCode);
+        }
+        else {
+
+            // Change additional length field of inquiry data
+            lun->inquiryData->bAdditionalLength
+                = (unsigned char) (commandState->length - 5);
+        }
     }
 
     // Identify current command state
@@ -582,7 +941,7 @@ static unsigned char SBC_Inquiry(MSDLun               *lun,
     case SBC_STATE_WRITE:
     //-------------------
         // Start write operation
-        status = MSDD_Write((void *) lun->inquiryData,
+        status = MSDD_Write(pData,
                             commandState->length,
                             (TransferCallback) MSDDriver_Callback,
                             (void *) transfer);
@@ -718,6 +1077,13 @@ static unsigned char SBC_RequestSense(MSDLun               *lun,
 //------------------------------------------------------------------------------
 //! \brief  Performs a MODE SENSE (6) command.
 //!
+//!         The mode parameter header is followed by the caching mode page,
+//!         which reports whether a write-back cache is enabled on the LUN.
+//!         The cache is chosen when the LUN is configured, so the default
+//!         values are the current ones, none of them is changeable and saved
+//!         values are not supported.
+//!         The data is built in the LUN read/write buffer.
+//!
 //!         This function operates asynchronously and must be called multiple
 //!         times to complete. A result code of MSDDriver_STATUS_INCOMPLETE
 //!         indicates that at least another call of the method is necessary.
@@ -727,15 +1093,22 @@ static unsigned char SBC_RequestSense(MSDLun               *lun,
 //! \see    MSDLun
 //! \see    MSDCommandState
 //------------------------------------------------------------------------------
-static unsigned char SBC_ModeSense6(MSDCommandState *commandState)
+static unsigned char SBC_ModeSense6(MSDLun          *lun,
+                                    MSDCommandState *commandState)
 {
     unsigned char      result = MSDD_STATUS_INCOMPLETE;
     unsigned char      status;
     MSDTransfer     *transfer = &(commandState->transfer);
+    unsigned char      pageCode;
+    unsigned char      pageControl;
+    SBCModeParameterHeader6 *header;
+    SBCCachingModePage *cachingPage;
 
-    // Check if mode page is supported
-    if (((SBCCommand *) commandState->cbw.pCommand)->modeSense6.bPageCode
-        != SBC_PAGE_RETURN_ALL) {
+    // Check if mode page and page control are supported
+    pageCode = ((SBCCommand *) commandState->cbw.pCommand)->modeSense6.bPageCode;
+    pageControl = ((SBCCommand *) commandState->cbw.pCommand)->modeSense6.bPC;
+    if (((pageCode != SBC_PAGE_RETURN_ALL) && (pageCode != SBC_PAGE_CACHING))
+        || (pageControl == SBC_PC_SAVED)) {
 
         return MSDD_STATUS_PARAMETER;
     }
@@ -751,8 +1124,23 @@ static unsigned char SBC_ModeSense6(MSDCommandState *commandState)
     //-------------------
     case SBC_STATE_WRITE:
     //-------------------
+        // Build the mode parameter header and the caching mode page
+        header = (SBCModeParameterHeader6 *) lun->readWriteBuffer;
+        cachingPage = (SBCCachingModePage *)
+                      (lun->readWriteBuffer + sizeof(SBCModeParameterHeader6));
+        memcpy(header, &modeParameterHeader6, sizeof(SBCModeParameterHeader6));
+        header->bModeDataLength += sizeof(SBCCachingModePage);
+        header->isWP = LUN_IsWriteProtected(lun);
+        memset(cachingPage, 0, sizeof(SBCCachingModePage));
+        cachingPage->bPageCode = SBC_PAGE_CACHING;
+        cachingPage->bPageLength = sizeof(SBCCachingModePage) - 2;
+        if (pageControl != SBC_PC_CHANGEABLE) {
+
+            cachingPage->isWCE = (lun->cache != 0);
+        }
+
         // Start transfer
-        status = MSDD_Write((void *) &modeParameterHeader6,
+        status = MSDD_Write(lun->readWriteBuffer,
                             commandState->length,
                             (TransferCallback) MSDDriver_Callback,
                             (void *) transfer);
@@ -817,22 +1205,14 @@ static unsigned char SBC_TestUnitReady(MSDLun *lun)
     switch(lun->media->state) {
     //-------------------
     case MED_STATE_READY:
+    case MED_STATE_BUSY:
     //-------------------
-        // Nothing to do
+        // A busy media is only doing background work (prefetch, cache write
+        // back, queued requests), the next commands wait for it
         TRACE_INFO_WP("Rdy ");
         result = MSDD_STATUS_SUCCESS;
         break;
 
-    //------------------
-    case MED_STATE_BUSY:
-    //------------------
-        TRACE_INFO_WP("Bsy ");
-        SBC_UpdateSenseData(&(lun->requestSenseData),
-                            SBC_SENSE_KEY_NOT_READY,
-                            0,
-                            0);
-        break;
-
     //------
     default:
     //------
@@ -893,6 +1273,24 @@ unsigned char SBC_GetCommandInformation(void          *command,
 
         // Allocation length is stored in big-endian format
         (*length) = WORDB(sbcCommand->inquiry.pAllocationLength);
+
+        // Vital product data pages
+        if (sbcCommand->inquiry.isEVPD) {
+
+            if (SBC_GetVpdPageSize(sbcCommand->inquiry.bPageCode) == 0) {
+
+                TRACE_WARNING(
+                "SBC_GetCommandInformation: VPD page not supported(0x%02X)\n\r",
+                              sbcCommand->inquiry.bPageCode);
+                isCommandSupported = 0;
+                (*length) = 0;
+            }
+            else if ((*length)
+                     > SBC_GetVpdPageSize(sbcCommand->inquiry.bPageCode)) {
+
+                (*length) = SBC_GetVpdPageSize(sbcCommand->inquiry.bPageCode);
+            }
+        }
         break;
 
     //--------------------
@@ -900,17 +1298,19 @@ unsigned char SBC_GetCommandInformation(void          *command,
     //--------------------
         (*type) = MSDD_DEVICE_TO_HOST;
         if (sbcCommand->modeSense6.bAllocationLength >
-            sizeof(SBCModeParameterHeader6)) {
+            (sizeof(SBCModeParameterHeader6) + sizeof(SBCCachingModePage))) {
 
-            *length = sizeof(SBCModeParameterHeader6);
+            *length = sizeof(SBCModeParameterHeader6)
+                      + sizeof(SBCCachingModePage);
         }
         else {
 
             *length = sbcCommand->modeSense6.bAllocationLength;
         }
 
-        // Only "return all pages" command is supported
-        if (sbcCommand->modeSense6.bPageCode != SBC_PAGE_RETURN_ALL) {
+        // Only "return all pages" and caching page are supported
+        if ((sbcCommand->modeSense6.bPageCode != SBC_PAGE_RETURN_ALL)
+            && (sbcCommand->modeSense6.bPageCode != SBC_PAGE_CACHING)) {
 
             // Unsupported page
             TRACE_WARNING(
@@ -963,12 +1363,52 @@ unsigned char SBC_GetCommandInformation(void          *command,
                      * lun->blockSize;
         break;
 
-    //-----------------
+    //----------------------------
     case SBC_VERIFY_10:
-    //-----------------
+    case SBC_SYNCHRONIZE_CACHE_10:
+    //----------------------------
         (*type) = MSDD_NO_TRANSFER;
         break;
 
+    //-------------
+    case SBC_UNMAP:
+    //-------------
+        (*type) = MSDD_HOST_TO_DEVICE;
+        (*length) = WORDB(sbcCommand->unmap.pParameterListLength);
+
+        // The parameter data is received in one block of the buffer
+        if (!lun->canUnmap || ((*length) > lun->blockSize)) {
+
+            TRACE_WARNING(
+                "SBC_GetCommandInformation: UNMAP not supported\n\r");
+            isCommandSupported = 0;
+            (*length) = 0;
+        }
+        break;
+
+    //----------------------------
+    case SBC_SERVICE_ACTION_IN_16:
+    //----------------------------
+        (*type) = MSDD_DEVICE_TO_HOST;
+        if (sbcCommand->readCapacity16.bServiceAction
+            != SBC_SAI_READ_CAPACITY_16) {
+
+            TRACE_WARNING(
+            "SBC_GetCommandInformation: Service action not supported(0x%02X)\n\r",
+                          sbcCommand->readCapacity16.bServiceAction);
+            isCommandSupported = 0;
+            (*length) = 0;
+        }
+        else {
+
+            (*length) = DWORDB(sbcCommand->readCapacity16.pAllocationLength);
+            if ((*length) > sizeof(SBCReadCapacity16Data)) {
+
+                (*length) = sizeof(SBCReadCapacity16Data);
+            }
+        }
+        break;
+
     //------
     default:
     //------
@@ -1012,6 +1452,18 @@ unsigned char SBC_ProcessCommand(MSDLun               *lun,
     //----------------
         TRACE_INFO_WP("Write(10) ");
 
+        // Check that the media can be written
+        if ((commandState->state == 0) && LUN_IsWriteProtected(lun)) {
+
+            TRACE_WARNING("SBC_ProcessCommand: Media write-protected\n\r");
+            SBC_UpdateSenseData(&(lun->requestSenseData),
+                                SBC_SENSE_KEY_DATA_PROTECT,
+                                SBC_ASC_WRITE_PROTECTED,
+                                0);
+            result = MSDD_STATUS_ERROR;
+            break;
+        }
+
         // Perform the Write10 command
         result = SBC_Write10(lun, commandState);
         break;
@@ -1025,14 +1477,55 @@ unsigned char SBC_ProcessCommand(MSDLun               *lun,
         result = SBC_ReadCapacity10(lun, commandState);
         break;
 
-    //---------------------
+    //----------------------------
     case SBC_VERIFY_10:
-    //---------------------
-        TRACE_INFO_WP("Verify(10) ");
+    case SBC_SYNCHRONIZE_CACHE_10:
+    //----------------------------
+        TRACE_INFO_WP("Verify(10)/SyncCache(10) ");
 
-        // Flush media
-        MED_Flush(lun->media);
-        result = MSDD_STATUS_SUCCESS;
+        // Write back cached data and flush media
+        if (LUN_Flush(lun) != USBD_STATUS_SUCCESS) {
+
+            SBC_UpdateSenseData(&(lun->requestSenseData),
+                                SBC_SENSE_KEY_MEDIUM_ERROR,
+                                SBC_ASC_WRITE_ERROR,
+                                0);
+            result = MSDD_STATUS_ERROR;
+        }
+        else {
+
+            result = MSDD_STATUS_SUCCESS;
+        }
+        break;
+
+    //-------------
+    case SBC_UNMAP:
+    //-------------
+        TRACE_INFO_WP("Unmap ");
+
+        // Check that the media can be written
+        if ((commandState->state == 0) && LUN_IsWriteProtected(lun)) {
+
+            TRACE_WARNING("SBC_ProcessCommand: Media write-protected\n\r");
+            SBC_UpdateSenseData(&(lun->requestSenseData),
+                                SBC_SENSE_KEY_DATA_PROTECT,
+                                SBC_ASC_WRITE_PROTECTED,
+                                0);
+            result = MSDD_STATUS_ERROR;
+            break;
+        }
+
+        // Perform the Unmap command
+        result = SBC_Unmap(lun, commandState);
+        break;
+
+    //----------------------------
+    case SBC_SERVICE_ACTION_IN_16:
+    //----------------------------
+        TRACE_INFO_WP("RdCapacity(16) ");
+
+        // Perform the ReadCapacity16 command
+        result = SBC_ReadCapacity16(lun, commandState);
         break;
 
     //---------------
@@ -1050,7 +1543,7 @@ unsigned char SBC_ProcessCommand(MSDLun               *lun,
         TRACE_INFO_WP("ModeSense(6) ");
 
         // Process ModeSense6 command
-        result = SBC_ModeSense6(commandState);
+        result = SBC_ModeSense6(lun, commandState);
         break;
 
     //-----------------------
@@ -69,6 +69,7 @@
 /// - SBC_STATE_WRITE
 /// - SBC_STATE_WAIT_WRITE
 /// - SBC_STATE_NEXT_BLOCK
+/// - SBC_STATE_ABORT
 
 /// Start of reading bulk data
 #define SBC_STATE_READ                          0x01
@@ -80,6 +81,8 @@
 #define SBC_STATE_WAIT_WRITE                    0x04
 /// Start next command block
 #define SBC_STATE_NEXT_BLOCK                    0x05
+/// Waiting for the pending transfers to end before reporting an error
+#define SBC_STATE_ABORT                         0x06
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
@@ -39,13 +39,15 @@
 /// !Usage
 ///
 /// Add string.c to the list of files to compile for the project. This will
-/// automatically replace standard libc methods by the custom ones.
+/// automatically replace standard libc methods by the custom ones. memcpy and
+/// memset run from SRAM (RAMFUNC) since they are used on the data paths.
 //------------------------------------------------------------------------------
 
 //------------------------------------------------------------------------------
 //         Headers
 //------------------------------------------------------------------------------
 
+#include <board.h>
 #include <string.h>
 
 //------------------------------------------------------------------------------
@@ -59,6 +61,7 @@
 /// \param pSource  Source buffer.
 /// \param num  Number of bytes to copy.
 //------------------------------------------------------------------------------
+RAMFUNC
 void * memcpy(void *pDestination, const void *pSource, size_t num)
 {
     unsigned char *pByteDestination;
@@ -97,6 +100,7 @@ void * memcpy(void *pDestination, const void *pSource, size_t num)
 /// \param value    Value to fill the region with
 /// \param num      Size to fill in bytes
 //------------------------------------------------------------------------------
+RAMFUNC
 void * memset(void *pBuffer, int value, size_t num)
 {
     unsigned char *pByteDestination;
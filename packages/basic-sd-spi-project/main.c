@@ -152,7 +152,8 @@ static const Pin pinsSd[] = {BOARD_SD_SPI_PINS};
 
 #define NB_MULTI_BLOCKS 5
 
-/// SPI clock frequency, in Hz.
+/// SPI clock frequency during the card initialization, in Hz. SD_Init then
+/// raises it to the fastest clock the card allows.
 #define SPCK        10000000
 
 
@@ -304,6 +305,7 @@ int main(void)
         printf("-I- SD/MMC card initialization successful\n\r");
         printf("-I- Card size: %u MB\n\r", SD_TOTAL_SIZE(&sdDrv)/(1024*1024));
         printf("-I- Block size: %d Bytes\n\r", SD_CSD_BLOCK_LEN(&sdDrv));
+        printf("-I- SPI clock: %u Hz\n\r", SD_CLOCK(&sdDrv));
     }
 
     // Perform tests on each block
@@ -110,10 +110,7 @@
 ///
 /// !Contents
 /// The code can be roughly broken down as follows:
-///    - AT26 Dataflash write data function.
-///    - AT26 Dataflash read data function.
-///    - AT26 Dataflash erase function.
-///    - Other AT26 functions (such as AT26_GetStatus())
+///    - Wait for the end of the AT26 operations.
 ///    - The main() function, which implements the program behavior.
 ///       - Initializes an AT26 instance and configures SPI chip select pin.
 ///       - Config SPI Interrupt Service Routine.
@@ -196,6 +193,9 @@ static At26 at26;
 /// Pins to configure for the application.
 static Pin pins[] = {SPI_PINS};
 
+/// Status of the last serial flash operation.
+static volatile unsigned char operationStatus;
+
 //------------------------------------------------------------------------------
 //         Internal functions
 //------------------------------------------------------------------------------
@@ -210,292 +210,25 @@ static void ISR_Spi(void)
 }
 
 //------------------------------------------------------------------------------
-/// Reads and returns the status register of the serial flash.
-/// \param pAt26  Pointer to an AT26 driver instance.
-//------------------------------------------------------------------------------
-static unsigned char AT26_ReadStatus(At26 *pAt26)
-{
-    unsigned char error, status;
-
-    SANITY_CHECK(pAt26);
-
-    // Issue a status read command
-    error = AT26_SendCommand(pAt26, AT26_READ_STATUS, 1, &status, 1, 0, 0, 0);
-    ASSERT(!error, "-F- AT26_GetStatus: Failed to issue command.\n\r");
-
-    // Wait for transfer to finish
-    while (AT26_IsBusy(pAt26));
-
-    return status;
-}
-
-//------------------------------------------------------------------------------
-/// Writes the given value in the status register of the serial flash device.
-/// \param pAt26  Pointer to an AT26 driver instance.
-/// \param status  Status to write.
+/// Records the status of a serial flash operation at its end.
+/// \param status  0 if successful; otherwise an AT26_ERROR_xxx code.
+/// \param pArgument  Unused.
 //------------------------------------------------------------------------------
-static void AT26_WriteStatus(At26 *pAt26, unsigned char status)
+static void AT26_Done(unsigned char status, void *pArgument)
 {
-    unsigned char error;
-
-    SANITY_CHECK(pAt26);
-
-    // Issue a write status command
-    error = AT26_SendCommand(pAt26, AT26_WRITE_STATUS, 1, &status, 1, 0, 0, 0);
-    ASSERT(!error, "-F- AT26_WriteStatus: Failed to issue command.\n\r");
-    while (AT26_IsBusy(pAt26));
+    operationStatus = status;
 }
 
 //------------------------------------------------------------------------------
-/// Waits for the serial flash device to become ready to accept new commands.
+/// Waits for the end of the current serial flash operation and returns its
+/// status.
 /// \param pAt26  Pointer to an AT26 driver instance.
 //------------------------------------------------------------------------------
-static void AT26_WaitReady(At26 *pAt26)
-{
-    unsigned char ready = 0;
-
-    SANITY_CHECK(pAt26);
-
-    // Read status register and check busy bit
-    while (!ready) {
-
-        ready = ((AT26_ReadStatus(pAt26) & AT26_STATUS_RDYBSY) == AT26_STATUS_RDYBSY_READY);
-    }
-}
-
-//------------------------------------------------------------------------------
-/// Reads and returns the serial flash device ID.
-/// \param pAt26  Pointer to an AT26 driver instance.
-//------------------------------------------------------------------------------
-static unsigned int AT26_ReadJedecId(At26 *pAt26)
-{
-    unsigned char error;
-    unsigned int id = 0;
-
-    SANITY_CHECK(pAt26);
-
-    // Issue a read ID command
-    error = AT26_SendCommand(pAt26, AT26_READ_JEDEC_ID, 1,
-                             (unsigned char *) &id, 3, 0, 0, 0);
-    ASSERT(!error, "-F- AT26_GetJedecId: Could not issue command.\n\r");
-
-     // Wait for transfer to finish
-    while (AT26_IsBusy(pAt26));
-
-    return id;
-}
-
-//------------------------------------------------------------------------------
-/// Enables critical writes operation on a serial flash device, such as sector
-/// protection, status register, etc.
-/// \para pAt26  Pointer to an AT26 driver instance.
-//------------------------------------------------------------------------------
-static void AT26_EnableWrite(At26 *pAt26)
+static unsigned char AT26_WaitOperation(At26 *pAt26)
 {
-    unsigned char error;
-
-    SANITY_CHECK(pAt26);
-
-    // Issue a write enable command
-    error = AT26_SendCommand(pAt26, AT26_WRITE_ENABLE, 1, 0, 0, 0, 0, 0);
-    ASSERT(!error, "-F- AT26_EnableWrite: Could not issue command.\n\r");
-
-    // Wait for end of transfer
     while (AT26_IsBusy(pAt26));
-}
-
-//------------------------------------------------------------------------------
-/// Unprotects the contents of the serial flash device.
-/// Returns 0 if the device has been unprotected; otherwise returns
-/// SF_PROTECTED.
-/// \param pAt26  Pointer to an AT26 driver instance.
-//------------------------------------------------------------------------------
-static unsigned char AT26_Unprotect(At26 *pAt26)
-{
-    unsigned char status;
-
-    SANITY_CHECK(pAt26);
-
-    // Get the status register value to check the current protection
-    status = AT26_ReadStatus(pAt26);
-    if ((status & AT26_STATUS_SWP) == AT26_STATUS_SWP_PROTNONE) {
 
-        // Protection already disabled
-        return 0;
-    }
-
-    // Check if sector protection registers are locked
-    if ((status & AT26_STATUS_SPRL) == AT26_STATUS_SPRL_LOCKED) {
-
-        // Unprotect sector protection registers by writing the status reg.
-        AT26_EnableWrite(pAt26);
-        AT26_WriteStatus(pAt26, 0);
-    }
-
-    // Perform a global unprotect command
-      AT26_EnableWrite(pAt26);
-    AT26_WriteStatus(pAt26, 0);
-
-    // Check the new status
-    if ((status & (AT26_STATUS_SPRL | AT26_STATUS_SWP)) != 0) {
-
-        return AT26_ERROR_PROTECTED;
-    }
-    else {
-
-        return 0;
-    }
-}
-
-//------------------------------------------------------------------------------
-/// Erases all the content of the memory chip.
-/// \param pAt26  Pointer to an AT26 driver instance.
-//------------------------------------------------------------------------------
-static unsigned char AT26_EraseChip(At26 *pAt26)
-{
-    unsigned char status;
-    unsigned char error;
-
-    SANITY_CHECK(pAt26);
-
-    // Check that the flash is ready an unprotected
-    status = AT26_ReadStatus(pAt26);
-    if ((status & AT26_STATUS_SWP) != AT26_STATUS_SWP_PROTNONE) {
-
-        TRACE_WARNING("AT26_EraseBlock: Device is protected.\n\r");
-        return AT26_ERROR_PROTECTED;
-    }
-
-    // Enable critical write operation
-      AT26_EnableWrite(pAt26);
-
-    // Erase the chip
-    error = AT26_SendCommand(pAt26, AT26_CHIP_ERASE_2, 1, 0, 0, 0, 0, 0);
-    ASSERT(!error, "-F- AT26_ChipErase: Could not issue command.\n\r");
-     while (AT26_IsBusy(pAt26));
-    AT26_WaitReady(pAt26);
-
-    return 0;
-}
-
-//------------------------------------------------------------------------------
-/// Erases the specified 4KB block of the serial firmware dataflash.
-/// Returns 0 if successful; otherwise returns AT26_ERROR_PROTECTED if the
-/// device is protected or AT26_ERROR_BUSY if it is busy executing a command.
-/// \param pAt26  Pointer to an AT26 driver instance.
-/// \param address  Address of the block to erase.
-//------------------------------------------------------------------------------
-#if 0
-static unsigned char AT26_EraseBlock(At26 *pAt26, unsigned int address)
-{
-    unsigned char status;
-    unsigned char error;
-
-    SANITY_CHECK(pAt26);
-
-    // Check that the flash is ready an unprotected
-    status = AT26_ReadStatus(pAt26);
-    if ((status & AT26_STATUS_RDYBSY) != AT26_STATUS_RDYBSY_BUSY) {
-
-        TRACE_WARNING("AT26_EraseBlock: Device is not ready.\n\r");
-        return AT26_ERROR_BUSY;
-    }
-    else if ((status & AT26_STATUS_SWP) != AT26_STATUS_SWP_PROTNONE) {
-
-        TRACE_WARNING("AT26_EraseBlock: Device is protected.\n\r");
-        return AT26_ERROR_PROTECTED;
-    }
-
-    // Enable critical write operation
-      AT26_EnableWrite(pAt26);
-
-    // Start the block erase command
-    error = AT26_SendCommand(pAt26, AT26_BLOCK_ERASE_4K, 4, 0, 0, address, 0, 0);
-    ASSERT(!error, "-F- AT26_EraseBlock: Could not issue command.\n\r");
-    while (AT26_IsBusy(pAt26));
-    AT26_WaitReady(pAt26);
-
-    return 0;
-}
-#endif
-
-//------------------------------------------------------------------------------
-/// Writes data at the specified address on the serial firmware dataflash. The
-/// page(s) to program must have been erased prior to writing. This function
-/// handles page boundary crossing automatically.
-/// Returns 0 if successful; otherwise, returns AT26_ERROR_PROGRAM is there has
-/// been an error during the data programming.
-/// \param pAt26  Pointer to an AT26 driver instance.
-/// \param pData  Data buffer.
-/// \param size  Number of bytes in buffer.
-/// \param address  Write address.
-//------------------------------------------------------------------------------
-static unsigned char AT26_Write(
-    At26 *pAt26,
-    unsigned char *pData,
-    unsigned int size,
-    unsigned int address)
-{
-    unsigned int pageSize;
-    unsigned int writeSize;
-    unsigned char error;
-    unsigned char status;
-
-    SANITY_CHECK(pAt26);
-    SANITY_CHECK(pData);
-
-    // Retrieve device page size
-    pageSize = AT26_PageSize(&at26);
-
-    // Program one page after the other
-    while (size > 0) {
-
-        // Compute number of bytes to program in page
-        writeSize = min(size, pageSize - (address % pageSize));
-
-        // Enable critical write operation
-        AT26_EnableWrite(pAt26);
-
-         // Program page
-          error = AT26_SendCommand(pAt26, AT26_BYTE_PAGE_PROGRAM, 4,
-                           pData, writeSize, address, 0, 0);
-        ASSERT(!error, "-F- AT26_WritePage: Failed to issue command.\n\r");
-        while (AT26_IsBusy(pAt26));
-        AT26_WaitReady(pAt26);
-
-        // Make sure that write was without error
-        status = AT26_ReadStatus(pAt26);
-        if ((status & AT26_STATUS_EPE) == AT26_STATUS_EPE_ERROR) {
-
-            return AT26_ERROR_PROGRAM;
-        }
-
-        size -= writeSize;
-        address += writeSize;
-    }
-
-    return 0;
-}
-
-//------------------------------------------------------------------------------
-/// Reads data from the specified address on the serial flash.
-/// \param pAt26  Pointer to an AT26 driver instance.
-/// \param pData  Data buffer.
-/// \param size  Number of bytes to read.
-/// \param address  Read address.
-//------------------------------------------------------------------------------
-static void AT26_Read(
-    At26 *pAt26,
-    unsigned char *pData,
-    unsigned int size,
-    unsigned int address)
-{
-    unsigned char error;
-
-     // Start a read operation
-      error = AT26_SendCommand(pAt26, AT26_READ_ARRAY_LF, 4, pData, size, address, 0, 0);
-    ASSERT(!error, "-F- AT26_Read: Could not issue command.\n\r");
-    while (AT26_IsBusy(pAt26));
+    return operationStatus;
 }
 
 //------------------------------------------------------------------------------
@@ -551,7 +284,12 @@ int main(void)
 
     // Erase the chip
     TRACE_INFO("Chip is being erased...\n\r");
-    AT26_EraseChip(&at26);
+    AT26_Erase(&at26, 0, AT26_Size(&at26), AT26_Done, 0);
+    if (AT26_WaitOperation(&at26)) {
+
+        TRACE_ERROR("Failed to erase the chip\n\r");
+        return 2;
+    }
     TRACE_INFO("Checking erase ...\n\r");
 
     // Check that the chip has been erased correctly
@@ -559,7 +297,8 @@ int main(void)
     for (i=0; i < numPages; i++) {
 
         TRACE_INFO("Checking page #%u\r", i);
-        AT26_Read(&at26, pBuffer, pageSize, address);
+        AT26_Read(&at26, address, pBuffer, pageSize, 0, 0);
+        while (AT26_IsBusy(&at26));
         for (j=0; j < pageSize; j++) {
 
             if (pBuffer[j] != 0xFF) {
@@ -590,11 +329,17 @@ int main(void)
         }
 
         // Write buffer
-        AT26_Write(&at26, pBuffer, pageSize, address);
+        AT26_Write(&at26, address, pBuffer, pageSize, AT26_Done, 0);
+        if (AT26_WaitOperation(&at26)) {
+
+            TRACE_ERROR("Failed program on page%u\n\r", i);
+            return 3;
+        }
 
         // Read page back and check result
         memset(pBuffer, 0, pageSize);
-        AT26_Read(&at26, pBuffer, pageSize, address);
+        AT26_Read(&at26, address, pBuffer, pageSize, 0, 0);
+        while (AT26_IsBusy(&at26));
 
         for (j=0; j < pageSize; j++) {
 
@@ -0,0 +1,324 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host check and microbenchmark of the address computation of the AT45
+/// dataflash driver (memories/spi-flash/at45.c).
+///
+/// !Description
+///
+/// The program runs on the host computer. The SPI, PMC and AIC registers are
+/// emulated in memory, mapped at their address on the chip; each command is
+/// ended at once by calling SPID_Handler, without exchanging its bytes.
+///
+/// For every dataflash of the driver, a command is built through
+/// AT45_SendCommand for every byte address of the device, and the address
+/// bytes must match the page/offset split computed with a division. In
+/// binary page mode, the first and last byte of each page must be sent
+/// unchanged.
+///
+/// The benchmark then times the command-build path (AT45_SendCommand and the
+/// end of the command), and the page/offset split alone, computed by the
+/// driver with a shift and a multiply, and with a division. The host has a
+/// hardware divider, unlike the ARM7TDMI, where each division is a library
+/// call of a few tens of cycles; the timings only compare the costs relative
+/// to each other.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints one line per device and the timings, and returns 0
+///    when every address matches.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <memories/spi-flash/spid.h>
+#include <memories/spi-flash/at45.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// First address and size of the emulated peripherals (SPI to system
+/// controller).
+#define PERIPH_START        0xFFFE0000
+#define PERIPH_SIZE         0x00020000
+
+/// Status register of a ready device, without its identifier.
+#define STATUS_READY        0x80
+/// Binary page mode bit of the status register.
+#define STATUS_BINARY       0x01
+
+/// Number of commands and of splits timed by the benchmark.
+#define NUM_COMMANDS        2000000
+#define NUM_SPLITS          20000000
+
+/// Number of pseudo-random addresses used by the benchmark, a power of two.
+#define NUM_ADDRESSES       4096
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Identifiers of the devices of the driver, as read in the status register.
+static const unsigned char pIds[] = {
+
+    0x0C, 0x14, 0x1C, 0x24, 0x2C, 0x34, 0x3C, 0x10, 0x18, 0x20
+};
+
+/// SPI and dataflash drivers.
+static Spid spid;
+static At45 at45;
+
+/// Number of mismatches.
+static unsigned long numErrors;
+
+/// Addresses used by the benchmark.
+static unsigned int pAddresses[NUM_ADDRESSES];
+
+/// Result of the timed splits, kept to prevent their removal.
+static volatile unsigned int sink;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Builds a command at the given address and ends it at once. Returns the
+/// address sent in the command.
+/// \param address  Byte address.
+//------------------------------------------------------------------------------
+static unsigned int Build(unsigned int address)
+{
+    const unsigned char *pCmd = at45.pCmdBuffer;
+    unsigned int sent;
+
+    if (AT45_SendCommand(&at45, AT45_CONTINUOUS_READ_LEG, 8, 0, 0, address,
+                         0, 0)) {
+
+        printf("AT45: command not sent\n");
+        numErrors++;
+        return 0;
+    }
+    AT91C_BASE_SPI->SPI_SR = AT91C_SPI_RXBUFF;
+    SPID_Handler(&spid);
+
+    if (at45.pDesc->pageNumber >= 16384) {
+
+        sent = (pCmd[1] << 24) | (pCmd[2] << 16) | (pCmd[3] << 8) | pCmd[4];
+    }
+    else {
+
+        sent = (pCmd[1] << 16) | (pCmd[2] << 8) | pCmd[3];
+    }
+
+    return sent;
+}
+
+//------------------------------------------------------------------------------
+/// Checks the addresses sent for every byte of the device, in both page
+/// modes. Returns the number of mismatches.
+/// \param pDesc  Device descriptor.
+/// \param id  Identifier of the device in the status register.
+//------------------------------------------------------------------------------
+static unsigned long CheckDevice(const At45Desc *pDesc, unsigned char id)
+{
+    unsigned long errors = numErrors;
+    unsigned int size = pDesc->pageNumber * pDesc->pageSize;
+    unsigned int binarySize = (pDesc->pageSize >> 8) << 8;
+    unsigned int expected;
+    unsigned int address;
+    unsigned int page;
+
+    // Standard page size: page number and offset in the page
+    for (address = 0; address < size; address++) {
+
+        expected = ((address / pDesc->pageSize) << pDesc->pageOffset)
+                   + (address % pDesc->pageSize);
+        if (Build(address) != expected) {
+
+            if (numErrors++ < 10) {
+
+                printf("%s: address 0x%X sent as 0x%X instead of 0x%X\n",
+                       pDesc->name, address, Build(address), expected);
+            }
+        }
+    }
+
+    // Binary page size: linear address
+    AT45_FindDevice(&at45, STATUS_READY | id | STATUS_BINARY);
+    for (page = 0; page < pDesc->pageNumber; page++) {
+
+        address = page * binarySize;
+        if ((Build(address) != address)
+            || (Build(address + binarySize - 1) != address + binarySize - 1)) {
+
+            if (numErrors++ < 10) {
+
+                printf("%s: binary page %u not sent as is\n", pDesc->name, page);
+            }
+        }
+    }
+    AT45_FindDevice(&at45, STATUS_READY | id);
+
+    return numErrors - errors;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the time elapsed since the given time, in nanoseconds.
+/// \param pStart  Start time.
+//------------------------------------------------------------------------------
+static double Elapsed(const struct timespec *pStart)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - pStart->tv_sec) * 1e9
+           + (now.tv_nsec - pStart->tv_nsec);
+}
+
+//------------------------------------------------------------------------------
+/// Times the command-build path and the address split of a device.
+/// \param pDesc  Device descriptor.
+//------------------------------------------------------------------------------
+static void Benchmark(const At45Desc *pDesc)
+{
+    unsigned int size = pDesc->pageNumber * pDesc->pageSize;
+    unsigned int address = 0;
+    unsigned int page;
+    unsigned int sum = 0;
+    struct timespec start;
+    double build;
+    double reciprocal;
+    double division;
+    unsigned int i;
+
+    // Pseudo-random addresses in the device, computed beforehand
+    for (i = 0; i < NUM_ADDRESSES; i++) {
+
+        address = (address * 1664525 + 1013904223) % size;
+        pAddresses[i] = address;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NUM_COMMANDS; i++) {
+
+        sum += Build(pAddresses[i & (NUM_ADDRESSES - 1)]);
+    }
+    build = Elapsed(&start) / NUM_COMMANDS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NUM_SPLITS; i++) {
+
+        address = pAddresses[i & (NUM_ADDRESSES - 1)];
+        page = (unsigned int)
+               (((unsigned long long) (address >> pDesc->pageShift)
+                 * pDesc->pageReciprocal) >> 32);
+        sum += (page << pDesc->pageOffset) + (address - page * pDesc->pageSize);
+    }
+    reciprocal = Elapsed(&start) / NUM_SPLITS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < NUM_SPLITS; i++) {
+
+        address = pAddresses[i & (NUM_ADDRESSES - 1)];
+        sum += ((address / pDesc->pageSize) << pDesc->pageOffset)
+               + (address % pDesc->pageSize);
+    }
+    division = Elapsed(&start) / NUM_SPLITS;
+    sink = sum;
+
+    printf("%s: command %.1f ns, split %.2f ns with a multiply, "
+           "%.2f ns with a division\n",
+           pDesc->name, build, reciprocal, division);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated peripherals, checks and times every device. Returns 0 if
+/// every address matches.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    const At45Desc *pDesc;
+    unsigned long errors;
+    unsigned int i;
+
+    if (mmap((void *) PERIPH_START, PERIPH_SIZE, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated peripherals");
+        return 1;
+    }
+
+    SPID_Configure(&spid, AT91C_BASE_SPI, AT91C_ID_SPI);
+    AT45_Configure(&at45, &spid, 0);
+
+    for (i = 0; i < sizeof(pIds); i++) {
+
+        pDesc = AT45_FindDevice(&at45, STATUS_READY | pIds[i]);
+        if (!pDesc) {
+
+            printf("Device 0x%02X not found\n", pIds[i]);
+            numErrors++;
+            continue;
+        }
+        errors = CheckDevice(pDesc, pIds[i]);
+        printf("%s: %u addresses, %lu mismatches\n", pDesc->name,
+               pDesc->pageNumber * pDesc->pageSize, errors);
+    }
+
+    for (i = 0; i < sizeof(pIds); i++) {
+
+        pDesc = AT45_FindDevice(&at45, STATUS_READY | pIds[i]);
+        if (pDesc) {
+
+            Benchmark(pDesc);
+        }
+    }
+
+    return numErrors > 0;
+}
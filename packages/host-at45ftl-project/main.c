@@ -0,0 +1,662 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test of the AT45 flash translation layer (memories/spi-flash/at45ftl.c)
+/// and of its media (memories/MEDAt45.c), with the pipelined and verified
+/// writes of the AT45 streaming write.
+///
+/// !Description
+///
+/// The program runs on the host computer. The SPI, PMC and AIC registers are
+/// emulated in memory, mapped at their address on the chip. When a PDC
+/// transfer is enabled, the emulated interrupt exchanges its bytes with a
+/// model of an AT45DB011D, then calls SPID_Handler. The model keeps its two
+/// SRAM buffers, transfers and compares pages, and stays busy for a while
+/// after each of these operations and each program. A few weak pages
+/// corrupt the data programmed in them.
+///
+/// The interrupt fires at random points of the main loop while a background
+/// transfer runs, and from AT45_IsBusy (wrapped at link time) while the FTL
+/// waits for a synchronous command. Random media accesses are checked
+/// against a shadow copy: runs of whole pages, read and written in the
+/// background, and unaligned accesses, performed synchronously. Each read
+/// must return the data last written, a write must leave its data buffer
+/// intact, and a command sent to the busy device is an error. The FTL is
+/// mounted again from the device from time to time, and must find the same
+/// data. Finally, a device stuck busy and a lost SPI transfer must make the
+/// FTL fail with AT45FTL_ERROR_TIMEOUT instead of hanging.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints its statistics and returns 0 when every check
+///    passed.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <memories/spi-flash/spid.h>
+#include <memories/spi-flash/at45.h>
+#include <memories/spi-flash/at45ftl.h>
+#include <memories/MEDAt45.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// First address and size of the emulated peripherals (SPI to system
+/// controller).
+#define PERIPH_START        0xFFFE0000
+#define PERIPH_SIZE         0x00020000
+
+/// Chip select of the device.
+#define AT45_CS             0
+
+/// Emulated AT45DB011D.
+#define AT45_STATUS_DEVICE  0x0C
+#define AT45_NUM_PAGES      512
+#define AT45_PAGE           264
+#define AT45_DATA           256
+
+/// Busy times of the device, in bytes clocked on the bus.
+#define AT45_PROGRAM_TIME   3000
+#define AT45_TRANSFER_TIME  300
+
+/// Number of weak pages, which corrupt the data programmed in them.
+#define NUM_WEAK_PAGES      6
+
+/// Size of the media, in logical pages.
+#define NUM_LOGICAL         AT45FTL_LOGICAL_PAGES(AT45_NUM_PAGES)
+
+/// Largest access, in logical pages.
+#define MAX_PAGES           8
+
+/// Number of logical pages written most of the time; the others hold static
+/// data, recycled by the wear leveling.
+#define HOT_PAGES           64
+
+/// Number of accesses, and number of accesses between two mounts.
+#define NUM_ACCESSES        40000
+#define MOUNT_PERIOD        2000
+
+/// Maximum number of steps of a background access.
+#define MAX_STEPS           10000000
+
+/// Size of the stack of the test.
+#define STACK_SIZE          (256 * 1024)
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// SPI driver, AT45 driver, FTL and media.
+static Spid spid;
+static At45 at45;
+static At45Ftl ftl;
+static Media media;
+static unsigned short pMap[NUM_LOGICAL];
+static unsigned char pFlags[AT45FTL_FLAGS_SIZE(AT45_NUM_PAGES)];
+
+/// Time of the device model, in bytes clocked on the bus.
+static unsigned long busTime;
+
+/// Number of transfers and of errors.
+static unsigned long numTransfers;
+static unsigned long numErrors;
+
+/// Set to leave the enabled PDC transfer pending.
+static unsigned char spiStuck;
+
+/// Set to make the device report itself busy forever.
+static unsigned char at45Stuck;
+
+/// AT45 model: memory, SRAM buffers, weak pages, and frame in progress.
+static unsigned char pAt45Memory[AT45_NUM_PAGES][AT45_PAGE];
+static unsigned char pAt45Buffers[2][AT45_PAGE];
+static unsigned char pAt45Weak[AT45_NUM_PAGES];
+static unsigned char at45Opcode;
+static unsigned int at45Count;
+static unsigned int at45Address;
+static unsigned long at45ReadyTime;
+static unsigned char at45BusyBuffer;
+static unsigned char at45Mismatch;
+static unsigned long at45Compares;
+static unsigned long at45Mismatches;
+
+/// Stack of the test: the FTL gives local variables to the PDC, which must
+/// lie below 4GB like the rest of the data.
+static unsigned char pStack[STACK_SIZE];
+static ucontext_t mainContext;
+static ucontext_t testContext;
+static int result;
+
+/// Shadow copy of the media, data of the accesses, and result of the
+/// background accesses.
+static unsigned char pShadow[NUM_LOGICAL * AT45_DATA];
+static unsigned char pData[MAX_PAGES * AT45_DATA];
+static unsigned char pCopy[MAX_PAGES * AT45_DATA];
+static volatile unsigned char done;
+static unsigned char doneStatus;
+static unsigned int doneTransferred;
+static unsigned int doneRemaining;
+
+//------------------------------------------------------------------------------
+//         AT45 model
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns the page addressed by the current frame.
+//------------------------------------------------------------------------------
+static unsigned int At45Page(void)
+{
+    return (at45Address >> 9) % AT45_NUM_PAGES;
+}
+
+//------------------------------------------------------------------------------
+/// Exchanges a byte of the current frame with the AT45 model.
+/// Returns the byte sent by the device.
+/// \param tx  Byte sent by the SPI.
+//------------------------------------------------------------------------------
+static unsigned char At45Exchange(unsigned char tx)
+{
+    unsigned char rx = 0xFF;
+    unsigned int buffer = 0;
+
+    if (at45Count == 0) {
+
+        // The buffer which is not in use can be loaded while busy
+        at45Opcode = tx;
+        at45Address = 0;
+        if ((tx != AT45_STATUS_READ)
+            && !((tx == AT45_BUF1_WRITE) && (at45BusyBuffer == 1))
+            && !((tx == AT45_BUF2_WRITE) && (at45BusyBuffer == 0))
+            && (busTime < at45ReadyTime)) {
+
+            printf("AT45: command 0x%02X while busy\n", tx);
+            numErrors++;
+        }
+    }
+    else if (at45Opcode == AT45_STATUS_READ) {
+
+        rx = AT45_STATUS_DEVICE
+             | (((busTime >= at45ReadyTime) && !at45Stuck) ? 0x80 : 0)
+             | (at45Mismatch ? 0x40 : 0);
+    }
+    else if (at45Count < 4) {
+
+        at45Address = (at45Address << 8) | tx;
+    }
+    else {
+
+        switch (at45Opcode) {
+
+            case AT45_BUF2_WRITE:
+                buffer = 1;
+            case AT45_BUF1_WRITE:
+                if ((at45Address & 0x1FF) >= AT45_PAGE) {
+
+                    printf("AT45: buffer write beyond the page\n");
+                    numErrors++;
+                }
+                pAt45Buffers[buffer][(at45Address & 0x1FF) % AT45_PAGE] = tx;
+                at45Address++;
+                break;
+
+            case AT45_CONTINUOUS_READ_LEG:
+                // Four dummy bytes, then the data
+                if (at45Count >= 8) {
+
+                    rx = pAt45Memory[At45Page()][at45Address & 0x1FF];
+                    at45Address++;
+                    if ((at45Address & 0x1FF) == AT45_PAGE) {
+
+                        at45Address = (at45Address & ~0x1FF) + 0x200;
+                    }
+                }
+                break;
+
+            default:
+                printf("AT45: unexpected data for command 0x%02X\n",
+                       at45Opcode);
+                numErrors++;
+        }
+    }
+    at45Count++;
+
+    return rx;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the current frame of the AT45 model, and starts the program, transfer
+/// or compare it requests. A weak page corrupts the first byte programmed.
+//------------------------------------------------------------------------------
+static void At45Deselect(void)
+{
+    unsigned char buffer = 0;
+
+    switch (at45Opcode) {
+
+        case AT45_BUF2_MEM_ERASE:
+            buffer = 1;
+        case AT45_BUF1_MEM_ERASE:
+            memcpy(pAt45Memory[At45Page()], pAt45Buffers[buffer], AT45_PAGE);
+            if (pAt45Weak[At45Page()]) {
+
+                pAt45Memory[At45Page()][0] ^= 0x01;
+            }
+            at45BusyBuffer = buffer;
+            at45ReadyTime = busTime + AT45_PROGRAM_TIME;
+            break;
+
+        case AT45_PAGE_BUF2_TX:
+            buffer = 1;
+        case AT45_PAGE_BUF1_TX:
+            memcpy(pAt45Buffers[buffer], pAt45Memory[At45Page()], AT45_PAGE);
+            at45BusyBuffer = buffer;
+            at45ReadyTime = busTime + AT45_TRANSFER_TIME;
+            break;
+
+        case AT45_PAGE_BUF2_CMP:
+            buffer = 1;
+        case AT45_PAGE_BUF1_CMP:
+            at45Mismatch = memcmp(pAt45Memory[At45Page()],
+                                  pAt45Buffers[buffer], AT45_PAGE) != 0;
+            at45Compares++;
+            at45Mismatches += at45Mismatch;
+            at45BusyBuffer = buffer;
+            at45ReadyTime = busTime + AT45_TRANSFER_TIME;
+            break;
+    }
+    at45Count = 0;
+}
+
+//------------------------------------------------------------------------------
+//         Emulated SPI
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a PDC transfer is enabled; otherwise returns 0.
+//------------------------------------------------------------------------------
+static unsigned char IsTransferring(void)
+{
+    return (AT91C_BASE_SPI->SPI_PTCR == (AT91C_PDC_RXTEN | AT91C_PDC_TXTEN));
+}
+
+//------------------------------------------------------------------------------
+/// Exchanges a PDC buffer with the device; the received bytes overwrite the
+/// sent ones.
+/// \param pointer  Buffer address.
+/// \param count  Number of bytes.
+//------------------------------------------------------------------------------
+static void Exchange(unsigned int pointer, unsigned int count)
+{
+    unsigned char *pBuffer = (unsigned char *) (unsigned long) pointer;
+
+    while (count > 0) {
+
+        *pBuffer = At45Exchange(*pBuffer);
+        pBuffer++;
+        count--;
+        busTime++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Emulated SPI interrupt: performs the enabled PDC transfer with the device,
+/// then calls SPID_Handler.
+//------------------------------------------------------------------------------
+static void SpiInterrupt(void)
+{
+    AT91S_SPI *pSpiHw = AT91C_BASE_SPI;
+
+    if (((pSpiHw->SPI_MR & AT91C_SPI_PCS) >> 16) != 0xE) {
+
+        printf("SPI: chip select 0x%X\n",
+               (pSpiHw->SPI_MR & AT91C_SPI_PCS) >> 16);
+        numErrors++;
+    }
+
+    Exchange(pSpiHw->SPI_TPR, pSpiHw->SPI_TCR);
+    Exchange(pSpiHw->SPI_TNPR, pSpiHw->SPI_TNCR);
+    At45Deselect();
+    numTransfers++;
+
+    pSpiHw->SPI_SR = AT91C_SPI_RXBUFF;
+    SPID_Handler(&spid);
+}
+
+//------------------------------------------------------------------------------
+/// AT45_IsBusy as called by the FTL: lets the time pass and the emulated
+/// interrupt fire, unless the transfer is stuck.
+/// \param pAt45  Pointer to the At45 driver instance.
+//------------------------------------------------------------------------------
+unsigned char __real_AT45_IsBusy(At45 *pAt45);
+unsigned char __wrap_AT45_IsBusy(At45 *pAt45)
+{
+    busTime++;
+    if (IsTransferring() && !spiStuck) {
+
+        SpiInterrupt();
+    }
+
+    return __real_AT45_IsBusy(pAt45);
+}
+
+//------------------------------------------------------------------------------
+//         Accesses
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Callback of the media accesses.
+/// \param argument  Unused.
+/// \param status  Status of the access.
+/// \param transferred  Number of bytes transferred.
+/// \param remaining  Number of bytes not transferred.
+//------------------------------------------------------------------------------
+static void MediaDone(void *argument,
+                      unsigned char status,
+                      unsigned int transferred,
+                      unsigned int remaining)
+{
+    doneStatus = status;
+    doneTransferred = transferred;
+    doneRemaining = remaining;
+    done = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Performs a media access and waits for its callback, firing the emulated
+/// interrupt at random points. Returns 0 if the access succeeded; otherwise
+/// returns 1.
+/// \param isRead  1 to read, 0 to write.
+/// \param address  Address of the access.
+/// \param length  Number of bytes.
+//------------------------------------------------------------------------------
+static unsigned char Access(unsigned char isRead,
+                            unsigned int address,
+                            unsigned int length)
+{
+    unsigned long step;
+    unsigned char result;
+
+    done = 0;
+    if (isRead) {
+
+        result = MED_Read(&media, address, pData, length, MediaDone, 0);
+    }
+    else {
+
+        result = MED_Write(&media, address, pData, length, MediaDone, 0);
+    }
+    if (result != MED_STATUS_SUCCESS) {
+
+        printf("Media: access 0x%X, %u not started (%u)\n",
+               address, length, result);
+        numErrors++;
+        return 1;
+    }
+
+    for (step = 0; !done && (step < MAX_STEPS); step++) {
+
+        busTime += rand() % 8;
+        if (IsTransferring() && (rand() % 4)) {
+
+            SpiInterrupt();
+        }
+    }
+    if (!done || (media.state != MED_STATE_READY)) {
+
+        printf("Media: access 0x%X, %u not ended\n", address, length);
+        numErrors++;
+        return 1;
+    }
+    if ((doneStatus != MED_STATUS_SUCCESS) || (doneTransferred != length)
+        || (doneRemaining != 0)) {
+
+        printf("Media: access 0x%X, %u failed (%u, %u, %u)\n", address,
+               length, doneStatus, doneTransferred, doneRemaining);
+        numErrors++;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Mounts the FTL and initializes the media.
+//------------------------------------------------------------------------------
+static void Mount(void)
+{
+    unsigned char error;
+
+    error = AT45FTL_Mount(&ftl, &at45, pMap, pFlags);
+    if (error) {
+
+        printf("FTL: mount failed (%u)\n", error);
+        numErrors++;
+    }
+    MEDAt45_Initialize(&media, &ftl);
+}
+
+//------------------------------------------------------------------------------
+/// Reads the whole media and compares it with the shadow copy.
+//------------------------------------------------------------------------------
+static void CheckAll(void)
+{
+    unsigned int address;
+    unsigned int length = MAX_PAGES * AT45_DATA;
+
+    for (address = 0; address < sizeof(pShadow); address += length) {
+
+        if (length > sizeof(pShadow) - address) {
+
+            length = sizeof(pShadow) - address;
+        }
+        if (!Access(1, address, length)
+            && memcmp(pData, pShadow + address, length)) {
+
+            printf("Media: data lost at 0x%X\n", address);
+            numErrors++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Performs a random media access and checks it against the shadow copy.
+/// Returns 1 if the access was whole pages; otherwise returns 0.
+//------------------------------------------------------------------------------
+static unsigned char RandomAccess(void)
+{
+    unsigned char aligned = rand() % 4;
+    unsigned char isRead = rand() % 2;
+    unsigned int pages = 1 + rand() % MAX_PAGES;
+    unsigned int first;
+    unsigned int address;
+    unsigned int length;
+    unsigned int i;
+
+    first = (rand() % 8) ? rand() % (HOT_PAGES - MAX_PAGES)
+                         : rand() % (NUM_LOGICAL - MAX_PAGES);
+    address = first * AT45_DATA;
+    length = pages * AT45_DATA;
+    if (!aligned) {
+
+        address += rand() % AT45_DATA;
+        length = 1 + rand() % (length - (address - first * AT45_DATA));
+    }
+
+    if (isRead) {
+
+        memset(pData, 0, length);
+        if (!Access(1, address, length)
+            && memcmp(pData, pShadow + address, length)) {
+
+            printf("Media: read mismatch at 0x%X, %u\n", address, length);
+            numErrors++;
+        }
+    }
+    else {
+
+        for (i = 0; i < length; i++) {
+
+            pData[i] = (unsigned char) rand();
+        }
+        memcpy(pCopy, pData, length);
+        if (!Access(0, address, length)) {
+
+            memcpy(pShadow + address, pCopy, length);
+        }
+        if (memcmp(pData, pCopy, length)) {
+
+            printf("Media: write buffer overwritten at 0x%X\n", address);
+            numErrors++;
+        }
+    }
+
+    return aligned != 0;
+}
+
+//------------------------------------------------------------------------------
+/// Checks that the FTL gives up on a device stuck busy and on a lost SPI
+/// transfer.
+//------------------------------------------------------------------------------
+static void CheckTimeouts(void)
+{
+    unsigned char byte;
+    unsigned char error;
+
+    // The device never gets ready
+    at45Stuck = 1;
+    byte = 0x5A;
+    error = AT45FTL_Write(&ftl, 0, 1, &byte, 1);
+    if (error != AT45FTL_ERROR_TIMEOUT) {
+
+        printf("FTL: busy device not detected (%u)\n", error);
+        numErrors++;
+    }
+    at45Stuck = 0;
+
+    // The SPI transfer never ends
+    spiStuck = 1;
+    error = AT45FTL_Read(&ftl, 0, 0, &byte, 1);
+    if (error != AT45FTL_ERROR_TIMEOUT) {
+
+        printf("FTL: lost transfer not detected (%u)\n", error);
+        numErrors++;
+    }
+    spiStuck = 0;
+    while (AT45_IsBusy(&at45));
+}
+
+//------------------------------------------------------------------------------
+/// Runs the test on its own stack, and sets its result.
+//------------------------------------------------------------------------------
+static void Test(void)
+{
+    unsigned long access;
+    unsigned long background = 0;
+    unsigned long moved = 0;
+    unsigned int i;
+
+    srand(1);
+    memset(pAt45Memory, 0xFF, sizeof(pAt45Memory));
+    memset(pShadow, 0xFF, sizeof(pShadow));
+    for (i = 0; i < NUM_WEAK_PAGES; i++) {
+
+        pAt45Weak[rand() % AT45_NUM_PAGES] = 1;
+    }
+
+    SPID_Configure(&spid, AT91C_BASE_SPI, AT91C_ID_SPI);
+    AT45_Configure(&at45, &spid, AT45_CS);
+    AT45_FindDevice(&at45, AT45_STATUS_DEVICE | 0x80);
+    Mount();
+
+    for (access = 1; access <= NUM_ACCESSES; access++) {
+
+        background += RandomAccess();
+        if ((access % MOUNT_PERIOD) == 0) {
+
+            moved += ftl.moved;
+            Mount();
+            CheckAll();
+        }
+    }
+    CheckTimeouts();
+    moved += ftl.moved;
+    Mount();
+    CheckAll();
+
+    printf("%lu accesses, %lu in the background, %lu transfers, "
+           "%lu compares, %lu mismatches, %lu pages moved, %lu errors\n",
+           (unsigned long) NUM_ACCESSES, background, numTransfers,
+           at45Compares, at45Mismatches, moved, numErrors);
+
+    result = (numErrors > 0) || (at45Mismatches == 0) || (moved == 0);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated peripherals and runs the test. Returns 0 if all the
+/// checks pass.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    if (mmap((void *) PERIPH_START, PERIPH_SIZE, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated peripherals");
+        return 1;
+    }
+
+    getcontext(&testContext);
+    testContext.uc_stack.ss_sp = pStack;
+    testContext.uc_stack.ss_size = sizeof(pStack);
+    testContext.uc_link = &mainContext;
+    makecontext(&testContext, Test, 0);
+    swapcontext(&mainContext, &testContext);
+
+    return result;
+}
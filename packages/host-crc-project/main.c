@@ -0,0 +1,408 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host check and benchmark of the CRC kernels of the SD card driver:
+/// CRC16_Ccitt (utility/crc16.c) and SDCRC_Crc7 (memories/sdmmc/sdcrc.c).
+///
+/// !Description
+///
+/// The program runs on the host computer. Both kernels are compared with a
+/// bitwise computation of the CRC from its polynomial, and with the byte-wise
+/// crc_itu_t and crc7 routines of external_libs/crc which they replace:
+///    - on the known values of the SD specification (CMD0, CMD8 and a block
+///      of 0xFF bytes),
+///    - on pseudo-random buffers of every length up to two blocks and every
+///      start alignment, so that the byte and word loops of CRC16_Ccitt are
+///      all run,
+///    - on blocks computed part by part at random split points, as done by
+///      the chunk mode of the SD driver (SDSPI_CRC_CHUNK_SIZE).
+///
+/// The benchmark then times the CRC16 of a 512-byte block with each routine.
+/// On x86 hosts, bytes per cycle are given from the time-stamp counter. The
+/// host has no flash wait states and large caches, unlike the AT91SAM7: the
+/// figures only compare the routines relative to each other.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints the number of mismatches and the timings, and
+///    returns 0 when every CRC matches.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <utility/crc16.h>
+#include <sdmmc/sdcrc.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Size of a SD data block.
+#define BLOCK_SIZE          512
+
+/// Longest buffer checked, and number of buffers per length.
+#define MAX_LENGTH          (2 * BLOCK_SIZE)
+#define NUM_BUFFERS         8
+
+/// Number of blocks computed part by part.
+#define NUM_SPLITS          100000
+
+/// Number of blocks timed per routine.
+#define NUM_BLOCKS          200000
+
+//------------------------------------------------------------------------------
+//         Reference routines
+//------------------------------------------------------------------------------
+
+// external_libs/crc/linuxtypes.h defines size_t as an unsigned int, which
+// conflicts with the host definition: the routines are declared here.
+extern unsigned short crc_itu_t(unsigned short crc,
+                                const unsigned char *buffer,
+                                unsigned int len);
+extern unsigned char crc7(unsigned char crc,
+                          const unsigned char *buffer,
+                          unsigned int len);
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Buffer checked or timed, 4 bytes longer than the longest buffer so that it
+/// can start at any alignment.
+static unsigned int pWords[(MAX_LENGTH + 4) / 4 + 1];
+
+/// Number of mismatches.
+static unsigned long numErrors;
+
+/// State of the pseudo-random generator.
+static unsigned int seed = 1;
+
+/// Result of the timed routines, kept to prevent their removal.
+static volatile unsigned int sink;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number.
+//------------------------------------------------------------------------------
+static unsigned int Random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+//------------------------------------------------------------------------------
+/// Fills the given buffer with pseudo-random bytes.
+/// \param pData  Pointer to the buffer.
+/// \param size  Size of the buffer.
+//------------------------------------------------------------------------------
+static void Fill(unsigned char *pData, unsigned int size)
+{
+    while (size > 0) {
+
+        *pData++ = Random();
+        size--;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Computes the CRC16-CCITT of a buffer bit by bit, from its polynomial
+/// (x^16 + x^12 + x^5 + 1, most significant bit first).
+/// \param crc  CRC of the previous bytes, 0 for the first ones.
+/// \param pData  Pointer to the bytes.
+/// \param size  Number of bytes.
+//------------------------------------------------------------------------------
+static unsigned short BitCrc16(unsigned short crc,
+                               const unsigned char *pData,
+                               unsigned int size)
+{
+    unsigned int bit;
+
+    while (size > 0) {
+
+        crc ^= *pData++ << 8;
+        for (bit = 0; bit < 8; bit++) {
+
+            if (crc & 0x8000) {
+
+                crc = (crc << 1) ^ 0x1021;
+            }
+            else {
+
+                crc <<= 1;
+            }
+        }
+        size--;
+    }
+
+    return crc;
+}
+
+//------------------------------------------------------------------------------
+/// Computes the CRC7 of a buffer bit by bit, from its polynomial
+/// (x^7 + x^3 + 1, most significant bit first).
+/// \param crc  CRC of the previous bytes, 0 for the first ones.
+/// \param pData  Pointer to the bytes.
+/// \param size  Number of bytes.
+//------------------------------------------------------------------------------
+static unsigned char BitCrc7(unsigned char crc,
+                             const unsigned char *pData,
+                             unsigned int size)
+{
+    unsigned int bit;
+    unsigned char data;
+
+    while (size > 0) {
+
+        data = *pData++;
+        for (bit = 0; bit < 8; bit++) {
+
+            crc <<= 1;
+            if (((crc >> 7) ^ (data >> 7)) & 1) {
+
+                crc ^= 0x09;
+            }
+            crc &= 0x7f;
+            data <<= 1;
+        }
+        size--;
+    }
+
+    return crc;
+}
+
+//------------------------------------------------------------------------------
+/// Counts a mismatch between two CRC values, and prints the first ones.
+/// \param pName  Name of the check.
+/// \param expected  Expected CRC.
+/// \param computed  Computed CRC.
+/// \param size  Size of the buffer.
+/// \param offset  Alignment of the buffer.
+//------------------------------------------------------------------------------
+static void Compare(const char *pName,
+                    unsigned int expected,
+                    unsigned int computed,
+                    unsigned int size,
+                    unsigned int offset)
+{
+    if (expected != computed) {
+
+        if (numErrors < 10) {
+
+            printf("%s: 0x%04X instead of 0x%04X (%u bytes at +%u)\n",
+                   pName, computed, expected, size, offset);
+        }
+        numErrors++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks the known values of the SD specification.
+//------------------------------------------------------------------------------
+static void CheckKnown(void)
+{
+    static const unsigned char pCmd0[] = {0x40, 0x00, 0x00, 0x00, 0x00};
+    static const unsigned char pCmd8[] = {0x48, 0x00, 0x00, 0x01, 0xAA};
+    unsigned char *pData = (unsigned char *) pWords;
+
+    Compare("CMD0 CRC7", 0x95 >> 1, SDCRC_Crc7(0, pCmd0, 5), 5, 0);
+    Compare("CMD8 CRC7", 0x87 >> 1, SDCRC_Crc7(0, pCmd8, 5), 5, 0);
+
+    memset(pData, 0xFF, BLOCK_SIZE);
+    Compare("0xFF block CRC16", 0x7FA1, CRC16_Ccitt(0, pData, BLOCK_SIZE),
+            BLOCK_SIZE, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Checks both kernels on pseudo-random buffers of every length and start
+/// alignment.
+//------------------------------------------------------------------------------
+static void CheckBuffers(void)
+{
+    unsigned char *pData;
+    unsigned int offset;
+    unsigned int size;
+    unsigned int i;
+    unsigned short crc16;
+    unsigned char crc7Bits;
+    unsigned short start;
+
+    for (size = 0; size <= MAX_LENGTH; size++) {
+
+        for (offset = 0; offset < 4; offset++) {
+
+            pData = (unsigned char *) pWords + offset;
+            for (i = 0; i < NUM_BUFFERS; i++) {
+
+                Fill(pData, size);
+
+                // Start from 0 and from a previous CRC
+                start = (i & 1) ? Random() : 0;
+                crc16 = BitCrc16(start, pData, size);
+                Compare("CRC16 vs bitwise", crc16,
+                        CRC16_Ccitt(start, pData, size), size, offset);
+                Compare("CRC16 vs crc_itu_t", crc_itu_t(start, pData, size),
+                        CRC16_Ccitt(start, pData, size), size, offset);
+
+                if (size <= 64) {
+
+                    start &= 0x7f;
+                    crc7Bits = BitCrc7(start, pData, size);
+                    Compare("CRC7 vs bitwise", crc7Bits,
+                            SDCRC_Crc7(start, pData, size), size, offset);
+                    Compare("CRC7 vs crc7", crc7(start, pData, size),
+                            SDCRC_Crc7(start, pData, size), size, offset);
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks the CRC16 of blocks computed part by part, at random split points,
+/// as in the chunk mode of the SD driver.
+//------------------------------------------------------------------------------
+static void CheckSplits(void)
+{
+    unsigned char *pData = (unsigned char *) pWords;
+    unsigned int done;
+    unsigned int size;
+    unsigned int i;
+    unsigned short crc;
+
+    for (i = 0; i < NUM_SPLITS; i++) {
+
+        Fill(pData, BLOCK_SIZE);
+        crc = 0;
+        done = 0;
+        while (done < BLOCK_SIZE) {
+
+            size = Random() % (BLOCK_SIZE - done + 1);
+            crc = CRC16_Ccitt(crc, pData + done, size);
+            done += size;
+        }
+        Compare("CRC16 by parts", BitCrc16(0, pData, BLOCK_SIZE), crc,
+                BLOCK_SIZE, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the number of cycles of the time-stamp counter, or 0 when the host
+/// has none.
+//------------------------------------------------------------------------------
+static unsigned long long Cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/// Times the CRC16 of a block with the given routine, and prints the time per
+/// block, the throughput and the bytes per cycle.
+/// \param pName  Name of the routine.
+/// \param crc16  CRC routine.
+/// \param numBlocks  Number of blocks timed.
+//------------------------------------------------------------------------------
+static void Time(const char *pName,
+                 unsigned short (*crc16)(unsigned short,
+                                         const unsigned char *,
+                                         unsigned int),
+                 unsigned int numBlocks)
+{
+    const unsigned char *pData = (const unsigned char *) pWords;
+    struct timespec start, end;
+    unsigned long long cycles;
+    unsigned int crc = 0;
+    unsigned int i;
+    double seconds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cycles = Cycles();
+    for (i = 0; i < numBlocks; i++) {
+
+        crc += crc16(i, pData, BLOCK_SIZE);
+    }
+    cycles = Cycles() - cycles;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sink = crc;
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%-12s %7.0f ns/block %8.1f MB/s", pName,
+           seconds * 1e9 / numBlocks,
+           (double) numBlocks * BLOCK_SIZE / seconds / 1e6);
+    if (cycles > 0) {
+
+        printf(" %5.2f bytes/cycle",
+               (double) numBlocks * BLOCK_SIZE / cycles);
+    }
+    printf("\n");
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Checks both kernels, then times the CRC16 routines. Returns 0 if every CRC
+/// matches.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    CheckKnown();
+    CheckBuffers();
+    CheckSplits();
+    printf("%lu mismatches\n", numErrors);
+
+    Fill((unsigned char *) pWords, BLOCK_SIZE);
+    Time("CRC16_Ccitt", CRC16_Ccitt, NUM_BLOCKS);
+    Time("crc_itu_t", crc_itu_t, NUM_BLOCKS);
+    Time("bitwise", BitCrc16, NUM_BLOCKS / 10);
+
+    return numErrors > 0;
+}
@@ -0,0 +1,463 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test and benchmark of the page writes of the internal flash driver
+/// (memories/flash/flashd_efc.c).
+///
+/// !Description
+///
+/// The program runs on the host computer. The internal flash and the EFC are
+/// emulated in memory, mapped at their address on the chip, and the EFC
+/// commands of the driver go to a model of the EFC. The memory of the flash
+/// holds the page latch as well: the driver fills the latch by writing the
+/// page in the flash, and the program command copies it into the flash
+/// contents kept by the model, erasing the page first unless NEBP is set.
+/// The model checks that the latch is only written at the page which is then
+/// programmed, and refuses to program the pages of locked regions.
+///
+/// The test writes random data at random addresses, with buffers of any
+/// alignment, through FLASHD_Write, and whole pages through
+/// FLASHD_WritePages. The flash must hold the data written last, and each
+/// page written must take a single program command. Writes to a locked region
+/// must fail and leave the flash unchanged.
+///
+/// The benchmark then writes the whole flash through FLASHD_Write with a
+/// misaligned buffer, which goes through the page buffer, with a word-aligned
+/// buffer, whose pages are copied straight in the latch, and through
+/// FLASHD_WritePages. It prints the host time spent in the driver per page,
+/// the model of the EFC doing nothing meanwhile, and the throughput of the
+/// flash given the programming time of a page.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints the results of the benchmark, and returns 0 when the
+///    flash always held the expected data.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <efc/efc.h>
+#include <memories/flash/flashd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Size of a flash page in bytes, number of pages and number of pages of a
+/// lock region.
+#define PAGE_SIZE           AT91C_IFLASH_PAGE_SIZE
+#define NUM_PAGES           AT91C_IFLASH_NB_OF_PAGES
+#define REGION_PAGES        (AT91C_IFLASH_LOCK_REGION_SIZE / PAGE_SIZE)
+
+/// First address and size of the emulated EFC registers.
+#define EFC_START           0xFFFFF000
+#define EFC_SIZE            0x1000
+
+/// Time taken by the EFC to erase and program a page, in us (assumed value).
+#define PROGRAM_US          4000
+
+/// Test: number of random writes, and largest size of a FLASHD_Write call and
+/// of a FLASHD_WritePages call in pages.
+#define NUM_WRITES          4000
+#define MAX_WRITE_PAGES     3
+#define MAX_RUN_PAGES       8
+
+/// Benchmark: number of times the whole flash is written by each method.
+#define NUM_ROUNDS          50
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Flash contents kept by the model of the EFC, and lock bits.
+static unsigned char pFlash[AT91C_IFLASH_SIZE];
+static unsigned char pLocked[NUM_PAGES / REGION_PAGES];
+
+/// Set while the benchmark runs: the model only counts the program commands,
+/// so that the time is spent in the driver, and the flash reads the latch.
+static unsigned char benchmark;
+
+/// Number of program commands.
+static unsigned long numPrograms;
+
+/// Expected flash contents, and source data, one word longer so that it can be
+/// given misaligned.
+static unsigned char pImage[AT91C_IFLASH_SIZE];
+static unsigned int pSource[(AT91C_IFLASH_SIZE / 4) + 1];
+
+/// Number of errors.
+static unsigned long numErrors;
+
+/// State of the pseudo-random generator.
+static unsigned int seed = 1;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number.
+//------------------------------------------------------------------------------
+static unsigned int Random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+//------------------------------------------------------------------------------
+/// Counts an error and prints the first ones.
+/// \param pMessage  Description of the error.
+//------------------------------------------------------------------------------
+static void Error(const char *pMessage)
+{
+    if (numErrors < 10) {
+
+        printf("Error: %s\n", pMessage);
+    }
+    numErrors++;
+}
+
+//------------------------------------------------------------------------------
+//         Emulated EFC
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Model of the EFC, called instead of EFC_PerformCommand: programs the page
+/// latch, locks and unlocks regions. Returns the error bits of the status
+/// register.
+/// \param pEfc  Pointer to an AT91S_EFC structure.
+/// \param command  Command to execute.
+/// \param argument  Command argument.
+//------------------------------------------------------------------------------
+unsigned char __wrap_EFC_PerformCommand(
+    AT91S_EFC *pEfc,
+    unsigned char command,
+    unsigned short argument)
+{
+    unsigned char *pLatch = (unsigned char *) AT91C_IFLASH;
+    unsigned char *pPage;
+    unsigned int i;
+
+    if (pEfc != AT91C_BASE_EFC) {
+
+        Error("command sent to another EFC");
+    }
+    pEfc->EFC_FCR = (0x5A << 24) | (argument << 8) | command;
+    pEfc->EFC_FSR = AT91C_MC_FRDY;
+    if (argument >= NUM_PAGES) {
+
+        Error("page out of the flash");
+        pEfc->EFC_FSR |= AT91C_MC_PROGE;
+        return AT91C_MC_PROGE;
+    }
+
+    switch (command) {
+
+        case AT91C_MC_FCMD_START_PROG:
+            numPrograms++;
+            pPage = &pFlash[argument * PAGE_SIZE];
+            if (benchmark) {
+
+                break;
+            }
+
+            // The latch must only hold the data of the page programmed
+            if ((memcmp(pLatch, pFlash, argument * PAGE_SIZE) != 0)
+                    || (memcmp(pLatch + (argument + 1) * PAGE_SIZE,
+                               pPage + PAGE_SIZE,
+                               (NUM_PAGES - argument - 1) * PAGE_SIZE) != 0)) {
+
+                Error("latch written outside the page programmed");
+            }
+
+            if (pLocked[argument / REGION_PAGES]) {
+
+                pEfc->EFC_FSR |= AT91C_MC_LOCKE;
+            }
+            else if ((pEfc->EFC_FMR & AT91C_MC_NEBP) == 0) {
+
+                memcpy(pPage, pLatch + argument * PAGE_SIZE, PAGE_SIZE);
+            }
+            else {
+
+                for (i = 0; i < PAGE_SIZE; i++) {
+
+                    pPage[i] &= pLatch[argument * PAGE_SIZE + i];
+                }
+            }
+
+            // The flash reads its contents again, not the latch
+            memcpy(pLatch + argument * PAGE_SIZE, pPage, PAGE_SIZE);
+            break;
+
+        case AT91C_MC_FCMD_LOCK:
+            pLocked[argument / REGION_PAGES] = 1;
+            break;
+
+        case AT91C_MC_FCMD_UNLOCK:
+            pLocked[argument / REGION_PAGES] = 0;
+            break;
+
+        default:
+            Error("unexpected command");
+            pEfc->EFC_FSR |= AT91C_MC_PROGE;
+    }
+
+    return pEfc->EFC_FSR & (AT91C_MC_PROGE | AT91C_MC_LOCKE);
+}
+
+//------------------------------------------------------------------------------
+//         Tests
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Checks that the flash holds the expected data.
+/// \param pOperation  Description of the last operation.
+//------------------------------------------------------------------------------
+static void Check(const char *pOperation)
+{
+    if (memcmp(pFlash, pImage, sizeof(pFlash)) != 0) {
+
+        Error(pOperation);
+        memcpy(pImage, pFlash, sizeof(pFlash));
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes random data at random addresses through FLASHD_Write and
+/// FLASHD_WritePages, and checks the flash contents and the number of program
+/// commands after each write.
+//------------------------------------------------------------------------------
+static void TestWrites(void)
+{
+    unsigned char *pData;
+    unsigned int address;
+    unsigned int size;
+    unsigned int pages;
+    unsigned long programs;
+    unsigned char error;
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0; i < NUM_WRITES; i++) {
+
+        programs = numPrograms;
+
+        // Any address, size and alignment
+        if (Random() & 1) {
+
+            address = Random() % AT91C_IFLASH_SIZE;
+            size = 1 + (Random() % (MAX_WRITE_PAGES * PAGE_SIZE));
+
+            // Whole pages one time in four
+            if ((Random() % 4) == 0) {
+
+                address -= address % PAGE_SIZE;
+                size = PAGE_SIZE * (1 + (Random() % MAX_WRITE_PAGES));
+            }
+            if ((address + size) > AT91C_IFLASH_SIZE) {
+
+                size = AT91C_IFLASH_SIZE - address;
+            }
+            pData = (unsigned char *) pSource + (Random() % 4);
+            for (j = 0; j < size; j++) {
+
+                pData[j] = Random();
+            }
+            error = FLASHD_Write(AT91C_IFLASH + address, pData, size);
+            pages = (address + size - 1) / PAGE_SIZE - address / PAGE_SIZE + 1;
+        }
+        // Run of whole pages
+        else {
+
+            pages = 1 + (Random() % MAX_RUN_PAGES);
+            address = (Random() % (NUM_PAGES - pages + 1)) * PAGE_SIZE;
+            size = pages * PAGE_SIZE;
+            pData = (unsigned char *) pSource;
+            for (j = 0; j < size; j++) {
+
+                pData[j] = Random();
+            }
+            error = FLASHD_WritePages(AT91C_IFLASH + address, pData, pages);
+        }
+
+        if (error) {
+
+            Error("write failed");
+        }
+        if ((numPrograms - programs) != pages) {
+
+            Error("not one program command per page");
+        }
+        memcpy(&pImage[address], pData, size);
+        Check("wrong flash contents after a write");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks that writes to a locked region fail and leave the flash unchanged.
+//------------------------------------------------------------------------------
+static void TestLock(void)
+{
+    unsigned int address = AT91C_IFLASH + 3 * AT91C_IFLASH_LOCK_REGION_SIZE;
+
+    memset(pSource, 0x5A, 2 * PAGE_SIZE);
+    if (FLASHD_Lock(address, address + PAGE_SIZE, 0, 0) != 0) {
+
+        Error("lock failed");
+    }
+    if (FLASHD_Write(address + 1, pSource, PAGE_SIZE) == 0) {
+
+        Error("FLASHD_Write succeeded in a locked region");
+    }
+    if (FLASHD_WritePages(address, pSource, 2) == 0) {
+
+        Error("FLASHD_WritePages succeeded in a locked region");
+    }
+    Check("locked region written");
+    if (FLASHD_Unlock(address, address + PAGE_SIZE, 0, 0) != 0) {
+
+        Error("unlock failed");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Writes the whole flash NUM_ROUNDS times with one method, and prints the
+/// host time spent in the driver per page.
+/// \param pName  Name of the method.
+/// \param method  0: FLASHD_Write with a misaligned buffer,
+///                1: FLASHD_Write with a word-aligned buffer,
+///                2: FLASHD_WritePages.
+//------------------------------------------------------------------------------
+static void Benchmark(const char *pName, unsigned char method)
+{
+    unsigned char *pData = (unsigned char *) pSource + ((method == 0) ? 1 : 0);
+    unsigned long programs = numPrograms;
+    struct timespec start;
+    struct timespec end;
+    double nanoseconds;
+    unsigned int round;
+    unsigned int i;
+
+    for (i = 0; i < AT91C_IFLASH_SIZE; i++) {
+
+        pData[i] = Random();
+    }
+
+    benchmark = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < NUM_ROUNDS; round++) {
+
+        if (method == 2) {
+
+            FLASHD_WritePages(AT91C_IFLASH, pData, NUM_PAGES);
+        }
+        else {
+
+            FLASHD_Write(AT91C_IFLASH, pData, AT91C_IFLASH_SIZE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    benchmark = 0;
+
+    // The pages were programmed with the latch contents
+    memcpy(pFlash, (void *) AT91C_IFLASH, AT91C_IFLASH_SIZE);
+    memcpy(pImage, pData, AT91C_IFLASH_SIZE);
+    Check("wrong flash contents after the benchmark");
+    if ((numPrograms - programs) != (NUM_ROUNDS * NUM_PAGES)) {
+
+        Error("not one program command per page");
+    }
+
+    nanoseconds = (end.tv_sec - start.tv_sec) * 1e9
+                  + (end.tv_nsec - start.tv_nsec);
+    printf("%-28s %6.1f ns per page in the driver, %lu command per page\n",
+           pName,
+           nanoseconds / (NUM_ROUNDS * NUM_PAGES),
+           (numPrograms - programs) / (NUM_ROUNDS * NUM_PAGES));
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated flash and EFC, runs the test and the benchmark.
+/// Returns 0 if the test passes.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    if (mmap((void *) AT91C_IFLASH, AT91C_IFLASH_SIZE,
+             PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated flash");
+        return 1;
+    }
+    if (mmap((void *) EFC_START, EFC_SIZE,
+             PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated EFC");
+        return 1;
+    }
+
+    // Erased flash
+    memset(pFlash, 0xFF, sizeof(pFlash));
+    memset((void *) AT91C_IFLASH, 0xFF, AT91C_IFLASH_SIZE);
+    memset(pImage, 0xFF, sizeof(pImage));
+
+    FLASHD_Initialize(BOARD_MCK);
+    TestWrites();
+    TestLock();
+
+    Benchmark("FLASHD_Write, misaligned", 0);
+    Benchmark("FLASHD_Write, word-aligned", 1);
+    Benchmark("FLASHD_WritePages", 2);
+    printf("Programming bound: %.1f KB/s at %u us per page\n",
+           PAGE_SIZE * 1e6 / 1024 / PROGRAM_US, PROGRAM_US);
+
+    printf("%lu program commands, %lu errors\n", numPrograms, numErrors);
+
+    return (numErrors > 0);
+}
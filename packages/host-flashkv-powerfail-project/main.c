@@ -0,0 +1,367 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test of the power-fail safety of the internal flash key-value store
+/// (memories/flash/flashkv.c).
+///
+/// !Description
+///
+/// The program runs on the host computer. The internal flash is emulated in
+/// memory, mapped at its address on the chip, and FLASHD_Write is replaced by
+/// a model of the EFC: programming a page only clears bits, unless bits must
+/// be set, in which case the page is erased first.
+///
+/// Random values are written and deleted in stores of 2 to 6 pages. Resets
+/// are injected at random flash operations: the page being programmed is left
+/// half-written with random contents, and the store is initialized again as
+/// after a reboot. After each reset the key being updated must hold either
+/// its old or its new value, and every other key its last value.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints one line per store size and returns 0 when no key
+///    was lost or corrupted.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <memories/flash/flashkv.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Size of a flash page in bytes.
+#define PAGE_SIZE           AT91C_IFLASH_PAGE_SIZE
+
+/// Number of keys of the stores.
+#define NUM_KEYS            8
+
+/// Number of updates of each store.
+#define NUM_UPDATES         200000
+
+/// One update in RESET_PERIOD is interrupted by a reset, on average.
+#define RESET_PERIOD        50
+
+/// Maximum length of the values written, in bytes. The last records of all
+/// the keys and one more record fit in one page, so that a store of two pages
+/// never gets full.
+#define MAX_LENGTH          16
+
+/// Smallest and largest number of pages of the stores tested.
+#define MIN_PAGES           2
+#define MAX_PAGES           6
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Context restored by the injected resets.
+static jmp_buf resetContext;
+
+/// Number of flash operations since the start.
+static unsigned long numOperations;
+
+/// Flash operation interrupted by a reset, 0 for none.
+static unsigned long resetOperation;
+
+/// Index of the store.
+static unsigned int pIndex[NUM_KEYS];
+
+/// Expected value of each key, and its length (-1 when the key has none).
+static unsigned char pValues[NUM_KEYS][MAX_LENGTH];
+static int pLengths[NUM_KEYS];
+
+//------------------------------------------------------------------------------
+//         Emulated flash
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Emulates the FLASHD_Write function of the EFC driver: the pages are erased
+/// before being programmed only when a bit must be set. When the operation is
+/// the one chosen for the next reset, the page is left with random contents
+/// and the execution goes back to the last FLASHKV call of the test.
+/// Returns 0.
+/// \param address  Write address.
+/// \param pBuffer  Data buffer.
+/// \param size  Size of data buffer in bytes.
+//------------------------------------------------------------------------------
+unsigned char FLASHD_Write(
+    unsigned int address,
+    const void *pBuffer,
+    unsigned int size)
+{
+    unsigned char pPage[PAGE_SIZE];
+    unsigned char *pFlash;
+    unsigned int offset;
+    unsigned int length;
+    unsigned int i;
+    unsigned char erase;
+
+    while (size > 0) {
+
+        pFlash = (unsigned char *) (address & ~(PAGE_SIZE - 1));
+        offset = address & (PAGE_SIZE - 1);
+        length = PAGE_SIZE - offset;
+        if (length > size) {
+
+            length = size;
+        }
+
+        // New contents of the page, erase needed when a bit is set
+        memcpy(pPage, pFlash, PAGE_SIZE);
+        memcpy(pPage + offset, pBuffer, length);
+        erase = 0;
+        for (i = 0; i < PAGE_SIZE; i++) {
+
+            if (pPage[i] & ~pFlash[i]) {
+
+                erase = 1;
+            }
+        }
+
+        // Reset in the middle of the operation
+        numOperations++;
+        if (numOperations == resetOperation) {
+
+            for (i = 0; i < PAGE_SIZE; i++) {
+
+                if (rand() & 1) {
+
+                    pFlash[i] = erase ? (unsigned char) rand()
+                                      : (pFlash[i] & pPage[i]);
+                }
+            }
+            longjmp(resetContext, 1);
+        }
+
+        for (i = 0; i < PAGE_SIZE; i++) {
+
+            pFlash[i] = erase ? pPage[i] : (pFlash[i] & pPage[i]);
+        }
+
+        address += length;
+        pBuffer = (const unsigned char *) pBuffer + length;
+        size -= length;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a key of the store holds the given value (length -1 when the
+/// key must have no value); otherwise returns 0.
+/// \param pKv  Pointer to the store.
+/// \param key  Key to check.
+/// \param pValue  Expected value.
+/// \param length  Expected length.
+//------------------------------------------------------------------------------
+static unsigned char Holds(
+    FlashKv *pKv,
+    unsigned short key,
+    const unsigned char *pValue,
+    int length)
+{
+    unsigned char pData[MAX_LENGTH];
+    unsigned short size = sizeof(pData);
+    unsigned char error;
+
+    error = FLASHKV_Read(pKv, key, pData, &size);
+    if (length < 0) {
+
+        return (error == FLASHKV_ERROR_NOT_FOUND);
+    }
+
+    return (!error && (size == length) && !memcmp(pData, pValue, length));
+}
+
+//------------------------------------------------------------------------------
+/// Runs the test on a store of the given number of pages.
+/// Returns 0 if no key was lost or corrupted; otherwise returns 1.
+/// \param numPages  Number of pages of the store.
+//------------------------------------------------------------------------------
+static int Run(unsigned short numPages)
+{
+    unsigned int start = AT91C_IFLASH + AT91C_IFLASH_SIZE
+                         - numPages * PAGE_SIZE;
+    FlashKv kv;
+    unsigned char pValue[MAX_LENGTH];
+    unsigned int numResets = 0;
+    unsigned int update;
+    unsigned int i;
+    unsigned short key;
+    int length;
+    unsigned char error;
+
+    memset((void *) AT91C_IFLASH, 0xFF, AT91C_IFLASH_SIZE);
+    for (key = 0; key < NUM_KEYS; key++) {
+
+        pLengths[key] = -1;
+    }
+    resetOperation = 0;
+    if (FLASHKV_Initialize(&kv, start, numPages, pIndex, NUM_KEYS)) {
+
+        printf("%u pages: cannot format the store\n", numPages);
+        return 1;
+    }
+
+    for (update = 0; update < NUM_UPDATES; update++) {
+
+        // New value of a random key, or deletion
+        key = rand() % NUM_KEYS;
+        length = ((rand() % 10) == 0) ? -1 : (4 * (1 + rand() % (MAX_LENGTH / 4)));
+        for (i = 0; i < MAX_LENGTH; i++) {
+
+            pValue[i] = (unsigned char) rand();
+        }
+
+        // Reset during one of the next flash operations
+        resetOperation = 0;
+        if ((rand() % RESET_PERIOD) == 0) {
+
+            resetOperation = numOperations + 1 + rand() % 6;
+        }
+
+        if (setjmp(resetContext) == 0) {
+
+            if (length < 0) {
+
+                error = FLASHKV_Delete(&kv, key);
+                if (error == FLASHKV_ERROR_NOT_FOUND) {
+
+                    error = 0;
+                }
+            }
+            else {
+
+                error = FLASHKV_Write(&kv, key, pValue, length);
+            }
+            if (error) {
+
+                printf("%u pages: update %u failed\n", numPages, update);
+                return 1;
+            }
+        }
+        else {
+
+            // Reboot, the key holds its old or its new value
+            numResets++;
+            resetOperation = 0;
+            if (FLASHKV_Initialize(&kv, start, numPages, pIndex, NUM_KEYS)) {
+
+                printf("%u pages: cannot mount after reset %u\n",
+                       numPages, numResets);
+                return 1;
+            }
+            if (!Holds(&kv, key, pValue, length)) {
+
+                if (!Holds(&kv, key, pValues[key], pLengths[key])) {
+
+                    printf("%u pages: key %u lost by reset %u\n",
+                           numPages, key, numResets);
+                    return 1;
+                }
+                continue;
+            }
+        }
+        resetOperation = 0;
+
+        // The update is done
+        pLengths[key] = length;
+        if (length > 0) {
+
+            memcpy(pValues[key], pValue, length);
+        }
+
+        // Every key holds its last value
+        for (i = 0; i < NUM_KEYS; i++) {
+
+            if (!Holds(&kv, i, pValues[i], pLengths[i])) {
+
+                printf("%u pages: key %u corrupted at update %u\n",
+                       numPages, i, update);
+                return 1;
+            }
+        }
+    }
+
+    printf("%u pages: %u updates, %u resets, no key lost\n",
+           numPages, NUM_UPDATES, numResets);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated flash and tests stores of MIN_PAGES to MAX_PAGES pages.
+/// Returns 0 if all the tests pass.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    unsigned short numPages;
+    int result = 0;
+
+    if (mmap((void *) AT91C_IFLASH, AT91C_IFLASH_SIZE,
+             PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated flash");
+        return 1;
+    }
+
+    srand(1);
+    for (numPages = MIN_PAGES; numPages <= MAX_PAGES; numPages++) {
+
+        result |= Run(numPages);
+    }
+
+    return result;
+}
@@ -0,0 +1,1185 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test harness of the Bulk-Only Transport of the mass storage driver
+/// (usb/device/massstorage): replays SCSI commands against a simulated media
+/// and bulk endpoints, checks the data and reports the throughput, with and
+/// without the read-ahead and the write-back cache of the LUN.
+///
+/// !Description
+///
+/// The program runs on the host computer. The BOT state machine, the SBC
+/// methods, the LUN and the media request queue are the driver sources;
+/// MSDD_Read and MSDD_Write are replaced by a simulated USB host, and the LUN
+/// media by a RAM image accessed with the timings of a SD card or of the
+/// internal flash.
+///
+/// Time is simulated: each USB or media transfer ends at a computed time,
+/// and the transfer which ends first completes next. The driver runs between
+/// two completions until it has nothing left to do, so its own processing
+/// time is not counted. When the driver busy-waits for the media, a timer
+/// signal plays the media interrupt and completes the pending transfer.
+///
+/// The timing model is a rough one, set by the constants below:
+///    - a full speed bulk pipe moving about 1 MB/s, with a fixed cost per
+///      transfer, and a host which sends its next CBW a little after the CSW;
+///    - a SD card on SPI, with a command and access time per media transfer
+///      and a transfer time per byte;
+///    - the internal flash, read at memory speed and written page by page,
+///      each page being erased and programmed.
+/// The figures compare the driver configurations with each other; they do
+/// not predict the throughput of a given board.
+///
+/// Each data block received by the host is compared with the data it wrote
+/// last, and each CSW must report a success with no residue. With the cache,
+/// the media must hold all the written data after SYNCHRONIZE CACHE (10),
+/// after the flush delay and after a USB reset, and MODE SENSE (6) must
+/// report the write-back cache.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints the throughput of each configuration, and returns 0
+///    when every command succeeds with the expected data.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <usb/device/massstorage/MSDDStateMachine.h>
+#include <usb/device/massstorage/MSDLun.h>
+#include <usb/device/massstorage/SBC.h>
+#include <memories/Media.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Size of one block of the LUN.
+#define BLOCK_SIZE          512
+
+/// Size of the simulated media.
+#define MEDIA_SIZE          (8 * 1024 * 1024)
+
+/// Largest LUN buffer used, in blocks.
+#define MAX_BUFFER_BLOCKS   8
+
+/// Largest number of commands replayed at once.
+#define MAX_COMMANDS        1024
+
+/// Largest read-ahead window used, in blocks.
+#define MAX_READ_AHEAD      32
+
+/// Smallest read-ahead window, in blocks, as in usb-device-massstorage-project.
+#define READ_AHEAD_MIN      1
+
+/// Largest write-back cache used, in blocks.
+#define MAX_CACHE_BLOCKS    16
+
+/// Number of LUN_Tick ticks without write before the cache is written back.
+#define CACHE_FLUSH_DELAY   1000
+
+/// File copied by the cache test: number and size of its clusters, address of
+/// its first cluster, and blocks of the FAT and of the directory updated
+/// after each cluster.
+#define CACHE_CLUSTERS          256
+#define CACHE_CLUSTER_BLOCKS    4
+#define CACHE_DATA_LBA          64
+#define CACHE_FAT_LBA           1
+#define CACHE_DIR_LBA           33
+
+/// Data length of MODE SENSE (6): header and caching mode page.
+#define MODE_SENSE_LENGTH   (sizeof(SBCModeParameterHeader6) \
+                             + sizeof(SBCCachingModePage))
+
+/// Fixed cost of a USB transfer, in ns.
+#define USB_TRANSFER_NS     10000
+/// Time to move one byte on the bulk pipes, in ns (about 1 MB/s).
+#define USB_BYTE_NS         1000
+/// Delay between the reception of a CSW by the host and its next CBW, in ns.
+#define HOST_GAP_NS         100000
+
+/// Number of calls of the BOT state machine between two completions.
+#define NUM_PASSES          8
+
+/// Period of the timer which completes the media transfers while the driver
+/// busy-waits, in microseconds.
+#define TICK_US             500
+
+/// End time of a transfer which has not been scheduled yet.
+#define NEVER               (~0ULL)
+
+/// Host phases.
+#define HOST_CBW            0
+#define HOST_DATA_IN        1
+#define HOST_DATA_OUT       2
+#define HOST_CSW            3
+#define HOST_DONE           4
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Timings and geometry of a simulated media.
+typedef struct {
+
+    /// Name of the media.
+    const char   *pName;
+    /// Fixed cost of a media transfer, in ns.
+    unsigned int transferNs;
+    /// Time to move one byte, in ns.
+    unsigned int byteNs;
+    /// Size of a page erased and programmed by each write, 0 if none.
+    unsigned int pageSize;
+    /// Time to erase and program a page, in ns.
+    unsigned int pageNs;
+    /// Smallest unit which can be written, in bytes.
+    unsigned int sectorSize;
+    /// Erase unit and optimal transfer length, in bytes.
+    unsigned int eraseUnit;
+
+} MediaModel;
+
+/// Command sent by the simulated host.
+typedef struct {
+
+    /// SBC operation code.
+    unsigned char opcode;
+    /// First block.
+    unsigned int  lba;
+    /// Number of blocks.
+    unsigned int  numBlocks;
+
+} HostCommand;
+
+/// Transfer in progress on the bulk pipes.
+typedef struct {
+
+    /// Set while a transfer is armed by the driver.
+    unsigned char    active;
+    /// 1 for a bulk IN transfer, 0 for a bulk OUT one.
+    unsigned char    in;
+    /// Buffer of the transfer.
+    unsigned char    *pData;
+    /// Size of the buffer.
+    unsigned int     size;
+    /// Number of bytes actually moved.
+    unsigned int     length;
+    /// End time, NEVER until the host takes part in the transfer.
+    unsigned long long end;
+    /// Callback of the driver.
+    TransferCallback callback;
+    /// Argument of the callback.
+    void             *argument;
+
+} UsbTransfer;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// SD card on SPI: command and access time of 250 us, about 3 MB/s.
+static const MediaModel sdModel = {
+
+    "SD card", 250000, 350, 0, 0, BLOCK_SIZE, 16 * BLOCK_SIZE
+};
+
+/// Internal flash: read at memory speed, about 4 ms to erase and program each
+/// 256-byte page written.
+static const MediaModel flashModel = {
+
+    "flash", 1000, 30, 256, 4000000, 4, 256
+};
+
+/// Media simulated by the current run.
+static const MediaModel *pModel;
+
+/// Media, LUN and BOT driver under test.
+Media medias[1];
+static MSDLun lun;
+static MSDDriver driver;
+
+/// LUN buffer.
+static unsigned char pLunBuffer[MAX_BUFFER_BLOCKS * BLOCK_SIZE];
+
+/// Read-ahead of the LUN.
+static MSDLunReadAhead readAhead;
+static unsigned char pReadAheadBuffer[MAX_READ_AHEAD * BLOCK_SIZE];
+
+/// Write-back cache of the LUN.
+static MSDLunCache cache;
+static MSDLunCacheLine pCacheLines[MAX_CACHE_BLOCKS];
+static unsigned char pCacheBuffer[MAX_CACHE_BLOCKS * BLOCK_SIZE];
+
+/// Content of the simulated media, and content expected by the host.
+static unsigned char pMedia[MEDIA_SIZE];
+static unsigned char pHostImage[MEDIA_SIZE];
+
+/// Simulated time, in ns.
+static unsigned long long now;
+
+/// End time of the media transfer in progress, and its direction.
+static unsigned long long mediaEnd;
+static unsigned char mediaWrite;
+
+/// Number of media transfers, and of pages programmed.
+static unsigned long mediaTransfers;
+static unsigned long mediaPages;
+
+/// Transfer in progress on the bulk pipes.
+static UsbTransfer usb;
+
+/// Commands of the simulated host.
+static HostCommand pCommands[MAX_COMMANDS];
+static unsigned int numCommands;
+
+/// Command in progress, host phase, number of data bytes moved, and time from
+/// which the next CBW can be sent.
+static unsigned int command;
+static unsigned char phase;
+static unsigned int done;
+static unsigned long long ready;
+
+/// Number of data bytes moved by the commands.
+static unsigned long long dataBytes;
+
+/// Set while the BOT state machine runs, and number of its completed calls.
+static volatile sig_atomic_t inDriver;
+static volatile unsigned long passes;
+
+/// Number of errors.
+static unsigned long numErrors;
+
+/// State of the pseudo-random generator.
+static unsigned int seed = 1;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number.
+//------------------------------------------------------------------------------
+static unsigned int Random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+//------------------------------------------------------------------------------
+/// Counts an error and prints the first ones.
+/// \param pMessage  Description of the error.
+//------------------------------------------------------------------------------
+static void Error(const char *pMessage)
+{
+    if (numErrors < 10) {
+
+        printf("Error at %llu us, command %u: %s\n",
+               now / 1000, command, pMessage);
+    }
+    numErrors++;
+}
+
+//------------------------------------------------------------------------------
+/// Prevents the timer from completing transfers while the simulation state
+/// is updated.
+/// \param pMask  Receives the previous signal mask.
+//------------------------------------------------------------------------------
+static void Lock(sigset_t *pMask)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &mask, pMask);
+}
+
+//------------------------------------------------------------------------------
+/// Restores the signal mask saved by Lock.
+/// \param pMask  Previous signal mask.
+//------------------------------------------------------------------------------
+static void Unlock(const sigset_t *pMask)
+{
+    sigprocmask(SIG_SETMASK, pMask, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Returns the data length of a command of the host.
+/// \param pCommand  Pointer to the command.
+//------------------------------------------------------------------------------
+static unsigned int CommandLength(const HostCommand *pCommand)
+{
+    switch (pCommand->opcode) {
+
+        case SBC_READ_10:
+        case SBC_WRITE_10:
+            return pCommand->numBlocks * BLOCK_SIZE;
+
+        case SBC_MODE_SENSE_6:
+            return MODE_SENSE_LENGTH;
+
+        default:
+            return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Schedules the bulk transfer armed by the driver, once the host can take
+/// part in it.
+//------------------------------------------------------------------------------
+static void UsbSchedule(void)
+{
+    unsigned long long start = now;
+    unsigned int remaining;
+
+    if (!usb.active || (usb.end != NEVER)) {
+
+        return;
+    }
+
+    if (usb.in) {
+
+        usb.length = usb.size;
+    }
+    else if (phase == HOST_CBW) {
+
+        usb.length = MSD_CBW_SIZE;
+        if (ready > start) {
+
+            start = ready;
+        }
+    }
+    else if (phase == HOST_DATA_OUT) {
+
+        remaining = CommandLength(&(pCommands[command])) - done;
+        usb.length = (usb.size < remaining) ? usb.size : remaining;
+    }
+    else {
+
+        // The host has nothing to send
+        return;
+    }
+
+    usb.end = start + USB_TRANSFER_NS
+              + (unsigned long long) usb.length * USB_BYTE_NS;
+}
+
+//------------------------------------------------------------------------------
+/// Builds the CBW of the current command in the given buffer.
+/// \param pCbw  Buffer of MSD_CBW_SIZE bytes.
+//------------------------------------------------------------------------------
+static void BuildCbw(unsigned char *pCbw)
+{
+    const HostCommand *pCommand = &(pCommands[command]);
+    unsigned int length = CommandLength(pCommand);
+    unsigned int tag = command + 1;
+
+    memset(pCbw, 0, MSD_CBW_SIZE);
+    pCbw[0] = MSD_CBW_SIGNATURE & 0xFF;
+    pCbw[1] = (MSD_CBW_SIGNATURE >> 8) & 0xFF;
+    pCbw[2] = (MSD_CBW_SIGNATURE >> 16) & 0xFF;
+    pCbw[3] = (MSD_CBW_SIGNATURE >> 24) & 0xFF;
+    pCbw[4] = tag & 0xFF;
+    pCbw[5] = (tag >> 8) & 0xFF;
+    pCbw[6] = (tag >> 16) & 0xFF;
+    pCbw[7] = (tag >> 24) & 0xFF;
+    pCbw[8] = length & 0xFF;
+    pCbw[9] = (length >> 8) & 0xFF;
+    pCbw[10] = (length >> 16) & 0xFF;
+    pCbw[11] = (length >> 24) & 0xFF;
+    if (pCommand->opcode != SBC_WRITE_10) {
+
+        pCbw[12] = MSD_CBW_DEVICE_TO_HOST;
+    }
+    pCbw[15] = pCommand->opcode;
+
+    // Caching mode page, current values
+    if (pCommand->opcode == SBC_MODE_SENSE_6) {
+
+        pCbw[14] = 6;
+        pCbw[17] = SBC_PAGE_CACHING;
+        pCbw[19] = length;
+        return;
+    }
+
+    // READ (10), WRITE (10) and SYNCHRONIZE CACHE (10) have the same layout
+    pCbw[14] = 10;
+    pCbw[17] = (pCommand->lba >> 24) & 0xFF;
+    pCbw[18] = (pCommand->lba >> 16) & 0xFF;
+    pCbw[19] = (pCommand->lba >> 8) & 0xFF;
+    pCbw[20] = pCommand->lba & 0xFF;
+    pCbw[22] = (pCommand->numBlocks >> 8) & 0xFF;
+    pCbw[23] = pCommand->numBlocks & 0xFF;
+}
+
+//------------------------------------------------------------------------------
+/// Checks the CSW of the current command and goes on with the next one.
+/// \param pCsw  Received CSW.
+/// \param size  Size of the CSW.
+//------------------------------------------------------------------------------
+static void CheckCsw(const unsigned char *pCsw, unsigned int size)
+{
+    unsigned int signature = pCsw[0] | (pCsw[1] << 8) | (pCsw[2] << 16)
+                             | (pCsw[3] << 24);
+    unsigned int tag = pCsw[4] | (pCsw[5] << 8) | (pCsw[6] << 16)
+                       | (pCsw[7] << 24);
+    unsigned int residue = pCsw[8] | (pCsw[9] << 8) | (pCsw[10] << 16)
+                           | (pCsw[11] << 24);
+
+    if ((size != MSD_CSW_SIZE) || (signature != MSD_CSW_SIGNATURE)) {
+
+        Error("bad CSW");
+    }
+    else if (tag != command + 1) {
+
+        Error("bad CSW tag");
+    }
+    else if (pCsw[12] != MSD_CSW_COMMAND_PASSED) {
+
+        Error("command failed");
+    }
+    else if (residue != 0) {
+
+        Error("CSW residue");
+    }
+
+    command++;
+    phase = (command < numCommands) ? HOST_CBW : HOST_DONE;
+    ready = now + HOST_GAP_NS;
+}
+
+//------------------------------------------------------------------------------
+/// Checks that the caching mode page returned by MODE SENSE (6) reports the
+/// write-back cache when the LUN has one.
+/// \param pData  Received data.
+/// \param size  Size of the data.
+//------------------------------------------------------------------------------
+static void CheckModeSense(const unsigned char *pData, unsigned int size)
+{
+    const SBCCachingModePage *pPage = (const SBCCachingModePage *)
+                                      (pData + sizeof(SBCModeParameterHeader6));
+
+    if ((size != MODE_SENSE_LENGTH) || (pPage->bPageCode != SBC_PAGE_CACHING)) {
+
+        Error("bad caching mode page");
+    }
+    else if (pPage->isWCE != (lun.cache != 0)) {
+
+        Error("bad write cache enable bit");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Ends the bulk transfer in progress: the host sends or checks its data,
+/// then the driver callback is invoked.
+//------------------------------------------------------------------------------
+static void UsbEnd(void)
+{
+    const HostCommand *pCommand = &(pCommands[command]);
+    unsigned int offset = pCommand->lba * BLOCK_SIZE + done;
+    unsigned int i;
+
+    usb.active = 0;
+    if (usb.in && (phase == HOST_DATA_IN)) {
+
+        if (done + usb.length > CommandLength(pCommand)) {
+
+            Error("too much data");
+        }
+        else if (pCommand->opcode == SBC_MODE_SENSE_6) {
+
+            CheckModeSense(usb.pData, usb.length);
+        }
+        else if (memcmp(usb.pData, &(pHostImage[offset]), usb.length)) {
+
+            Error("bad data read");
+        }
+        done += usb.length;
+        dataBytes += usb.length;
+        if (done >= CommandLength(pCommand)) {
+
+            phase = HOST_CSW;
+        }
+    }
+    else if (usb.in && (phase == HOST_CSW)) {
+
+        CheckCsw(usb.pData, usb.length);
+    }
+    else if (usb.in) {
+
+        Error("unexpected IN transfer");
+    }
+    else if (phase == HOST_CBW) {
+
+        BuildCbw(usb.pData);
+        done = 0;
+        if ((pCommand->opcode == SBC_READ_10)
+            || (pCommand->opcode == SBC_MODE_SENSE_6)) {
+
+            phase = HOST_DATA_IN;
+        }
+        else if (pCommand->opcode == SBC_WRITE_10) {
+
+            phase = HOST_DATA_OUT;
+        }
+        else {
+
+            phase = HOST_CSW;
+        }
+    }
+    else {
+
+        // New data written by the host
+        for (i = 0; i < usb.length; i++) {
+
+            pHostImage[offset + i] = Random();
+        }
+        memcpy(usb.pData, &(pHostImage[offset]), usb.length);
+        done += usb.length;
+        dataBytes += usb.length;
+        if (done >= CommandLength(pCommand)) {
+
+            phase = HOST_CSW;
+        }
+    }
+
+    usb.callback(usb.argument, USBD_STATUS_SUCCESS, usb.length,
+                 usb.size - usb.length);
+}
+
+//------------------------------------------------------------------------------
+/// Arms a bulk transfer.
+/// \param in  1 for a bulk IN transfer, 0 for a bulk OUT one.
+/// \param pData  Buffer of the transfer.
+/// \param size  Size of the buffer.
+/// \param callback  Callback of the driver.
+/// \param pArgument  Argument of the callback.
+//------------------------------------------------------------------------------
+static char UsbStart(unsigned char in,
+                     void *pData,
+                     unsigned int size,
+                     TransferCallback callback,
+                     void *pArgument)
+{
+    sigset_t mask;
+
+    Lock(&mask);
+    if (usb.active) {
+
+        Error("two bulk transfers at once");
+        Unlock(&mask);
+        return USBD_STATUS_LOCKED;
+    }
+    usb.active = 1;
+    usb.in = in;
+    usb.pData = pData;
+    usb.size = size;
+    usb.end = NEVER;
+    usb.callback = callback;
+    usb.argument = pArgument;
+    UsbSchedule();
+    Unlock(&mask);
+
+    return USBD_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+/// Starts a transfer of the simulated media, which ends after the time given
+/// by its model.
+/// \param pMedium  Pointer to the Media instance.
+/// \param write  1 to write the media, 0 to read it.
+/// \param address  Address of the data on the media.
+/// \param pData  Data buffer.
+/// \param length  Number of bytes.
+/// \param callback  Callback invoked when the transfer ends.
+/// \param pArgument  Argument of the callback.
+//------------------------------------------------------------------------------
+static unsigned char MediaStart(Media *pMedium,
+                                unsigned char write,
+                                unsigned int address,
+                                void *pData,
+                                unsigned int length,
+                                MediaCallback callback,
+                                void *pArgument)
+{
+    sigset_t mask;
+    unsigned int pages = 0;
+
+    if ((address + length) > MEDIA_SIZE) {
+
+        Error("media access out of range");
+        return MED_STATUS_ERROR;
+    }
+
+    Lock(&mask);
+    if (pMedium->state != MED_STATE_READY) {
+
+        Unlock(&mask);
+        return MED_STATUS_BUSY;
+    }
+    pMedium->state = MED_STATE_BUSY;
+    pMedium->transfer.data = pData;
+    pMedium->transfer.address = address;
+    pMedium->transfer.length = length;
+    pMedium->transfer.callback = callback;
+    pMedium->transfer.argument = pArgument;
+    mediaWrite = write;
+    mediaEnd = now + pModel->transferNs
+               + (unsigned long long) length * pModel->byteNs;
+    if (write && (pModel->pageSize > 0) && (length > 0)) {
+
+        // Each page written is erased and programmed
+        pages = (address + length - 1) / pModel->pageSize
+                - address / pModel->pageSize + 1;
+        mediaEnd += (unsigned long long) pages * pModel->pageNs;
+    }
+    mediaTransfers++;
+    mediaPages += pages;
+    Unlock(&mask);
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+/// Read method of the simulated media.
+//------------------------------------------------------------------------------
+static unsigned char MediaRead(Media *pMedium,
+                               unsigned int address,
+                               void *pData,
+                               unsigned int length,
+                               MediaCallback callback,
+                               void *pArgument)
+{
+    return MediaStart(pMedium, 0, address, pData, length, callback,
+                      pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Write method of the simulated media.
+//------------------------------------------------------------------------------
+static unsigned char MediaWrite(Media *pMedium,
+                                unsigned int address,
+                                void *pData,
+                                unsigned int length,
+                                MediaCallback callback,
+                                void *pArgument)
+{
+    return MediaStart(pMedium, 1, address, pData, length, callback,
+                      pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Control method of the simulated media, which has the geometry of its
+/// model.
+//------------------------------------------------------------------------------
+static unsigned char MediaIoctl(Media *pMedium,
+                                unsigned char ctrl,
+                                void *pBuffer)
+{
+    switch (ctrl) {
+
+        case MED_IOCTL_GET_SECTOR_SIZE:
+            *((unsigned int *) pBuffer) = pModel->sectorSize;
+            break;
+
+        case MED_IOCTL_GET_ERASE_UNIT:
+        case MED_IOCTL_GET_OPTIMAL_TRANSFER:
+            *((unsigned int *) pBuffer) = pModel->eraseUnit;
+            break;
+
+        case MED_IOCTL_GET_WRITE_PROTECT:
+            *((unsigned char *) pBuffer) = 0;
+            break;
+
+        case MED_IOCTL_SYNC:
+            break;
+
+        default:
+            return MED_STATUS_ERROR;
+    }
+
+    return MED_STATUS_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the media transfer in progress: the data is moved at the end of the
+/// transfer, so that the buffer must stay untouched until then.
+//------------------------------------------------------------------------------
+static void MediaEnd(void)
+{
+    Media *pMedium = &(medias[0]);
+    MEDTransfer *pTransfer = &(pMedium->transfer);
+
+    if (mediaWrite) {
+
+        memcpy(&(pMedia[pTransfer->address]), pTransfer->data,
+               pTransfer->length);
+    }
+    else {
+
+        memcpy(pTransfer->data, &(pMedia[pTransfer->address]),
+               pTransfer->length);
+    }
+    mediaEnd = NEVER;
+    pMedium->state = MED_STATE_READY;
+    if (pTransfer->callback) {
+
+        pTransfer->callback(pTransfer->argument, MED_STATUS_SUCCESS,
+                            pTransfer->length, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Completes the transfer which ends first. Returns 0 if no transfer is
+/// scheduled.
+//------------------------------------------------------------------------------
+static unsigned char Step(void)
+{
+    sigset_t mask;
+    unsigned char result = 1;
+
+    Lock(&mask);
+    UsbSchedule();
+    if ((mediaEnd != NEVER) && (!usb.active || (mediaEnd <= usb.end))) {
+
+        now = mediaEnd;
+        MediaEnd();
+    }
+    else if (usb.active && (usb.end != NEVER)) {
+
+        now = usb.end;
+        UsbEnd();
+    }
+    else {
+
+        result = 0;
+    }
+    Unlock(&mask);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+/// Timer signal handler: when the driver has been stuck in the same call of
+/// the state machine since the previous tick, it busy-waits for the media;
+/// the transfer which ends first is then completed, as done by the interrupt
+/// of the media on the chip.
+//------------------------------------------------------------------------------
+static void Tick(int signal)
+{
+    static unsigned long lastPasses;
+
+    if (inDriver && (passes == lastPasses)) {
+
+        Step();
+    }
+    lastPasses = passes;
+}
+
+//------------------------------------------------------------------------------
+/// Calls the BOT state machine until it has nothing left to do.
+//------------------------------------------------------------------------------
+static void RunDriver(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUM_PASSES; i++) {
+
+        inDriver = 1;
+        MSDD_StateMachine(&driver);
+        inDriver = 0;
+        passes++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Initializes the media, the LUN and the BOT driver.
+/// \param pMediaModel  Model of the simulated media.
+/// \param bufferBlocks  Size of the LUN buffer, in blocks.
+/// \param cacheBlocks  Size of the write-back cache in blocks, 0 for none.
+/// \param readAheadBlocks  Largest read-ahead window in blocks, 0 for none.
+//------------------------------------------------------------------------------
+static void Configure(const MediaModel *pMediaModel,
+                      unsigned int bufferBlocks,
+                      unsigned int cacheBlocks,
+                      unsigned int readAheadBlocks)
+{
+    Media *pMedium = &(medias[0]);
+    unsigned int lineSize;
+
+    memset(pMedium, 0, sizeof(Media));
+    pMedium->read = MediaRead;
+    pMedium->write = MediaWrite;
+    pMedium->ioctl = MediaIoctl;
+    pMedium->size = MEDIA_SIZE;
+    pMedium->state = MED_STATE_READY;
+    MED_InitializeQueue(pMedium);
+    pModel = pMediaModel;
+    mediaEnd = NEVER;
+    mediaTransfers = 0;
+    mediaPages = 0;
+
+    LUN_Init(&lun, pMedium, pLunBuffer, bufferBlocks * BLOCK_SIZE, 0,
+             MEDIA_SIZE, BLOCK_SIZE);
+
+    // Lines as large as the erase unit, as in usb-device-massstorage-project
+    if (cacheBlocks > 0) {
+
+        lineSize = pModel->eraseUnit / BLOCK_SIZE;
+        if (lineSize == 0) {
+
+            lineSize = 1;
+        }
+        else if (lineSize > cacheBlocks) {
+
+            lineSize = cacheBlocks;
+        }
+        LUN_ConfigureCache(&lun, &cache, pCacheLines, pCacheBuffer,
+                           cacheBlocks / lineSize, lineSize,
+                           CACHE_FLUSH_DELAY);
+    }
+    if (readAheadBlocks > 0) {
+
+        LUN_ConfigureReadAhead(&lun, &readAhead, pReadAheadBuffer,
+                               READ_AHEAD_MIN, readAheadBlocks);
+    }
+
+    memset(&driver, 0, sizeof(driver));
+    driver.luns = &lun;
+    driver.maxLun = 0;
+    driver.state = MSDD_STATE_READ_CBW;
+    memset(&usb, 0, sizeof(usb));
+}
+
+//------------------------------------------------------------------------------
+/// Replays the commands of the host, and returns the throughput of their
+/// data phases in MB/s.
+//------------------------------------------------------------------------------
+static double Replay(void)
+{
+    unsigned long long start = now;
+
+    command = 0;
+    phase = (numCommands > 0) ? HOST_CBW : HOST_DONE;
+    ready = now;
+    dataBytes = 0;
+
+    RunDriver();
+    while (phase != HOST_DONE) {
+
+        if (!Step()) {
+
+            Error("no transfer in progress");
+            break;
+        }
+        RunDriver();
+    }
+
+    return (now > start) ? (dataBytes * 1000.0 / (now - start)) : 0;
+}
+
+//------------------------------------------------------------------------------
+/// Lets the driver perform its background work (cache write back) until no
+/// transfer is left.
+//------------------------------------------------------------------------------
+static void Drain(void)
+{
+    RunDriver();
+    while (Step()) {
+
+        RunDriver();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Queues sequential commands of the host.
+/// \param opcode  SBC operation code.
+/// \param lba  First block of the first command.
+/// \param numBlocks  Number of blocks per command.
+/// \param count  Number of commands.
+//------------------------------------------------------------------------------
+static void Queue(unsigned char opcode,
+                  unsigned int lba,
+                  unsigned int numBlocks,
+                  unsigned int count)
+{
+    while ((count > 0) && (numCommands < MAX_COMMANDS)) {
+
+        pCommands[numCommands].opcode = opcode;
+        pCommands[numCommands].lba = lba;
+        pCommands[numCommands].numBlocks = numBlocks;
+        numCommands++;
+        lba += numBlocks;
+        count--;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Measures sequential READ (10) commands with LUN buffers of 1 block (media
+/// and USB transfers one after the other, as before the block FIFO) and more.
+//------------------------------------------------------------------------------
+static void TestRead(void)
+{
+    static const unsigned int pBuffers[] = {1, 2, 4, 8};
+    static const unsigned int pLengths[] = {8, 128};
+    unsigned int b;
+    unsigned int l;
+    double rate;
+
+    for (l = 0; l < sizeof(pLengths) / sizeof(pLengths[0]); l++) {
+
+        for (b = 0; b < sizeof(pBuffers) / sizeof(pBuffers[0]); b++) {
+
+            Configure(&sdModel, pBuffers[b], 0, 0);
+            numCommands = 0;
+            Queue(SBC_READ_10, 0, pLengths[l], 4096 / pLengths[l]);
+            rate = Replay();
+            printf("READ (10) of %3u KB, buffer of %u blocks: %.2f MB/s, "
+                   "%lu media transfers\n",
+                   pLengths[l] * BLOCK_SIZE / 1024, pBuffers[b], rate,
+                   mediaTransfers);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Measures the read-ahead on the SD card with READ (10) commands of 4 KB:
+/// sequential ones, sequential ones interleaved with writes of the blocks
+/// which follow (the prefetched data must be dropped), and random ones.
+//------------------------------------------------------------------------------
+static void TestReadAhead(void)
+{
+    static const unsigned int pWindows[] = {0, 4, 16, 32};
+    static const char *pStreams[] = {"sequential", "with writes", "random"};
+    unsigned int w;
+    unsigned int t;
+    unsigned int i;
+    double rate;
+
+    for (t = 0; t < sizeof(pStreams) / sizeof(pStreams[0]); t++) {
+
+        for (w = 0; w < sizeof(pWindows) / sizeof(pWindows[0]); w++) {
+
+            Configure(&sdModel, 2, 0, pWindows[w]);
+            numCommands = 0;
+            for (i = 0; i < 512; i++) {
+
+                if (t == 2) {
+
+                    Queue(SBC_READ_10, (Random() % 1024) * 8, 8, 1);
+                }
+                else {
+
+                    Queue(SBC_READ_10, i * 8, 8, 1);
+                    if ((t == 1) && ((i % 4) == 3)) {
+
+                        Queue(SBC_WRITE_10, i * 8 + 8, 2, 1);
+                    }
+                }
+            }
+            rate = Replay();
+            printf("READ (10) of 4 KB, %-11s, read-ahead of %2u blocks: "
+                   "%.2f MB/s, %lu media transfers, %u hits, %u misses\n",
+                   pStreams[t], pWindows[w], rate, mediaTransfers,
+                   pWindows[w] ? readAhead.hits : 0,
+                   pWindows[w] ? readAhead.misses : 0);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Queues the writes of a file copied on a FAT volume: each cluster of data
+/// is followed by an update of the same FAT and directory blocks, and the
+/// FAT is read back from time to time.
+/// \param count  Number of clusters.
+//------------------------------------------------------------------------------
+static void QueueFileCopy(unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+
+        Queue(SBC_WRITE_10, CACHE_DATA_LBA + i * CACHE_CLUSTER_BLOCKS,
+              CACHE_CLUSTER_BLOCKS, 1);
+        Queue(SBC_WRITE_10, CACHE_FAT_LBA, 1, 1);
+        Queue(SBC_WRITE_10, CACHE_DIR_LBA, 1, 1);
+        if ((i % 16) == 15) {
+
+            Queue(SBC_READ_10, CACHE_FAT_LBA, 1, 1);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Measures the write-back cache on the flash with the writes of a file copy,
+/// and checks that the media holds all the written data after SYNCHRONIZE
+/// CACHE (10), after the flush delay and after a USB reset.
+//------------------------------------------------------------------------------
+static void TestCache(void)
+{
+    static const unsigned int pCaches[] = {0, 8, 16};
+    static const char *pEnds[] = {"SYNCHRONIZE CACHE", "flush delay",
+                                  "USB reset"};
+    unsigned int c;
+    unsigned int e;
+    double rate;
+
+    // Throughput, ended by SYNCHRONIZE CACHE (10) and MODE SENSE (6)
+    for (c = 0; c < sizeof(pCaches) / sizeof(pCaches[0]); c++) {
+
+        Configure(&flashModel, 2, pCaches[c], 0);
+        numCommands = 0;
+        QueueFileCopy(CACHE_CLUSTERS);
+        Queue(SBC_SYNCHRONIZE_CACHE_10, 0, 0, 1);
+        Queue(SBC_MODE_SENSE_6, 0, 0, 1);
+        rate = Replay();
+        printf("File copy on the %s, cache of %2u blocks: %.2f MB/s, "
+               "%lu media transfers, %lu pages programmed\n",
+               pModel->pName, pCaches[c], rate, mediaTransfers, mediaPages);
+        if (memcmp(pMedia, pHostImage, MEDIA_SIZE)) {
+
+            Error("media not up to date after SYNCHRONIZE CACHE");
+        }
+    }
+
+    // Write back without SYNCHRONIZE CACHE (10)
+    for (e = 1; e < sizeof(pEnds) / sizeof(pEnds[0]); e++) {
+
+        Configure(&flashModel, 2, 8, 0);
+        numCommands = 0;
+        QueueFileCopy(CACHE_CLUSTERS);
+        Replay();
+        if (!memcmp(pMedia, pHostImage, MEDIA_SIZE)) {
+
+            Error("no data left in the cache");
+        }
+        if (e == 1) {
+
+            LUN_Tick(&lun, CACHE_FLUSH_DELAY);
+        }
+        else {
+
+            LUN_RequestFlush(&lun);
+        }
+        Drain();
+        if (memcmp(pMedia, pHostImage, MEDIA_SIZE)) {
+
+            Error("media not up to date after the write back");
+        }
+        printf("Write back after the %s: %lu media transfers\n",
+               pEnds[e], mediaTransfers);
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Arms a transfer on the bulk OUT pipe of the simulated host; replaces the
+/// function of MSDDriver.c.
+/// \param pData  Buffer receiving the data.
+/// \param size  Size of the buffer.
+/// \param callback  Callback invoked when the transfer ends.
+/// \param pArgument  Argument of the callback.
+//------------------------------------------------------------------------------
+char MSDD_Read(void *pData,
+               unsigned int size,
+               TransferCallback callback,
+               void *pArgument)
+{
+    return UsbStart(0, pData, size, callback, pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Arms a transfer on the bulk IN pipe of the simulated host; replaces the
+/// function of MSDDriver.c.
+/// \param pData  Data to send.
+/// \param size  Size of the data.
+/// \param callback  Callback invoked when the transfer ends.
+/// \param pArgument  Argument of the callback.
+//------------------------------------------------------------------------------
+char MSDD_Write(void *pData,
+                unsigned int size,
+                TransferCallback callback,
+                void *pArgument)
+{
+    return UsbStart(1, pData, size, callback, pArgument);
+}
+
+//------------------------------------------------------------------------------
+/// Halts the bulk pipes; never expected with the commands of the simulated
+/// host.
+/// \param stallCase  Pipes to halt.
+//------------------------------------------------------------------------------
+void MSDD_Halt(unsigned int stallCase)
+{
+    Error("pipe halted");
+}
+
+//------------------------------------------------------------------------------
+/// Fills the media, starts the timer and runs the tests. Returns 0 if every
+/// command succeeds with the expected data.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    struct itimerval timer;
+    unsigned int i;
+
+    for (i = 0; i < MEDIA_SIZE; i++) {
+
+        pMedia[i] = Random();
+    }
+    memcpy(pHostImage, pMedia, MEDIA_SIZE);
+
+    signal(SIGALRM, Tick);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = TICK_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, 0);
+
+    TestRead();
+    TestReadAhead();
+    TestCache();
+
+    printf("%lu errors\n", numErrors);
+
+    return numErrors > 0;
+}
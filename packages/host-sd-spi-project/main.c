@@ -0,0 +1,1657 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test of the SD card driver on the SPI bus (memories/sdmmc) and of the
+/// SD card media (memories/MEDSdcard.c), against a simulated SD card.
+///
+/// !Description
+///
+/// The program runs on the host computer. The SPI, PMC and AIC registers are
+/// emulated in memory, mapped at their address on the chip. When a PDC
+/// transfer is enabled, the emulated interrupt exchanges its bytes, then the
+/// bytes of the chained buffers, with a model of a 4 MB standard capacity SD
+/// card, then calls SDSPI_Handler.
+///
+/// The card model answers the commands used by the driver with R1, R1b, R2,
+/// R3 and R7 responses after a random NCR delay. It sends the data blocks
+/// after their start token and checks the start tokens, the stop transmission
+/// token, the CRC of the commands and of the data blocks written, and the
+/// data response. The card stays busy while it programs a block, after a
+/// stop and during an erase; any byte other than 0xFF sent meanwhile is an
+/// error, and so is a byte other than 0xFF sent while the card sends data,
+/// except for CMD12.
+///
+/// Time is counted in MCK cycles: each byte takes 8 SPCK periods on the
+/// bus, and each interrupt a fixed time during which the bus is idle. The
+/// card delays the responses, the data blocks and the end of the busy state
+/// by random amounts of time.
+///
+/// While the driver busy-waits (SD_Init, the vectored transfers, the flush
+/// and the erase), a timer signal plays the SPI interrupt. The transfers
+/// started by MED_Read and MED_Write proceed from the interrupts which the
+/// program plays until the media callback is invoked.
+///
+/// The media test runs random reads and writes through MEDSdcard, half of them
+/// continuing the previous access, with a few vectored transfers, flushes and
+/// trims. Each block read must match the data written last. The card must
+/// receive one CMD18 or CMD25 (after ACMD23) per access which does not
+/// continue the previous one, and one CMD12 or stop token per stream ended.
+/// At the end, the card must hold the written data.
+///
+/// The gap measurement then reads and writes a multiple blocks transfer
+/// while the card sends each block as soon as it can. The card model records
+/// the time lost between two blocks: from the time it could send the start
+/// token of a block to its first data byte, past the token itself, and from
+/// the end of the programming of a block to the start token of the next one.
+///
+/// The timing test last runs accesses through MED_Read and MED_Write with a
+/// card without delays, a typical card, and a card which always takes the
+/// largest delays allowed by the specification (NCR of 8 bytes, 100 ms read
+/// access time, 250 ms programming time). The card is polled from the SPI
+/// interrupts, then paced by a timer calling SDSPI_Poll. The program prints
+/// the share of the processor taken by the interrupts.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints the number of accesses, of commands and of errors,
+///    and returns 0 when every access ended with the expected data.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <memories/sdmmc/sdspi.h>
+#include <memories/sdmmc/sdmmc_spi.h>
+#include <memories/MEDSdcard.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// First address and size of the emulated peripherals (SPI to system
+/// controller).
+#define PERIPH_START        0xFFFE0000
+#define PERIPH_SIZE         0x00020000
+
+/// Size of the stack of the tests. It lies in the data of the program, below
+/// 4GB, since the driver gives the PDC buffers which are on its stack.
+#define STACK_SIZE          (256 * 1024)
+
+/// Period of the timer signal which plays the SPI interrupt while the driver
+/// busy-waits, in us.
+#define TICK_US             20
+
+/// SPCK until the card is identified, in Hz.
+#define INIT_SPCK           400000
+
+/// Converts a time in us into MCK cycles.
+#define US(time)            ((time) * (BOARD_MCK / 1000000))
+
+/// Time of an interrupt, during which the bus is idle, in MCK cycles.
+#define ISR_CYCLES          200
+
+/// Emulated card: 4 MB standard capacity SD card, erased by sectors of 16
+/// blocks, which powers up after a few ACMD41.
+#define CARD_C_SIZE         15
+#define CARD_C_SIZE_MULT    7
+#define CARD_BLOCKS         ((CARD_C_SIZE + 1) << (CARD_C_SIZE_MULT + 2))
+#define CARD_SECTOR_BLOCKS  16
+#define CARD_POWER_UP       3
+
+/// Largest delays of a typical card: response (NCR, in bytes), first data
+/// block of a read and data block following another one (NAC), programming of
+/// a block, end of a transfer and erase.
+#define CARD_NCR            8
+#define CARD_ACCESS_TIME    US(100)
+#define CARD_BLOCK_TIME     US(10)
+#define CARD_PROGRAM_TIME   US(250)
+#define CARD_STOP_TIME      US(50)
+#define CARD_ERASE_TIME     US(1000)
+
+/// Largest delays allowed by the SD specification for a standard capacity
+/// card: NCR, read access time and write timeout.
+#define SPEC_NCR            8
+#define SPEC_READ_TIME      US(100000)
+#define SPEC_WRITE_TIME     US(250000)
+
+/// States of the card data path.
+#define CARD_IDLE           0
+#define CARD_READ           1
+#define CARD_WRITE          2
+#define CARD_RECEIVE        3
+
+/// R1 response bits.
+#define R1_IDLE             0x01
+#define R1_ILLEGAL_COMMAND  0x04
+#define R1_COM_CRC          0x08
+#define R1_ADDRESS          0x20
+#define R1_PARAMETER        0x40
+
+/// Data response tokens.
+#define DATA_ACCEPTED       0x05
+#define DATA_CRC_ERROR      0x0B
+
+/// Media test: number of accesses, largest access in blocks and largest
+/// number of fragments of a vectored transfer.
+#define NUM_ACCESSES        3000
+#define MAX_BLOCKS          32
+#define MAX_FRAGMENTS       3
+
+/// Gap measurement: first block and number of blocks transferred, and
+/// largest number of interrupts per block read through MED_Read.
+#define GAP_START           256
+#define GAP_BLOCKS          MAX_BLOCKS
+#define GAP_READ_INTERRUPTS 2
+
+/// Timing test: number of accesses and largest access in blocks for each
+/// card timing, and period of the timer which calls SDSPI_Poll when the
+/// polling is paced.
+#define TIMING_ACCESSES     40
+#define TIMING_BLOCKS       4
+#define POLL_PERIOD         US(100)
+
+/// Directions of the open multiple blocks transfer.
+#define STREAM_NONE         0
+#define STREAM_READ         1
+#define STREAM_WRITE        2
+
+//------------------------------------------------------------------------------
+//         Local types
+//------------------------------------------------------------------------------
+
+/// Delays of the card model, in MCK cycles unless stated otherwise.
+typedef struct {
+
+    /// Name of the timing.
+    const char *pName;
+    /// Largest NCR, in bytes.
+    unsigned int ncr;
+    /// Largest delay before the first data block of a read.
+    unsigned long long accessTime;
+    /// Largest delay before a data block following another one.
+    unsigned long long blockTime;
+    /// Largest programming time of a block.
+    unsigned long long programTime;
+    /// Largest busy time after a stop.
+    unsigned long long stopTime;
+    /// Set when the card always takes the largest delays.
+    unsigned char fixed;
+
+} CardTiming;
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// SPI driver, card driver and media.
+static SdSpi sdSpi;
+static SdCard sdCard;
+static Media media;
+
+/// Stack and contexts of the tests.
+static unsigned char pStack[STACK_SIZE];
+static ucontext_t mainContext;
+static ucontext_t testContext;
+static int result;
+
+/// Current time and duration of a byte on the bus, in MCK cycles.
+static unsigned long long now;
+static unsigned int byteCycles;
+
+/// Number of interrupts, of SDSPI_Poll timer interrupts and of bytes
+/// exchanged.
+static unsigned long numInterrupts;
+static unsigned long numPolls;
+static unsigned long numBytes;
+
+/// Set while the driver may busy-wait, so that the timer plays the interrupt.
+static volatile sig_atomic_t inDriver;
+
+/// Number of errors.
+static unsigned long numErrors;
+
+/// State of the pseudo-random generator.
+static unsigned int seed = 1;
+
+/// Timings of the card model: no delay, typical card, and largest delays
+/// allowed by the specification.
+static const CardTiming pTimings[] = {
+
+    {"fastest", 1, 0, 0, 0, 0, 1},
+    {"typical", CARD_NCR, CARD_ACCESS_TIME, CARD_BLOCK_TIME,
+     CARD_PROGRAM_TIME, CARD_STOP_TIME, 0},
+    {"slowest", SPEC_NCR, SPEC_READ_TIME, SPEC_READ_TIME,
+     SPEC_WRITE_TIME, SPEC_WRITE_TIME, 1}
+};
+
+/// Card model: current timing.
+static CardTiming cardTiming;
+
+/// Card model: memory, CSD, and state of the card.
+static unsigned char pCard[CARD_BLOCKS * SD_BLOCK_SIZE];
+static unsigned char pCsd[16];
+static unsigned char cardIdle;
+static unsigned char cardPowerUp;
+static unsigned char cardCrcOn;
+static unsigned char cardApp;
+static unsigned short cardPreErase;
+
+/// Card model: command being received.
+static unsigned char pCardCmd[6];
+static unsigned int cardCmdCount;
+
+/// Card model: response being sent, preceded by the NCR delay, and busy time
+/// which follows it.
+static unsigned char pCardOut[16];
+static unsigned int cardOutSize;
+static unsigned int cardOutIndex;
+static unsigned long long cardBusyTime;
+static unsigned long long cardBusyEnd;
+
+/// Card model: data path. A data block is sent from its start token (index
+/// -1) up to its CRC, or received with its CRC.
+static unsigned char cardMode;
+static unsigned char cardDataCmd;
+static unsigned int cardBlock;
+static const unsigned char *pCardData;
+static unsigned int cardDataSize;
+static int cardDataIndex;
+static unsigned short cardDataCrc;
+static unsigned long long cardReadyTime;
+static unsigned char cardFollowing;
+static unsigned char pCardReceived[SD_BLOCK_SIZE + 2];
+static unsigned int cardEraseStart;
+static unsigned int cardEraseEnd;
+
+/// Card model: time lost between the data blocks of the multiple blocks
+/// transfers, past the delays of the card: number of blocks measured, total
+/// and largest time, for the reads and for the writes.
+static unsigned long pGapBlocks[2];
+static unsigned long long pGapTime[2];
+static unsigned long long pGapMax[2];
+
+/// Card model: number of each command and application command, of stop
+/// tokens, and of blocks read and written.
+static unsigned long pCardCommands[64];
+static unsigned long pCardAppCommands[64];
+static unsigned long cardStopTokens;
+static unsigned long cardBlocksRead;
+static unsigned long cardBlocksWritten;
+
+/// Media test: expected content of the card, data buffer, end of the access
+/// in progress and open stream expected.
+static unsigned char pImage[CARD_BLOCKS * SD_BLOCK_SIZE];
+static unsigned char pBuffer[MAX_BLOCKS * SD_BLOCK_SIZE];
+static volatile unsigned char mediaDone;
+static unsigned char mediaStatus;
+static unsigned int mediaTransferred;
+static unsigned char streamDirection;
+static unsigned int streamNext;
+static unsigned long numStreams;
+static unsigned long numStreamEnds;
+static unsigned long numContinued;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number.
+//------------------------------------------------------------------------------
+static unsigned int Random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+//------------------------------------------------------------------------------
+/// Counts an error and prints the first ones.
+/// \param pFormat  Format of the description of the error.
+//------------------------------------------------------------------------------
+static void Error(const char *pFormat, ...)
+{
+    va_list ap;
+
+    if (numErrors < 10) {
+
+        printf("Error at %llu us: ", now / US(1));
+        va_start(ap, pFormat);
+        vprintf(pFormat, ap);
+        va_end(ap);
+        printf("\n");
+    }
+    numErrors++;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CRC7 of a command token, computed bit by bit.
+/// \param pData  Command token.
+/// \param size  Number of bytes.
+//------------------------------------------------------------------------------
+static unsigned char Crc7(const unsigned char *pData, unsigned int size)
+{
+    unsigned char crc = 0;
+    unsigned int i;
+
+    for (i = 0; i < (size * 8); i++) {
+
+        crc <<= 1;
+        if ((((pData[i / 8] >> (7 - (i % 8))) ^ (crc >> 7)) & 1) != 0) {
+
+            crc ^= 0x09;
+        }
+    }
+
+    return crc & 0x7F;
+}
+
+//------------------------------------------------------------------------------
+/// Returns the CRC16 of a data block, computed bit by bit.
+/// \param pData  Data block.
+/// \param size  Number of bytes.
+//------------------------------------------------------------------------------
+static unsigned short Crc16(const unsigned char *pData, unsigned int size)
+{
+    unsigned short crc = 0;
+    unsigned int i;
+
+    for (i = 0; i < (size * 8); i++) {
+
+        if ((((pData[i / 8] >> (7 - (i % 8))) ^ (crc >> 15)) & 1) != 0) {
+
+            crc = (crc << 1) ^ 0x1021;
+        }
+        else {
+
+            crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+//------------------------------------------------------------------------------
+//         Card model
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a delay of the card below the given value, the largest one when
+/// the card always takes the largest delays.
+/// \param max  Bound of the delay, 0 for none.
+//------------------------------------------------------------------------------
+static unsigned long long CardDelay(unsigned long long max)
+{
+    if (max == 0) {
+
+        return 0;
+    }
+    if (cardTiming.fixed) {
+
+        return max - 1;
+    }
+
+    return ((Random() << 16) | Random()) % max;
+}
+
+//------------------------------------------------------------------------------
+/// Sets a field of the CSD.
+/// \param start  Index of the lowest bit of the field.
+/// \param size  Number of bits of the field.
+/// \param value  Value of the field.
+//------------------------------------------------------------------------------
+static void SetCsd(unsigned int start, unsigned int size, unsigned int value)
+{
+    unsigned int bit;
+    unsigned int i;
+
+    for (i = 0; i < size; i++) {
+
+        bit = start + i;
+        if ((value >> i) & 1) {
+
+            pCsd[15 - (bit / 8)] |= 1 << (bit % 8);
+        }
+        else {
+
+            pCsd[15 - (bit / 8)] &= ~(1 << (bit % 8));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Powers the card model up.
+//------------------------------------------------------------------------------
+static void CardPowerOn(void)
+{
+    memset(pCsd, 0, sizeof(pCsd));
+    SetCsd(112, 8, 0x0E);                   // TAAC: 1 ms
+    SetCsd(96, 8, 0x32);                    // TRAN_SPEED: 25 MHz
+    SetCsd(84, 12, 0x5B5);                  // CCC
+    SetCsd(80, 4, 9);                       // READ_BL_LEN: 512 bytes
+    SetCsd(62, 12, CARD_C_SIZE);            // C_SIZE
+    SetCsd(47, 3, CARD_C_SIZE_MULT);        // C_SIZE_MULT
+    SetCsd(39, 7, CARD_SECTOR_BLOCKS - 1);  // SECTOR_SIZE
+    SetCsd(26, 3, 2);                       // R2W_FACTOR
+    SetCsd(22, 4, 9);                       // WRITE_BL_LEN: 512 bytes
+    SetCsd(1, 7, Crc7(pCsd, 15));
+    SetCsd(0, 1, 1);
+
+    cardIdle = 1;
+    cardCrcOn = 0;
+    cardApp = 0;
+    cardPreErase = 0;
+    cardCmdCount = 0;
+    cardOutSize = 0;
+    cardOutIndex = 0;
+    cardBusyTime = 0;
+    cardBusyEnd = 0;
+    cardMode = CARD_IDLE;
+}
+
+//------------------------------------------------------------------------------
+/// Queues the response of a command, after a random NCR delay.
+/// \param pResponse  Response bytes.
+/// \param size  Number of bytes.
+/// \param busyTime  Time during which the card is busy after the response.
+//------------------------------------------------------------------------------
+static void CardRespond(const unsigned char *pResponse,
+                        unsigned int size,
+                        unsigned long long busyTime)
+{
+    unsigned int delay = CardDelay(cardTiming.ncr);
+
+    cardOutSize = 0;
+    cardOutIndex = 0;
+
+    // Cmd12 is followed by a stuff byte
+    if ((pCardCmd[0] & 0x3F) == 12) {
+
+        pCardOut[cardOutSize++] = Random();
+    }
+    while (delay-- > 0) {
+
+        pCardOut[cardOutSize++] = 0xFF;
+    }
+    memcpy(&pCardOut[cardOutSize], pResponse, size);
+    cardOutSize += size;
+    cardBusyTime = busyTime;
+}
+
+//------------------------------------------------------------------------------
+/// Queues a R1 response.
+/// \param r1  R1 byte.
+/// \param busyTime  Time during which the card is busy after the response
+///                  (R1b), 0 for none.
+//------------------------------------------------------------------------------
+static void CardRespondR1(unsigned char r1, unsigned long long busyTime)
+{
+    CardRespond(&r1, 1, busyTime);
+}
+
+//------------------------------------------------------------------------------
+/// Starts sending a data block.
+/// \param pData  Data of the block.
+/// \param size  Size of the block.
+/// \param readyTime  Time from which the start token may be sent.
+//------------------------------------------------------------------------------
+static void CardStartBlock(const unsigned char *pData,
+                           unsigned int size,
+                           unsigned long long readyTime)
+{
+    cardMode = CARD_READ;
+    pCardData = pData;
+    cardDataSize = size;
+    cardDataIndex = -1;
+    cardDataCrc = Crc16(pData, size);
+    cardReadyTime = readyTime;
+}
+
+//------------------------------------------------------------------------------
+/// Records the time lost by the host between two data blocks.
+/// \param write  1 for a write, 0 for a read.
+/// \param gap  Time lost.
+//------------------------------------------------------------------------------
+static void CardGap(unsigned char write, unsigned long long gap)
+{
+    pGapBlocks[write]++;
+    pGapTime[write] += gap;
+    if (gap > pGapMax[write]) {
+
+        pGapMax[write] = gap;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a memory access command addresses a valid block; otherwise
+/// responds with an address error and returns 0.
+/// \param index  Command index.
+/// \param arg  Byte address given to the command.
+//------------------------------------------------------------------------------
+static unsigned char CardCheckAddress(unsigned char index, unsigned int arg)
+{
+    if (((arg % SD_BLOCK_SIZE) != 0)
+        || ((arg / SD_BLOCK_SIZE) >= CARD_BLOCKS)) {
+
+        Error("CMD%u: address 0x%08X", index, arg);
+        CardRespondR1(R1_ADDRESS, 0);
+        return 0;
+    }
+    cardBlock = arg / SD_BLOCK_SIZE;
+
+    return 1;
+}
+
+//------------------------------------------------------------------------------
+/// Executes the application command received by the card model.
+/// \param index  Command index.
+/// \param arg  Command argument.
+//------------------------------------------------------------------------------
+static void CardAppCommand(unsigned char index, unsigned int arg)
+{
+    pCardAppCommands[index]++;
+
+    switch (index) {
+
+        case 41:
+            if (cardPowerUp > 0) {
+
+                cardPowerUp--;
+            }
+            cardIdle = (cardPowerUp > 0);
+            CardRespondR1(cardIdle ? R1_IDLE : 0, 0);
+            break;
+
+        case 23:
+            cardPreErase = arg;
+            CardRespondR1(0, 0);
+            break;
+
+        default:
+            Error("unexpected ACMD%u", index);
+            CardRespondR1(R1_ILLEGAL_COMMAND | (cardIdle ? R1_IDLE : 0), 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Executes the command received by the card model.
+//------------------------------------------------------------------------------
+static void CardCommand(void)
+{
+    unsigned char index = pCardCmd[0] & 0x3F;
+    unsigned int arg = (pCardCmd[1] << 24) | (pCardCmd[2] << 16)
+                       | (pCardCmd[3] << 8) | pCardCmd[4];
+    unsigned char r1 = cardIdle ? R1_IDLE : 0;
+    unsigned char app = cardApp;
+    unsigned char pResponse[5];
+    unsigned int first;
+    unsigned int last;
+
+    cardApp = 0;
+
+    // Cmd0 and Cmd8 are always checked
+    if ((cardCrcOn || (index == 0) || (index == 8))
+        && (pCardCmd[5] != ((Crc7(pCardCmd, 5) << 1) | 1))) {
+
+        Error("CMD%u: CRC error", index);
+        CardRespondR1(r1 | R1_COM_CRC, 0);
+        return;
+    }
+
+    // Only Cmd12 may interrupt a read
+    if ((cardMode == CARD_READ) && (index != 12)) {
+
+        Error("CMD%u during a read", index);
+        cardMode = CARD_IDLE;
+    }
+
+    if (app) {
+
+        CardAppCommand(index, arg);
+        return;
+    }
+    pCardCommands[index]++;
+
+    if (cardIdle && (index != 0) && (index != 8) && (index != 55)
+        && (index != 58) && (index != 59)) {
+
+        Error("CMD%u in idle state", index);
+        CardRespondR1(r1 | R1_ILLEGAL_COMMAND, 0);
+        return;
+    }
+
+    switch (index) {
+
+        case 0:
+            CardPowerOn();
+            CardRespondR1(R1_IDLE, 0);
+            break;
+
+        case 8:
+            pResponse[0] = r1;
+            pResponse[1] = 0;
+            pResponse[2] = 0;
+            pResponse[3] = (arg >> 8) & 0xF;
+            pResponse[4] = arg & 0xFF;
+            CardRespond(pResponse, 5, 0);
+            break;
+
+        case 9:
+            CardRespondR1(r1, 0);
+            CardStartBlock(pCsd,
+                           sizeof(pCsd),
+                           now + (cardOutSize + 1) * byteCycles);
+            break;
+
+        case 12:
+            if (cardMode != CARD_READ) {
+
+                Error("CMD12 without read");
+            }
+            cardMode = CARD_IDLE;
+            CardRespondR1(r1, 1 + CardDelay(cardTiming.stopTime));
+            break;
+
+        case 13:
+            pResponse[0] = r1;
+            pResponse[1] = 0;
+            CardRespond(pResponse, 2, 0);
+            break;
+
+        case 16:
+            CardRespondR1(r1 | ((arg != SD_BLOCK_SIZE) ? R1_PARAMETER : 0), 0);
+            break;
+
+        case 18:
+            if (CardCheckAddress(index, arg)) {
+
+                cardDataCmd = index;
+                cardFollowing = 0;
+                CardRespondR1(r1, 0);
+                CardStartBlock(&pCard[cardBlock * SD_BLOCK_SIZE],
+                               SD_BLOCK_SIZE,
+                               now + (cardOutSize + 1) * byteCycles
+                               + 1 + CardDelay(cardTiming.accessTime));
+            }
+            break;
+
+        case 25:
+            if (CardCheckAddress(index, arg)) {
+
+                if (cardPreErase == 0) {
+
+                    Error("CMD25 without ACMD23");
+                }
+                cardDataCmd = index;
+                cardFollowing = 0;
+                cardMode = CARD_WRITE;
+                CardRespondR1(r1, 0);
+            }
+            cardPreErase = 0;
+            break;
+
+        case 32:
+            cardEraseStart = arg / SD_BLOCK_SIZE;
+            CardRespondR1(r1, 0);
+            break;
+
+        case 33:
+            cardEraseEnd = arg / SD_BLOCK_SIZE;
+            CardRespondR1(r1, 0);
+            break;
+
+        case 38:
+            // Whole sectors are erased
+            first = cardEraseStart - (cardEraseStart % CARD_SECTOR_BLOCKS);
+            last = cardEraseEnd - (cardEraseEnd % CARD_SECTOR_BLOCKS)
+                   + CARD_SECTOR_BLOCKS;
+            if ((cardEraseEnd < cardEraseStart) || (last > CARD_BLOCKS)) {
+
+                Error("CMD38: blocks %u to %u", cardEraseStart, cardEraseEnd);
+                CardRespondR1(r1 | R1_PARAMETER, 0);
+                break;
+            }
+            memset(&pCard[first * SD_BLOCK_SIZE],
+                   0,
+                   (last - first) * SD_BLOCK_SIZE);
+            CardRespondR1(r1, 1 + CardDelay(CARD_ERASE_TIME));
+            break;
+
+        case 55:
+            cardApp = 1;
+            CardRespondR1(r1, 0);
+            break;
+
+        case 58:
+            pResponse[0] = r1;
+            pResponse[1] = cardIdle ? 0x00 : 0x80;
+            pResponse[2] = 0xFF;
+            pResponse[3] = 0x80;
+            pResponse[4] = 0x00;
+            CardRespond(pResponse, 5, 0);
+            break;
+
+        case 59:
+            cardCrcOn = arg & 1;
+            CardRespondR1(r1, 0);
+            break;
+
+        default:
+            Error("unexpected CMD%u", index);
+            CardRespondR1(r1 | R1_ILLEGAL_COMMAND, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the next byte of the data block sent by the card model.
+//------------------------------------------------------------------------------
+static unsigned char CardSend(void)
+{
+    unsigned char rx;
+
+    // Start token once the data is ready
+    if (cardDataIndex < 0) {
+
+        if (now < cardReadyTime) {
+
+            return 0xFF;
+        }
+        cardDataIndex = 0;
+        return 0xFE;
+    }
+
+    if (cardDataIndex < cardDataSize) {
+
+        // The first data byte would follow the token sent when ready
+        if ((cardDataIndex == 0) && cardFollowing) {
+
+            CardGap(0, now - cardReadyTime - byteCycles);
+        }
+        return pCardData[cardDataIndex++];
+    }
+
+    rx = (cardDataIndex == cardDataSize) ? (cardDataCrc >> 8)
+                                         : (cardDataCrc & 0xFF);
+    cardDataIndex++;
+    if (cardDataIndex < (cardDataSize + 2)) {
+
+        return rx;
+    }
+
+    // Multiple block reads go on with the next block, if any
+    cardMode = CARD_IDLE;
+    if (cardDataCmd == 18) {
+
+        cardBlocksRead++;
+        cardBlock++;
+        if (cardBlock < CARD_BLOCKS) {
+
+            cardFollowing = 1;
+            CardStartBlock(&pCard[cardBlock * SD_BLOCK_SIZE],
+                           SD_BLOCK_SIZE,
+                           now + byteCycles
+                           + CardDelay(cardTiming.blockTime));
+        }
+        else {
+
+            // Nothing more to send until Cmd12
+            CardStartBlock(pCardData, 0, ~0ULL);
+        }
+    }
+
+    return rx;
+}
+
+//------------------------------------------------------------------------------
+/// Programs the data block received by the card model, and queues its data
+/// response.
+//------------------------------------------------------------------------------
+static void CardProgram(void)
+{
+    unsigned short crc = (pCardReceived[SD_BLOCK_SIZE] << 8)
+                         | pCardReceived[SD_BLOCK_SIZE + 1];
+    unsigned char response = DATA_ACCEPTED;
+
+    if (cardCrcOn && (crc != Crc16(pCardReceived, SD_BLOCK_SIZE))) {
+
+        Error("block %u: CRC error", cardBlock);
+        response = DATA_CRC_ERROR;
+    }
+    else if (cardBlock >= CARD_BLOCKS) {
+
+        Error("block %u: out of range", cardBlock);
+        response = DATA_CRC_ERROR;
+    }
+    else {
+
+        memcpy(&pCard[cardBlock * SD_BLOCK_SIZE],
+               pCardReceived,
+               SD_BLOCK_SIZE);
+        cardBlocksWritten++;
+    }
+
+    // The data response follows the CRC
+    cardOutSize = 1;
+    cardOutIndex = 0;
+    pCardOut[0] = response;
+    cardBusyTime = 1 + CardDelay(cardTiming.programTime);
+    cardBlock++;
+    cardFollowing = 1;
+    cardMode = CARD_WRITE;
+}
+
+//------------------------------------------------------------------------------
+/// Exchanges a byte with the card model.
+/// Returns the byte sent by the card.
+/// \param tx  Byte sent by the SPI.
+//------------------------------------------------------------------------------
+static unsigned char CardExchange(unsigned char tx)
+{
+    unsigned char rx = 0xFF;
+
+    // Busy, the card holds DO low
+    if (now < cardBusyEnd) {
+
+        if (tx != 0xFF) {
+
+            Error("byte 0x%02X sent while the card is busy", tx);
+        }
+        return 0x00;
+    }
+
+    // Response, then data
+    if (cardOutIndex < cardOutSize) {
+
+        rx = pCardOut[cardOutIndex++];
+        if ((cardOutIndex == cardOutSize) && (cardBusyTime > 0)) {
+
+            cardBusyEnd = now + byteCycles + cardBusyTime;
+            cardBusyTime = 0;
+        }
+    }
+    else if (cardMode == CARD_READ) {
+
+        rx = CardSend();
+    }
+
+    // Data block being written
+    if (cardMode == CARD_RECEIVE) {
+
+        pCardReceived[cardDataIndex++] = tx;
+        if (cardDataIndex == (SD_BLOCK_SIZE + 2)) {
+
+            CardProgram();
+        }
+        return rx;
+    }
+
+    // Start token or stop transmission token
+    if (cardMode == CARD_WRITE) {
+
+        if (tx == 0xFC) {
+
+            if (cardFollowing) {
+
+                CardGap(1, now - cardBusyEnd);
+            }
+            cardMode = CARD_RECEIVE;
+            cardDataIndex = 0;
+        }
+        else if (tx == 0xFD) {
+
+            cardStopTokens++;
+            cardMode = CARD_IDLE;
+            cardOutSize = 1;
+            cardOutIndex = 0;
+            pCardOut[0] = 0xFF;
+            cardBusyTime = 1 + CardDelay(cardTiming.stopTime);
+        }
+        else if (tx != 0xFF) {
+
+            Error("byte 0x%02X in a multiple blocks write", tx);
+        }
+        return rx;
+    }
+
+    // Command
+    if ((cardCmdCount == 0) && ((tx & 0xC0) != 0x40)) {
+
+        if (tx != 0xFF) {
+
+            Error("unexpected byte 0x%02X", tx);
+        }
+        return rx;
+    }
+    pCardCmd[cardCmdCount++] = tx;
+    if (cardCmdCount == sizeof(pCardCmd)) {
+
+        cardCmdCount = 0;
+        CardCommand();
+    }
+
+    return rx;
+}
+
+//------------------------------------------------------------------------------
+//         Emulated SPI
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a PDC transfer is enabled along with its interrupt; otherwise
+/// returns 0.
+//------------------------------------------------------------------------------
+static unsigned char IsTransferring(void)
+{
+    AT91S_SPI *pSpiHw = AT91C_BASE_SPI;
+
+    return (pSpiHw->SPI_PTCR == (AT91C_PDC_RXTEN | AT91C_PDC_TXTEN))
+           && ((pSpiHw->SPI_IER & AT91C_SPI_RXBUFF) != 0);
+}
+
+//------------------------------------------------------------------------------
+/// Exchanges a PDC buffer pair with the card model.
+/// \param rxPointer  Address of the buffer receiving the bytes of the card.
+/// \param txPointer  Address of the bytes sent to the card.
+/// \param count  Number of bytes.
+//------------------------------------------------------------------------------
+static void Exchange(unsigned int rxPointer,
+                     unsigned int txPointer,
+                     unsigned int count)
+{
+    unsigned char *pRx = (unsigned char *) (unsigned long) rxPointer;
+    const unsigned char *pTx = (unsigned char *) (unsigned long) txPointer;
+    unsigned char tx;
+
+    while (count > 0) {
+
+        tx = *pTx++;
+        *pRx++ = CardExchange(tx);
+        now += byteCycles;
+        numBytes++;
+        count--;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Emulated SPI interrupt: performs the enabled PDC transfer and its chained
+/// part with the card, then calls SDSPI_Handler.
+//------------------------------------------------------------------------------
+static void SpiInterrupt(void)
+{
+    AT91S_SPI *pSpiHw = AT91C_BASE_SPI;
+    unsigned int pcs = (pSpiHw->SPI_MR & AT91C_SPI_PCS) >> 16;
+
+    if (pcs != (0xF & ~(1 << BOARD_SD_NPCS))) {
+
+        Error("chip select 0x%X", pcs);
+    }
+    if ((pSpiHw->SPI_RCR != pSpiHw->SPI_TCR)
+        || (pSpiHw->SPI_RNCR != pSpiHw->SPI_TNCR)) {
+
+        Error("PDC receive and transmit counters differ");
+    }
+
+    byteCycles = 8 * ((pSpiHw->SPI_CSR[BOARD_SD_NPCS] & AT91C_SPI_SCBR) >> 8);
+    Exchange(pSpiHw->SPI_RPR, pSpiHw->SPI_TPR, pSpiHw->SPI_RCR);
+    Exchange(pSpiHw->SPI_RNPR, pSpiHw->SPI_TNPR, pSpiHw->SPI_RNCR);
+    pSpiHw->SPI_RPR = pSpiHw->SPI_RNPR + pSpiHw->SPI_RNCR;
+    pSpiHw->SPI_TPR = pSpiHw->SPI_TNPR + pSpiHw->SPI_TNCR;
+    pSpiHw->SPI_RCR = 0;
+    pSpiHw->SPI_TCR = 0;
+    pSpiHw->SPI_RNCR = 0;
+    pSpiHw->SPI_TNCR = 0;
+
+    numInterrupts++;
+    now += ISR_CYCLES;
+    pSpiHw->SPI_IER = 0;
+    pSpiHw->SPI_SR = AT91C_SPI_RXBUFF;
+    SDSPI_Handler(&sdSpi);
+}
+
+//------------------------------------------------------------------------------
+/// Timer signal handler: plays the SPI interrupt while the driver busy-waits
+/// for the end of a transfer.
+//------------------------------------------------------------------------------
+static void Tick(int signal)
+{
+    if (inDriver && IsTransferring()) {
+
+        SpiInterrupt();
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Plays the SPI interrupts, and the timer interrupts calling SDSPI_Poll when
+/// the driver waits for them, until the media callback has been invoked.
+//------------------------------------------------------------------------------
+static void WaitMedia(void)
+{
+    while (!mediaDone) {
+
+        if (IsTransferring()) {
+
+            SpiInterrupt();
+        }
+        else if (sdSpi.pollPending) {
+
+            now += POLL_PERIOD - (now % POLL_PERIOD);
+            numPolls++;
+            now += ISR_CYCLES;
+            SDSPI_Poll(&sdSpi);
+        }
+        else {
+
+            Error("media transfer stalled");
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Media test
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Media callback: records the result of the transfer.
+//------------------------------------------------------------------------------
+static void MediaDone(void *argument,
+                          unsigned char status,
+                          unsigned int transferred,
+                          unsigned int remaining)
+{
+    mediaStatus = status;
+    mediaTransferred = transferred;
+    mediaDone = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Updates the expected open stream for an access.
+/// \param direction  STREAM_READ or STREAM_WRITE, STREAM_NONE to end it.
+/// \param block  First block of the access.
+/// \param count  Number of blocks.
+//------------------------------------------------------------------------------
+static void Stream(unsigned char direction,
+                   unsigned int block,
+                   unsigned int count)
+{
+    if ((direction != STREAM_NONE)
+        && (direction == streamDirection) && (block == streamNext)) {
+
+        numContinued++;
+    }
+    else {
+
+        if (streamDirection != STREAM_NONE) {
+
+            numStreamEnds++;
+        }
+        if (direction != STREAM_NONE) {
+
+            numStreams++;
+        }
+        streamDirection = direction;
+    }
+    streamNext = block + count;
+}
+
+//------------------------------------------------------------------------------
+/// Checks the result of a media transfer.
+/// \param status  Result code returned by the media.
+/// \param length  Length of the transfer.
+//------------------------------------------------------------------------------
+static void CheckTransfer(unsigned char status, unsigned int length)
+{
+    if ((status != MED_STATUS_SUCCESS) || !mediaDone
+        || (mediaStatus != MED_STATUS_SUCCESS)
+        || (mediaTransferred != length)) {
+
+        Error("transfer of %u bytes ended with %u/%u, %u bytes", length,
+              status, mediaStatus, mediaTransferred);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads or writes blocks through MED_Read or MED_Write, and checks the data
+/// read.
+/// \param write  1 to write, 0 to read.
+/// \param block  First block.
+/// \param count  Number of blocks.
+//------------------------------------------------------------------------------
+static void Access(unsigned char write, unsigned int block, unsigned int count)
+{
+    unsigned int address = block * SD_BLOCK_SIZE;
+    unsigned int length = count * SD_BLOCK_SIZE;
+    unsigned char status;
+    unsigned int i;
+
+    mediaDone = 0;
+    if (write) {
+
+        for (i = 0; i < length; i++) {
+
+            pBuffer[i] = Random();
+        }
+        memcpy(&pImage[address], pBuffer, length);
+        status = MED_Write(&media, address, pBuffer, length,
+                           MediaDone, 0);
+    }
+    else {
+
+        memset(pBuffer, 0x5A, length);
+        status = MED_Read(&media, address, pBuffer, length,
+                          MediaDone, 0);
+    }
+
+    // The transfer ends in the interrupts
+    if (mediaDone) {
+
+        Error("transfer ended before any interrupt");
+    }
+    if (status == MED_STATUS_SUCCESS) {
+
+        WaitMedia();
+    }
+    CheckTransfer(status, length);
+    Stream(write ? STREAM_WRITE : STREAM_READ, block, count);
+
+    if (!write && (memcmp(pBuffer, &pImage[address], length) != 0)) {
+
+        Error("wrong data read from blocks %u to %u", block, block + count - 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads or writes blocks in several fragments through MED_Readv or
+/// MED_Writev, and checks the data read.
+/// \param write  1 to write, 0 to read.
+/// \param block  First block.
+/// \param count  Number of blocks.
+/// \param numFragments  Number of fragments, up to MAX_FRAGMENTS.
+//------------------------------------------------------------------------------
+static void AccessVector(unsigned char write,
+                         unsigned int block,
+                         unsigned int count,
+                         unsigned int numFragments)
+{
+    MEDVector pVector[MAX_FRAGMENTS];
+    unsigned int address = block * SD_BLOCK_SIZE;
+    unsigned int length = count * SD_BLOCK_SIZE;
+    unsigned int offset = 0;
+    unsigned char status;
+    unsigned int size;
+    unsigned int i;
+
+    // Fragments of whole blocks, possibly empty
+    for (i = 0; i < numFragments; i++) {
+
+        size = (i == (numFragments - 1)) ? (count - offset)
+                                         : (Random() % (count - offset + 1));
+        pVector[i].data = &pBuffer[offset * SD_BLOCK_SIZE];
+        pVector[i].length = size * SD_BLOCK_SIZE;
+        offset += size;
+    }
+
+    mediaDone = 0;
+    inDriver = 1;
+    if (write) {
+
+        for (i = 0; i < length; i++) {
+
+            pBuffer[i] = Random();
+        }
+        memcpy(&pImage[address], pBuffer, length);
+        status = MED_Writev(&media, address, pVector, numFragments,
+                            MediaDone, 0);
+    }
+    else {
+
+        memset(pBuffer, 0x5A, length);
+        status = MED_Readv(&media, address, pVector, numFragments,
+                           MediaDone, 0);
+    }
+    inDriver = 0;
+    CheckTransfer(status, length);
+    Stream(write ? STREAM_WRITE : STREAM_READ, block, count);
+
+    if (!write && (memcmp(pBuffer, &pImage[address], length) != 0)) {
+
+        Error("wrong data read from blocks %u to %u (%u fragments)",
+              block, block + count - 1, numFragments);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Ends the open stream with MED_Flush.
+//------------------------------------------------------------------------------
+static void Flush(void)
+{
+    unsigned char status;
+
+    inDriver = 1;
+    status = MED_Flush(&media);
+    inDriver = 0;
+    if (status != MED_STATUS_SUCCESS) {
+
+        Error("flush failed (%u)", status);
+    }
+    Stream(STREAM_NONE, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/// Discards a range of blocks with MED_IOCTL_TRIM. The whole erase sectors it
+/// contains read as 0 afterwards.
+/// \param block  First block.
+/// \param count  Number of blocks.
+//------------------------------------------------------------------------------
+static void Trim(unsigned int block, unsigned int count)
+{
+    MEDRange range;
+    unsigned int first;
+    unsigned int last;
+    unsigned char status;
+
+    range.address = block * SD_BLOCK_SIZE;
+    range.length = count * SD_BLOCK_SIZE;
+    inDriver = 1;
+    status = MED_Ioctl(&media, MED_IOCTL_TRIM, &range);
+    inDriver = 0;
+    if (status != MED_STATUS_SUCCESS) {
+
+        Error("trim failed (%u)", status);
+    }
+
+    first = ((block + CARD_SECTOR_BLOCKS - 1) / CARD_SECTOR_BLOCKS)
+            * CARD_SECTOR_BLOCKS;
+    last = ((block + count) / CARD_SECTOR_BLOCKS) * CARD_SECTOR_BLOCKS;
+    if (last > first) {
+
+        memset(&pImage[first * SD_BLOCK_SIZE],
+               0,
+               (last - first) * SD_BLOCK_SIZE);
+        Stream(STREAM_NONE, 0, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Initializes the card and the media. Returns 0 if successful.
+//------------------------------------------------------------------------------
+static unsigned char Initialize(void)
+{
+    unsigned int value = 0;
+    unsigned char error;
+
+    CardPowerOn();
+    cardPowerUp = CARD_POWER_UP;
+    SDSPI_Configure(&sdSpi, AT91C_BASE_SPI, AT91C_ID_SPI);
+    SDSPI_ConfigureCS(&sdSpi, BOARD_SD_NPCS, AT45_CSR(BOARD_MCK, INIT_SPCK));
+
+    inDriver = 1;
+    error = SD_Init(&sdCard, (SdDriver *) &sdSpi);
+    inDriver = 0;
+    if (error) {
+
+        Error("SD_Init failed (%u)", error);
+        return error;
+    }
+    if ((sdCard.cardType != CARD_SD) || (SD_TOTAL_BLOCK(&sdCard) != CARD_BLOCKS)
+        || (SD_CLOCK(&sdCard) != (BOARD_MCK / SDSPI_SCBR_MIN))) {
+
+        Error("card type %u, %u blocks, clock %u Hz", sdCard.cardType,
+              SD_TOTAL_BLOCK(&sdCard), SD_CLOCK(&sdCard));
+    }
+    if (!cardCrcOn) {
+
+        Error("CRC not enabled");
+    }
+
+    MEDSdcard_Initialize(&media, &sdCard);
+    if (media.size != (CARD_BLOCKS * SD_BLOCK_SIZE)) {
+
+        Error("media size %u", media.size);
+    }
+    MED_Ioctl(&media, MED_IOCTL_GET_SECTOR_SIZE, &value);
+    if (value != SD_BLOCK_SIZE) {
+
+        Error("sector size %u", value);
+    }
+    MED_Ioctl(&media, MED_IOCTL_GET_ERASE_UNIT, &value);
+    if (value != (CARD_SECTOR_BLOCKS * SD_BLOCK_SIZE)) {
+
+        Error("erase unit %u", value);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Runs random accesses through the media, then checks the card content.
+//------------------------------------------------------------------------------
+static void TestMedia(void)
+{
+    unsigned long pCommands[64];
+    unsigned long acmd23;
+    unsigned long stopTokens;
+    unsigned int block;
+    unsigned int count;
+    unsigned int choice;
+    unsigned char write;
+    unsigned int i;
+
+    memcpy(pCommands, pCardCommands, sizeof(pCommands));
+    acmd23 = pCardAppCommands[23];
+    stopTokens = cardStopTokens;
+
+    for (i = 0; i < NUM_ACCESSES; i++) {
+
+        choice = Random() % 100;
+        count = 1 + (Random() % MAX_BLOCKS);
+
+        // Half of the accesses continue the previous one
+        if ((streamDirection != STREAM_NONE) && (choice < 50)
+            && (streamNext < CARD_BLOCKS)) {
+
+            write = (streamDirection == STREAM_WRITE);
+            block = streamNext;
+        }
+        else {
+
+            write = Random() & 1;
+            block = Random() % CARD_BLOCKS;
+        }
+        if ((block + count) > CARD_BLOCKS) {
+
+            count = CARD_BLOCKS - block;
+        }
+
+        if ((choice % 50) < 4) {
+
+            AccessVector(write, block, count, 1 + (Random() % MAX_FRAGMENTS));
+        }
+        else if ((choice % 50) < 6) {
+
+            Flush();
+        }
+        else if ((choice % 50) < 8) {
+
+            count *= 4;
+            if ((block + count) > CARD_BLOCKS) {
+
+                count = CARD_BLOCKS - block;
+            }
+            Trim(block, count);
+        }
+        else {
+
+            Access(write, block, count);
+        }
+    }
+    Flush();
+
+    if (memcmp(pCard, pImage, sizeof(pCard)) != 0) {
+
+        Error("card content differs from the data written");
+    }
+
+    // One command per stream, and one stop per stream ended
+    printf("Media: %u accesses, %lu continued, %lu CMD18, %lu CMD25, "
+           "%lu ACMD23, %lu CMD12, %lu stop tokens, %lu blocks read, "
+           "%lu blocks written\n",
+           NUM_ACCESSES, numContinued,
+           pCardCommands[18] - pCommands[18],
+           pCardCommands[25] - pCommands[25],
+           pCardAppCommands[23] - acmd23,
+           pCardCommands[12] - pCommands[12],
+           cardStopTokens - stopTokens,
+           cardBlocksRead, cardBlocksWritten);
+    if (((pCardCommands[18] - pCommands[18])
+         + (pCardCommands[25] - pCommands[25])) != numStreams) {
+
+        Error("%lu streams expected", numStreams);
+    }
+    if (((pCardCommands[12] - pCommands[12])
+         + (cardStopTokens - stopTokens)) != numStreamEnds) {
+
+        Error("%lu stream ends expected", numStreamEnds);
+    }
+    if ((pCardAppCommands[23] - acmd23)
+        != (pCardCommands[25] - pCommands[25])) {
+
+        Error("CMD25 not pre-erased");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Reads or writes GAP_BLOCKS blocks in a single multiple blocks transfer,
+/// while the card sends each block as soon as it can, and prints the time
+/// lost between the blocks, past the delays of the card, with the interrupts,
+/// the bytes exchanged and the time per block.
+/// \param write  1 to write, 0 to read.
+/// \param async  1 to transfer through MED_Read or MED_Write, 0 through
+///               MED_Readv or MED_Writev which wait for the end of the
+///               transfer.
+//------------------------------------------------------------------------------
+static void MeasureGap(unsigned char write, unsigned char async)
+{
+    unsigned long interrupts;
+    unsigned long bytes;
+    unsigned long long start;
+    unsigned long long blockTime = cardTiming.blockTime;
+
+    Flush();
+    memset(pGapBlocks, 0, sizeof(pGapBlocks));
+    memset(pGapTime, 0, sizeof(pGapTime));
+    memset(pGapMax, 0, sizeof(pGapMax));
+    cardTiming.blockTime = 0;
+    interrupts = numInterrupts;
+    bytes = numBytes;
+    start = now;
+
+    if (async) {
+
+        Access(write, GAP_START, GAP_BLOCKS);
+    }
+    else {
+
+        AccessVector(write, GAP_START, GAP_BLOCKS, 1);
+    }
+
+    interrupts = numInterrupts - interrupts;
+    bytes = numBytes - bytes;
+    printf("%s through %s: %.1f interrupts, %lu bytes, %llu us per block; "
+           "gap %llu cycles average, %llu max over %lu blocks\n",
+           write ? "Write" : "Read",
+           async ? (write ? "MED_Write" : "MED_Read")
+                 : (write ? "MED_Writev" : "MED_Readv"),
+           (double) interrupts / GAP_BLOCKS,
+           bytes / GAP_BLOCKS,
+           (now - start) / GAP_BLOCKS / US(1),
+           pGapBlocks[write] ? (pGapTime[write] / pGapBlocks[write]) : 0,
+           pGapMax[write],
+           pGapBlocks[write]);
+    if (pGapBlocks[write] != (GAP_BLOCKS - 1)) {
+
+        Error("gap measured on %lu blocks", pGapBlocks[write]);
+    }
+    if (!write && async && (interrupts > (GAP_READ_INTERRUPTS * GAP_BLOCKS))) {
+
+        Error("%lu interrupts for %u blocks read", interrupts, GAP_BLOCKS);
+    }
+    cardTiming.blockTime = blockTime;
+}
+
+//------------------------------------------------------------------------------
+/// Runs random accesses through MED_Read and MED_Write with a card timing,
+/// and prints the load of the processor by the interrupts of the driver.
+/// The card model checks the protocol meanwhile; the accesses must succeed
+/// with the largest delays allowed by the specification.
+/// \param pTiming  Timing of the card.
+/// \param timer  1 to pace the polling of the card with SDSPI_Poll, 0 to poll
+///               from the interrupts.
+//------------------------------------------------------------------------------
+static void TestTiming(const CardTiming *pTiming, unsigned char timer)
+{
+    unsigned long interrupts;
+    unsigned long polls;
+    unsigned long errors = numErrors;
+    unsigned long long start;
+    unsigned int block = 0;
+    unsigned int count;
+    unsigned char write = 0;
+    unsigned int i;
+
+    Flush();
+    cardTiming = *pTiming;
+    SDSPI_ConfigurePolling(&sdSpi, timer);
+    interrupts = numInterrupts;
+    polls = numPolls;
+    start = now;
+
+    for (i = 0; i < TIMING_ACCESSES; i++) {
+
+        count = 1 + (Random() % TIMING_BLOCKS);
+
+        // Half of the accesses continue the previous one
+        if ((i == 0) || (Random() & 1) || (streamNext >= CARD_BLOCKS)) {
+
+            write = Random() & 1;
+            block = Random() % CARD_BLOCKS;
+        }
+        else {
+
+            block = streamNext;
+        }
+        if ((block + count) > CARD_BLOCKS) {
+
+            count = CARD_BLOCKS - block;
+        }
+        Access(write, block, count);
+    }
+
+    interrupts = numInterrupts - interrupts;
+    polls = numPolls - polls;
+    printf("%s card, %s: %lu interrupts, %lu polls in %llu ms, "
+           "%.2f%% of the processor, %lu errors\n",
+           pTiming->pName,
+           timer ? "paced polling" : "polling from the interrupts",
+           interrupts, polls, (now - start) / US(1000),
+           100.0 * (interrupts + polls) * ISR_CYCLES / (now - start),
+           numErrors - errors);
+
+    SDSPI_ConfigurePolling(&sdSpi, 0);
+    cardTiming = pTimings[1];
+}
+
+//------------------------------------------------------------------------------
+/// Runs the tests on the stack of the tests.
+//------------------------------------------------------------------------------
+static void RunTests(void)
+{
+    unsigned int i;
+
+    cardTiming = pTimings[1];
+    if (Initialize() == 0) {
+
+        TestMedia();
+        MeasureGap(0, 0);
+        MeasureGap(0, 1);
+        MeasureGap(1, 0);
+        MeasureGap(1, 1);
+        for (i = 0; i < (sizeof(pTimings) / sizeof(pTimings[0])); i++) {
+
+            TestTiming(&pTimings[i], 0);
+            TestTiming(&pTimings[i], 1);
+        }
+        Flush();
+        if (memcmp(pCard, pImage, sizeof(pCard)) != 0) {
+
+            Error("card content differs from the data written");
+        }
+    }
+
+    printf("%lu interrupts, %lu bytes, %llu ms, %lu errors\n",
+           numInterrupts, numBytes, now / US(1000), numErrors);
+    result = (numErrors > 0);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated peripherals, starts the timer and runs the tests.
+/// Returns 0 if all the tests pass.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    struct itimerval timer;
+    unsigned int i;
+
+    if (mmap((void *) PERIPH_START, PERIPH_SIZE, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated peripherals");
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(pCard); i++) {
+
+        pCard[i] = Random();
+    }
+    memcpy(pImage, pCard, sizeof(pCard));
+
+    signal(SIGALRM, Tick);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = TICK_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, 0);
+
+    getcontext(&testContext);
+    testContext.uc_stack.ss_sp = pStack;
+    testContext.uc_stack.ss_size = sizeof(pStack);
+    testContext.uc_link = &mainContext;
+    makecontext(&testContext, RunTests, 0);
+    swapcontext(&mainContext, &testContext);
+
+    return result;
+}
@@ -0,0 +1,591 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test of the serial flash read cache (memories/spi-flash/sfcache.c),
+/// which measures its hit rate on typical access patterns.
+///
+/// !Description
+///
+/// The program runs on the host computer. The cache reads a model of a
+/// serial flash of DEVICE_SIZE bytes, whose reads wrap around at its end
+/// like those of the AT26 and AT45. Like the SPI driver, the model only
+/// starts a read: a timer signal plays the SPI interrupt, which copies the
+/// data and invokes the callback of the cache, so that the cache busy-waits
+/// for its misses and its prefetches complete in the background. The model
+/// counts the reads and the bytes sent on the bus, including the command,
+/// address and dummy bytes of each read (DEVICE_OVERHEAD), and the reads
+/// past its end. Starting a read while the previous one is in progress is an
+/// error.
+///
+/// Each workload starts from an empty cache and reads the data with
+/// SFC_Read, or with SFC_Map when the data lies in a single line; the data
+/// must match the device. The program prints the hit rate of the lines, the
+/// prefetches and the reads and bytes of the device, compared to reading
+/// each access directly from the device:
+/// - "stream" reads blocks of 4 KB by chunks of 48 bytes. Each block must
+///   only miss its first two lines: the following ones are prefetched.
+/// - "hot table" reads random entries of 8 bytes in a table as large as the
+///   cache, which must miss once per line, plus at most twice per useless
+///   prefetch: the prefetches of the line following the table replace lines
+///   of the table.
+/// - "records" scans 24-byte records and reads a few random ones between
+///   two scans.
+/// - "large table" reads random entries of 16 bytes in 64 KB, far larger
+///   than the cache.
+///
+/// The program then checks that the least recently used line of a set is
+/// replaced, that the cache holds the new data of the device after
+/// SFC_Invalidate, and that it never returns the data of a failed read when
+/// one read out of FAIL_RATE cannot be started or ends with an error.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints the statistics of each workload and the number of
+///    errors, and returns 0 when every access returned the expected data.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <memories/spi-flash/sfcache.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// Size of the emulated serial flash in bytes.
+#define DEVICE_SIZE         (256 * 1024)
+
+/// Command, address and dummy bytes of a read of the device (AT26 fast read).
+#define DEVICE_OVERHEAD     5
+
+/// Period of the timer signal which plays the SPI interrupt, in us.
+#define TICK_US             20
+
+/// Size of the cache in bytes.
+#define CACHE_SIZE          (SFC_SETS * SFC_WAYS * SFC_LINE_SIZE)
+
+/// One read of the device out of FAIL_RATE fails in the error test.
+#define FAIL_RATE           8
+
+/// Largest access of the tests in bytes.
+#define MAX_ACCESS          256
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// Cache under test.
+static Sfc sfc;
+
+/// Content of the emulated device.
+static unsigned char pDevice[DEVICE_SIZE];
+
+/// Read of the device in progress.
+static volatile sig_atomic_t devicePending;
+static unsigned int deviceAddress;
+static unsigned char *pDeviceData;
+static unsigned int deviceSize;
+static SpidCallback deviceCallback;
+static void *pDeviceArgument;
+static unsigned char deviceStatus;
+
+/// Set when reads of the device fail at random.
+static unsigned char failReads;
+
+/// Statistics of the device.
+static unsigned long deviceReads;
+static unsigned long deviceBytes;
+static unsigned long deviceFailures;
+static unsigned long deviceWraps;
+
+/// Statistics of the accesses of the current workload.
+static unsigned long numAccesses;
+static unsigned long directBytes;
+static unsigned long failedAccesses;
+
+/// Number of errors.
+static unsigned long numErrors;
+
+/// Seed of the pseudo-random numbers.
+static unsigned int seed = 1;
+
+//------------------------------------------------------------------------------
+//         Local functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number.
+//------------------------------------------------------------------------------
+static unsigned int Random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+//------------------------------------------------------------------------------
+/// Returns a pseudo-random number lower than a maximum.
+/// \param max  Maximum.
+//------------------------------------------------------------------------------
+static unsigned int RandomBelow(unsigned int max)
+{
+    return ((Random() << 16) | Random()) % max;
+}
+
+//------------------------------------------------------------------------------
+/// Counts an error and prints the first ones.
+/// \param pFormat  Format of the description of the error.
+//------------------------------------------------------------------------------
+static void Error(const char *pFormat, ...)
+{
+    va_list ap;
+
+    if (numErrors < 10) {
+
+        printf("Error: ");
+        va_start(ap, pFormat);
+        vprintf(pFormat, ap);
+        va_end(ap);
+        printf("\n");
+    }
+    numErrors++;
+}
+
+//------------------------------------------------------------------------------
+//         Device model
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Starts a read of the emulated device, which ends on the next timer signal.
+/// Returns 0 if the read is started.
+/// \param pInterface  Unused.
+/// \param address  Address of the data in the device.
+/// \param pData  Buffer receiving the data.
+/// \param size  Number of bytes to read.
+/// \param callback  Function invoked at the end of the read.
+/// \param pArgument  Argument of the callback.
+//------------------------------------------------------------------------------
+static unsigned char DeviceRead(void *pInterface,
+                                unsigned int address,
+                                unsigned char *pData,
+                                unsigned int size,
+                                SpidCallback callback,
+                                void *pArgument)
+{
+    if (devicePending) {
+
+        Error("read of 0x%X started while the device is busy", address);
+        return 1;
+    }
+    // The failures are drawn here, since the timer signal may interrupt
+    // the test at any time
+    deviceStatus = 0;
+    if (failReads && ((Random() % FAIL_RATE) == 0)) {
+
+        deviceFailures++;
+        if (Random() & 1) {
+
+            return 1;
+        }
+        deviceStatus = 1;
+    }
+
+    deviceReads++;
+    deviceBytes += DEVICE_OVERHEAD + size;
+    if ((address + size) > DEVICE_SIZE) {
+
+        deviceWraps++;
+    }
+    deviceAddress = address;
+    pDeviceData = pData;
+    deviceSize = size;
+    deviceCallback = callback;
+    pDeviceArgument = pArgument;
+    devicePending = 1;
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+/// Plays the SPI interrupt: ends the read in progress, if any. A failed read
+/// leaves garbage in the buffer.
+/// \param signal  Unused.
+//------------------------------------------------------------------------------
+static void Tick(int signal)
+{
+    unsigned int i;
+
+    if (devicePending) {
+
+        if (deviceStatus) {
+
+            memset(pDeviceData, 0xA5, deviceSize);
+        }
+        else {
+
+            for (i = 0; i < deviceSize; i++) {
+
+                pDeviceData[i] = pDevice[(deviceAddress + i) % DEVICE_SIZE];
+            }
+        }
+        devicePending = 0;
+        deviceCallback(deviceStatus, pDeviceArgument);
+    }
+}
+
+//------------------------------------------------------------------------------
+//         Workloads
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Empties the cache and clears the statistics.
+//------------------------------------------------------------------------------
+static void Start(void)
+{
+    SFC_Initialize(&sfc, DeviceRead, 0);
+    deviceReads = 0;
+    deviceBytes = 0;
+    deviceFailures = 0;
+    deviceWraps = 0;
+    numAccesses = 0;
+    directBytes = 0;
+    failedAccesses = 0;
+}
+
+//------------------------------------------------------------------------------
+/// Reads data through the cache and checks it against the device. A failure
+/// is an error unless reads of the device fail.
+/// \param address  Address of the data in the device.
+/// \param size  Number of bytes to read.
+//------------------------------------------------------------------------------
+static void Access(unsigned int address, unsigned int size)
+{
+    unsigned char pBuffer[MAX_ACCESS];
+    const unsigned char *pData;
+
+    numAccesses++;
+    directBytes += DEVICE_OVERHEAD + size;
+
+    // Map the data when it lies in a single line, half of the time
+    if ((((address & (SFC_LINE_SIZE - 1)) + size) <= SFC_LINE_SIZE)
+        && (Random() & 1)) {
+
+        pData = SFC_Map(&sfc, address, size);
+    }
+    else if (SFC_Read(&sfc, address, pBuffer, size) == 0) {
+
+        pData = pBuffer;
+    }
+    else {
+
+        pData = 0;
+    }
+
+    if (!pData) {
+
+        failedAccesses++;
+        if (!failReads) {
+
+            Error("access of 0x%X (%u bytes) failed", address, size);
+        }
+    }
+    else if (memcmp(pData, &pDevice[address], size) != 0) {
+
+        Error("access of 0x%X (%u bytes) returned wrong data", address, size);
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Prints the statistics of a workload.
+/// \param pName  Name of the workload.
+//------------------------------------------------------------------------------
+static void Report(const char *pName)
+{
+    unsigned int lines = sfc.hits + sfc.misses;
+
+    printf("%-12s %6lu accesses, %6u lines, hit rate %5.1f%%, "
+           "%5u/%5u prefetches used\n",
+           pName, numAccesses, lines, 100.0 * sfc.hits / lines,
+           sfc.prefetchHits, sfc.prefetches);
+    printf("%-12s device reads %6lu (direct %6lu), "
+           "bytes %7lu (direct %7lu)\n",
+           "", deviceReads, numAccesses, deviceBytes, directBytes);
+}
+
+//------------------------------------------------------------------------------
+/// Reads blocks of 4 KB at random addresses by chunks of 48 bytes. Each
+/// block must only miss its first two lines: the access to the second line
+/// starts the prefetches.
+//------------------------------------------------------------------------------
+static void Stream(void)
+{
+    unsigned int block;
+    unsigned int start;
+    unsigned int address;
+    unsigned int misses;
+
+    Start();
+    for (block = 0; block < 64; block++) {
+
+        start = RandomBelow(DEVICE_SIZE - 4096);
+        misses = sfc.misses;
+        for (address = start; address < (start + 4096); address += 48) {
+
+            Access(address, 48);
+        }
+        if ((sfc.misses - misses) > 2) {
+
+            Error("stream: %u misses in a block", sfc.misses - misses);
+        }
+    }
+    Report("stream");
+}
+
+//------------------------------------------------------------------------------
+/// Reads random entries of 8 bytes in a table as large as the cache, which
+/// must miss once per line, and at most twice more per useless prefetch.
+//------------------------------------------------------------------------------
+static void HotTable(void)
+{
+    unsigned int table = RandomBelow(DEVICE_SIZE / CACHE_SIZE) * CACHE_SIZE;
+    unsigned int i;
+
+    Start();
+    for (i = 0; i < 20000; i++) {
+
+        Access(table + RandomBelow(CACHE_SIZE / 8) * 8, 8);
+    }
+    if (sfc.misses > ((CACHE_SIZE / SFC_LINE_SIZE)
+                      + 2 * (sfc.prefetches - sfc.prefetchHits))) {
+
+        Error("hot table: %u misses", sfc.misses);
+    }
+    Report("hot table");
+}
+
+//------------------------------------------------------------------------------
+/// Scans 200 records of 24 bytes, and reads a few random records between two
+/// scans.
+//------------------------------------------------------------------------------
+static void Records(void)
+{
+    unsigned int table = RandomBelow(DEVICE_SIZE - 200 * 24);
+    unsigned int scan;
+    unsigned int i;
+
+    Start();
+    for (scan = 0; scan < 20; scan++) {
+
+        for (i = 0; i < 200; i++) {
+
+            Access(table + i * 24, 24);
+        }
+        for (i = 0; i < 50; i++) {
+
+            Access(table + RandomBelow(200) * 24, 24);
+        }
+    }
+    Report("records");
+}
+
+//------------------------------------------------------------------------------
+/// Reads random entries of 16 bytes in a table of 64 KB.
+//------------------------------------------------------------------------------
+static void LargeTable(void)
+{
+    unsigned int i;
+
+    Start();
+    for (i = 0; i < 10000; i++) {
+
+        Access(RandomBelow(64 * 1024 / 16) * 16, 16);
+    }
+    Report("large table");
+}
+
+//------------------------------------------------------------------------------
+//         Checks
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Checks that a new line replaces the least recently used line of its set.
+//------------------------------------------------------------------------------
+static void CheckReplacement(void)
+{
+    unsigned int stride = SFC_SETS * SFC_LINE_SIZE;
+    unsigned int misses;
+    unsigned int i;
+
+    // Lines of the same set, never following each other: no prefetch
+    Start();
+    for (i = 0; i < (10 * SFC_WAYS); i++) {
+
+        Access((i % SFC_WAYS) * 2 * stride, 1);
+    }
+    if (sfc.misses != SFC_WAYS) {
+
+        Error("replacement: %u misses for %u lines", sfc.misses, SFC_WAYS);
+    }
+
+    // The first line is the least recently used one
+    Access(SFC_WAYS * 2 * stride, 1);
+    misses = sfc.misses;
+    Access((SFC_WAYS - 1) * 2 * stride, 1);
+    if (sfc.misses != misses) {
+
+        Error("replacement: most recently used line replaced");
+    }
+    Access(0, 1);
+    if (sfc.misses != (misses + 1)) {
+
+        Error("replacement: least recently used line kept");
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks that the cache holds the new data of the device after
+/// SFC_Invalidate.
+//------------------------------------------------------------------------------
+static void CheckInvalidate(void)
+{
+    unsigned int address;
+    unsigned int i;
+
+    Start();
+    for (address = 0; address < (4 * CACHE_SIZE); address += 32) {
+
+        Access(address, 32);
+    }
+
+    // Wait for the last prefetch, as the driver of the device would before
+    // writing it
+    while (devicePending);
+    for (i = 0; i < (4 * CACHE_SIZE); i++) {
+
+        pDevice[i] = Random();
+    }
+    SFC_Invalidate(&sfc);
+    for (i = 0; i < 2000; i++) {
+
+        Access(RandomBelow(4 * CACHE_SIZE - MAX_ACCESS),
+               1 + RandomBelow(MAX_ACCESS));
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Checks that the data of a failed read is never returned, with random and
+/// sequential accesses.
+//------------------------------------------------------------------------------
+static void CheckFailures(void)
+{
+    unsigned int address = 0;
+    unsigned int size;
+    unsigned int i;
+
+    Start();
+    failReads = 1;
+    for (i = 0; i < 20000; i++) {
+
+        if (Random() & 1) {
+
+            address = RandomBelow(DEVICE_SIZE - MAX_ACCESS);
+        }
+        size = 1 + RandomBelow(MAX_ACCESS);
+        if ((address + size) > DEVICE_SIZE) {
+
+            address = 0;
+        }
+        Access(address, size);
+        address += size;
+    }
+    failReads = 0;
+    while (devicePending);
+
+    // A failed prefetch does not fail any access
+    if ((failedAccesses == 0) || (failedAccesses > deviceFailures)) {
+
+        Error("failures: %lu accesses failed, %lu reads",
+              failedAccesses, deviceFailures);
+    }
+    printf("%-12s %6lu accesses, %6lu failed, %lu reads failed, "
+           "%lu past the end\n",
+           "failures", numAccesses, failedAccesses, deviceFailures,
+           deviceWraps);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Starts the timer and runs the workloads and the checks.
+/// Returns 0 if all the tests pass.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    struct itimerval timer;
+    unsigned int i;
+
+    for (i = 0; i < DEVICE_SIZE; i++) {
+
+        pDevice[i] = Random();
+    }
+
+    signal(SIGALRM, Tick);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = TICK_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, 0);
+
+    printf("%u sets of %u lines of %u bytes\n",
+           SFC_SETS, SFC_WAYS, SFC_LINE_SIZE);
+    Stream();
+    HotTable();
+    Records();
+    LargeTable();
+    CheckReplacement();
+    CheckInvalidate();
+    CheckFailures();
+
+    printf("%lu errors\n", numErrors);
+    return (numErrors > 0);
+}
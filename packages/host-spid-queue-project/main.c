@@ -0,0 +1,860 @@
+/* ----------------------------------------------------------------------------
+ *         ATMEL Microcontroller Software Support
+ * ----------------------------------------------------------------------------
+ * Copyright (c) 2008, Atmel Corporation
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the disclaimer below.
+ *
+ * Atmel's name may not be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * DISCLAIMER: THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ----------------------------------------------------------------------------
+ */
+
+//------------------------------------------------------------------------------
+/// \dir
+/// !Purpose
+///
+/// Host test of the SPI driver command queue (memories/spi-flash/spid.c) with
+/// an AT45 dataflash and an AT26 serial flash sharing the bus.
+///
+/// !Description
+///
+/// The program runs on the host computer. The SPI, PMC and AIC registers are
+/// emulated in memory, mapped at their address on the chip. When a PDC
+/// transfer is enabled, the emulated interrupt exchanges its bytes with a
+/// model of the device selected by SPI_MR (an AT45DB011D on NPCS0 and an
+/// AT25DF041A on NPCS1), then calls SPID_Handler. The time of the models is
+/// counted in bytes clocked on the bus, and the devices stay busy for a while
+/// after each program or erase.
+///
+/// Two operations run at once in random interleavings with the interrupts:
+/// AT45 streaming writes of random page runs, each read back with a
+/// continuous read, and AT26 erases followed by a write and a read back. Each
+/// read must match the data written, a command sent to a busy device or
+/// without write enable is an error, and each operation must end. Outside
+/// commands sent to the AT45 during a streaming write must be rejected. The
+/// test is run with the AT45 status reads sent back to back, then paced by
+/// AT45_Poll.
+///
+/// Beforehand, the SPI clock programmed for the AT26 is checked: at most
+/// AT26_ID_SPCK before the device is identified, then the fastest clock
+/// within both AT26_SPCK and the rating of each identified part.
+///
+/// !Usage
+///
+/// -# Build the program with "make" and run it with "make run" (gcc on a Linux
+///    host).
+/// -# The program prints one line per polling mode and returns 0 when every
+///    operation ended with the expected data.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//         Headers
+//------------------------------------------------------------------------------
+
+#include <board.h>
+#include <memories/spi-flash/spid.h>
+#include <memories/spi-flash/at45.h>
+#include <memories/spi-flash/at26.h>
+#include <utility/math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------
+//         Local definitions
+//------------------------------------------------------------------------------
+
+/// First address and size of the emulated peripherals (SPI to system
+/// controller).
+#define PERIPH_START        0xFFFE0000
+#define PERIPH_SIZE         0x00020000
+
+/// Chip selects of the devices.
+#define AT45_CS             0
+#define AT26_CS             1
+
+/// Emulated AT45DB011D.
+#define AT45_STATUS_DEVICE  0x0C
+#define AT45_NUM_PAGES      512
+#define AT45_PAGE           264
+
+/// Emulated AT25DF041A, with the size given by its descriptor.
+#define AT26_JEDEC          0x0001441F
+#define AT26_MEMORY_SIZE    (1024 * 1024)
+
+/// Busy times of the devices, in bytes clocked on the bus.
+#define AT45_PROGRAM_TIME   3000
+#define AT26_PROGRAM_TIME   400
+#define AT26_ERASE_TIME     5000
+
+/// Largest AT45 streaming write, in pages.
+#define AT45_MAX_PAGES      4
+
+/// Largest AT26 write, in bytes.
+#define AT26_MAX_WRITE      700
+
+/// Number of steps of each test, and maximum number of steps to end the
+/// operations left.
+#define NUM_STEPS           2000000
+#define MAX_DRAIN_STEPS     10000000
+
+/// States of the operations of the test.
+#define OP_IDLE             0
+#define OP_ERASE            1
+#define OP_WRITE            2
+#define OP_READ             3
+
+/// Clock limits of the AT26 driver, its default settings.
+#define AT26_SPCK           (BOARD_MCK / 2)
+#define AT26_ID_SPCK        20000000
+
+/// Identifiers and SPI clock ratings of serial flash parts, in Hz.
+static const struct {
+
+    unsigned int jedecId;
+    unsigned int maxSpck;
+
+} pAt26Ratings[] = {
+
+    {0x0001441F, 70000000},     // AT25DF041A
+    {0x0000471F, 66000000},     // AT26DF321
+    {0x00102020, 20000000},     // M25P05
+    {0x00112020, 20000000},     // M25P10
+    {0x00122020, 25000000},     // M25P20
+    {0x001330EF, 75000000},     // W25X40
+    {0x001620C2, 50000000},     // MX25L3205
+    {0x000048BF, 20000000}      // SST25VF512
+};
+
+//------------------------------------------------------------------------------
+//         Local variables
+//------------------------------------------------------------------------------
+
+/// SPI driver, and the drivers of its devices.
+static Spid spid;
+static At45 at45;
+static At26 at26;
+
+/// Time of the device models, in bytes clocked on the bus.
+static unsigned long busTime;
+
+/// Number of transfers, of changes of chip select between two transfers and
+/// of protocol errors.
+static unsigned long numTransfers;
+static unsigned long numSwitches;
+static unsigned long numErrors;
+static unsigned char lastCs;
+
+/// AT45 model: memory, SRAM buffers, and frame in progress.
+static unsigned char pAt45Memory[AT45_NUM_PAGES][AT45_PAGE];
+static unsigned char pAt45Buffers[2][AT45_PAGE];
+static unsigned char at45Opcode;
+static unsigned int at45Count;
+static unsigned int at45Address;
+static unsigned long at45ReadyTime;
+static unsigned char at45ProgramBuffer;
+
+/// AT26 model: memory, write enable latch, and frame in progress.
+static unsigned char pAt26Memory[AT26_MEMORY_SIZE];
+static unsigned char at26Opcode;
+static unsigned int at26Count;
+static unsigned int at26Address;
+static unsigned char at26Wel;
+static unsigned long at26ReadyTime;
+
+/// AT45 operation: state, data, expected data and result.
+static unsigned char at45State;
+static unsigned char pAt45Data[AT45_MAX_PAGES * AT45_PAGE];
+static unsigned char pAt45Expected[AT45_MAX_PAGES * AT45_PAGE];
+static unsigned int at45OpAddress;
+static unsigned int at45OpSize;
+static volatile unsigned char at45Done;
+static unsigned char at45Status;
+static unsigned long at45Runs;
+static unsigned long at45Locked;
+
+/// AT26 operation: state, data, expected data and result.
+static unsigned char at26State;
+static unsigned char pAt26Data[AT26_MAX_WRITE];
+static unsigned char pAt26Expected[AT26_MAX_WRITE];
+static unsigned int at26EraseAddress;
+static unsigned int at26EraseSize;
+static unsigned int at26OpAddress;
+static unsigned int at26OpSize;
+static volatile unsigned char at26Done;
+static unsigned char at26Status;
+static unsigned long at26Runs;
+
+//------------------------------------------------------------------------------
+//         AT45 model
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Exchanges a byte of the current frame with the AT45 model.
+/// Returns the byte sent by the device.
+/// \param tx  Byte sent by the SPI.
+//------------------------------------------------------------------------------
+static unsigned char At45Exchange(unsigned char tx)
+{
+    unsigned char rx = 0xFF;
+    unsigned int buffer = 0;
+
+    if (at45Count == 0) {
+
+        // The buffer which is not programmed can be loaded while busy
+        at45Opcode = tx;
+        at45Address = 0;
+        if ((tx != AT45_STATUS_READ)
+            && !((tx == AT45_BUF1_WRITE) && (at45ProgramBuffer == 1))
+            && !((tx == AT45_BUF2_WRITE) && (at45ProgramBuffer == 0))
+            && (busTime < at45ReadyTime)) {
+
+            printf("AT45: command 0x%02X while busy\n", tx);
+            numErrors++;
+        }
+    }
+    else if (at45Opcode == AT45_STATUS_READ) {
+
+        rx = AT45_STATUS_DEVICE | ((busTime >= at45ReadyTime) ? 0x80 : 0);
+    }
+    else if (at45Count < 4) {
+
+        at45Address = (at45Address << 8) | tx;
+    }
+    else {
+
+        switch (at45Opcode) {
+
+            case AT45_BUF2_WRITE:
+                buffer = 1;
+            case AT45_BUF1_WRITE:
+                pAt45Buffers[buffer][(at45Address & 0x1FF) % AT45_PAGE] = tx;
+                at45Address++;
+                break;
+
+            case AT45_CONTINUOUS_READ_LEG:
+                // Four dummy bytes, then the data
+                if (at45Count >= 8) {
+
+                    rx = pAt45Memory[(at45Address >> 9) % AT45_NUM_PAGES]
+                                    [at45Address & 0x1FF];
+                    at45Address++;
+                    if ((at45Address & 0x1FF) == AT45_PAGE) {
+
+                        at45Address = (at45Address & ~0x1FF) + 0x200;
+                    }
+                }
+                break;
+
+            default:
+                printf("AT45: unexpected data for command 0x%02X\n",
+                       at45Opcode);
+                numErrors++;
+        }
+    }
+    at45Count++;
+
+    return rx;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the current frame of the AT45 model, and starts the page program it
+/// requests.
+//------------------------------------------------------------------------------
+static void At45Deselect(void)
+{
+    if ((at45Opcode == AT45_BUF1_MEM_ERASE)
+        || (at45Opcode == AT45_BUF2_MEM_ERASE)) {
+
+        at45ProgramBuffer = (at45Opcode == AT45_BUF2_MEM_ERASE);
+        memcpy(pAt45Memory[(at45Address >> 9) % AT45_NUM_PAGES],
+               pAt45Buffers[at45ProgramBuffer],
+               AT45_PAGE);
+        at45ReadyTime = busTime + AT45_PROGRAM_TIME;
+    }
+    at45Count = 0;
+}
+
+//------------------------------------------------------------------------------
+//         AT26 model
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Exchanges a byte of the current frame with the AT26 model.
+/// Returns the byte sent by the device.
+/// \param tx  Byte sent by the SPI.
+//------------------------------------------------------------------------------
+static unsigned char At26Exchange(unsigned char tx)
+{
+    unsigned char rx = 0xFF;
+    unsigned int page;
+
+    if (at26Count == 0) {
+
+        at26Opcode = tx;
+        at26Address = 0;
+        if ((tx != AT26_READ_STATUS) && (busTime < at26ReadyTime)) {
+
+            printf("AT26: command 0x%02X while busy\n", tx);
+            numErrors++;
+        }
+    }
+    else if (at26Opcode == AT26_READ_STATUS) {
+
+        rx = ((busTime < at26ReadyTime) ? AT26_STATUS_RDYBSY_BUSY : 0)
+             | (at26Wel ? AT26_STATUS_WEL_ENABLED : 0);
+    }
+    else if (at26Count < 4) {
+
+        at26Address = (at26Address << 8) | tx;
+    }
+    else {
+
+        switch (at26Opcode) {
+
+            case AT26_BYTE_PAGE_PROGRAM:
+                // The address wraps around in the page
+                page = at26Address & ~0xFF;
+                pAt26Memory[(page | ((at26Address + at26Count - 4) & 0xFF))
+                            % AT26_MEMORY_SIZE] &= tx;
+                break;
+
+            case AT26_READ_ARRAY:
+                // One dummy byte, then the data
+                if (at26Count >= 5) {
+
+                    rx = pAt26Memory[(at26Address + at26Count - 5)
+                                     % AT26_MEMORY_SIZE];
+                }
+                break;
+
+            default:
+                printf("AT26: unexpected data for command 0x%02X\n",
+                       at26Opcode);
+                numErrors++;
+        }
+    }
+    at26Count++;
+
+    return rx;
+}
+
+//------------------------------------------------------------------------------
+/// Ends the current frame of the AT26 model, and starts the program or erase
+/// it requests.
+//------------------------------------------------------------------------------
+static void At26Deselect(void)
+{
+    unsigned int size = 0;
+
+    switch (at26Opcode) {
+
+        case AT26_WRITE_ENABLE:
+            at26Wel = 1;
+            break;
+
+        case AT26_WRITE_DISABLE:
+            at26Wel = 0;
+            break;
+
+        case AT26_BYTE_PAGE_PROGRAM:
+            if (!at26Wel) {
+
+                printf("AT26: program without write enable\n");
+                numErrors++;
+            }
+            at26Wel = 0;
+            at26ReadyTime = busTime + AT26_PROGRAM_TIME;
+            break;
+
+        case AT26_BLOCK_ERASE_4K:
+            size = 4 * 1024;
+            break;
+
+        case AT26_BLOCK_ERASE_32K:
+            size = 32 * 1024;
+            break;
+
+        case AT26_BLOCK_ERASE_64K:
+            size = 64 * 1024;
+            break;
+    }
+
+    if (size > 0) {
+
+        if (!at26Wel) {
+
+            printf("AT26: erase without write enable\n");
+            numErrors++;
+        }
+        memset(pAt26Memory + ((at26Address & ~(size - 1)) % AT26_MEMORY_SIZE),
+               0xFF, size);
+        at26Wel = 0;
+        at26ReadyTime = busTime + AT26_ERASE_TIME;
+    }
+    at26Count = 0;
+}
+
+//------------------------------------------------------------------------------
+//         Emulated SPI
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Returns 1 if a PDC transfer is enabled; otherwise returns 0.
+//------------------------------------------------------------------------------
+static unsigned char IsTransferring(void)
+{
+    return (AT91C_BASE_SPI->SPI_PTCR == (AT91C_PDC_RXTEN | AT91C_PDC_TXTEN));
+}
+
+//------------------------------------------------------------------------------
+/// Exchanges a PDC buffer with the selected device; the received bytes
+/// overwrite the sent ones.
+/// \param cs  Chip select of the device.
+/// \param pointer  Buffer address.
+/// \param count  Number of bytes.
+//------------------------------------------------------------------------------
+static void Exchange(unsigned char cs, unsigned int pointer, unsigned int count)
+{
+    unsigned char *pBuffer = (unsigned char *) (unsigned long) pointer;
+
+    while (count > 0) {
+
+        *pBuffer = (cs == AT45_CS) ? At45Exchange(*pBuffer)
+                                   : At26Exchange(*pBuffer);
+        pBuffer++;
+        count--;
+        busTime++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Emulated SPI interrupt: performs the enabled PDC transfer with the device
+/// selected in SPI_MR, then calls SPID_Handler.
+//------------------------------------------------------------------------------
+static void SpiInterrupt(void)
+{
+    AT91S_SPI *pSpiHw = AT91C_BASE_SPI;
+    unsigned int pcs = (pSpiHw->SPI_MR & AT91C_SPI_PCS) >> 16;
+    unsigned char cs = (pcs & 1) ? 1 : 0;
+
+    if ((pcs | (1 << cs)) != 0xF) {
+
+        printf("SPI: chip select 0x%X\n", pcs);
+        numErrors++;
+    }
+
+    Exchange(cs, pSpiHw->SPI_TPR, pSpiHw->SPI_TCR);
+    Exchange(cs, pSpiHw->SPI_TNPR, pSpiHw->SPI_TNCR);
+    if (cs == AT45_CS) {
+
+        At45Deselect();
+    }
+    else {
+
+        At26Deselect();
+    }
+
+    numTransfers++;
+    if (cs != lastCs) {
+
+        numSwitches++;
+        lastCs = cs;
+    }
+
+    pSpiHw->SPI_SR = AT91C_SPI_RXBUFF;
+    SPID_Handler(&spid);
+}
+
+//------------------------------------------------------------------------------
+//         Operations
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Callback of the AT45 operation steps.
+/// \param status  Result of the step.
+/// \param pArgument  Unused.
+//------------------------------------------------------------------------------
+static void At45Callback(unsigned char status, void *pArgument)
+{
+    at45Status = status;
+    at45Done = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Callback of the AT26 operation steps.
+/// \param status  Result of the step.
+/// \param pArgument  Unused.
+//------------------------------------------------------------------------------
+static void At26Callback(unsigned char status, void *pArgument)
+{
+    at26Status = status;
+    at26Done = 1;
+}
+
+//------------------------------------------------------------------------------
+/// Advances the AT45 operation: streaming write of a random page run, then
+/// continuous read of the run. A command sent during the write must be
+/// rejected.
+//------------------------------------------------------------------------------
+static void At45Advance(void)
+{
+    unsigned char status;
+    unsigned int i;
+
+    switch (at45State) {
+
+        case OP_IDLE:
+            at45OpSize = (1 + rand() % AT45_MAX_PAGES) * AT45_PAGE;
+            at45OpAddress = (rand() % (AT45_NUM_PAGES - AT45_MAX_PAGES))
+                            * AT45_PAGE;
+            for (i = 0; i < at45OpSize; i++) {
+
+                pAt45Data[i] = (unsigned char) rand();
+            }
+            memcpy(pAt45Expected, pAt45Data, at45OpSize);
+            at45Done = 0;
+            if (AT45_StreamWrite(&at45, at45OpAddress, pAt45Data, at45OpSize,
+                                 At45Callback, 0)) {
+
+                printf("AT45: streaming write not started\n");
+                numErrors++;
+                break;
+            }
+            at45State = OP_WRITE;
+            break;
+
+        case OP_WRITE:
+            if (!at45Done) {
+
+                if ((rand() % 16) == 0) {
+
+                    if (AT45_SendCommand(&at45, AT45_STATUS_READ, 1, &status,
+                                         1, 0, 0, 0) != AT45_ERROR_LOCK) {
+
+                        printf("AT45: command accepted during a write\n");
+                        numErrors++;
+                    }
+                    at45Locked++;
+                }
+                break;
+            }
+            if (at45Status) {
+
+                printf("AT45: streaming write failed\n");
+                numErrors++;
+            }
+            memset(pAt45Data, 0, at45OpSize);
+            at45Done = 0;
+            if (AT45_SendCommand(&at45, AT45_CONTINUOUS_READ_LEG, 8,
+                                 pAt45Data, at45OpSize, at45OpAddress,
+                                 At45Callback, 0)) {
+
+                printf("AT45: read not started\n");
+                numErrors++;
+                at45State = OP_IDLE;
+                break;
+            }
+            at45State = OP_READ;
+            break;
+
+        case OP_READ:
+            if (!at45Done) {
+
+                break;
+            }
+            if (memcmp(pAt45Data, pAt45Expected, at45OpSize)) {
+
+                printf("AT45: data mismatch at 0x%X\n", at45OpAddress);
+                numErrors++;
+            }
+            at45Runs++;
+            at45State = OP_IDLE;
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Advances the AT26 operation: erase of a random block, write of random data
+/// in it, then read of the block.
+//------------------------------------------------------------------------------
+static void At26Advance(void)
+{
+    unsigned int i;
+    unsigned int offset;
+
+    switch (at26State) {
+
+        case OP_IDLE:
+            at26EraseSize = (4 * 1024) << (rand() % 3);
+            if (at26EraseSize == (16 * 1024)) {
+
+                at26EraseSize = 64 * 1024;
+            }
+            at26EraseAddress = (rand() % (AT26_Size(&at26) / at26EraseSize))
+                               * at26EraseSize;
+            at26Done = 0;
+            if (AT26_Erase(&at26, at26EraseAddress, at26EraseSize,
+                           At26Callback, 0)) {
+
+                printf("AT26: erase not started\n");
+                numErrors++;
+                break;
+            }
+            at26State = OP_ERASE;
+            break;
+
+        case OP_ERASE:
+            if (!at26Done) {
+
+                break;
+            }
+            at26OpSize = 1 + rand() % AT26_MAX_WRITE;
+            offset = rand() % (at26EraseSize - at26OpSize);
+            at26OpAddress = at26EraseAddress + offset;
+            for (i = 0; i < at26OpSize; i++) {
+
+                pAt26Data[i] = (unsigned char) rand();
+            }
+            memcpy(pAt26Expected, pAt26Data, at26OpSize);
+            at26Done = 0;
+            if (at26Status || AT26_Write(&at26, at26OpAddress, pAt26Data,
+                                         at26OpSize, At26Callback, 0)) {
+
+                printf("AT26: erase failed or write not started\n");
+                numErrors++;
+                at26State = OP_IDLE;
+                break;
+            }
+            at26State = OP_WRITE;
+            break;
+
+        case OP_WRITE:
+            if (!at26Done) {
+
+                break;
+            }
+            memset(pAt26Data, 0, at26OpSize);
+            at26Done = 0;
+            if (at26Status || AT26_Read(&at26, at26OpAddress, pAt26Data,
+                                        at26OpSize, At26Callback, 0)) {
+
+                printf("AT26: write failed or read not started\n");
+                numErrors++;
+                at26State = OP_IDLE;
+                break;
+            }
+            at26State = OP_READ;
+            break;
+
+        case OP_READ:
+            if (!at26Done) {
+
+                break;
+            }
+            if (memcmp(pAt26Data, pAt26Expected, at26OpSize)) {
+
+                printf("AT26: data mismatch at 0x%X\n", at26OpAddress);
+                numErrors++;
+            }
+            for (i = at26EraseAddress; i < at26EraseAddress + at26EraseSize; i++) {
+
+                if ((i - at26OpAddress >= at26OpSize)
+                    && (pAt26Memory[i] != 0xFF)) {
+
+                    printf("AT26: byte 0x%X written out of range\n", i);
+                    numErrors++;
+                    break;
+                }
+            }
+            at26Runs++;
+            at26State = OP_IDLE;
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Returns the SPI clock divider programmed for the AT26 chip select.
+//------------------------------------------------------------------------------
+static unsigned int At26Scbr(void)
+{
+    return (AT91C_BASE_SPI->SPI_CSR[AT26_CS] & AT91C_SPI_SCBR) >> 8;
+}
+
+//------------------------------------------------------------------------------
+/// Checks the SPI clock of the AT26 before and after the identification of
+/// each rated part. Returns 0 if every clock is right; otherwise returns 1.
+//------------------------------------------------------------------------------
+static int CheckClocks(void)
+{
+    unsigned int limit;
+    unsigned int scbr;
+    unsigned int i;
+    int errors = 0;
+
+    SPID_Configure(&spid, AT91C_BASE_SPI, AT91C_ID_SPI);
+    for (i = 0; i < sizeof(pAt26Ratings) / sizeof(pAt26Ratings[0]); i++) {
+
+        AT26_Configure(&at26, &spid, AT26_CS);
+        scbr = At26Scbr();
+        if ((scbr == 0) || (BOARD_MCK > scbr * AT26_ID_SPCK)) {
+
+            printf("AT26: divider %u before identification\n", scbr);
+            errors++;
+        }
+
+        limit = min(pAt26Ratings[i].maxSpck, AT26_SPCK);
+        if (!AT26_FindDevice(&at26, pAt26Ratings[i].jedecId)) {
+
+            printf("AT26: part 0x%08X not found\n", pAt26Ratings[i].jedecId);
+            errors++;
+            continue;
+        }
+
+        // The fastest clock within the limit
+        scbr = At26Scbr();
+        if ((scbr == 0) || (BOARD_MCK > scbr * limit)
+            || ((scbr > 1) && (BOARD_MCK <= (scbr - 1) * limit))) {
+
+            printf("AT26: divider %u for %s rated %u Hz\n", scbr,
+                   at26.pDesc->name, pAt26Ratings[i].maxSpck);
+            errors++;
+        }
+        else {
+
+            printf("AT26: %s clocked at %u Hz\n", at26.pDesc->name,
+                   BOARD_MCK / scbr);
+        }
+    }
+
+    return errors > 0;
+}
+
+//------------------------------------------------------------------------------
+/// Runs the two operations with random interleavings of the interrupts.
+/// Returns 0 if every operation ended with the expected data; otherwise
+/// returns 1.
+/// \param timer  1 to pace the AT45 status reads with AT45_Poll.
+//------------------------------------------------------------------------------
+static int Run(unsigned char timer)
+{
+    unsigned long step;
+
+    numTransfers = 0;
+    numSwitches = 0;
+    numErrors = 0;
+    at45Runs = 0;
+    at45Locked = 0;
+    at26Runs = 0;
+    at45State = OP_IDLE;
+    at26State = OP_IDLE;
+
+    SPID_Configure(&spid, AT91C_BASE_SPI, AT91C_ID_SPI);
+    AT45_Configure(&at45, &spid, AT45_CS);
+    AT45_FindDevice(&at45, AT45_STATUS_DEVICE | 0x80);
+    AT45_ConfigurePolling(&at45, timer);
+    AT26_Configure(&at26, &spid, AT26_CS);
+    AT26_FindDevice(&at26, AT26_JEDEC);
+
+    for (step = 0; step < NUM_STEPS + MAX_DRAIN_STEPS; step++) {
+
+        // Stop starting new operations, and wait for the last ones
+        if ((step >= NUM_STEPS)
+            && (at45State == OP_IDLE) && (at26State == OP_IDLE)
+            && !IsTransferring()) {
+
+            break;
+        }
+
+        busTime += 2;
+        if (IsTransferring() && (rand() % 4)) {
+
+            SpiInterrupt();
+        }
+        else {
+
+            if ((step < NUM_STEPS) || (at45State != OP_IDLE)) {
+
+                At45Advance();
+            }
+            if ((step < NUM_STEPS) || (at26State != OP_IDLE)) {
+
+                At26Advance();
+            }
+            if (timer && ((rand() % 8) == 0)) {
+
+                AT45_Poll(&at45);
+            }
+        }
+    }
+
+    if ((at45State != OP_IDLE) || (at26State != OP_IDLE)) {
+
+        printf("Operations not ended: AT45 %u, AT26 %u\n",
+               at45State, at26State);
+        numErrors++;
+    }
+    if (SPID_IsBusy(&spid) || (spid.head != spid.tail)) {
+
+        printf("SPI driver not released\n");
+        numErrors++;
+    }
+
+    printf("%s status reads: %lu AT45 writes, %lu AT26 writes, "
+           "%lu transfers, %lu chip select changes, %lu locked commands, "
+           "%lu errors\n",
+           timer ? "Paced" : "Back to back",
+           at45Runs, at26Runs, numTransfers, numSwitches, at45Locked,
+           numErrors);
+
+    return (numErrors > 0) || (at45Runs == 0) || (at26Runs == 0)
+           || (numSwitches == 0);
+}
+
+//------------------------------------------------------------------------------
+//         Exported functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+/// Maps the emulated peripherals and runs the test in both polling modes.
+/// Returns 0 if all the tests pass.
+//------------------------------------------------------------------------------
+int main(void)
+{
+    int result = 0;
+
+    if (mmap((void *) PERIPH_START, PERIPH_SIZE, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+
+        perror("Cannot map the emulated peripherals");
+        return 1;
+    }
+    memset(pAt26Memory, 0xFF, sizeof(pAt26Memory));
+
+    srand(1);
+    result |= CheckClocks();
+    result |= Run(0);
+    result |= Run(1);
+
+    return result;
+}
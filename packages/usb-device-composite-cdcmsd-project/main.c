@@ -228,6 +228,10 @@
 /// Size of one block in bytes.
 #define BLOCK_SIZE          512
 
+/// Size of the LUN read/write buffer: two blocks, so that USB and media
+/// transfers can overlap.
+#define MSD_BUFFER_SIZE     (2*BLOCK_SIZE)
+
 /// Use for power management
 #define STATE_IDLE    0
 /// The USB device is in suspend state
@@ -265,7 +269,7 @@ Media medias[MAX_LUNS];
 MSDLun luns[MAX_LUNS];
 
 /// LUN read/write buffer.
-unsigned char msdBuffer[BLOCK_SIZE];
+unsigned char msdBuffer[MSD_BUFFER_SIZE];
 
 //-----------------------------------------------------------------------------
 //         VBus monitoring (optional)
@@ -769,7 +773,7 @@ void MSDDInitialize()
                         (unsigned int) AT91C_EBI_SDRAM + CODE_SIZE,
                         10*1024*1024); // 10Mb used for R/W testing
     LUN_Init(&(luns[numMedias]), &(medias[numMedias]),
-        msdBuffer, 0, 10*1024*1024, BLOCK_SIZE);
+        msdBuffer, MSD_BUFFER_SIZE, 0, 10*1024*1024, BLOCK_SIZE);
     numMedias++;
 #endif
 
@@ -780,7 +784,7 @@ void MSDDInitialize()
 
         FLA_Initialize(&(medias[numMedias]), AT91C_BASE_EFC);
         LUN_Init(&(luns[numMedias]), &(medias[numMedias]),
-            msdBuffer, 30*1024, 34*1024, BLOCK_SIZE);
+            msdBuffer, MSD_BUFFER_SIZE, 30*1024, 34*1024, BLOCK_SIZE);
         numMedias++;
 
         // Install handler for flash interrupt
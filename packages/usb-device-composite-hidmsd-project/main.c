@@ -234,6 +234,10 @@
 /// Size of one block in bytes.
 #define BLOCK_SIZE          512
 
+/// Size of the LUN read/write buffer: two blocks, so that USB and media
+/// transfers can overlap.
+#define MSD_BUFFER_SIZE     (2*BLOCK_SIZE)
+
 /// Use for power management
 #define STATE_IDLE    0
 /// The USB device is in suspend state
@@ -273,7 +277,7 @@ Media medias[MAX_LUNS];
 MSDLun luns[MAX_LUNS];
 
 /// LUN read/write buffer.
-unsigned char msdBuffer[BLOCK_SIZE];
+unsigned char msdBuffer[MSD_BUFFER_SIZE];
 
 //------------------------------------------------------------------------------
 //         Remote wake-up support (optional)
@@ -805,7 +809,7 @@ void MSDDInitialize()
                         (unsigned int) AT91C_EBI_SDRAM + CODE_SIZE,
                         10*1024*1024); // 10Mb used for R/W testing
     LUN_Init(&(luns[numMedias]), &(medias[numMedias]),
-        msdBuffer, 0, 10*1024*1024, BLOCK_SIZE);
+        msdBuffer, MSD_BUFFER_SIZE, 0, 10*1024*1024, BLOCK_SIZE);
     numMedias++;
 #endif
 
@@ -816,7 +820,7 @@ void MSDDInitialize()
 
         FLA_Initialize(&(medias[numMedias]), AT91C_BASE_EFC);
         LUN_Init(&(luns[numMedias]), &(medias[numMedias]),
-            msdBuffer, 30*1024, 34*1024, BLOCK_SIZE);
+            msdBuffer, MSD_BUFFER_SIZE, 30*1024, 34*1024, BLOCK_SIZE);
         numMedias++;
 
         // Install handler for flash interrupt
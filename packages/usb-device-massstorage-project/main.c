@@ -79,6 +79,9 @@
 /// If there is no SDRAM but only internal flash, the disk is about 30K and
 /// only small file can be tested.
 ///
+/// If the board defines a SD card connected to the SPI (BOARD_SD_SPI_BASE)
+/// and a card is present at startup, it appears as a second disk.
+///
 /// !!!Usage
 ///
 /// -# Build the program and download it inside the evaluation board. Please
@@ -133,6 +136,8 @@
 ///       - ISR_Pit
 ///       - WakeUpHandler
 ///       - ISR_Media
+///       - ISR_Flash
+///       - ISR_SdSpi
 ///    - The main function, which implements the program behavior
 ///
 /// Please refer to the list of functions in the #Overview# tab of this unit
@@ -149,6 +154,7 @@
 #include <pio/pio.h>
 #include <pio/pio_it.h>
 #include <pit/pit.h>
+#include <rtt/rtt.h>
 #include <aic/aic.h>
 #include <dbgu/dbgu.h>
 #include <utility/trace.h>
@@ -161,8 +167,11 @@
 #include <usb/device/core/USBDCallbacks.h>
 #include <memories/Media.h>
 #include <memories/MEDFlash.h>
+#include <memories/flash/flashd.h>
 #include <memories/MEDSdram.h>
 #include <memories/MEDDdram.h>
+#include <memories/MEDSdcard.h>
+#include <sdmmc/sdspi.h>
 #include <pmc/pmc.h>
 
 #include <string.h>
@@ -186,6 +195,27 @@
 /// Size of one block in bytes.
 #define BLOCK_SIZE          512
 
+/// Size of the LUN read/write buffer: two blocks, so that USB and media
+/// transfers can overlap.
+#define MSD_BUFFER_SIZE     (2*BLOCK_SIZE)
+
+/// Number of blocks of the internal flash write-back cache. They are split
+/// into lines as large as the flash erase unit.
+#define CACHE_BLOCKS        8
+
+/// Number of RTT ticks (about 1ms) without write before the cached data is
+/// written back to the internal flash.
+#define CACHE_FLUSH_DELAY   1000
+
+/// Minimum number of blocks prefetched on the SD card LUN.
+#define READ_AHEAD_MIN      1
+
+/// Maximum number of blocks prefetched on the SD card LUN.
+#define READ_AHEAD_MAX      4
+
+/// SPI clock frequency of the SD card during its initialization, in Hz.
+#define SD_SPCK             10000000
+
 /// Use for power management
 #define STATE_IDLE    0
 /// The USB device is in suspend state
@@ -206,7 +236,35 @@ Media medias[MAX_LUNS];
 MSDLun luns[MAX_LUNS];
 
 /// LUN read/write buffer.
-unsigned char msdBuffer[BLOCK_SIZE];
+unsigned char msdBuffer[MSD_BUFFER_SIZE];
+
+#if defined(AT91C_BASE_EFC)
+/// Write-back cache of the internal flash LUN.
+static MSDLunCache flashCache;
+
+/// Line descriptors of the internal flash cache, enough for one-block lines.
+static MSDLunCacheLine flashCacheLines[CACHE_BLOCKS];
+
+/// Data buffer of the internal flash cache.
+static unsigned char flashCacheBuffer[CACHE_BLOCKS*BLOCK_SIZE];
+#endif
+
+#if defined(BOARD_SD_SPI_BASE)
+/// SPI driver of the SD card.
+static SdSpi sdSpiDrv;
+
+/// SD card driver.
+static SdCard sdDrv;
+
+/// SD card pins.
+static const Pin pinsSd[] = {BOARD_SD_SPI_PINS};
+
+/// Read-ahead state of the SD card LUN.
+static MSDLunReadAhead sdReadAhead;
+
+/// Read-ahead buffer of the SD card LUN.
+static unsigned char sdReadAheadBuffer[READ_AHEAD_MAX*BLOCK_SIZE];
+#endif
 
 //------------------------------------------------------------------------------
 //         Remote wake-up support (optional)
@@ -227,6 +285,11 @@ static void ISR_Pit(void)
     static unsigned long debounceCounter = DEBOUNCE_TIME;
     unsigned long pisr = 0;
 
+#if MEDFLASH_ASYNC
+    // The system interrupt is shared with the flash controller
+    FLASHD_Handler();
+#endif
+
     // Read the PISR
     pisr = PIT_GetStatus() & AT91C_PITC_PITS;
 
@@ -235,6 +298,10 @@ static void ISR_Pit(void)
         // Read the PIVR. It acknowledges the IT
         PIT_GetPIVR();
     }
+    else {
+
+        return;
+    }
 
     // Button released
     if (PIO_Get(&pinWakeUp)) {
@@ -411,11 +478,37 @@ void ISR_Media(void)
     MED_HandleAll(medias, numMedias);
 }
 
+#if MEDFLASH_ASYNC
+//------------------------------------------------------------------------------
+/// System interrupt handler. Ends the asynchronous writes of the flash media.
+//------------------------------------------------------------------------------
+static void ISR_Flash(void)
+{
+    FLASHD_Handler();
+}
+#endif
+
+#if defined(BOARD_SD_SPI_BASE)
+//------------------------------------------------------------------------------
+/// SPI interrupt handler. Forwards the event to the SD SPI driver, which is
+/// used before the SD card media is defined.
+//------------------------------------------------------------------------------
+static void ISR_SdSpi(void)
+{
+    SDSPI_Handler(&sdSpiDrv);
+}
+#endif
+
 //------------------------------------------------------------------------------
 /// Initialize memory for LUN
 //------------------------------------------------------------------------------
 static void MemoryInitialization(void)
 {
+#if defined(AT91C_BASE_EFC)
+    unsigned int eraseUnit;
+    unsigned int lineSize;
+#endif
+
     // Memory initialization
 #if defined(AT91C_BASE_DDR2C)
     TRACE_DEBUG("LUN DDR2\n\r");
@@ -424,13 +517,13 @@ static void MemoryInitialization(void)
     MEDDdram_Initialize(&(medias[numMedias]),
                         (unsigned int) AT91C_DDR2 + CODE_SIZE,
                         1024*1024); // Only 1Mb used for faster formatting
-    LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, 0, 1024*1024, BLOCK_SIZE);
+    LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, MSD_BUFFER_SIZE, 0, 1024*1024, BLOCK_SIZE);
 
     // All DDR size
     //MEDDdram_Initialize(&(medias[numMedias]),
     //                    (unsigned int) AT91C_DDR2 + CODE_SIZE,
     //                    BOARD_DDRAM_SIZE-CODE_SIZE);
-    //LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, 0, BOARD_DDRAM_SIZE-CODE_SIZE, sizeof(msdBuffer));
+    //LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, MSD_BUFFER_SIZE, 0, BOARD_DDRAM_SIZE-CODE_SIZE, BLOCK_SIZE);
 
     numMedias++;
 
@@ -446,13 +539,13 @@ static void MemoryInitialization(void)
                         10*1024*1024); // Only 10Mb used for faster formatting
     LUN_Init(&(luns[numMedias]),
              &(medias[numMedias]),
-             msdBuffer, 0, 10*1024*1024, BLOCK_SIZE);
+             msdBuffer, MSD_BUFFER_SIZE, 0, 10*1024*1024, BLOCK_SIZE);
 
     // All SDRAM size
     //MEDSdram_Initialize(&(medias[numMedias]),
     //                    (unsigned int) AT91C_EBI_SDRAM + CODE_SIZE,
     //                    BOARD_SDRAM_SIZE-CODE_SIZE);
-    //LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, 0, BOARD_SDRAM_SIZE-CODE_SIZE, sizeof(msdBuffer));
+    //LUN_Init(&(luns[numMedias]), &(medias[numMedias]), msdBuffer, MSD_BUFFER_SIZE, 0, BOARD_SDRAM_SIZE-CODE_SIZE, BLOCK_SIZE);
 
     numMedias++;
 
@@ -464,19 +557,111 @@ static void MemoryInitialization(void)
     if (numMedias == 0) {
 
         FLA_Initialize(&(medias[numMedias]), AT91C_BASE_EFC);
+#if MEDFLASH_ASYNC
+        // The flash writes end in the system interrupt, which ISR_Pit takes
+        // over when the remote wake-up is used
+        AIC_ConfigureIT(AT91C_ID_SYS, 0, ISR_Flash);
+        AIC_EnableIT(AT91C_ID_SYS);
+#endif
         LUN_Init(&(luns[numMedias]),
                  &(medias[numMedias]),
                  msdBuffer,
+                 MSD_BUFFER_SIZE,
                  CODE_SIZE,
                  AT91C_IFLASH_SIZE - CODE_SIZE,
                  BLOCK_SIZE);
 
+        // Make the cache lines as large as the erase unit, so that a line
+        // is written back as whole pages
+        MED_Ioctl(&(medias[numMedias]), MED_IOCTL_GET_ERASE_UNIT, &eraseUnit);
+        lineSize = eraseUnit / BLOCK_SIZE;
+        if (lineSize == 0) {
+
+            lineSize = 1;
+        }
+        else if (lineSize > CACHE_BLOCKS) {
+
+            lineSize = CACHE_BLOCKS;
+        }
+        LUN_ConfigureCache(&(luns[numMedias]),
+                           &flashCache,
+                           flashCacheLines,
+                           flashCacheBuffer,
+                           CACHE_BLOCKS / lineSize,
+                           lineSize,
+                           CACHE_FLUSH_DELAY);
+
         numMedias++;
     }
 #endif // AT91C_BASE_EFC
+
+    // SD card
+#if defined(BOARD_SD_SPI_BASE)
+    TRACE_INFO("LUN SD card\n\r");
+    PIO_Configure(pinsSd, PIO_LISTSIZE(pinsSd));
+    AIC_ConfigureIT(BOARD_SD_SPI_ID, AT91C_AIC_PRIOR_LOWEST, ISR_SdSpi);
+    SDSPI_Configure(&sdSpiDrv, BOARD_SD_SPI_BASE, BOARD_SD_SPI_ID);
+    AIC_EnableIT(BOARD_SD_SPI_ID);
+    SDSPI_ConfigureCS(&sdSpiDrv, BOARD_SD_NPCS, AT45_CSR(BOARD_MCK, SD_SPCK));
+
+    if (SD_Init(&sdDrv, (SdDriver *) &sdSpiDrv)) {
+
+        TRACE_WARNING("No SD card\n\r");
+    }
+    else if (numMedias < MAX_LUNS) {
+
+        MEDSdcard_Initialize(&(medias[numMedias]), &sdDrv);
+        LUN_Init(&(luns[numMedias]),
+                 &(medias[numMedias]),
+                 msdBuffer,
+                 MSD_BUFFER_SIZE,
+                 0,
+                 medias[numMedias].size,
+                 BLOCK_SIZE);
+
+        // Hide the latency of the card on sequential reads
+        LUN_ConfigureReadAhead(&(luns[numMedias]),
+                               &sdReadAhead,
+                               sdReadAheadBuffer,
+                               READ_AHEAD_MIN,
+                               READ_AHEAD_MAX);
+
+        numMedias++;
+    }
+#endif // BOARD_SD_SPI_BASE
 }
 
 
+//------------------------------------------------------------------------------
+/// Advances the flush timers of the LUN caches by the number of RTT ticks
+/// elapsed since the last call.
+//------------------------------------------------------------------------------
+static void TickLuns(void)
+{
+    static unsigned int lastTime = 0;
+    unsigned int time = RTT_GetTime(AT91C_BASE_RTTC);
+    unsigned int i;
+
+    for (i = 0; i < numMedias; i++) {
+
+        LUN_Tick(&(luns[i]), time - lastTime);
+    }
+    lastTime = time;
+}
+
+//------------------------------------------------------------------------------
+/// Writes back the cached data of all the LUNs.
+//------------------------------------------------------------------------------
+static void FlushLuns(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < numMedias; i++) {
+
+        LUN_Flush(&(luns[i]));
+    }
+}
+
 #if defined (CP15_PRESENT)
 //------------------------------------------------------------------------------
 /// Put the CPU in 32kHz, disable PLL, main oscillator
@@ -724,6 +909,9 @@ int main(void)
 
     MemoryInitialization();
 
+    // RTT ticks of about 1ms for the LUN cache flush timers
+    RTT_SetPrescaler(AT91C_BASE_RTTC, 32);
+
     ASSERT(numMedias > 0, "Error: No media defined.\n\r");
     TRACE_DEBUG("%u medias defined\n\r", numMedias);
 
@@ -740,9 +928,15 @@ int main(void)
 
         // Mass storage state machine
         MSDDriver_StateMachine();
+        TickLuns();
 
         if( USBState == STATE_SUSPEND ) {
             TRACE_DEBUG("suspend  !\n\r");
+#if defined(BOARD_SD_SPI_BASE)
+            TRACE_DEBUG("read-ahead hits %u, misses %u\n\r",
+                        sdReadAhead.hits, sdReadAhead.misses);
+#endif
+            FlushLuns();
             LowPowerMode();
             USBState = STATE_IDLE;
         }